@@ -0,0 +1,676 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The bitsliced core follows the aes_ct64 code of BearSSL:
+ *
+ * Copyright (c) 2016 Thomas Pornin <pornin@bolet.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Four blocks are spread over eight 64-bit words, word i holding bit i of
+ * every byte of every block, so SubBytes becomes a boolean circuit and
+ * the other steps shifts and masks.  As with aes-hw.c the round keys come
+ * from an expanded rijndael_ctx, all engines compute the same cipher.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "aes-ct.h"
+
+static void	aesct_ortho(u_int64_t *);
+static void	aesct_interleave_in(u_int64_t *, u_int64_t *,
+		    const u_int32_t *);
+static void	aesct_interleave_out(u_int32_t *, u_int64_t, u_int64_t);
+static void	aesct_sbox(u_int64_t *);
+static void	aesct_inv_sbox(u_int64_t *);
+static void	aesct_shift_rows(u_int64_t *);
+static void	aesct_inv_shift_rows(u_int64_t *);
+static void	aesct_mix_columns(u_int64_t *);
+static void	aesct_inv_mix_columns(u_int64_t *);
+static void	aesct_add_round_key(u_int64_t *, const u_int64_t *);
+static void	aesct_crypt4(const struct aesct_ctx *, u_int8_t [4][16], int);
+
+#define AESCT_DEC32LE(p)						\
+	((u_int32_t)(p)[0] | (u_int32_t)(p)[1] << 8 |			\
+	(u_int32_t)(p)[2] << 16 | (u_int32_t)(p)[3] << 24)
+#define AESCT_ENC32LE(p, v) do {					\
+	(p)[0] = (u_int8_t)(v); (p)[1] = (u_int8_t)((v) >> 8);		\
+	(p)[2] = (u_int8_t)((v) >> 16); (p)[3] = (u_int8_t)((v) >> 24);	\
+} while (0)
+
+#define AESCT_ROTR32(x)	(((x) << 32) | ((x) >> 32))
+
+/* transpose the 8x8 bit matrices spread over q[0..7] */
+static void
+aesct_ortho(u_int64_t *q)
+{
+#define AESCT_SWAPN(cl, ch, s, x, y) do {				\
+	u_int64_t	a, b;						\
+									\
+	a = (x);							\
+	b = (y);							\
+	(x) = (a & (u_int64_t)(cl)) | ((b & (u_int64_t)(cl)) << (s));	\
+	(y) = ((a & (u_int64_t)(ch)) >> (s)) | (b & (u_int64_t)(ch));	\
+} while (0)
+#define AESCT_SWAP2(x, y)	AESCT_SWAPN(0x5555555555555555ULL,	\
+				    0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define AESCT_SWAP4(x, y)	AESCT_SWAPN(0x3333333333333333ULL,	\
+				    0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define AESCT_SWAP8(x, y)	AESCT_SWAPN(0x0F0F0F0F0F0F0F0FULL,	\
+				    0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+	AESCT_SWAP2(q[0], q[1]);
+	AESCT_SWAP2(q[2], q[3]);
+	AESCT_SWAP2(q[4], q[5]);
+	AESCT_SWAP2(q[6], q[7]);
+
+	AESCT_SWAP4(q[0], q[2]);
+	AESCT_SWAP4(q[1], q[3]);
+	AESCT_SWAP4(q[4], q[6]);
+	AESCT_SWAP4(q[5], q[7]);
+
+	AESCT_SWAP8(q[0], q[4]);
+	AESCT_SWAP8(q[1], q[5]);
+	AESCT_SWAP8(q[2], q[6]);
+	AESCT_SWAP8(q[3], q[7]);
+}
+
+/* spread the four little endian words of a block over two q words */
+static void
+aesct_interleave_in(u_int64_t *q0, u_int64_t *q1, const u_int32_t *w)
+{
+	u_int64_t	x0, x1, x2, x3;
+
+	x0 = w[0];
+	x1 = w[1];
+	x2 = w[2];
+	x3 = w[3];
+	x0 |= (x0 << 16);
+	x1 |= (x1 << 16);
+	x2 |= (x2 << 16);
+	x3 |= (x3 << 16);
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	x0 |= (x0 << 8);
+	x1 |= (x1 << 8);
+	x2 |= (x2 << 8);
+	x3 |= (x3 << 8);
+	x0 &= 0x00FF00FF00FF00FFULL;
+	x1 &= 0x00FF00FF00FF00FFULL;
+	x2 &= 0x00FF00FF00FF00FFULL;
+	x3 &= 0x00FF00FF00FF00FFULL;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+static void
+aesct_interleave_out(u_int32_t *w, u_int64_t q0, u_int64_t q1)
+{
+	u_int64_t	x0, x1, x2, x3;
+
+	x0 = q0 & 0x00FF00FF00FF00FFULL;
+	x1 = q1 & 0x00FF00FF00FF00FFULL;
+	x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+	x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+	x0 |= (x0 >> 8);
+	x1 |= (x1 >> 8);
+	x2 |= (x2 >> 8);
+	x3 |= (x3 >> 8);
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	w[0] = (u_int32_t)x0 | (u_int32_t)(x0 >> 16);
+	w[1] = (u_int32_t)x1 | (u_int32_t)(x1 >> 16);
+	w[2] = (u_int32_t)x2 | (u_int32_t)(x2 >> 16);
+	w[3] = (u_int32_t)x3 | (u_int32_t)(x3 >> 16);
+}
+
+/*
+ * SubBytes as the 113 gate circuit of Boyar and Peralta, "A new
+ * combinational logic minimization technique with applications to
+ * cryptology".  x0 is the high bit, x7 the low one.
+ */
+static void
+aesct_sbox(u_int64_t *q)
+{
+	u_int64_t	x0, x1, x2, x3, x4, x5, x6, x7;
+	u_int64_t	y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	u_int64_t	y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	u_int64_t	y20, y21;
+	u_int64_t	z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	u_int64_t	z10, z11, z12, z13, z14, z15, z16, z17;
+	u_int64_t	t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	u_int64_t	t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	u_int64_t	t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	u_int64_t	t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	u_int64_t	t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	u_int64_t	t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	u_int64_t	t60, t61, t62, t63, t64, t65, t66, t67;
+	u_int64_t	s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/*
+ * The inverse S-box is the forward one between two applications of the
+ * inverse of its affine part.
+ */
+static void
+aesct_inv_sbox(u_int64_t *q)
+{
+#define AESCT_INV_AFFINE(q) do {					\
+	u_int64_t	q0, q1, q2, q3, q4, q5, q6, q7;			\
+									\
+	q0 = ~(q)[0]; q1 = ~(q)[1]; q2 = (q)[2]; q3 = (q)[3];		\
+	q4 = (q)[4]; q5 = ~(q)[5]; q6 = ~(q)[6]; q7 = (q)[7];		\
+	(q)[7] = q1 ^ q4 ^ q6;						\
+	(q)[6] = q0 ^ q3 ^ q5;						\
+	(q)[5] = q7 ^ q2 ^ q4;						\
+	(q)[4] = q6 ^ q1 ^ q3;						\
+	(q)[3] = q5 ^ q0 ^ q2;						\
+	(q)[2] = q4 ^ q7 ^ q1;						\
+	(q)[1] = q3 ^ q6 ^ q0;						\
+	(q)[0] = q2 ^ q5 ^ q7;						\
+} while (0)
+
+	AESCT_INV_AFFINE(q);
+	aesct_sbox(q);
+	AESCT_INV_AFFINE(q);
+}
+
+static void
+aesct_shift_rows(u_int64_t *q)
+{
+	u_int64_t	x;
+	int		i;
+
+	for (i = 0; i < 8; i++) {
+		x = q[i];
+		q[i] = (x & 0x000000000000FFFFULL) |
+		    ((x & 0x00000000FFF00000ULL) >> 4) |
+		    ((x & 0x00000000000F0000ULL) << 12) |
+		    ((x & 0x0000FF0000000000ULL) >> 8) |
+		    ((x & 0x000000FF00000000ULL) << 8) |
+		    ((x & 0xF000000000000000ULL) >> 12) |
+		    ((x & 0x0FFF000000000000ULL) << 4);
+	}
+}
+
+static void
+aesct_inv_shift_rows(u_int64_t *q)
+{
+	u_int64_t	x;
+	int		i;
+
+	for (i = 0; i < 8; i++) {
+		x = q[i];
+		q[i] = (x & 0x000000000000FFFFULL) |
+		    ((x & 0x000000000FFF0000ULL) << 4) |
+		    ((x & 0x00000000F0000000ULL) >> 12) |
+		    ((x & 0x000000FF00000000ULL) << 8) |
+		    ((x & 0x0000FF0000000000ULL) >> 8) |
+		    ((x & 0x000F000000000000ULL) << 12) |
+		    ((x & 0xFFF0000000000000ULL) >> 4);
+	}
+}
+
+static void
+aesct_mix_columns(u_int64_t *q)
+{
+	u_int64_t	q0, q1, q2, q3, q4, q5, q6, q7;
+	u_int64_t	r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+	q4 = q[4]; q5 = q[5]; q6 = q[6]; q7 = q[7];
+	r0 = (q0 >> 16) | (q0 << 48);
+	r1 = (q1 >> 16) | (q1 << 48);
+	r2 = (q2 >> 16) | (q2 << 48);
+	r3 = (q3 >> 16) | (q3 << 48);
+	r4 = (q4 >> 16) | (q4 << 48);
+	r5 = (q5 >> 16) | (q5 << 48);
+	r6 = (q6 >> 16) | (q6 << 48);
+	r7 = (q7 >> 16) | (q7 << 48);
+
+	q[0] = q7 ^ r7 ^ r0 ^ AESCT_ROTR32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ AESCT_ROTR32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ AESCT_ROTR32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ AESCT_ROTR32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ AESCT_ROTR32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ AESCT_ROTR32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ AESCT_ROTR32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ AESCT_ROTR32(q7 ^ r7);
+}
+
+static void
+aesct_inv_mix_columns(u_int64_t *q)
+{
+	u_int64_t	q0, q1, q2, q3, q4, q5, q6, q7;
+	u_int64_t	r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+	q4 = q[4]; q5 = q[5]; q6 = q[6]; q7 = q[7];
+	r0 = (q0 >> 16) | (q0 << 48);
+	r1 = (q1 >> 16) | (q1 << 48);
+	r2 = (q2 >> 16) | (q2 << 48);
+	r3 = (q3 >> 16) | (q3 << 48);
+	r4 = (q4 >> 16) | (q4 << 48);
+	r5 = (q5 >> 16) | (q5 << 48);
+	r6 = (q6 >> 16) | (q6 << 48);
+	r7 = (q7 >> 16) | (q7 << 48);
+
+	q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^
+	    AESCT_ROTR32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+	q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+	q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+	q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^
+	    AESCT_ROTR32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+	q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+	q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+	q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+	q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^
+	    AESCT_ROTR32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+static void
+aesct_add_round_key(u_int64_t *q, const u_int64_t *sk)
+{
+	q[0] ^= sk[0]; q[1] ^= sk[1]; q[2] ^= sk[2]; q[3] ^= sk[3];
+	q[4] ^= sk[4]; q[5] ^= sk[5]; q[6] ^= sk[6]; q[7] ^= sk[7];
+}
+
+void
+aesct_set_key(struct aesct_ctx *ct, const rijndael_ctx *ctx)
+{
+	u_int64_t	q[8];
+	u_int32_t	w[4];
+	int		i, j;
+
+	ct->Nr = ctx->Nr;
+	for (i = 0; i <= ctx->Nr; i++) {
+		/* rijndael_ctx words are big endian, blocks load as little */
+		for (j = 0; j < 4; j++)
+			w[j] = __builtin_bswap32(ctx->ek[4 * i + j]);
+		aesct_interleave_in(&q[0], &q[4], w);
+		q[1] = q[2] = q[3] = q[0];
+		q[5] = q[6] = q[7] = q[4];
+		aesct_ortho(q);
+		memcpy(ct->sk + 8 * i, q, sizeof(q));
+	}
+	explicit_bzero(q, sizeof(q));
+	explicit_bzero(w, sizeof(w));
+}
+
+/* run four blocks through the cipher, in place */
+static void
+aesct_crypt4(const struct aesct_ctx *ct, u_int8_t blk[4][16], int dec)
+{
+	u_int64_t	q[8];
+	u_int32_t	w[4];
+	int		i, j;
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++)
+			w[j] = AESCT_DEC32LE(blk[i] + 4 * j);
+		aesct_interleave_in(&q[i], &q[i + 4], w);
+	}
+	aesct_ortho(q);
+
+	if (!dec) {
+		aesct_add_round_key(q, ct->sk);
+		for (i = 1; i < ct->Nr; i++) {
+			aesct_sbox(q);
+			aesct_shift_rows(q);
+			aesct_mix_columns(q);
+			aesct_add_round_key(q, ct->sk + 8 * i);
+		}
+		aesct_sbox(q);
+		aesct_shift_rows(q);
+		aesct_add_round_key(q, ct->sk + 8 * ct->Nr);
+	} else {
+		aesct_add_round_key(q, ct->sk + 8 * ct->Nr);
+		for (i = ct->Nr - 1; i > 0; i--) {
+			aesct_inv_shift_rows(q);
+			aesct_inv_sbox(q);
+			aesct_add_round_key(q, ct->sk + 8 * i);
+			aesct_inv_mix_columns(q);
+		}
+		aesct_inv_shift_rows(q);
+		aesct_inv_sbox(q);
+		aesct_add_round_key(q, ct->sk);
+	}
+
+	aesct_ortho(q);
+	for (i = 0; i < 4; i++) {
+		aesct_interleave_out(w, q[i], q[i + 4]);
+		for (j = 0; j < 4; j++)
+			AESCT_ENC32LE(blk[i] + 4 * j, w[j]);
+	}
+}
+
+void
+aesct_encrypt(const struct aesct_ctx *ct, const u_char *src, u_char *dst)
+{
+	u_int8_t	blk[4][16];
+
+	memset(blk, 0, sizeof(blk));
+	memcpy(blk[0], src, 16);
+	aesct_crypt4(ct, blk, 0);
+	memcpy(dst, blk[0], 16);
+}
+
+/*
+ * A CBC chain is serial, encryption fills one of the four slots only; use
+ * aesct_cbc_encrypt_mb() to encrypt several values at once.
+ */
+void
+aesct_cbc_encrypt(const struct aesct_ctx *ct, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	u_int8_t	blk[4][16];
+	int		i;
+
+	memset(blk, 0, sizeof(blk));
+	memcpy(blk[0], iv, 16);
+	for (; len >= 16; len -= 16, src += 16, dst += 16) {
+		for (i = 0; i < 16; i++)
+			blk[0][i] ^= src[i];
+		aesct_crypt4(ct, blk, 0);
+		memcpy(dst, blk[0], 16);
+	}
+	memcpy(iv, blk[0], 16);
+}
+
+/* four blocks per pass, ciphertext is saved first so src may equal dst */
+void
+aesct_cbc_decrypt(const struct aesct_ctx *ct, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	u_int8_t	blk[4][16], c[4][16], prev[16];
+	size_t		i, n, nb;
+
+	memcpy(prev, iv, 16);
+	for (; len >= 16; len -= n, src += n, dst += n) {
+		nb = len / 16 < 4 ? len / 16 : 4;
+		n = nb * 16;
+		memset(blk, 0, sizeof(blk));
+		memcpy(blk, src, n);
+		memcpy(c, src, n);
+		aesct_crypt4(ct, blk, 1);
+
+		for (i = 0; i < 16; i++)
+			dst[i] = blk[0][i] ^ prev[i];
+		for (i = 16; i < n; i++)
+			dst[i] = blk[i / 16][i % 16] ^ c[i / 16 - 1][i % 16];
+		memcpy(prev, c[nb - 1], 16);
+	}
+	memcpy(iv, prev, 16);
+}
+
+void
+aesct_ctr_xor(const struct aesct_ctx *ct, const u_char *nonce, u_int32_t ctr,
+    const u_char *src, u_char *dst, size_t len)
+{
+	u_int8_t	blk[4][16];
+	size_t		i, n;
+
+	for (; len > 0; len -= n, src += n, dst += n) {
+		for (i = 0; i < 4; i++, ctr++) {
+			memcpy(blk[i], nonce, 12);
+			blk[i][12] = (u_int8_t)(ctr >> 24);
+			blk[i][13] = (u_int8_t)(ctr >> 16);
+			blk[i][14] = (u_int8_t)(ctr >> 8);
+			blk[i][15] = (u_int8_t)ctr;
+		}
+		aesct_crypt4(ct, blk, 0);
+
+		n = len < sizeof(blk) ? len : sizeof(blk);
+		for (i = 0; i < n; i++)
+			dst[i] = src[i] ^ blk[i / 16][i % 16];
+	}
+}
+
+/*
+ * Multi-buffer CBC, see aes-hw.h: the lanes are taken four at a time, one
+ * block of each per pass, skipping groups with no lane running.
+ */
+void
+aesct_cbc_encrypt_mb(const struct aesct_ctx *ct, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	u_int8_t	blk[4][16];
+	size_t		n;
+	int		g, i, j;
+
+	for (g = 0; g < AESHW_LANES; g += 4) {
+		if ((mb->step[g] | mb->step[g + 1] | mb->step[g + 2] |
+		    mb->step[g + 3]) == 0)
+			continue;
+
+		memcpy(blk, mb->iv[g], sizeof(blk));
+		for (n = 0; n < nblocks; n++) {
+			for (i = 0; i < 4; i++)
+				for (j = 0; j < 16; j++)
+					blk[i][j] ^= mb->src[g + i][j];
+			aesct_crypt4(ct, blk, 0);
+			for (i = 0; i < 4; i++) {
+				memcpy(mb->dst[g + i], blk[i], 16);
+				mb->src[g + i] += mb->step[g + i];
+				mb->dst[g + i] += mb->step[g + i];
+			}
+		}
+		memcpy(mb->iv[g], blk, sizeof(blk));
+	}
+}
+
+void
+aesct_cbc_decrypt_mb(const struct aesct_ctx *ct, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	u_int8_t	blk[4][16], c[4][16];
+	size_t		n;
+	int		g, i, j;
+
+	for (g = 0; g < AESHW_LANES; g += 4) {
+		if ((mb->step[g] | mb->step[g + 1] | mb->step[g + 2] |
+		    mb->step[g + 3]) == 0)
+			continue;
+
+		for (n = 0; n < nblocks; n++) {
+			for (i = 0; i < 4; i++)
+				memcpy(c[i], mb->src[g + i], 16);
+			memcpy(blk, c, sizeof(blk));
+			aesct_crypt4(ct, blk, 1);
+			for (i = 0; i < 4; i++) {
+				for (j = 0; j < 16; j++)
+					mb->dst[g + i][j] = blk[i][j] ^
+					    mb->iv[g + i][j];
+				memcpy(mb->iv[g + i], c[i], 16);
+				mb->src[g + i] += mb->step[g + i];
+				mb->dst[g + i] += mb->step[g + i];
+			}
+		}
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef AES_CT_H
+#define AES_CT_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+#include "bsd-rijndael.h"
+#include "aes-hw.h"
+
+CEXT_BEGIN
+
+/*
+ * Constant time bitsliced AES on 64-bit integers, four blocks per pass.
+ * No table lookups and no data dependent branches, for hosts without
+ * AES instructions.  sk holds every round key already bitsliced and
+ * replicated over the four block slots.
+ */
+struct aesct_ctx {
+	u_int64_t	sk[8 * (AES_MAXROUNDS + 1)];
+	int		Nr;
+};
+
+void	aesct_set_key(struct aesct_ctx *, const rijndael_ctx *);
+void	aesct_encrypt(const struct aesct_ctx *, const u_char *, u_char *);
+void	aesct_cbc_encrypt(const struct aesct_ctx *, u_char *, const u_char *,
+	    u_char *, size_t);
+void	aesct_cbc_decrypt(const struct aesct_ctx *, u_char *, const u_char *,
+	    u_char *, size_t);
+void	aesct_ctr_xor(const struct aesct_ctx *, const u_char *, u_int32_t,
+	    const u_char *, u_char *, size_t);
+void	aesct_cbc_encrypt_mb(const struct aesct_ctx *, struct aeshw_mb *,
+	    size_t);
+void	aesct_cbc_decrypt_mb(const struct aesct_ctx *, struct aeshw_mb *,
+	    size_t);
+
+CEXT_END
+
+#endif /* !AES_CT_H */
@@ -0,0 +1,934 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * AES rounds on the CPU crypto instructions.  The schedule is taken from
+ * an already expanded rijndael_ctx, so both engines are guaranteed to
+ * run the very same cipher and produce identical ciphertext.
+ *
+ * Functions are compiled with per-function target attributes, the rest
+ * of the library keeps the baseline instruction set; aeshw_probe() must
+ * return non-zero before anything else in here is called.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "aes-hw.h"
+
+static void	aeshw_load_schedule(u_int8_t *, const u32 *, int);
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+static int	aeshw_mb_busy(const struct aeshw_mb *, int);
+#endif
+
+/* CTR mode counter blocks: 12 bytes nonce, 32 bits big endian counter */
+#define AESHW_CTRBLK(b, n, c) do {					\
+	memcpy((b), (n), 12);						\
+	(b)[12] = (u_int8_t)((c) >> 24); (b)[13] = (u_int8_t)((c) >> 16);	\
+	(b)[14] = (u_int8_t)((c) >> 8); (b)[15] = (u_int8_t)(c);	\
+} while (0)
+
+static void
+aeshw_load_schedule(u_int8_t *dst, const u32 *rk, int Nr)
+{
+	int	i;
+
+	/* rijndael_ctx keeps round keys as big endian words */
+	for (i = 0; i < 4 * (Nr + 1); i++) {
+		dst[4 * i + 0] = (u_int8_t)(rk[i] >> 24);
+		dst[4 * i + 1] = (u_int8_t)(rk[i] >> 16);
+		dst[4 * i + 2] = (u_int8_t)(rk[i] >> 8);
+		dst[4 * i + 3] = (u_int8_t)(rk[i]);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+/* any lane of the group of eight starting at g still running */
+static int
+aeshw_mb_busy(const struct aeshw_mb *mb, int g)
+{
+	int	i;
+
+	for (i = g; i < g + 8; i++)
+		if (mb->step[i] != 0)
+			return (1);
+
+	return (0);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define AESHW_TARGET	__attribute__((target("sse2,aes")))
+#define AESHW_VAES_TARGET __attribute__((target("avx512f,vaes")))
+
+static int	aeshw_probe_vaes(void);
+
+int
+aeshw_probe(void)
+{
+	unsigned int	eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+		return (0);
+
+	return ((ecx & bit_AES) != 0 && (edx & bit_SSE2) != 0);
+}
+
+/* AVX-512 VAES, which also needs the OS to save the zmm registers */
+static int
+aeshw_probe_vaes(void)
+{
+	unsigned int	eax, ebx, ecx, edx, xcr0;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 ||
+	    (ecx & bit_OSXSAVE) == 0)
+		return (0);
+	__asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+	if ((xcr0 & 0xe6) != 0xe6)
+		return (0);
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+		return (0);
+
+	return ((ebx & bit_AVX512F) != 0 && (ecx & bit_VAES) != 0);
+}
+
+AESHW_TARGET void
+aeshw_set_key(struct aeshw_ctx *hw, const rijndael_ctx *ctx)
+{
+	__m128i	*ek = (__m128i *)hw->ek;
+	__m128i	*dk = (__m128i *)hw->dk;
+	int	 i;
+
+	hw->Nr = ctx->Nr;
+	hw->vaes = aeshw_probe_vaes();
+	aeshw_load_schedule(hw->ek, ctx->ek, ctx->Nr);
+
+	dk[0] = ek[hw->Nr];
+	for (i = 1; i < hw->Nr; i++)
+		dk[i] = _mm_aesimc_si128(ek[hw->Nr - i]);
+	dk[hw->Nr] = ek[0];
+}
+
+static inline AESHW_TARGET __m128i
+aeshw_enc_block(const __m128i *ek, int Nr, __m128i b)
+{
+	int	i;
+
+	b = _mm_xor_si128(b, ek[0]);
+	for (i = 1; i < Nr; i++)
+		b = _mm_aesenc_si128(b, ek[i]);
+
+	return (_mm_aesenclast_si128(b, ek[Nr]));
+}
+
+static inline AESHW_TARGET __m128i
+aeshw_dec_block(const __m128i *dk, int Nr, __m128i b)
+{
+	int	i;
+
+	b = _mm_xor_si128(b, dk[0]);
+	for (i = 1; i < Nr; i++)
+		b = _mm_aesdec_si128(b, dk[i]);
+
+	return (_mm_aesdeclast_si128(b, dk[Nr]));
+}
+
+AESHW_TARGET void
+aeshw_encrypt(const struct aeshw_ctx *hw, const u_char *src, u_char *dst)
+{
+	__m128i	b;
+
+	b = _mm_loadu_si128((const __m128i *)src);
+	b = aeshw_enc_block((const __m128i *)hw->ek, hw->Nr, b);
+	_mm_storeu_si128((__m128i *)dst, b);
+}
+
+AESHW_TARGET void
+aeshw_cbc_encrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	const __m128i	*ek = (const __m128i *)hw->ek;
+	__m128i		 b;
+
+	b = _mm_loadu_si128((const __m128i *)iv);
+	for (; len >= 16; len -= 16, src += 16, dst += 16) {
+		b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)src));
+		b = aeshw_enc_block(ek, hw->Nr, b);
+		_mm_storeu_si128((__m128i *)dst, b);
+	}
+	_mm_storeu_si128((__m128i *)iv, b);
+}
+
+/*
+ * CBC decryption has no dependency between blocks, run eight of them
+ * through the aesdec pipeline at once.  All loads of a group happen before
+ * its stores, so src may equal dst.
+ */
+#define AESHW_ROUND8(op, k) do {					\
+	b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k);	\
+	b4 = op(b4, k); b5 = op(b5, k); b6 = op(b6, k); b7 = op(b7, k);	\
+} while (0)
+
+AESHW_TARGET void
+aeshw_cbc_decrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	const __m128i	*dk = (const __m128i *)hw->dk;
+	const __m128i	*s;
+	__m128i		*d;
+	__m128i		 b, c, prev;
+	__m128i		 b0, b1, b2, b3, b4, b5, b6, b7;
+	int		 i;
+
+	prev = _mm_loadu_si128((const __m128i *)iv);
+	for (; len >= 128; len -= 128, src += 128, dst += 128) {
+		s = (const __m128i *)src;
+		d = (__m128i *)dst;
+		b0 = _mm_loadu_si128(s + 0); b1 = _mm_loadu_si128(s + 1);
+		b2 = _mm_loadu_si128(s + 2); b3 = _mm_loadu_si128(s + 3);
+		b4 = _mm_loadu_si128(s + 4); b5 = _mm_loadu_si128(s + 5);
+		b6 = _mm_loadu_si128(s + 6); b7 = _mm_loadu_si128(s + 7);
+		c = _mm_loadu_si128(s + 7);
+
+		AESHW_ROUND8(_mm_xor_si128, dk[0]);
+		for (i = 1; i < hw->Nr; i++)
+			AESHW_ROUND8(_mm_aesdec_si128, dk[i]);
+		AESHW_ROUND8(_mm_aesdeclast_si128, dk[hw->Nr]);
+
+		b0 = _mm_xor_si128(b0, prev);
+		b1 = _mm_xor_si128(b1, _mm_loadu_si128(s + 0));
+		b2 = _mm_xor_si128(b2, _mm_loadu_si128(s + 1));
+		b3 = _mm_xor_si128(b3, _mm_loadu_si128(s + 2));
+		b4 = _mm_xor_si128(b4, _mm_loadu_si128(s + 3));
+		b5 = _mm_xor_si128(b5, _mm_loadu_si128(s + 4));
+		b6 = _mm_xor_si128(b6, _mm_loadu_si128(s + 5));
+		b7 = _mm_xor_si128(b7, _mm_loadu_si128(s + 6));
+
+		_mm_storeu_si128(d + 0, b0); _mm_storeu_si128(d + 1, b1);
+		_mm_storeu_si128(d + 2, b2); _mm_storeu_si128(d + 3, b3);
+		_mm_storeu_si128(d + 4, b4); _mm_storeu_si128(d + 5, b5);
+		_mm_storeu_si128(d + 6, b6); _mm_storeu_si128(d + 7, b7);
+		prev = c;
+	}
+
+	for (; len >= 16; len -= 16, src += 16, dst += 16) {
+		c = _mm_loadu_si128((const __m128i *)src);
+		b = aeshw_dec_block(dk, hw->Nr, c);
+		_mm_storeu_si128((__m128i *)dst, _mm_xor_si128(b, prev));
+		prev = c;
+	}
+	_mm_storeu_si128((__m128i *)iv, prev);
+}
+
+/*
+ * Multi-buffer CBC, one block of every lane per step.  Each lane reads
+ * its block before writing it, so lanes may run in place.
+ */
+#define AESHW_MB_LOAD(j)	_mm_loadu_si128((const __m128i *)s[j])
+#define AESHW_MB_STORE(j, b) do {					\
+	_mm_storeu_si128((__m128i *)d[j], (b));				\
+	s[j] += step[j];						\
+	d[j] += step[j];						\
+} while (0)
+
+static AESHW_TARGET void
+aeshw_cbc_encrypt_mb8(const struct aeshw_ctx *hw, struct aeshw_mb *mb, int g,
+    size_t nblocks)
+{
+	const size_t	*step = mb->step + g;
+	const __m128i	*ek = (const __m128i *)hw->ek;
+	__m128i		*iv = (__m128i *)mb->iv[g];
+	const u_char	*s[8];
+	u_char		*d[8];
+	__m128i		 b0, b1, b2, b3, b4, b5, b6, b7;
+	int		 i;
+
+	memcpy(s, mb->src + g, sizeof(s));
+	memcpy(d, mb->dst + g, sizeof(d));
+	b0 = iv[0]; b1 = iv[1]; b2 = iv[2]; b3 = iv[3];
+	b4 = iv[4]; b5 = iv[5]; b6 = iv[6]; b7 = iv[7];
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = _mm_xor_si128(b0, AESHW_MB_LOAD(0));
+		b1 = _mm_xor_si128(b1, AESHW_MB_LOAD(1));
+		b2 = _mm_xor_si128(b2, AESHW_MB_LOAD(2));
+		b3 = _mm_xor_si128(b3, AESHW_MB_LOAD(3));
+		b4 = _mm_xor_si128(b4, AESHW_MB_LOAD(4));
+		b5 = _mm_xor_si128(b5, AESHW_MB_LOAD(5));
+		b6 = _mm_xor_si128(b6, AESHW_MB_LOAD(6));
+		b7 = _mm_xor_si128(b7, AESHW_MB_LOAD(7));
+
+		AESHW_ROUND8(_mm_xor_si128, ek[0]);
+		for (i = 1; i < hw->Nr; i++)
+			AESHW_ROUND8(_mm_aesenc_si128, ek[i]);
+		AESHW_ROUND8(_mm_aesenclast_si128, ek[hw->Nr]);
+
+		AESHW_MB_STORE(0, b0); AESHW_MB_STORE(1, b1);
+		AESHW_MB_STORE(2, b2); AESHW_MB_STORE(3, b3);
+		AESHW_MB_STORE(4, b4); AESHW_MB_STORE(5, b5);
+		AESHW_MB_STORE(6, b6); AESHW_MB_STORE(7, b7);
+	}
+
+	iv[0] = b0; iv[1] = b1; iv[2] = b2; iv[3] = b3;
+	iv[4] = b4; iv[5] = b5; iv[6] = b6; iv[7] = b7;
+	memcpy(mb->src + g, s, sizeof(s));
+	memcpy(mb->dst + g, d, sizeof(d));
+}
+
+static AESHW_TARGET void
+aeshw_cbc_decrypt_mb8(const struct aeshw_ctx *hw, struct aeshw_mb *mb, int g,
+    size_t nblocks)
+{
+	const size_t	*step = mb->step + g;
+	const __m128i	*dk = (const __m128i *)hw->dk;
+	__m128i		*iv = (__m128i *)mb->iv[g];
+	const u_char	*s[8];
+	u_char		*d[8];
+	__m128i		 b0, b1, b2, b3, b4, b5, b6, b7, c;
+	int		 i;
+
+	memcpy(s, mb->src + g, sizeof(s));
+	memcpy(d, mb->dst + g, sizeof(d));
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = AESHW_MB_LOAD(0); b1 = AESHW_MB_LOAD(1);
+		b2 = AESHW_MB_LOAD(2); b3 = AESHW_MB_LOAD(3);
+		b4 = AESHW_MB_LOAD(4); b5 = AESHW_MB_LOAD(5);
+		b6 = AESHW_MB_LOAD(6); b7 = AESHW_MB_LOAD(7);
+
+		AESHW_ROUND8(_mm_xor_si128, dk[0]);
+		for (i = 1; i < hw->Nr; i++)
+			AESHW_ROUND8(_mm_aesdec_si128, dk[i]);
+		AESHW_ROUND8(_mm_aesdeclast_si128, dk[hw->Nr]);
+
+#define AESHW_MB_CHAIN(j) do {						\
+	c = AESHW_MB_LOAD(j);						\
+	b##j = _mm_xor_si128(b##j, iv[j]);				\
+	iv[j] = c;							\
+	AESHW_MB_STORE(j, b##j);					\
+} while (0)
+		AESHW_MB_CHAIN(0); AESHW_MB_CHAIN(1);
+		AESHW_MB_CHAIN(2); AESHW_MB_CHAIN(3);
+		AESHW_MB_CHAIN(4); AESHW_MB_CHAIN(5);
+		AESHW_MB_CHAIN(6); AESHW_MB_CHAIN(7);
+#undef AESHW_MB_CHAIN
+	}
+
+	memcpy(mb->src + g, s, sizeof(s));
+	memcpy(mb->dst + g, d, sizeof(d));
+}
+
+/*
+ * VAES: sixteen lanes in four zmm registers, four lanes each.  Blocks are
+ * gathered from, scattered to the lanes 128 bits at a time.
+ */
+#define AESHW_MB16_LOAD(j)						\
+	_mm512_inserti32x4(_mm512_inserti32x4(_mm512_inserti32x4(	\
+	    _mm512_castsi128_si512(AESHW_MB_LOAD(4 * (j))),		\
+	    AESHW_MB_LOAD(4 * (j) + 1), 1),				\
+	    AESHW_MB_LOAD(4 * (j) + 2), 2),				\
+	    AESHW_MB_LOAD(4 * (j) + 3), 3)
+#define AESHW_MB16_STORE(j, b) do {					\
+	AESHW_MB_STORE(4 * (j), _mm512_castsi512_si128(b));		\
+	AESHW_MB_STORE(4 * (j) + 1, _mm512_extracti32x4_epi32((b), 1));	\
+	AESHW_MB_STORE(4 * (j) + 2, _mm512_extracti32x4_epi32((b), 2));	\
+	AESHW_MB_STORE(4 * (j) + 3, _mm512_extracti32x4_epi32((b), 3));	\
+} while (0)
+#define AESHW_ROUND16(op, k) do {					\
+	b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k);	\
+} while (0)
+
+static AESHW_VAES_TARGET void
+aeshw_cbc_encrypt_mb16(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	const __m128i	*ek = (const __m128i *)hw->ek;
+	const size_t	*step = mb->step;
+	const u_char	*s[16];
+	u_char		*d[16];
+	__m512i		 k[AES_MAXROUNDS + 1];
+	__m512i		 b0, b1, b2, b3;
+	int		 i;
+
+	memcpy(s, mb->src, sizeof(s));
+	memcpy(d, mb->dst, sizeof(d));
+	for (i = 0; i <= hw->Nr; i++)
+		k[i] = _mm512_broadcast_i32x4(ek[i]);
+	b0 = _mm512_loadu_si512(mb->iv[0]);
+	b1 = _mm512_loadu_si512(mb->iv[4]);
+	b2 = _mm512_loadu_si512(mb->iv[8]);
+	b3 = _mm512_loadu_si512(mb->iv[12]);
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = _mm512_xor_si512(b0, AESHW_MB16_LOAD(0));
+		b1 = _mm512_xor_si512(b1, AESHW_MB16_LOAD(1));
+		b2 = _mm512_xor_si512(b2, AESHW_MB16_LOAD(2));
+		b3 = _mm512_xor_si512(b3, AESHW_MB16_LOAD(3));
+
+		AESHW_ROUND16(_mm512_xor_si512, k[0]);
+		for (i = 1; i < hw->Nr; i++)
+			AESHW_ROUND16(_mm512_aesenc_epi128, k[i]);
+		AESHW_ROUND16(_mm512_aesenclast_epi128, k[hw->Nr]);
+
+		AESHW_MB16_STORE(0, b0); AESHW_MB16_STORE(1, b1);
+		AESHW_MB16_STORE(2, b2); AESHW_MB16_STORE(3, b3);
+	}
+
+	_mm512_storeu_si512(mb->iv[0], b0);
+	_mm512_storeu_si512(mb->iv[4], b1);
+	_mm512_storeu_si512(mb->iv[8], b2);
+	_mm512_storeu_si512(mb->iv[12], b3);
+	memcpy(mb->src, s, sizeof(s));
+	memcpy(mb->dst, d, sizeof(d));
+}
+
+static AESHW_VAES_TARGET void
+aeshw_cbc_decrypt_mb16(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	const __m128i	*dk = (const __m128i *)hw->dk;
+	const size_t	*step = mb->step;
+	const u_char	*s[16];
+	u_char		*d[16];
+	__m512i		 k[AES_MAXROUNDS + 1];
+	__m512i		 b0, b1, b2, b3, c0, c1, c2, c3, v0, v1, v2, v3;
+	int		 i;
+
+	memcpy(s, mb->src, sizeof(s));
+	memcpy(d, mb->dst, sizeof(d));
+	for (i = 0; i <= hw->Nr; i++)
+		k[i] = _mm512_broadcast_i32x4(dk[i]);
+	v0 = _mm512_loadu_si512(mb->iv[0]);
+	v1 = _mm512_loadu_si512(mb->iv[4]);
+	v2 = _mm512_loadu_si512(mb->iv[8]);
+	v3 = _mm512_loadu_si512(mb->iv[12]);
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = c0 = AESHW_MB16_LOAD(0);
+		b1 = c1 = AESHW_MB16_LOAD(1);
+		b2 = c2 = AESHW_MB16_LOAD(2);
+		b3 = c3 = AESHW_MB16_LOAD(3);
+
+		AESHW_ROUND16(_mm512_xor_si512, k[0]);
+		for (i = 1; i < hw->Nr; i++)
+			AESHW_ROUND16(_mm512_aesdec_epi128, k[i]);
+		AESHW_ROUND16(_mm512_aesdeclast_epi128, k[hw->Nr]);
+
+		b0 = _mm512_xor_si512(b0, v0);
+		b1 = _mm512_xor_si512(b1, v1);
+		b2 = _mm512_xor_si512(b2, v2);
+		b3 = _mm512_xor_si512(b3, v3);
+		v0 = c0; v1 = c1; v2 = c2; v3 = c3;
+
+		AESHW_MB16_STORE(0, b0); AESHW_MB16_STORE(1, b1);
+		AESHW_MB16_STORE(2, b2); AESHW_MB16_STORE(3, b3);
+	}
+
+	_mm512_storeu_si512(mb->iv[0], v0);
+	_mm512_storeu_si512(mb->iv[4], v1);
+	_mm512_storeu_si512(mb->iv[8], v2);
+	_mm512_storeu_si512(mb->iv[12], v3);
+	memcpy(mb->src, s, sizeof(s));
+	memcpy(mb->dst, d, sizeof(d));
+}
+
+void
+aeshw_cbc_encrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	int	g;
+
+	if (hw->vaes) {
+		aeshw_cbc_encrypt_mb16(hw, mb, nblocks);
+		return;
+	}
+
+	for (g = 0; g < AESHW_LANES; g += 8)
+		if (aeshw_mb_busy(mb, g))
+			aeshw_cbc_encrypt_mb8(hw, mb, g, nblocks);
+}
+
+void
+aeshw_cbc_decrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	int	g;
+
+	if (hw->vaes) {
+		aeshw_cbc_decrypt_mb16(hw, mb, nblocks);
+		return;
+	}
+
+	for (g = 0; g < AESHW_LANES; g += 8)
+		if (aeshw_mb_busy(mb, g))
+			aeshw_cbc_decrypt_mb8(hw, mb, g, nblocks);
+}
+
+AESHW_TARGET void
+aeshw_ctr_xor(const struct aeshw_ctx *hw, const u_char *nonce, u_int32_t ctr,
+    const u_char *src, u_char *dst, size_t len)
+{
+	const __m128i	*ek = (const __m128i *)hw->ek;
+	const __m128i	*s;
+	__m128i		*d;
+	u_int8_t	 cb[8][16], pad[16];
+	__m128i		 b0, b1, b2, b3, b4, b5, b6, b7;
+	size_t		 i;
+
+	/* keystream blocks are independent, same pipelining as decrypt */
+	for (; len >= 128; len -= 128, src += 128, dst += 128, ctr += 8) {
+		for (i = 0; i < 8; i++)
+			AESHW_CTRBLK(cb[i], nonce, ctr + i);
+		s = (const __m128i *)src;
+		d = (__m128i *)dst;
+		b0 = _mm_loadu_si128((__m128i *)cb[0]);
+		b1 = _mm_loadu_si128((__m128i *)cb[1]);
+		b2 = _mm_loadu_si128((__m128i *)cb[2]);
+		b3 = _mm_loadu_si128((__m128i *)cb[3]);
+		b4 = _mm_loadu_si128((__m128i *)cb[4]);
+		b5 = _mm_loadu_si128((__m128i *)cb[5]);
+		b6 = _mm_loadu_si128((__m128i *)cb[6]);
+		b7 = _mm_loadu_si128((__m128i *)cb[7]);
+
+		AESHW_ROUND8(_mm_xor_si128, ek[0]);
+		for (i = 1; i < (size_t)hw->Nr; i++)
+			AESHW_ROUND8(_mm_aesenc_si128, ek[i]);
+		AESHW_ROUND8(_mm_aesenclast_si128, ek[hw->Nr]);
+
+		b0 = _mm_xor_si128(b0, _mm_loadu_si128(s + 0));
+		b1 = _mm_xor_si128(b1, _mm_loadu_si128(s + 1));
+		b2 = _mm_xor_si128(b2, _mm_loadu_si128(s + 2));
+		b3 = _mm_xor_si128(b3, _mm_loadu_si128(s + 3));
+		b4 = _mm_xor_si128(b4, _mm_loadu_si128(s + 4));
+		b5 = _mm_xor_si128(b5, _mm_loadu_si128(s + 5));
+		b6 = _mm_xor_si128(b6, _mm_loadu_si128(s + 6));
+		b7 = _mm_xor_si128(b7, _mm_loadu_si128(s + 7));
+
+		_mm_storeu_si128(d + 0, b0); _mm_storeu_si128(d + 1, b1);
+		_mm_storeu_si128(d + 2, b2); _mm_storeu_si128(d + 3, b3);
+		_mm_storeu_si128(d + 4, b4); _mm_storeu_si128(d + 5, b5);
+		_mm_storeu_si128(d + 6, b6); _mm_storeu_si128(d + 7, b7);
+	}
+
+	for (; len > 0; ctr++) {
+		AESHW_CTRBLK(cb[0], nonce, ctr);
+		b0 = aeshw_enc_block(ek, hw->Nr,
+		    _mm_loadu_si128((__m128i *)cb[0]));
+		if (len >= 16) {
+			b0 = _mm_xor_si128(b0,
+			    _mm_loadu_si128((const __m128i *)src));
+			_mm_storeu_si128((__m128i *)dst, b0);
+			len -= 16, src += 16, dst += 16;
+			continue;
+		}
+		_mm_storeu_si128((__m128i *)pad, b0);
+		for (i = 0; i < len; i++)
+			dst[i] = src[i] ^ pad[i];
+		break;
+	}
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__OpenBSD__) || defined(__FreeBSD__)
+#include <sys/auxv.h>
+#include <machine/elf.h>
+#endif
+
+#if defined(__clang__)
+#define AESHW_TARGET	__attribute__((target("aes")))
+#else
+#define AESHW_TARGET	__attribute__((target("+crypto")))
+#endif
+
+int
+aeshw_probe(void)
+{
+#if defined(__linux__)
+	return ((getauxval(AT_HWCAP) & HWCAP_AES) != 0);
+#elif defined(AT_HWCAP) && defined(HWCAP_AES)
+	unsigned long	hwcap = 0;
+
+	if (elf_aux_info(AT_HWCAP, &hwcap, sizeof(hwcap)) != 0)
+		return (0);
+
+	return ((hwcap & HWCAP_AES) != 0);
+#else
+	return (0);
+#endif
+}
+
+AESHW_TARGET void
+aeshw_set_key(struct aeshw_ctx *hw, const rijndael_ctx *ctx)
+{
+	int	i;
+
+	hw->Nr = ctx->Nr;
+	hw->vaes = 0;
+	aeshw_load_schedule(hw->ek, ctx->ek, ctx->Nr);
+
+	vst1q_u8(hw->dk, vld1q_u8(hw->ek + 16 * hw->Nr));
+	for (i = 1; i < hw->Nr; i++)
+		vst1q_u8(hw->dk + 16 * i,
+		    vaesimcq_u8(vld1q_u8(hw->ek + 16 * (hw->Nr - i))));
+	vst1q_u8(hw->dk + 16 * hw->Nr, vld1q_u8(hw->ek));
+}
+
+static inline AESHW_TARGET uint8x16_t
+aeshw_enc_block(const u_int8_t *ek, int Nr, uint8x16_t b)
+{
+	int	i;
+
+	for (i = 0; i < Nr - 1; i++)
+		b = vaesmcq_u8(vaeseq_u8(b, vld1q_u8(ek + 16 * i)));
+	b = vaeseq_u8(b, vld1q_u8(ek + 16 * (Nr - 1)));
+
+	return (veorq_u8(b, vld1q_u8(ek + 16 * Nr)));
+}
+
+static inline AESHW_TARGET uint8x16_t
+aeshw_dec_block(const u_int8_t *dk, int Nr, uint8x16_t b)
+{
+	int	i;
+
+	for (i = 0; i < Nr - 1; i++)
+		b = vaesimcq_u8(vaesdq_u8(b, vld1q_u8(dk + 16 * i)));
+	b = vaesdq_u8(b, vld1q_u8(dk + 16 * (Nr - 1)));
+
+	return (veorq_u8(b, vld1q_u8(dk + 16 * Nr)));
+}
+
+AESHW_TARGET void
+aeshw_encrypt(const struct aeshw_ctx *hw, const u_char *src, u_char *dst)
+{
+	vst1q_u8(dst, aeshw_enc_block(hw->ek, hw->Nr, vld1q_u8(src)));
+}
+
+AESHW_TARGET void
+aeshw_cbc_encrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	uint8x16_t	b;
+
+	b = vld1q_u8(iv);
+	for (; len >= 16; len -= 16, src += 16, dst += 16) {
+		b = aeshw_enc_block(hw->ek, hw->Nr, veorq_u8(b, vld1q_u8(src)));
+		vst1q_u8(dst, b);
+	}
+	vst1q_u8(iv, b);
+}
+
+/* four independent blocks in flight, see the x86 version */
+#define AESHW_ROUND4(op, k) do {					\
+	b0 = op(b0, k); b1 = op(b1, k); b2 = op(b2, k); b3 = op(b3, k);	\
+} while (0)
+
+AESHW_TARGET void
+aeshw_cbc_decrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+	uint8x16_t	b, c, prev, k;
+	uint8x16_t	b0, b1, b2, b3, c0, c1, c2, c3;
+	int		i;
+
+	prev = vld1q_u8(iv);
+	for (; len >= 64; len -= 64, src += 64, dst += 64) {
+		b0 = c0 = vld1q_u8(src);
+		b1 = c1 = vld1q_u8(src + 16);
+		b2 = c2 = vld1q_u8(src + 32);
+		b3 = c3 = vld1q_u8(src + 48);
+
+		for (i = 0; i < hw->Nr - 1; i++) {
+			k = vld1q_u8(hw->dk + 16 * i);
+			AESHW_ROUND4(vaesdq_u8, k);
+			b0 = vaesimcq_u8(b0); b1 = vaesimcq_u8(b1);
+			b2 = vaesimcq_u8(b2); b3 = vaesimcq_u8(b3);
+		}
+		k = vld1q_u8(hw->dk + 16 * (hw->Nr - 1));
+		AESHW_ROUND4(vaesdq_u8, k);
+		k = vld1q_u8(hw->dk + 16 * hw->Nr);
+		AESHW_ROUND4(veorq_u8, k);
+
+		vst1q_u8(dst, veorq_u8(b0, prev));
+		vst1q_u8(dst + 16, veorq_u8(b1, c0));
+		vst1q_u8(dst + 32, veorq_u8(b2, c1));
+		vst1q_u8(dst + 48, veorq_u8(b3, c2));
+		prev = c3;
+	}
+
+	for (; len >= 16; len -= 16, src += 16, dst += 16) {
+		c = vld1q_u8(src);
+		b = aeshw_dec_block(hw->dk, hw->Nr, c);
+		vst1q_u8(dst, veorq_u8(b, prev));
+		prev = c;
+	}
+	vst1q_u8(iv, prev);
+}
+
+/* multi-buffer CBC, see the x86 version */
+#define AESHW_MB_STORE(j, b) do {					\
+	vst1q_u8(d[j], (b));						\
+	s[j] += step[j];						\
+	d[j] += step[j];						\
+} while (0)
+
+static AESHW_TARGET void
+aeshw_cbc_encrypt_mb8(const struct aeshw_ctx *hw, struct aeshw_mb *mb, int g,
+    size_t nblocks)
+{
+	const size_t	*step = mb->step + g;
+	const u_char	*s[8];
+	u_char		*d[8];
+	uint8x16_t	 b0, b1, b2, b3, b4, b5, b6, b7, k;
+	int		 i;
+
+	memcpy(s, mb->src + g, sizeof(s));
+	memcpy(d, mb->dst + g, sizeof(d));
+	b0 = vld1q_u8(mb->iv[g + 0]); b1 = vld1q_u8(mb->iv[g + 1]);
+	b2 = vld1q_u8(mb->iv[g + 2]); b3 = vld1q_u8(mb->iv[g + 3]);
+	b4 = vld1q_u8(mb->iv[g + 4]); b5 = vld1q_u8(mb->iv[g + 5]);
+	b6 = vld1q_u8(mb->iv[g + 6]); b7 = vld1q_u8(mb->iv[g + 7]);
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = veorq_u8(b0, vld1q_u8(s[0]));
+		b1 = veorq_u8(b1, vld1q_u8(s[1]));
+		b2 = veorq_u8(b2, vld1q_u8(s[2]));
+		b3 = veorq_u8(b3, vld1q_u8(s[3]));
+		b4 = veorq_u8(b4, vld1q_u8(s[4]));
+		b5 = veorq_u8(b5, vld1q_u8(s[5]));
+		b6 = veorq_u8(b6, vld1q_u8(s[6]));
+		b7 = veorq_u8(b7, vld1q_u8(s[7]));
+
+		for (i = 0; i < hw->Nr - 1; i++) {
+			k = vld1q_u8(hw->ek + 16 * i);
+			b0 = vaesmcq_u8(vaeseq_u8(b0, k));
+			b1 = vaesmcq_u8(vaeseq_u8(b1, k));
+			b2 = vaesmcq_u8(vaeseq_u8(b2, k));
+			b3 = vaesmcq_u8(vaeseq_u8(b3, k));
+			b4 = vaesmcq_u8(vaeseq_u8(b4, k));
+			b5 = vaesmcq_u8(vaeseq_u8(b5, k));
+			b6 = vaesmcq_u8(vaeseq_u8(b6, k));
+			b7 = vaesmcq_u8(vaeseq_u8(b7, k));
+		}
+		k = vld1q_u8(hw->ek + 16 * (hw->Nr - 1));
+		AESHW_ROUND4(vaeseq_u8, k);
+		b4 = vaeseq_u8(b4, k); b5 = vaeseq_u8(b5, k);
+		b6 = vaeseq_u8(b6, k); b7 = vaeseq_u8(b7, k);
+		k = vld1q_u8(hw->ek + 16 * hw->Nr);
+		AESHW_ROUND4(veorq_u8, k);
+		b4 = veorq_u8(b4, k); b5 = veorq_u8(b5, k);
+		b6 = veorq_u8(b6, k); b7 = veorq_u8(b7, k);
+
+		AESHW_MB_STORE(0, b0); AESHW_MB_STORE(1, b1);
+		AESHW_MB_STORE(2, b2); AESHW_MB_STORE(3, b3);
+		AESHW_MB_STORE(4, b4); AESHW_MB_STORE(5, b5);
+		AESHW_MB_STORE(6, b6); AESHW_MB_STORE(7, b7);
+	}
+
+	vst1q_u8(mb->iv[g + 0], b0); vst1q_u8(mb->iv[g + 1], b1);
+	vst1q_u8(mb->iv[g + 2], b2); vst1q_u8(mb->iv[g + 3], b3);
+	vst1q_u8(mb->iv[g + 4], b4); vst1q_u8(mb->iv[g + 5], b5);
+	vst1q_u8(mb->iv[g + 6], b6); vst1q_u8(mb->iv[g + 7], b7);
+	memcpy(mb->src + g, s, sizeof(s));
+	memcpy(mb->dst + g, d, sizeof(d));
+}
+
+static AESHW_TARGET void
+aeshw_cbc_decrypt_mb8(const struct aeshw_ctx *hw, struct aeshw_mb *mb, int g,
+    size_t nblocks)
+{
+	const size_t	*step = mb->step + g;
+	const u_char	*s[8];
+	u_char		*d[8];
+	uint8x16_t	 b0, b1, b2, b3, b4, b5, b6, b7, c, k;
+	int		 i;
+
+	memcpy(s, mb->src + g, sizeof(s));
+	memcpy(d, mb->dst + g, sizeof(d));
+
+	for (; nblocks > 0; nblocks--) {
+		b0 = vld1q_u8(s[0]); b1 = vld1q_u8(s[1]);
+		b2 = vld1q_u8(s[2]); b3 = vld1q_u8(s[3]);
+		b4 = vld1q_u8(s[4]); b5 = vld1q_u8(s[5]);
+		b6 = vld1q_u8(s[6]); b7 = vld1q_u8(s[7]);
+
+		for (i = 0; i < hw->Nr - 1; i++) {
+			k = vld1q_u8(hw->dk + 16 * i);
+			b0 = vaesimcq_u8(vaesdq_u8(b0, k));
+			b1 = vaesimcq_u8(vaesdq_u8(b1, k));
+			b2 = vaesimcq_u8(vaesdq_u8(b2, k));
+			b3 = vaesimcq_u8(vaesdq_u8(b3, k));
+			b4 = vaesimcq_u8(vaesdq_u8(b4, k));
+			b5 = vaesimcq_u8(vaesdq_u8(b5, k));
+			b6 = vaesimcq_u8(vaesdq_u8(b6, k));
+			b7 = vaesimcq_u8(vaesdq_u8(b7, k));
+		}
+		k = vld1q_u8(hw->dk + 16 * (hw->Nr - 1));
+		AESHW_ROUND4(vaesdq_u8, k);
+		b4 = vaesdq_u8(b4, k); b5 = vaesdq_u8(b5, k);
+		b6 = vaesdq_u8(b6, k); b7 = vaesdq_u8(b7, k);
+		k = vld1q_u8(hw->dk + 16 * hw->Nr);
+		AESHW_ROUND4(veorq_u8, k);
+		b4 = veorq_u8(b4, k); b5 = veorq_u8(b5, k);
+		b6 = veorq_u8(b6, k); b7 = veorq_u8(b7, k);
+
+#define AESHW_MB_CHAIN(j) do {						\
+	c = vld1q_u8(s[j]);						\
+	b##j = veorq_u8(b##j, vld1q_u8(mb->iv[g + j]));			\
+	vst1q_u8(mb->iv[g + j], c);					\
+	AESHW_MB_STORE(j, b##j);					\
+} while (0)
+		AESHW_MB_CHAIN(0); AESHW_MB_CHAIN(1);
+		AESHW_MB_CHAIN(2); AESHW_MB_CHAIN(3);
+		AESHW_MB_CHAIN(4); AESHW_MB_CHAIN(5);
+		AESHW_MB_CHAIN(6); AESHW_MB_CHAIN(7);
+#undef AESHW_MB_CHAIN
+	}
+
+	memcpy(mb->src + g, s, sizeof(s));
+	memcpy(mb->dst + g, d, sizeof(d));
+}
+
+void
+aeshw_cbc_encrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	int	g;
+
+	for (g = 0; g < AESHW_LANES; g += 8)
+		if (aeshw_mb_busy(mb, g))
+			aeshw_cbc_encrypt_mb8(hw, mb, g, nblocks);
+}
+
+void
+aeshw_cbc_decrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+	int	g;
+
+	for (g = 0; g < AESHW_LANES; g += 8)
+		if (aeshw_mb_busy(mb, g))
+			aeshw_cbc_decrypt_mb8(hw, mb, g, nblocks);
+}
+
+AESHW_TARGET void
+aeshw_ctr_xor(const struct aeshw_ctx *hw, const u_char *nonce, u_int32_t ctr,
+    const u_char *src, u_char *dst, size_t len)
+{
+	u_int8_t	cb[4][16], pad[16];
+	uint8x16_t	b0, b1, b2, b3, k;
+	size_t		i;
+
+	for (; len >= 64; len -= 64, src += 64, dst += 64, ctr += 4) {
+		for (i = 0; i < 4; i++)
+			AESHW_CTRBLK(cb[i], nonce, ctr + i);
+		b0 = vld1q_u8(cb[0]); b1 = vld1q_u8(cb[1]);
+		b2 = vld1q_u8(cb[2]); b3 = vld1q_u8(cb[3]);
+
+		for (i = 0; i < (size_t)hw->Nr - 1; i++) {
+			k = vld1q_u8(hw->ek + 16 * i);
+			AESHW_ROUND4(vaeseq_u8, k);
+			b0 = vaesmcq_u8(b0); b1 = vaesmcq_u8(b1);
+			b2 = vaesmcq_u8(b2); b3 = vaesmcq_u8(b3);
+		}
+		k = vld1q_u8(hw->ek + 16 * (hw->Nr - 1));
+		AESHW_ROUND4(vaeseq_u8, k);
+		k = vld1q_u8(hw->ek + 16 * hw->Nr);
+		AESHW_ROUND4(veorq_u8, k);
+
+		vst1q_u8(dst, veorq_u8(b0, vld1q_u8(src)));
+		vst1q_u8(dst + 16, veorq_u8(b1, vld1q_u8(src + 16)));
+		vst1q_u8(dst + 32, veorq_u8(b2, vld1q_u8(src + 32)));
+		vst1q_u8(dst + 48, veorq_u8(b3, vld1q_u8(src + 48)));
+	}
+
+	for (; len > 0; ctr++) {
+		AESHW_CTRBLK(cb[0], nonce, ctr);
+		b0 = aeshw_enc_block(hw->ek, hw->Nr, vld1q_u8(cb[0]));
+		if (len >= 16) {
+			vst1q_u8(dst, veorq_u8(b0, vld1q_u8(src)));
+			len -= 16, src += 16, dst += 16;
+			continue;
+		}
+		vst1q_u8(pad, b0);
+		for (i = 0; i < len; i++)
+			dst[i] = src[i] ^ pad[i];
+		break;
+	}
+}
+
+#else /* no hardware AES support compiled in */
+
+int
+aeshw_probe(void)
+{
+	return (0);
+}
+
+void
+aeshw_set_key(struct aeshw_ctx *hw, const rijndael_ctx *ctx)
+{
+	hw->Nr = ctx->Nr;
+	hw->vaes = 0;
+	aeshw_load_schedule(hw->ek, ctx->ek, ctx->Nr);
+}
+
+void
+aeshw_encrypt(const struct aeshw_ctx *hw, const u_char *src, u_char *dst)
+{
+}
+
+void
+aeshw_cbc_encrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+}
+
+void
+aeshw_cbc_decrypt(const struct aeshw_ctx *hw, u_char *iv, const u_char *src,
+    u_char *dst, size_t len)
+{
+}
+
+void
+aeshw_cbc_encrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+}
+
+void
+aeshw_cbc_decrypt_mb(const struct aeshw_ctx *hw, struct aeshw_mb *mb,
+    size_t nblocks)
+{
+}
+
+void
+aeshw_ctr_xor(const struct aeshw_ctx *hw, const u_char *nonce, u_int32_t ctr,
+    const u_char *src, u_char *dst, size_t len)
+{
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef AES_HW_H
+#define AES_HW_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+#include "bsd-rijndael.h"
+
+CEXT_BEGIN
+
+/*
+ * Hardware AES (x86 AES-NI, ARMv8 crypto extension).  Round keys are
+ * stored as byte strings, ready to be loaded into vector registers; dk
+ * holds the equivalent inverse cipher schedule.
+ */
+struct aeshw_ctx {
+	u_int8_t	ek[16 * (AES_MAXROUNDS + 1)] __attribute__((aligned(16)));
+	u_int8_t	dk[16 * (AES_MAXROUNDS + 1)] __attribute__((aligned(16)));
+	int		Nr;
+	int		vaes;		/* x86 AVX-512 VAES available */
+};
+
+/*
+ * Multi-buffer CBC: AESHW_LANES independent chains advanced one block each
+ * per step, so the AES pipeline is kept busy even though every chain on
+ * its own is serial.  Lanes with nothing to do have step 0, src and dst
+ * pointing at scratch.  Run as two groups of eight with AES-NI and ARMv8,
+ * in one go with VAES.
+ */
+#define AESHW_LANES	16
+
+struct aeshw_mb {
+	u_int8_t	 iv[AESHW_LANES][16] __attribute__((aligned(16)));
+	const u_char	*src[AESHW_LANES];
+	u_char		*dst[AESHW_LANES];
+	size_t		 step[AESHW_LANES];
+	u_int8_t	 scratch[16] __attribute__((aligned(16)));
+};
+
+int	aeshw_probe(void);
+void	aeshw_set_key(struct aeshw_ctx *, const rijndael_ctx *);
+void	aeshw_encrypt(const struct aeshw_ctx *, const u_char *, u_char *);
+void	aeshw_cbc_encrypt(const struct aeshw_ctx *, u_char *, const u_char *,
+	    u_char *, size_t);
+void	aeshw_cbc_decrypt(const struct aeshw_ctx *, u_char *, const u_char *,
+	    u_char *, size_t);
+void	aeshw_cbc_encrypt_mb(const struct aeshw_ctx *, struct aeshw_mb *,
+	    size_t);
+void	aeshw_cbc_decrypt_mb(const struct aeshw_ctx *, struct aeshw_mb *,
+	    size_t);
+void	aeshw_ctr_xor(const struct aeshw_ctx *, const u_char *, u_int32_t,
+	    const u_char *, u_char *, size_t);
+
+CEXT_END
+
+#endif /* !AES_HW_H */
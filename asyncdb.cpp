@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "hiredis/hiredis.h"
+#include "cryptredis.h"
+#include "cryptredisxx.h"
+
+CRPTRDS_BEGIN_NAMESPACE
+
+struct CryptRedisAsyncDbPrivate {
+	struct cryptredis_async	*async;
+	string			 host;
+	int			 port;
+	int			 format;
+	bool			 crypt;
+	bool			 raw;
+	bool			 lz4;
+	size_t			 lz4min;
+	string			 errmsg;
+
+	int configure();
+	static void reply(struct cryptredis_async *, struct redisReply *,
+	    void *);
+};
+
+/*
+ * Apply the settings to the handle, once it is open.  Checked first, on
+ * error the handle keeps the previous ones.
+ */
+int
+CryptRedisAsyncDbPrivate::configure()
+{
+	struct cryptredis	*crp;
+	const char		*errstr;
+	int			 f = format | (lz4 ? CRYPTREDIS_FMT_LZ4 : 0);
+
+	if ((errstr = cryptredis_format_error(f)) != NULL) {
+		errmsg = errstr;
+		return (-1);
+	}
+	if (async == NULL)
+		return (0);
+	crp = &async->ca_crypt;
+
+	if (cryptredis_config_encrypt(crp, crypt ? f :
+	    CRYPTREDIS_FMT_NONE) == -1) {
+		errmsg = getenv("CRYPTREDIS_KEYFILE") == NULL ?
+		    "CRYPTREDIS_KEYFILE environment variable not set" :
+		    "can't read the key files in CRYPTREDIS_KEYFILE";
+		return (-1);
+	}
+	cryptredis_config_raw(crp, raw);
+	cryptredis_config_compress(crp, lz4min);
+
+	return (0);
+}
+
+/* the reply of a command, NULL if it never came: hand it to its callback */
+void
+CryptRedisAsyncDbPrivate::reply(struct cryptredis_async *cra,
+    struct redisReply *r, void *arg)
+{
+	CryptRedisAsyncDb::Callback	*cb;
+	CryptRedisResult		 res;
+
+	cb = static_cast<CryptRedisAsyncDb::Callback *>(arg);
+	if (r != NULL) {
+		res.setType(r->type);
+		res.setStatus(r->type == REDIS_REPLY_ERROR ?
+		    CryptRedisResult::Fail : CryptRedisResult::Ok);
+		switch (r->type) {
+		case REDIS_REPLY_ERROR:
+		case REDIS_REPLY_STATUS:
+		case REDIS_REPLY_STRING:
+			/* hiredis frees r once we return, without its string */
+			res.adoptData(r->str, r->len);
+			r->str = NULL;
+			break;
+		case REDIS_REPLY_INTEGER:
+			res.setData(r->integer);
+			break;
+		case REDIS_REPLY_ARRAY:
+			res.setSize(r->elements);
+			break;
+		}
+	}
+
+	(*cb)(res);
+	delete cb;
+}
+
+CryptRedisAsyncDb::CryptRedisAsyncDb() :
+	d(new CryptRedisAsyncDbPrivate)
+{
+	d->async = NULL;
+	d->port = -1;
+	d->format = CryptRedisDb::LegacyFormat;
+	d->crypt = false;
+	d->raw = false;
+	d->lz4 = false;
+	d->lz4min = CRYPTREDIS_LZ4_MIN;
+}
+
+CryptRedisAsyncDb::~CryptRedisAsyncDb()
+{
+	close();
+	delete d;
+}
+
+bool
+CryptRedisAsyncDb::open(const string &h, int p)
+{
+	d->host = h.empty() ? "localhost" : h;
+	d->port = p > 0 ? p : 6379;
+
+	if ((d->async = cryptredis_async_open(d->host.data(), d->port)) ==
+	    NULL)
+		return (false);
+	if (d->configure() == -1) {
+		close();
+		return (false);
+	}
+
+	return (true);
+}
+
+/* callbacks still pending run with a Fail result */
+void
+CryptRedisAsyncDb::close()
+{
+	if (d->async) {
+		cryptredis_async_close(d->async);
+		d->async = NULL;
+	}
+}
+
+bool
+CryptRedisAsyncDb::connected()
+{
+	return (d->async && d->async->ca_context != NULL);
+}
+
+struct redisAsyncContext *
+CryptRedisAsyncDb::context()
+{
+	return (d->async ? d->async->ca_context : NULL);
+}
+
+int
+CryptRedisAsyncDb::get(const string &key, const Callback &cb)
+{
+	Callback	*arg;
+
+	if (!connected())
+		return (-1);
+
+	arg = new Callback(cb);
+	if (cryptredis_async_get(d->async, key.data(), key.size(),
+	    CryptRedisAsyncDbPrivate::reply, arg) == -1) {
+		delete arg;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* without a callback the reply is dropped, nothing is allocated for it */
+int
+CryptRedisAsyncDb::set(const string &key, const string &value,
+	const Callback &cb)
+{
+	Callback	*arg = NULL;
+
+	if (!connected())
+		return (-1);
+
+	if (cb)
+		arg = new Callback(cb);
+	if (cryptredis_async_set(d->async, key.data(), key.size(),
+	    value.data(), value.size(), arg ? CryptRedisAsyncDbPrivate::reply :
+	    NULL, arg) == -1) {
+		delete arg;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+CryptRedisAsyncDb::setCryptEnabled(bool enable)
+{
+	bool	old = d->crypt;
+
+	d->crypt = enable;
+	if (d->configure() == -1) {
+		d->crypt = old;
+		return (-1);
+	}
+
+	return (0);
+}
+
+bool
+CryptRedisAsyncDb::cryptEnabled()
+{
+	return (d->crypt);
+}
+
+int
+CryptRedisAsyncDb::setCryptFormat(int f)
+{
+	int	old = d->format;
+
+	d->format = f;
+	if (d->configure() == -1) {
+		d->format = old;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+CryptRedisAsyncDb::cryptFormat()
+{
+	return (d->format);
+}
+
+void
+CryptRedisAsyncDb::setRawStorage(bool raw)
+{
+	d->raw = raw;
+
+	if (d->async)
+		cryptredis_config_raw(&d->async->ca_crypt, raw);
+}
+
+bool
+CryptRedisAsyncDb::rawStorage()
+{
+	return (d->raw);
+}
+
+int
+CryptRedisAsyncDb::setCompression(bool enable, size_t min)
+{
+	bool	oldlz4 = d->lz4;
+	size_t	oldmin = d->lz4min;
+
+	d->lz4 = enable;
+	d->lz4min = min;
+	if (d->configure() == -1) {
+		d->lz4 = oldlz4;
+		d->lz4min = oldmin;
+		return (-1);
+	}
+
+	return (0);
+}
+
+bool
+CryptRedisAsyncDb::compression()
+{
+	return (d->lz4);
+}
+
+string
+CryptRedisAsyncDb::lastError()
+{
+	return (d->errmsg);
+}
+
+CRPTRDS_END_NAMESPACE
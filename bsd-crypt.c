@@ -47,16 +47,39 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <err.h>
 
 #include "bsd-crypt.h"
 #include "bsd-rijndael.h"
+#include "aes-hw.h"
+#include "aes-ct.h"
+#include "chacha.h"
+#include "poly1305.h"
 
-static rijndael_ctx ctxt;
+/*
+ * AES engine, probed once on first key setup: -1 not yet probed, else one
+ * of CRYPTREDIS_AES_*.  The result is copied into every key, this is the
+ * only process-wide state.
+ */
+static int	cryptredis_engine = -1;
 
-static void	cryptredis_dump_ctxt(rijndael_ctx *);
-static void	cryptredis_key_prepare(const struct cryptredis_key *, int);
+static void	cryptredis_dump_ctxt(const rijndael_ctx *);
+static int	cryptredis_engine_probe(void);
+static void	cryptredis_hmac_init(SHA2_CTX *, SHA2_CTX *, const u_int8_t *,
+		    size_t);
+static void	cryptredis_hmac_final(SHA2_CTX *, const SHA2_CTX *,
+		    u_int8_t *);
+static void	cryptredis_chacha_mac(const struct cryptredis_key *,
+		    const u_int8_t *, const void *, size_t, const void *, size_t,
+		    u_int8_t *);
+static void	cryptredis_cbc_batch(const struct cryptredis_key *,
+		    const struct cryptredis_iov *, size_t, int);
+static void	cryptredis_cbc_one(const struct cryptredis_key *, u_char *,
+		    const u_char *, u_char *, size_t, int);
+static void	cryptredis_cbc_mb(const struct cryptredis_key *,
+		    struct aeshw_mb *, size_t, int);
 
 /*
  * Encrypt the data before it goes to swap, the size should be 64-bit
@@ -71,14 +94,25 @@ cryptredis_encrypt(const struct cryptredis_key *key, const char *src, u_int32_t
         u_int32_t iv[4];
         u_int32_t iv1, iv2, iv3, iv4;
 
-        cryptredis_key_prepare(key, 1);
-	memcpy(iv, key->iv, sizeof(iv));
-
         count /= sizeof(u_int32_t);
 
-        iv[2] = ~iv[0]; iv[3] = ~iv[1];
-        rijndael_encrypt(&ctxt, (u_char *)iv, (u_char *)iv);
-        iv1 = iv[0]; iv2 = iv[1]; iv3 = iv[2]; iv4 = iv[3];
+	switch (key->engine) {
+	case CRYPTREDIS_AES_HW:
+		memcpy(iv, key->wiv, sizeof(iv));
+		aeshw_cbc_encrypt(&key->hwctx, (u_char *)iv,
+		    (const u_char *)dsrc, (u_char *)ddst,
+		    count * sizeof(u_int32_t));
+		return;
+	case CRYPTREDIS_AES_CT:
+		memcpy(iv, key->wiv, sizeof(iv));
+		aesct_cbc_encrypt(&key->ctctx, (u_char *)iv,
+		    (const u_char *)dsrc, (u_char *)ddst,
+		    count * sizeof(u_int32_t));
+		return;
+	}
+
+        iv1 = key->wiv[0]; iv2 = key->wiv[1];
+        iv3 = key->wiv[2]; iv4 = key->wiv[3];
 
         for (; count > 0; count -= 4) {
                 ddst[0] = dsrc[0] ^ iv1;
@@ -89,7 +123,7 @@ cryptredis_encrypt(const struct cryptredis_key *key, const char *src, u_int32_t
                  * Do not worry about endianess, it only needs to decrypt
                  * on this machine.
                  */
-                rijndael_encrypt(&ctxt, (u_char *)ddst, (u_char *)ddst);
+                rijndael_encrypt(&key->ctx, (u_char *)ddst, (u_char *)ddst);
                 iv1 = ddst[0];
                 iv2 = ddst[1];
                 iv3 = ddst[2];
@@ -108,22 +142,65 @@ cryptredis_decrypt(const struct cryptredis_key *key, const u_int32_t *src, char
         u_int32_t *ddst = (u_int32_t *)dst;
         u_int32_t iv[4];
         u_int32_t iv1, iv2, iv3, iv4, niv1, niv2, niv3, niv4;
-
-        cryptredis_key_prepare(key, 0);
-	memcpy(iv, key->iv, sizeof(iv));
+	u_int32_t blk[16];
+	int i;
 
         count /= sizeof(u_int32_t);
 
-        iv[2] = ~iv[0]; iv[3] = ~iv[1];
-        rijndael_encrypt(&ctxt, (u_char *)iv, (u_char *)iv); 
-        iv1 = iv[0]; iv2 = iv[1]; iv3 = iv[2]; iv4 = iv[3];
+	switch (key->engine) {
+	case CRYPTREDIS_AES_HW:
+		memcpy(iv, key->wiv, sizeof(iv));
+		aeshw_cbc_decrypt(&key->hwctx, (u_char *)iv,
+		    (const u_char *)dsrc, (u_char *)ddst,
+		    count * sizeof(u_int32_t));
+		return;
+	case CRYPTREDIS_AES_CT:
+		memcpy(iv, key->wiv, sizeof(iv));
+		aesct_cbc_decrypt(&key->ctctx, (u_char *)iv,
+		    (const u_char *)dsrc, (u_char *)ddst,
+		    count * sizeof(u_int32_t));
+		return;
+	}
+
+        iv1 = key->wiv[0]; iv2 = key->wiv[1];
+        iv3 = key->wiv[2]; iv4 = key->wiv[3];
+
+	/*
+	 * Blocks do not depend on each other when decrypting: run four
+	 * independent table lookup chains back to back, so the CPU overlaps
+	 * them, and do the CBC xor afterwards.  The xor walks backwards so
+	 * that src may equal dst.
+	 */
+	for (; count >= 16; count -= 16) {
+		rijndael_decrypt(&key->ctx, (u_char *)&dsrc[0],
+		    (u_char *)&blk[0]);
+		rijndael_decrypt(&key->ctx, (u_char *)&dsrc[4],
+		    (u_char *)&blk[4]);
+		rijndael_decrypt(&key->ctx, (u_char *)&dsrc[8],
+		    (u_char *)&blk[8]);
+		rijndael_decrypt(&key->ctx, (u_char *)&dsrc[12],
+		    (u_char *)&blk[12]);
+
+		niv1 = dsrc[12]; niv2 = dsrc[13];
+		niv3 = dsrc[14]; niv4 = dsrc[15];
+		for (i = 15; i >= 4; i--)
+			ddst[i] = blk[i] ^ dsrc[i - 4];
+		ddst[0] = blk[0] ^ iv1;
+		ddst[1] = blk[1] ^ iv2;
+		ddst[2] = blk[2] ^ iv3;
+		ddst[3] = blk[3] ^ iv4;
+		iv1 = niv1; iv2 = niv2; iv3 = niv3; iv4 = niv4;
+
+		dsrc += 16;
+		ddst += 16;
+	}
 
         for (; count > 0; count -= 4) {
                 ddst[0] = niv1 = dsrc[0];
                 ddst[1] = niv2 = dsrc[1];
                 ddst[2] = niv3 = dsrc[2];
                 ddst[3] = niv4 = dsrc[3];
-                rijndael_decrypt(&ctxt, (u_char *)ddst, (u_char *)ddst);
+                rijndael_decrypt(&key->ctx, (u_char *)ddst, (u_char *)ddst);
                 ddst[0] ^= iv1;
                 ddst[1] ^= iv2;
                 ddst[2] ^= iv3;
@@ -139,8 +216,372 @@ cryptredis_decrypt(const struct cryptredis_key *key, const u_int32_t *src, char
         }
 }
 
+/*
+ * Encrypt, decrypt a batch of independent values, as many separate calls
+ * to cryptredis_encrypt(), cryptredis_decrypt() would.  With the CPU AES
+ * and the bitsliced engines the CBC chains of up to AESHW_LANES values are
+ * interleaved.
+ */
+void
+cryptredis_encrypt_batch(const struct cryptredis_key *key,
+    const struct cryptredis_iov *iov, size_t n)
+{
+	size_t	i;
+
+	if (key->engine != CRYPTREDIS_AES_TABLE && n > 1) {
+		cryptredis_cbc_batch(key, iov, n, 1);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		cryptredis_encrypt(key, iov[i].ci_src, iov[i].ci_dst,
+		    iov[i].ci_len);
+}
+
+void
+cryptredis_decrypt_batch(const struct cryptredis_key *key,
+    const struct cryptredis_iov *iov, size_t n)
+{
+	size_t	i;
+
+	if (key->engine != CRYPTREDIS_AES_TABLE && n > 1) {
+		cryptredis_cbc_batch(key, iov, n, 0);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		cryptredis_decrypt(key, iov[i].ci_src, iov[i].ci_dst,
+		    iov[i].ci_len);
+}
+
+/*
+ * Multi-buffer scheduler: keep every lane fed with the next value of the
+ * batch and run all of them until the shortest one is done.  Once the
+ * batch is drained, finish the last value on its own, and when decrypting
+ * the last few, decryption of a single value is already pipelined.
+ */
+static void
+cryptredis_cbc_batch(const struct cryptredis_key *key,
+    const struct cryptredis_iov *iov, size_t n, int enc)
+{
+	struct aeshw_mb	 mb;
+	size_t		 left[AESHW_LANES];
+	size_t		 next = 0, nblocks;
+	int		 i, active;
+
+	memset(&mb, 0, sizeof(mb));
+	for (i = 0; i < AESHW_LANES; i++) {
+		mb.src[i] = mb.dst[i] = mb.scratch;
+		left[i] = 0;
+	}
+
+	for (;;) {
+		active = 0;
+		nblocks = 0;
+		for (i = 0; i < AESHW_LANES; i++) {
+			while (left[i] == 0 && next < n) {
+				left[i] = iov[next].ci_len / 16;
+				mb.src[i] = iov[next].ci_src;
+				mb.dst[i] = iov[next].ci_dst;
+				mb.step[i] = 16;
+				memcpy(mb.iv[i], key->wiv, sizeof(mb.iv[i]));
+				next++;
+			}
+			if (left[i] == 0) {
+				mb.src[i] = mb.dst[i] = mb.scratch;
+				mb.step[i] = 0;
+				continue;
+			}
+			if (nblocks == 0 || left[i] < nblocks)
+				nblocks = left[i];
+			active++;
+		}
+
+		if (active == 0)
+			break;
+
+		if (next == n && (active == 1 ||
+		    (!enc && active <= AESHW_LANES / 8))) {
+			for (i = 0; i < AESHW_LANES; i++) {
+				if (left[i] == 0)
+					continue;
+				cryptredis_cbc_one(key, mb.iv[i], mb.src[i],
+				    mb.dst[i], left[i] * 16, enc);
+			}
+			break;
+		}
+
+		cryptredis_cbc_mb(key, &mb, nblocks, enc);
+
+		for (i = 0; i < AESHW_LANES; i++)
+			if (left[i] != 0)
+				left[i] -= nblocks;
+	}
+
+	explicit_bzero(&mb, sizeof(mb));
+}
+
+/* one CBC chain of a batch on the key's engine, iv is updated */
+static void
+cryptredis_cbc_one(const struct cryptredis_key *key, u_char *iv,
+    const u_char *src, u_char *dst, size_t len, int enc)
+{
+	if (key->engine == CRYPTREDIS_AES_CT) {
+		if (enc)
+			aesct_cbc_encrypt(&key->ctctx, iv, src, dst, len);
+		else
+			aesct_cbc_decrypt(&key->ctctx, iv, src, dst, len);
+	} else {
+		if (enc)
+			aeshw_cbc_encrypt(&key->hwctx, iv, src, dst, len);
+		else
+			aeshw_cbc_decrypt(&key->hwctx, iv, src, dst, len);
+	}
+}
+
+static void
+cryptredis_cbc_mb(const struct cryptredis_key *key, struct aeshw_mb *mb,
+    size_t nblocks, int enc)
+{
+	if (key->engine == CRYPTREDIS_AES_CT) {
+		if (enc)
+			aesct_cbc_encrypt_mb(&key->ctctx, mb, nblocks);
+		else
+			aesct_cbc_decrypt_mb(&key->ctctx, mb, nblocks);
+	} else {
+		if (enc)
+			aeshw_cbc_encrypt_mb(&key->hwctx, mb, nblocks);
+		else
+			aeshw_cbc_decrypt_mb(&key->hwctx, mb, nblocks);
+	}
+}
+
+/*
+ * AES-CTR keystream xor, counter blocks are nonce || be32(ctr).  Blocks are
+ * independent, the table engine runs four of them back to back.
+ */
+void
+cryptredis_ctr_crypt(const struct cryptredis_key *key, const u_int8_t *nonce,
+    u_int32_t ctr, const void *src, void *dst, size_t len)
+{
+	const u_int8_t	*s = src;
+	u_int8_t	*d = dst;
+	u_int8_t	 ks[4 * 16];
+	size_t		 i, n;
+
+	switch (key->engine) {
+	case CRYPTREDIS_AES_HW:
+		aeshw_ctr_xor(&key->ctr_hwctx, nonce, ctr, s, d, len);
+		return;
+	case CRYPTREDIS_AES_CT:
+		aesct_ctr_xor(&key->ctr_ctctx, nonce, ctr, s, d, len);
+		return;
+	}
+
+	for (; len > 0; len -= n, s += n, d += n) {
+		for (i = 0; i < 4; i++, ctr++) {
+			memcpy(ks + 16 * i, nonce, CRYPTREDIS_NONCELEN);
+			ks[16 * i + 12] = (u_int8_t)(ctr >> 24);
+			ks[16 * i + 13] = (u_int8_t)(ctr >> 16);
+			ks[16 * i + 14] = (u_int8_t)(ctr >> 8);
+			ks[16 * i + 15] = (u_int8_t)ctr;
+		}
+		for (i = 0; i < 4; i++)
+			rijndael_encrypt(&key->ctr_ctx, ks + 16 * i,
+			    ks + 16 * i);
+
+		n = len < sizeof(ks) ? len : sizeof(ks);
+		for (i = 0; i < n; i++)
+			d[i] = s[i] ^ ks[i];
+	}
+}
+
+/*
+ * HMAC-SHA256 of a single buffer, the padded key states are precomputed.
+ */
+void
+cryptredis_mac(const struct cryptredis_key *key, const void *buf, size_t len,
+    u_int8_t *mac)
+{
+	SHA2_CTX	ctx;
+
+	memcpy(&ctx, &key->mac_ictx, sizeof(ctx));
+	SHA256Update(&ctx, buf, len);
+	cryptredis_hmac_final(&ctx, &key->mac_octx, mac);
+}
+
+/*
+ * ChaCha20-Poly1305 AEAD, RFC 8439 section 2.8: the one-time poly1305 key
+ * is keystream block 0, the payload is xored with blocks 1 and on, and the
+ * tag covers aad and ciphertext, each zero padded to 16 bytes, followed by
+ * both lengths as little endian 64-bit words.
+ */
+void
+cryptredis_chacha_seal(const struct cryptredis_key *key, const u_int8_t *nonce,
+    const void *aad, size_t aadlen, const void *src, void *dst, size_t len,
+    u_int8_t *tag)
+{
+	chacha20_xor(key->chacha, key->cc_key, nonce, 1, src, dst, len);
+	cryptredis_chacha_mac(key, nonce, aad, aadlen, dst, len, tag);
+}
+
+/*
+ * Returns -1 without touching dst if the tag does not match.
+ */
+int
+cryptredis_chacha_open(const struct cryptredis_key *key, const u_int8_t *nonce,
+    const void *aad, size_t aadlen, const void *src, void *dst, size_t len,
+    const u_int8_t *tag)
+{
+	u_int8_t	mac[POLY1305_TAGLEN];
+	int		bad;
+
+	cryptredis_chacha_mac(key, nonce, aad, aadlen, src, len, mac);
+	bad = timingsafe_bcmp(mac, tag, sizeof(mac));
+	explicit_bzero(mac, sizeof(mac));
+	if (bad)
+		return (-1);
+
+	chacha20_xor(key->chacha, key->cc_key, nonce, 1, src, dst, len);
+	return (0);
+}
+
+static void
+cryptredis_chacha_mac(const struct cryptredis_key *key, const u_int8_t *nonce,
+    const void *aad, size_t aadlen, const void *ct, size_t len, u_int8_t *tag)
+{
+	static const u_int8_t zero[POLY1305_BLOCKLEN];
+	struct poly1305_ctx	pctx;
+	u_int8_t		pkey[CHACHA_BLOCKLEN];
+	u_int8_t		lens[16];
+	int			i;
+
+	memset(pkey, 0, sizeof(pkey));
+	chacha20_xor(key->chacha, key->cc_key, nonce, 0, pkey, pkey,
+	    sizeof(pkey));
+	poly1305_init(&pctx, pkey);
+	explicit_bzero(pkey, sizeof(pkey));
+
+	poly1305_update(&pctx, aad, aadlen);
+	poly1305_update(&pctx, zero, -aadlen & (POLY1305_BLOCKLEN - 1));
+	poly1305_update(&pctx, ct, len);
+	poly1305_update(&pctx, zero, -len & (POLY1305_BLOCKLEN - 1));
+	for (i = 0; i < 8; i++) {
+		lens[i] = (u_int8_t)((u_int64_t)aadlen >> (8 * i));
+		lens[8 + i] = (u_int8_t)((u_int64_t)len >> (8 * i));
+	}
+	poly1305_update(&pctx, lens, sizeof(lens));
+	poly1305_finish(&pctx, tag);
+}
+
+static void
+cryptredis_hmac_init(SHA2_CTX *ictx, SHA2_CTX *octx, const u_int8_t *k,
+    size_t klen)
+{
+	u_int8_t	pad[SHA256_BLOCK_LENGTH];
+	size_t		i;
+
+	/* keys are never longer than a sha256 block here */
+	memset(pad, 0x36, sizeof(pad));
+	for (i = 0; i < klen; i++)
+		pad[i] ^= k[i];
+	SHA256Init(ictx);
+	SHA256Update(ictx, pad, sizeof(pad));
+
+	memset(pad, 0x5c, sizeof(pad));
+	for (i = 0; i < klen; i++)
+		pad[i] ^= k[i];
+	SHA256Init(octx);
+	SHA256Update(octx, pad, sizeof(pad));
+
+	explicit_bzero(pad, sizeof(pad));
+}
+
+static void
+cryptredis_hmac_final(SHA2_CTX *ictx, const SHA2_CTX *octx, u_int8_t *mac)
+{
+	SHA2_CTX	ctx;
+	u_int8_t	ihash[SHA256_DIGEST_LENGTH];
+
+	SHA256Final(ihash, ictx);
+	memcpy(&ctx, octx, sizeof(ctx));
+	SHA256Update(&ctx, ihash, sizeof(ihash));
+	SHA256Final(mac, &ctx);
+}
+
+/*
+ * Expand the encrypt and decrypt schedules and whiten the iv, once per key
+ * load; the encrypt/decrypt paths only read the result.
+ *
+ * Counter mode uses its own subkeys, HMAC-SHA256(key, label), so that
+ * neither the cipher nor the mac key is shared with the legacy CBC format.
+ * ChaCha20-Poly1305 gets a third one the same way.  The key id written in
+ * value headers is the start of HMAC-SHA256(key, label | iv), so it names
+ * the whole key file without giving anything of it away.
+ */
+void
+cryptredis_key_setup(struct cryptredis_key *key)
+{
+	SHA2_CTX	ictx, octx;
+	u_int8_t	subkey[SHA256_DIGEST_LENGTH];
+	static const char ctrlabel[] = "cryptredis aes-256-ctr";
+	static const char maclabel[] = "cryptredis hmac-sha256";
+	static const char cclabel[] = "cryptredis chacha20-poly1305";
+	static const char kidlabel[] = "cryptredis key id";
+
+	rijndael_set_key(&key->ctx, key->key, 256);
+
+	cryptredis_hmac_init(&ictx, &octx, key->key, sizeof(key->key));
+	SHA256Update(&ictx, (const u_int8_t *)ctrlabel, sizeof(ctrlabel) - 1);
+	cryptredis_hmac_final(&ictx, &octx, subkey);
+	rijndael_set_key_enc_only(&key->ctr_ctx, subkey, 256);
+
+	cryptredis_hmac_init(&ictx, &octx, key->key, sizeof(key->key));
+	SHA256Update(&ictx, (const u_int8_t *)maclabel, sizeof(maclabel) - 1);
+	cryptredis_hmac_final(&ictx, &octx, subkey);
+	cryptredis_hmac_init(&key->mac_ictx, &key->mac_octx, subkey,
+	    sizeof(subkey));
+	explicit_bzero(subkey, sizeof(subkey));
+
+	cryptredis_hmac_init(&ictx, &octx, key->key, sizeof(key->key));
+	SHA256Update(&ictx, (const u_int8_t *)cclabel, sizeof(cclabel) - 1);
+	cryptredis_hmac_final(&ictx, &octx, key->cc_key);
+	key->chacha = chacha_probe();
+
+	cryptredis_hmac_init(&ictx, &octx, key->key, sizeof(key->key));
+	SHA256Update(&ictx, (const u_int8_t *)kidlabel, sizeof(kidlabel) - 1);
+	SHA256Update(&ictx, (const u_int8_t *)key->iv, sizeof(key->iv));
+	cryptredis_hmac_final(&ictx, &octx, subkey);
+	memcpy(key->kid, subkey, sizeof(key->kid));
+	explicit_bzero(subkey, sizeof(subkey));
+
+	memcpy(key->wiv, key->iv, sizeof(key->wiv));
+	key->wiv[2] = ~key->wiv[0]; key->wiv[3] = ~key->wiv[1];
+
+	switch ((key->engine = cryptredis_engine_probe())) {
+	case CRYPTREDIS_AES_HW:
+		aeshw_set_key(&key->hwctx, &key->ctx);
+		aeshw_set_key(&key->ctr_hwctx, &key->ctr_ctx);
+		aeshw_encrypt(&key->hwctx, (u_char *)key->wiv,
+		    (u_char *)key->wiv);
+		break;
+	case CRYPTREDIS_AES_CT:
+		aesct_set_key(&key->ctctx, &key->ctx);
+		aesct_set_key(&key->ctr_ctctx, &key->ctr_ctx);
+		aesct_encrypt(&key->ctctx, (u_char *)key->wiv,
+		    (u_char *)key->wiv);
+		break;
+	default:
+		rijndael_encrypt(&key->ctx, (u_char *)key->wiv,
+		    (u_char *)key->wiv);
+		break;
+	}
+
+	cryptredis_dump_ctxt(&key->ctx);
+}
+
 static void 
-cryptredis_dump_ctxt(rijndael_ctx *ctxtp)
+cryptredis_dump_ctxt(const rijndael_ctx *ctxtp)
 {
 #ifdef DEBUG_RIJNDAEL_CTXT
         fprintf(stderr, "=>");
@@ -152,13 +593,27 @@ cryptredis_dump_ctxt(rijndael_ctx *ctxtp)
 #endif
 }
 
-static void
-cryptredis_key_prepare(const struct cryptredis_key *key, int encrypt)
+static int
+cryptredis_engine_probe(void)
 {
-        if (encrypt)
-		rijndael_set_key_enc_only(&ctxt, key->key, 256);
-        else
-		rijndael_set_key(&ctxt, key->key, 256);
+	int	engine;
+
+	/*
+	 * Racing threads may both probe, they store the same answer.  Without
+	 * AES instructions use the bitsliced code, the T-table one leaks key
+	 * bits through the cache.  CRYPTREDIS_NOAESHW forces the bitsliced
+	 * code, CRYPTREDIS_AESTABLE the table one, e.g. for regressions.
+	 */
+	engine = __atomic_load_n(&cryptredis_engine, __ATOMIC_RELAXED);
+	if (engine == -1) {
+		if (getenv("CRYPTREDIS_AESTABLE") != NULL)
+			engine = CRYPTREDIS_AES_TABLE;
+		else if (getenv("CRYPTREDIS_NOAESHW") == NULL && aeshw_probe())
+			engine = CRYPTREDIS_AES_HW;
+		else
+			engine = CRYPTREDIS_AES_CT;
+		__atomic_store_n(&cryptredis_engine, engine, __ATOMIC_RELAXED);
+	}
 
-        cryptredis_dump_ctxt(&ctxt);
+	return (engine);
 }
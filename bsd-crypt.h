@@ -20,20 +20,86 @@
 
 #include <sys/types.h>
 
+#include <sha2.h>
+
 #include "tools.h"
+#include "bsd-rijndael.h"
+#include "aes-hw.h"
+#include "aes-ct.h"
+#include "chacha.h"
+#include "poly1305.h"
 
 CEXT_BEGIN
 
+#define CRYPTREDIS_KIDLEN	4
+
 struct cryptredis_key {
 	u_int8_t	key[32];
 	u_int8_t	salt[8];
 	u_int32_t	iv[4];
+
+	/* derived by cryptredis_key_setup() */
+	rijndael_ctx	ctx;
+	struct aeshw_ctx hwctx;
+	struct aesct_ctx ctctx;
+	u_int32_t	wiv[4];		/* whitened iv */
+	int		engine;		/* CRYPTREDIS_AES_* */
+
+	/* counter mode subkeys, see cryptredis_key_setup() */
+	rijndael_ctx	ctr_ctx;
+	struct aeshw_ctx ctr_hwctx;
+	struct aesct_ctx ctr_ctctx;
+	SHA2_CTX	mac_ictx;	/* hmac-sha256 state after ipad */
+	SHA2_CTX	mac_octx;	/* hmac-sha256 state after opad */
+
+	/* chacha20-poly1305 subkey, see cryptredis_key_setup() */
+	u_int8_t	cc_key[CHACHA_KEYLEN];
+	int		chacha;		/* CHACHA_* implementation */
+
+	u_int8_t	kid[CRYPTREDIS_KIDLEN];	/* key id, in value headers */
 };
 
+/* one value of a batch, ci_len is a multiple of 16, src may equal dst */
+struct cryptredis_iov {
+	const void	*ci_src;
+	void		*ci_dst;
+	size_t		 ci_len;
+};
+
+/* AES engines, all compute the same cipher */
+#define CRYPTREDIS_AES_TABLE	0	/* rijndael T-tables */
+#define CRYPTREDIS_AES_CT	1	/* bitsliced, constant time */
+#define CRYPTREDIS_AES_HW	2	/* CPU instructions */
+
+#define CRYPTREDIS_NONCELEN	12
+#define CRYPTREDIS_MACLEN	SHA256_DIGEST_LENGTH
+#define CRYPTREDIS_CC_NONCELEN	CHACHA_NONCELEN
+#define CRYPTREDIS_CC_TAGLEN	POLY1305_TAGLEN
+
+/*
+ * A key is only written by cryptredis_key_setup(), encrypt and decrypt
+ * treat it as read-only and keep their chaining state on the stack, so one
+ * key may be shared by any number of threads.
+ */
+void	cryptredis_key_setup(struct cryptredis_key *);
+
 void	cryptredis_encrypt(const struct cryptredis_key *, const char *,
 	    u_int32_t *, size_t);
 void	cryptredis_decrypt(const struct cryptredis_key *, const u_int32_t *,
 	    char *, size_t);
+void	cryptredis_encrypt_batch(const struct cryptredis_key *,
+	    const struct cryptredis_iov *, size_t);
+void	cryptredis_decrypt_batch(const struct cryptredis_key *,
+	    const struct cryptredis_iov *, size_t);
+void	cryptredis_ctr_crypt(const struct cryptredis_key *, const u_int8_t *,
+	    u_int32_t, const void *, void *, size_t);
+void	cryptredis_mac(const struct cryptredis_key *, const void *, size_t,
+	    u_int8_t *);
+void	cryptredis_chacha_seal(const struct cryptredis_key *, const u_int8_t *,
+	    const void *, size_t, const void *, void *, size_t, u_int8_t *);
+int	cryptredis_chacha_open(const struct cryptredis_key *, const u_int8_t *,
+	    const void *, size_t, const void *, void *, size_t,
+	    const u_int8_t *);
 
 CEXT_END
 
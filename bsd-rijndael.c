@@ -1253,13 +1253,13 @@ rijndael_set_key(rijndael_ctx *ctx, const u_char *key, int bits)
 }
 
 void
-rijndael_decrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
+rijndael_decrypt(const rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
 	rijndaelDecrypt(ctx->dk, ctx->Nr, src, dst);
 }
 
 void
-rijndael_encrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
+rijndael_encrypt(const rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
 	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
 }
@@ -47,8 +47,8 @@ typedef struct {
 
 int	 rijndael_set_key(rijndael_ctx *, const u_char *, int);
 int	 rijndael_set_key_enc_only(rijndael_ctx *, const u_char *, int);
-void	 rijndael_decrypt(rijndael_ctx *, const u_char *, u_char *);
-void	 rijndael_encrypt(rijndael_ctx *, const u_char *, u_char *);
+void	 rijndael_decrypt(const rijndael_ctx *, const u_char *, u_char *);
+void	 rijndael_encrypt(const rijndael_ctx *, const u_char *, u_char *);
 
 int	rijndaelKeySetupEnc(unsigned int [], const unsigned char [], int);
 int	rijndaelKeySetupDec(unsigned int [], const unsigned char [], int);
@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * ChaCha20 as in RFC 8439: 256-bit key, 96-bit nonce, 32-bit block
+ * counter.  The vector versions keep state word i of N consecutive blocks
+ * in one register, run the rounds on all of them at once and transpose
+ * back to N keystream blocks; whatever is left over goes through the
+ * scalar code.  All of them produce the same keystream.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "chacha.h"
+
+static void	chacha_init(u_int32_t *, const u_int8_t *, const u_int8_t *,
+		    u_int32_t);
+static void	chacha20_scalar(u_int32_t *, const u_char *, u_char *, size_t);
+
+#define U8TO32(p)							\
+	((u_int32_t)(p)[0] | (u_int32_t)(p)[1] << 8 |			\
+	(u_int32_t)(p)[2] << 16 | (u_int32_t)(p)[3] << 24)
+#define U32TO8(p, v) do {						\
+	(p)[0] = (u_int8_t)(v); (p)[1] = (u_int8_t)((v) >> 8);		\
+	(p)[2] = (u_int8_t)((v) >> 16); (p)[3] = (u_int8_t)((v) >> 24);	\
+} while (0)
+
+/* quarter round, spelled with the add, xor and rotate of an engine */
+#define CHACHA_QR(ADD, XOR, ROTL, a, b, c, d) do {			\
+	a = ADD(a, b); d = XOR(d, a); d = ROTL(d, 16);			\
+	c = ADD(c, d); b = XOR(b, c); b = ROTL(b, 12);			\
+	a = ADD(a, b); d = XOR(d, a); d = ROTL(d, 8);			\
+	c = ADD(c, d); b = XOR(b, c); b = ROTL(b, 7);			\
+} while (0)
+
+#define CHACHA_DOUBLEROUND(ADD, XOR, ROTL, x) do {			\
+	CHACHA_QR(ADD, XOR, ROTL, x[0], x[4], x[8], x[12]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[1], x[5], x[9], x[13]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[2], x[6], x[10], x[14]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[3], x[7], x[11], x[15]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[0], x[5], x[10], x[15]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[1], x[6], x[11], x[12]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[2], x[7], x[8], x[13]);		\
+	CHACHA_QR(ADD, XOR, ROTL, x[3], x[4], x[9], x[14]);		\
+} while (0)
+
+#define SC_ADD(a, b)	((a) + (b))
+#define SC_XOR(a, b)	((a) ^ (b))
+#define SC_ROTL(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+static void
+chacha_init(u_int32_t *st, const u_int8_t *key, const u_int8_t *nonce,
+    u_int32_t ctr)
+{
+	int	i;
+
+	/* "expand 32-byte k" */
+	st[0] = 0x61707865;
+	st[1] = 0x3320646e;
+	st[2] = 0x79622d32;
+	st[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		st[4 + i] = U8TO32(key + 4 * i);
+	st[12] = ctr;
+	st[13] = U8TO32(nonce);
+	st[14] = U8TO32(nonce + 4);
+	st[15] = U8TO32(nonce + 8);
+}
+
+static void
+chacha20_scalar(u_int32_t *st, const u_char *src, u_char *dst, size_t len)
+{
+	u_int32_t	x[16];
+	u_int8_t	ks[CHACHA_BLOCKLEN];
+	size_t		i, n;
+
+	for (; len > 0; len -= n, src += n, dst += n) {
+		memcpy(x, st, sizeof(x));
+		for (i = 0; i < 10; i++)
+			CHACHA_DOUBLEROUND(SC_ADD, SC_XOR, SC_ROTL, x);
+		for (i = 0; i < 16; i++)
+			U32TO8(ks + 4 * i, x[i] + st[i]);
+		st[12]++;
+
+		n = len < sizeof(ks) ? len : sizeof(ks);
+		for (i = 0; i < n; i++)
+			dst[i] = src[i] ^ ks[i];
+	}
+	explicit_bzero(x, sizeof(x));
+	explicit_bzero(ks, sizeof(ks));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CHACHA_SSE2_TARGET	__attribute__((target("sse2")))
+#define CHACHA_AVX2_TARGET	__attribute__((target("avx2")))
+
+static size_t	chacha20_sse2(u_int32_t *, const u_char *, u_char *, size_t);
+static size_t	chacha20_avx2(u_int32_t *, const u_char *, u_char *, size_t);
+
+int
+chacha_probe(void)
+{
+	unsigned int	eax, ebx, ecx, edx, xcr0;
+	int		sse2;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+		return (CHACHA_SCALAR);
+	sse2 = (edx & bit_SSE2) != 0;
+
+	/* AVX2 also needs the OS to save the ymm registers */
+	if ((ecx & bit_OSXSAVE) == 0)
+		return (sse2 ? CHACHA_SSE2 : CHACHA_SCALAR);
+	__asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+	if ((xcr0 & 0x6) == 0x6 &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 &&
+	    (ebx & bit_AVX2) != 0)
+		return (CHACHA_AVX2);
+
+	return (sse2 ? CHACHA_SSE2 : CHACHA_SCALAR);
+}
+
+/* SSE2 has no rotate nor byte shuffle, two shifts it is */
+#define SSE_ROTL(v, n)							\
+	_mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+
+/* 4x4 transpose of words a..d of four blocks, xor into dst block k */
+#define SSE_XOR4(a, b, c, d, off) do {					\
+	__m128i	t0, t1, t2, t3;						\
+									\
+	t0 = _mm_unpacklo_epi32((a), (b));				\
+	t1 = _mm_unpacklo_epi32((c), (d));				\
+	t2 = _mm_unpackhi_epi32((a), (b));				\
+	t3 = _mm_unpackhi_epi32((c), (d));				\
+	SSE_XOR1(_mm_unpacklo_epi64(t0, t1), 0 * 64 + (off));		\
+	SSE_XOR1(_mm_unpackhi_epi64(t0, t1), 1 * 64 + (off));		\
+	SSE_XOR1(_mm_unpacklo_epi64(t2, t3), 2 * 64 + (off));		\
+	SSE_XOR1(_mm_unpackhi_epi64(t2, t3), 3 * 64 + (off));		\
+} while (0)
+#define SSE_XOR1(v, off)						\
+	_mm_storeu_si128((__m128i *)(dst + (off)), _mm_xor_si128((v),	\
+	    _mm_loadu_si128((const __m128i *)(src + (off)))))
+
+static CHACHA_SSE2_TARGET size_t
+chacha20_sse2(u_int32_t *st, const u_char *src, u_char *dst, size_t len)
+{
+	__m128i	x[16], s[16];
+	size_t	done = 0;
+	int	i;
+
+	for (; len >= 4 * CHACHA_BLOCKLEN; len -= 4 * CHACHA_BLOCKLEN) {
+		for (i = 0; i < 16; i++)
+			s[i] = _mm_set1_epi32((int)st[i]);
+		s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			CHACHA_DOUBLEROUND(_mm_add_epi32, _mm_xor_si128,
+			    SSE_ROTL, x);
+		for (i = 0; i < 16; i++)
+			x[i] = _mm_add_epi32(x[i], s[i]);
+
+		SSE_XOR4(x[0], x[1], x[2], x[3], 0);
+		SSE_XOR4(x[4], x[5], x[6], x[7], 16);
+		SSE_XOR4(x[8], x[9], x[10], x[11], 32);
+		SSE_XOR4(x[12], x[13], x[14], x[15], 48);
+
+		st[12] += 4;
+		src += 4 * CHACHA_BLOCKLEN;
+		dst += 4 * CHACHA_BLOCKLEN;
+		done += 4 * CHACHA_BLOCKLEN;
+	}
+
+	return (done);
+}
+
+/* rotations by whole bytes are a single shuffle */
+#define AVX_ROTL(v, n)							\
+	((n) == 16 ? _mm256_shuffle_epi8((v), rot16) :			\
+	(n) == 8 ? _mm256_shuffle_epi8((v), rot8) :			\
+	_mm256_or_si256(_mm256_slli_epi32((v), (n)),			\
+	    _mm256_srli_epi32((v), 32 - (n))))
+
+/*
+ * The in-lane 4x4 transpose leaves blocks 0-3 in the low 128 bits and
+ * blocks 4-7 in the high ones; words a..d of block k are then merged
+ * with the next group of words by a lane permute.
+ */
+#define AVX_TRANSPOSE4(a, b, c, d) do {					\
+	__m256i	t0, t1, t2, t3;						\
+									\
+	t0 = _mm256_unpacklo_epi32((a), (b));				\
+	t1 = _mm256_unpacklo_epi32((c), (d));				\
+	t2 = _mm256_unpackhi_epi32((a), (b));				\
+	t3 = _mm256_unpackhi_epi32((c), (d));				\
+	(a) = _mm256_unpacklo_epi64(t0, t1);				\
+	(b) = _mm256_unpackhi_epi64(t0, t1);				\
+	(c) = _mm256_unpacklo_epi64(t2, t3);				\
+	(d) = _mm256_unpackhi_epi64(t2, t3);				\
+} while (0)
+#define AVX_XOR1(v, off)						\
+	_mm256_storeu_si256((__m256i *)(dst + (off)),			\
+	    _mm256_xor_si256((v),					\
+	    _mm256_loadu_si256((const __m256i *)(src + (off)))))
+
+static CHACHA_AVX2_TARGET size_t
+chacha20_avx2(u_int32_t *st, const u_char *src, u_char *dst, size_t len)
+{
+	__m256i	x[16], s[16];
+	__m256i	rot16, rot8;
+	size_t	done = 0;
+	int	i;
+
+	rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+	    5, 4, 7, 6, 1, 0, 3, 2, 13, 12, 15, 14, 9, 8, 11, 10,
+	    5, 4, 7, 6, 1, 0, 3, 2);
+	rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11,
+	    6, 5, 4, 7, 2, 1, 0, 3, 14, 13, 12, 15, 10, 9, 8, 11,
+	    6, 5, 4, 7, 2, 1, 0, 3);
+
+	for (; len >= 8 * CHACHA_BLOCKLEN; len -= 8 * CHACHA_BLOCKLEN) {
+		for (i = 0; i < 16; i++)
+			s[i] = _mm256_set1_epi32((int)st[i]);
+		s[12] = _mm256_add_epi32(s[12],
+		    _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			CHACHA_DOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256,
+			    AVX_ROTL, x);
+		for (i = 0; i < 16; i++)
+			x[i] = _mm256_add_epi32(x[i], s[i]);
+
+		AVX_TRANSPOSE4(x[0], x[1], x[2], x[3]);
+		AVX_TRANSPOSE4(x[4], x[5], x[6], x[7]);
+		AVX_TRANSPOSE4(x[8], x[9], x[10], x[11]);
+		AVX_TRANSPOSE4(x[12], x[13], x[14], x[15]);
+
+		for (i = 0; i < 4; i++) {
+			AVX_XOR1(_mm256_permute2x128_si256(x[i], x[4 + i],
+			    0x20), i * 64);
+			AVX_XOR1(_mm256_permute2x128_si256(x[8 + i], x[12 + i],
+			    0x20), i * 64 + 32);
+			AVX_XOR1(_mm256_permute2x128_si256(x[i], x[4 + i],
+			    0x31), (4 + i) * 64);
+			AVX_XOR1(_mm256_permute2x128_si256(x[8 + i], x[12 + i],
+			    0x31), (4 + i) * 64 + 32);
+		}
+
+		st[12] += 8;
+		src += 8 * CHACHA_BLOCKLEN;
+		dst += 8 * CHACHA_BLOCKLEN;
+		done += 8 * CHACHA_BLOCKLEN;
+	}
+
+	return (done);
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+static size_t	chacha20_neon(u_int32_t *, const u_char *, u_char *, size_t);
+
+int
+chacha_probe(void)
+{
+	/* Advanced SIMD is mandatory on aarch64 */
+	return (CHACHA_NEON);
+}
+
+#define NEON_ROTL(v, n)							\
+	((n) == 16 ? vreinterpretq_u32_u16(vrev32q_u16(			\
+	    vreinterpretq_u16_u32(v))) :				\
+	vsriq_n_u32(vshlq_n_u32((v), (n)), (v), 32 - (n)))
+
+/* 4x4 transpose of words a..d of four blocks, xor into dst block k */
+#define NEON_XOR4(a, b, c, d, off) do {					\
+	uint32x4x2_t	ab, cd;						\
+									\
+	ab = vtrnq_u32((a), (b));					\
+	cd = vtrnq_u32((c), (d));					\
+	NEON_XOR1(vcombine_u32(vget_low_u32(ab.val[0]),			\
+	    vget_low_u32(cd.val[0])), 0 * 64 + (off));			\
+	NEON_XOR1(vcombine_u32(vget_low_u32(ab.val[1]),			\
+	    vget_low_u32(cd.val[1])), 1 * 64 + (off));			\
+	NEON_XOR1(vcombine_u32(vget_high_u32(ab.val[0]),		\
+	    vget_high_u32(cd.val[0])), 2 * 64 + (off));			\
+	NEON_XOR1(vcombine_u32(vget_high_u32(ab.val[1]),		\
+	    vget_high_u32(cd.val[1])), 3 * 64 + (off));			\
+} while (0)
+#define NEON_XOR1(v, off)						\
+	vst1q_u8(dst + (off), veorq_u8(vreinterpretq_u8_u32(v),		\
+	    vld1q_u8(src + (off))))
+
+static size_t
+chacha20_neon(u_int32_t *st, const u_char *src, u_char *dst, size_t len)
+{
+	static const u_int32_t	ctrinc[4] = { 0, 1, 2, 3 };
+	uint32x4_t		x[16], s[16];
+	size_t			done = 0;
+	int			i;
+
+	for (; len >= 4 * CHACHA_BLOCKLEN; len -= 4 * CHACHA_BLOCKLEN) {
+		for (i = 0; i < 16; i++)
+			s[i] = vdupq_n_u32(st[i]);
+		s[12] = vaddq_u32(s[12], vld1q_u32(ctrinc));
+		memcpy(x, s, sizeof(x));
+
+		for (i = 0; i < 10; i++)
+			CHACHA_DOUBLEROUND(vaddq_u32, veorq_u32, NEON_ROTL, x);
+		for (i = 0; i < 16; i++)
+			x[i] = vaddq_u32(x[i], s[i]);
+
+		NEON_XOR4(x[0], x[1], x[2], x[3], 0);
+		NEON_XOR4(x[4], x[5], x[6], x[7], 16);
+		NEON_XOR4(x[8], x[9], x[10], x[11], 32);
+		NEON_XOR4(x[12], x[13], x[14], x[15], 48);
+
+		st[12] += 4;
+		src += 4 * CHACHA_BLOCKLEN;
+		dst += 4 * CHACHA_BLOCKLEN;
+		done += 4 * CHACHA_BLOCKLEN;
+	}
+
+	return (done);
+}
+
+#else /* no vector code compiled in */
+
+int
+chacha_probe(void)
+{
+	return (CHACHA_SCALAR);
+}
+
+#endif
+
+/*
+ * XOR len bytes of keystream, starting at block ctr, into dst.  An
+ * implementation this build lacks falls back to the next best one.
+ */
+void
+chacha20_xor(int impl, const u_int8_t *key, const u_int8_t *nonce,
+    u_int32_t ctr, const u_char *src, u_char *dst, size_t len)
+{
+	u_int32_t	st[16];
+	size_t		n = 0;
+
+	chacha_init(st, key, nonce, ctr);
+
+	switch (impl) {
+#if defined(__x86_64__) || defined(__i386__)
+	case CHACHA_AVX2:
+		n = chacha20_avx2(st, src, dst, len);
+		src += n, dst += n, len -= n;
+		/* FALLTHROUGH */
+	case CHACHA_SSE2:
+		n = chacha20_sse2(st, src, dst, len);
+		src += n, dst += n, len -= n;
+		break;
+#elif defined(__aarch64__)
+	case CHACHA_NEON:
+		n = chacha20_neon(st, src, dst, len);
+		src += n, dst += n, len -= n;
+		break;
+#endif
+	default:
+		break;
+	}
+
+	chacha20_scalar(st, src, dst, len);
+	explicit_bzero(st, sizeof(st));
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+
+CEXT_BEGIN
+
+#define CHACHA_KEYLEN		32
+#define CHACHA_NONCELEN		12	/* RFC 8439, 32-bit block counter */
+#define CHACHA_BLOCKLEN		64
+
+/* implementations, chacha_probe() returns the best one for this CPU */
+#define CHACHA_SCALAR		0
+#define CHACHA_SSE2		1	/* 4 blocks per pass */
+#define CHACHA_AVX2		2	/* 8 blocks per pass */
+#define CHACHA_NEON		3	/* 4 blocks per pass */
+
+int	chacha_probe(void);
+void	chacha20_xor(int, const u_int8_t *, const u_int8_t *, u_int32_t,
+	    const u_char *, u_char *, size_t);
+
+CEXT_END
+
+#endif /* !CHACHA_H */
@@ -14,16 +14,21 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
-#include <util.h>
 
 #include "cryptredis.h"
 #include "encode.h"
 #include "bsd-crypt.h"
+#include "format.h"
+#include "keyring.h"
+#include "lz4.h"
 #include "hiredis/hiredis.h"
+#include "hiredis/async.h"
+#include "hiredis/sds.h"
 
 struct cryptredis_context {
 	struct redisContext		*cc_hiredis_context;
@@ -33,12 +38,111 @@ struct cryptredis_context {
 	struct redisReply		*cc_hiredis_reply;
 	int				 cc_errnum;
 	char				 cc_errmsg[LINE_MAX];
+	struct cryptredis_pipe		*cc_pipe;	/* commands appended */
+	size_t				 cc_pipe_len;
+	size_t				 cc_pipe_size;
+	size_t				 cc_pipe_next;	/* reply handed out next */
+	int				 cc_pipe_open;	/* begun, not executed */
+	void				*cc_scratch;	/* for mset, kept */
+	size_t				 cc_scratch_size;
 };
 
+/* a command of the pipeline, then its reply */
+struct cryptredis_pipe {
+	struct redisReply		*cp_reply;
+	int				 cp_get;	/* the reply is a value */
+};
+
+/* room cryptredis_store() needs past the stored value, to align it */
+#define CRYPTREDIS_STORE_SLACK	sizeof(u_int32_t)
+
+/* replies cryptredis_open_replies() opens in one batch */
+#define CRYPTREDIS_OPEN_BATCH	64
+
+/* a reply handle, its nodes those of the reply and the spare ones */
+struct cryptredis_reply {
+	struct redisReply		*rp_reply;	/* or NULL */
+	struct cryptredis_node		*rp_used;
+	struct cryptredis_node		*rp_free;
+};
+
+/* an object of a handle's reply, kept with its buffers once released */
+struct cryptredis_node {
+	struct redisReply		 rn_reply;
+	char				*rn_buf;	/* rn_reply.str */
+	size_t				 rn_size;
+	struct redisReply		**rn_elem;	/* rn_reply.element */
+	size_t				 rn_nelem;
+	struct cryptredis_node		*rn_next;
+};
+
+/* a queued asynchronous command */
+struct cryptredis_async_cmd {
+	cryptredis_async_fn		*cm_fn;
+	void				*cm_arg;
+	int				 cm_get;	/* the reply is a value */
+};
+
+/* redis strings are at most 512MB, so are compressed values */
+#define CRYPTREDIS_LZ4_MAXLEN	(512U * 1024 * 1024)
+
 static int	cryptredis_reset_key(struct cryptredis *);
-static void	cryptredis_load_hexbin(void *pk, const char *, size_t);
+static void	cryptredis_put_keys(struct cryptredis *);
+static void	cryptredis_sync_keys(struct cryptredis *);
+static ssize_t	cryptredis_compress(const struct cryptredis *, const void *,
+		    size_t, u_int8_t **);
+static int	cryptredis_compressible(const struct cryptredis *, size_t);
+static ssize_t	cryptredis_compress_to(const void *, size_t, u_int8_t *);
+static ssize_t	cryptredis_decompress(char **, size_t);
+static size_t	cryptredis_stored_len(const struct cryptredis *, int, size_t);
+static int	cryptredis_store(const struct cryptredis *, int, const void *,
+		    size_t, char *, size_t);
+static size_t	cryptredis_store_room(const struct cryptredis *, size_t);
+static ssize_t	cryptredis_store_value(const struct cryptredis *, const void *,
+		    size_t, char *, char **);
+static int	cryptredis_append_set(struct cryptredis *, int, const char *,
+		    size_t, const void *, size_t);
+static int	cryptredis_append_value(struct cryptredis *, const char *,
+		    size_t, const void *, size_t);
+static int	cryptredis_pipeline_add(struct cryptredis *, int);
+static void	cryptredis_pipeline_clear(struct cryptredis *);
+static void	cryptredis_reply_error(struct redisReply *, const char *);
+static int	cryptredis_async_command(struct cryptredis_async *, int,
+		    const char **, const size_t *, int, cryptredis_async_fn *,
+		    void *);
+static void	cryptredis_async_reply(redisAsyncContext *, void *, void *);
+static void	cryptredis_async_disconnected(const redisAsyncContext *, int);
+static int	cryptredis_command_rp(struct cryptredis *, int, const char **,
+		    const size_t *, struct cryptredis_reply *);
+static int	cryptredis_read_rp(struct cryptredis *,
+		    struct cryptredis_reply *);
+static struct cryptredis_node
+		*cryptredis_node_get(const redisReadTask *, int);
+static void	*cryptredis_node_string(const redisReadTask *, char *, size_t);
+static void	*cryptredis_node_array(const redisReadTask *, int);
+static void	*cryptredis_node_integer(const redisReadTask *, long long);
+static void	*cryptredis_node_nil(const redisReadTask *);
+static void	cryptredis_node_keep(void *);
+static ssize_t	cryptredis_value_decode(const struct cryptredis *, char *,
+		    size_t);
+static ssize_t	cryptredis_value_finish(char **, ssize_t, int, int);
+static void	cryptredis_open_replies(const struct cryptredis *,
+		    struct redisReply **, size_t);
+static int	cryptredis_mset(struct cryptredis *, const char *,
+		    const char *const *, const size_t *, const void *const *,
+		    const size_t *, size_t);
+static void	*cryptredis_scratch(struct cryptredis *, size_t);
 static int	cryptredis_set_error(struct cryptredis *, const char *);
 
+/* how the hiredis reader builds replies into a handle */
+static redisReplyObjectFunctions cryptredis_node_fn = {
+	cryptredis_node_string,
+	cryptredis_node_array,
+	cryptredis_node_integer,
+	cryptredis_node_nil,
+	cryptredis_node_keep
+};
+
 #if 0
 #define DPRINTF fprintf
 #else
@@ -79,6 +183,7 @@ cryptredis_open(const char *host, int port)
 		goto err;
 	}
 
+	c->cr_lz4_min = CRYPTREDIS_LZ4_MIN;
 	c->cr_connected = 1;
 	return (c);
 
@@ -93,6 +198,10 @@ cryptredis_open(const char *host, int port)
 int
 cryptredis_close(struct cryptredis *cr)
 {
+	cryptredis_pipeline_clear(cr);
+	free(cr->cr_context->cc_pipe);
+	free(cr->cr_context->cc_scratch);
+	cryptredis_put_keys(cr);
 	redisFree(cr->cr_context->hiredis_ctx);
 	free(cr->cr_context);
 	free(cr);
@@ -101,215 +210,527 @@ cryptredis_close(struct cryptredis *cr)
 	return (0);
 }
 
+/* 0 once the connection failed, a hiredis context doesn't recover */
 int
-cryptredis_config_encrypt(struct cryptredis *crp, int enable)
+cryptredis_connected(const struct cryptredis *crp)
 {
-	crp->cr_crypt_enabled = 0;
+	return (crp->cr_connected &&
+	    crp->cr_context->hiredis_errnum == REDIS_OK);
+}
 
-	if (crp->cr_key != NULL) {
-		free(crp->cr_key);
-		crp->cr_key = NULL;
+/*
+ * Why format can't be given to cryptredis_config_encrypt(), NULL if it
+ * can: an unknown format, or CRYPTREDIS_FMT_LZ4 on one with no header to
+ * flag compressed values.
+ */
+const char *
+cryptredis_format_error(int format)
+{
+	switch (format & ~CRYPTREDIS_FMT_LZ4) {
+	case CRYPTREDIS_FMT_NONE:
+	case CRYPTREDIS_FMT_LEGACY:
+		if (format & CRYPTREDIS_FMT_LZ4)
+			return ("the legacy format can't be compressed");
+		return (NULL);
+	case CRYPTREDIS_FMT_CTR:
+	case CRYPTREDIS_FMT_CBC:
+	case CRYPTREDIS_FMT_CHACHA:
+		return (NULL);
+	default:
+		return ("unknown format");
 	}
+}
 
-	if (!enable)
-		return (0);
+/*
+ * Enable encryption writing values in the given CRYPTREDIS_FMT_* format,
+ * CRYPTREDIS_FMT_NONE disables it; 1 is the legacy format.  Or in
+ * CRYPTREDIS_FMT_LZ4 to compress values of cr_lz4_min bytes or more
+ * before sealing them.  On error the handle is left as it was, keys and
+ * all.
+ */
+int
+cryptredis_config_encrypt(struct cryptredis *crp, int format)
+{
+	const char	*errstr;
+
+	if ((errstr = cryptredis_format_error(format)) != NULL) {
+		(void)fprintf(stderr, "%s: format %d: %s\n", __func__, format,
+		    errstr);
+		return (-1);
+	}
 
-	if (cryptredis_reset_key(crp) == -1) {
+	if (format != CRYPTREDIS_FMT_NONE &&
+	    cryptredis_reset_key(crp) == -1) {
 		(void)fprintf(stderr, "%s: cryptredis_reset_key\n", __func__);
 		return (-1);
 	}
+
+	crp->cr_flags &= ~CRYPTREDIS_F_LZ4;
+	if (format == CRYPTREDIS_FMT_NONE) {
+		crp->cr_crypt_enabled = 0;
+		crp->cr_format = CRYPTREDIS_FMT_NONE;
+		cryptredis_put_keys(crp);
+		return (0);
+	}
 	crp->cr_crypt_enabled = 1;
+	crp->cr_format = format & CRYPTREDIS_FMT_MASK;
+	if (format & CRYPTREDIS_FMT_LZ4)
+		crp->cr_flags |= CRYPTREDIS_F_LZ4;
 
 	return (0);
 }
 
+/*
+ * Store encrypted values as raw ciphertext instead of base64 text, a third
+ * smaller in redis and on the wire.  Reads handle both either way, but for
+ * legacy format values, see cryptredis_value_decode().
+ */
+int
+cryptredis_config_raw(struct cryptredis *crp, int raw)
+{
+	if (raw)
+		crp->cr_flags |= CRYPTREDIS_F_RAW;
+	else
+		crp->cr_flags &= ~CRYPTREDIS_F_RAW;
+
+	return (0);
+}
+
+/*
+ * Values shorter than min are never compressed, CRYPTREDIS_LZ4_MIN by
+ * default; short values seldom shrink and the length word eats the gain.
+ */
+int
+cryptredis_config_compress(struct cryptredis *crp, size_t min)
+{
+	crp->cr_lz4_min = min;
+
+	return (0);
+}
+
+/*
+ * Reload the key files when they change, CRYPTREDIS_KEYFILE is watched
+ * from the next cryptredis_config_encrypt() on.  Rotating keys is then
+ * rewriting the files, no handle needs opening again.
+ */
+int
+cryptredis_config_keywatch(struct cryptredis *crp, int watch)
+{
+	if (watch)
+		crp->cr_flags |= CRYPTREDIS_F_KEYWATCH;
+	else
+		crp->cr_flags &= ~CRYPTREDIS_F_KEYWATCH;
+
+	return (0);
+}
+
+/*
+ * CRYPTREDIS_KEYFILE holds one key file or a colon separated list of them,
+ * the first one seals new values and all of them open values carrying
+ * their key id.  Rotating keys is adding the new file to the end of every
+ * reader's list, then moving it first; old values still open while they
+ * are rewritten.
+ */
 static int
 cryptredis_reset_key(struct cryptredis *crp)
 {
-	char		*filenamep;
-	FILE		*f;
-	int	 	 i;
-	char	 	 line[LINE_MAX], *kp, *vp;
-	char		 tmpkey[LINE_MAX];
-	struct cryptredis_key
-			*ckp;
-	int		 ret = -1;
+	const struct cryptredis_keyset	*ks = NULL;
+	struct cryptredis_keywatch	*kw = NULL;
+	unsigned int			 gen = 0;
+	char				*filenamep;
 
 	if ((filenamep = getenv("CRYPTREDIS_KEYFILE")) == NULL) {
 		(void)fprintf(stderr, "%s: getenv\n", __func__);
 		return (-1);
 	}
 
-	if ((f = fopen(filenamep, "r")) == NULL) {
-		(void)fprintf(stderr, "%s: fopen %s\n", __func__, filenamep);
+	if (crp->cr_flags & CRYPTREDIS_F_KEYWATCH) {
+		if ((kw = cryptredis_keywatch_get(filenamep)) == NULL) {
+			(void)fprintf(stderr, "%s: cryptredis_keywatch_get\n",
+			    __func__);
+			return (-1);
+		}
+		cryptredis_keywatch_sync(kw, &ks, &gen);
+	} else if ((ks = cryptredis_keyset_get(filenamep)) == NULL) {
+		(void)fprintf(stderr, "%s: cryptredis_keyset_get\n", __func__);
 		return (-1);
 	}
 
-	if ((crp->cr_key = calloc(1, sizeof(*(crp->cr_key)))) == NULL) {
-		(void)fprintf(stderr, "%s: calloc\n", __func__);
-		goto err;
-	}
-	ckp = crp->cr_key;
+	/* the keys in use are only dropped once the new ones are in hand */
+	cryptredis_put_keys(crp);
+	crp->cr_keyset = ks;
+	crp->cr_keywatch = kw;
+	crp->cr_keygen = gen;
+
+	return (0);
+}
 
-	/* no more than 3 lines */
-	for (i = 0; i < 3; i++) {
-		memset(line, 0, sizeof(line));
-		if (fgets(line, LINE_MAX, f) == NULL)
-			break;
-		if (strlen(line) == 0)
-			break;
-		kp = line;
-		vp = strchr(kp, '=');
+static void
+cryptredis_put_keys(struct cryptredis *crp)
+{
+	cryptredis_keyset_put(crp->cr_keyset);
+	crp->cr_keyset = NULL;
+	crp->cr_keywatch = NULL;
+}
 
-		if (vp == NULL)
-			continue;
+/* a watched key file changed: trade the keys for the new ones */
+static void
+cryptredis_sync_keys(struct cryptredis *crp)
+{
+	if (crp->cr_keywatch != NULL &&
+	    cryptredis_keywatch_gen(crp->cr_keywatch) != crp->cr_keygen)
+		cryptredis_keywatch_sync(crp->cr_keywatch, &crp->cr_keyset,
+		    &crp->cr_keygen);
+}
 
-		if (*vp == '=') {
-			*vp++ = '\0';
-			vp += strspn(vp, " \t\r\n");
-		} else {
-			*vp++ = '\0';
-		}
+int
+cryptredis_set_r(struct cryptredis *crp, const char *key, const char *value)
+{
+	return (cryptredis_set_rn(crp, key, strlen(key), value, strlen(value)));
+}
 
-		if (vp == NULL)
-			continue;
+/*
+ * Binary safe SET, key and value may hold any bytes.  Encrypted values go
+ * out as raw ciphertext with CRYPTREDIS_F_RAW, base64 text otherwise.
+ */
+int
+cryptredis_set_rn(struct cryptredis *crp, const char *key, size_t klen,
+    const void *value, size_t vlen)
+{
+	void	*reply;
 
-		kp[strcspn(kp, "\r\n\t ")] = '\0';
-		vp[strcspn(vp, "\r\n\t ")] = '\0';
-
-		DPRINTF(stderr, "%s: key %s value %s\n", __func__, kp, vp);
-		if (!strncmp(kp, "salt", 5)) {
-			cryptredis_load_hexbin(ckp->salt, vp,
-			    sizeof(ckp->salt));
-		} else if (!strncmp(kp, "key", 3)) {
-			memcpy(tmpkey, vp, sizeof(tmpkey));
-		} else if (!strncmp(kp, "iv", 2)) {
-			cryptredis_load_hexbin(ckp->iv, vp,
-			    sizeof(ckp->iv));
-		}
+	if (crp->cr_crypt_enabled)
+		cryptredis_sync_keys(crp);
+	if (cryptredis_append_value(crp, key, klen, value, vlen) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_append_value\n",
+		    __func__);
+		return (-1);
+	}
+	if (redisGetReply(crp->cr_context->cc_hiredis_context, &reply) !=
+	    REDIS_OK) {
+		(void)fprintf(stderr, "%s: redisGetReply\n", __func__);
+		return (-1);
+	}
+	crp->cr_context->cc_hiredis_reply = reply;
 
-		kp = NULL;
-		vp = NULL;
+	return (0);
+}
+
+/* append a SET of value, compressed and sealed when crypt is enabled */
+static int
+cryptredis_append_value(struct cryptredis *crp, const char *key,
+    size_t klen, const void *value, size_t vlen)
+{
+	redisContext	*c = crp->cr_context->cc_hiredis_context;
+	u_int8_t	*zbuf = NULL;
+	const char	*argv[3];
+	size_t		 argvlen[3];
+	ssize_t		 n;
+	int		 fmt, ret = -1;
+
+	if (!crp->cr_crypt_enabled) {
+		argv[0] = "SET";
+		argvlen[0] = 3;
+		argv[1] = key;
+		argvlen[1] = klen;
+		argv[2] = value;
+		argvlen[2] = vlen;
+		return (redisAppendCommandArgv(c, 3, argv, argvlen) ==
+		    REDIS_OK ? 0 : -1);
+	}
+
+	fmt = crp->cr_format;
+	if ((n = cryptredis_compress(crp, value, vlen, &zbuf)) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_compress\n", __func__);
+		return (-1);
+	}
+	if (n > 0) {
+		value = zbuf;
+		vlen = n;
+		fmt |= CRYPTREDIS_FMT_LZ4;
 	}
 
-	if (bcrypt_pbkdf(tmpkey, strlen(tmpkey), ckp->salt, sizeof(ckp->salt),
-	    ckp->key, sizeof(ckp->key), 16) == -1) {
-		(void)fprintf(stderr, "%s: pkcs5_pbkdf2\n", __func__);
+	if (cryptredis_append_set(crp, fmt, key, klen, value, vlen) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_append_set\n", __func__);
 		goto err;
 	}
 	ret = 0;
 
  err:
-	fclose(f);
+	free(zbuf);
 
 	return (ret);
 }
 
-static void
-cryptredis_load_hexbin(void *pk, const char *value, size_t pksize)
+/*
+ * With CRYPTREDIS_F_LZ4, compress values of cr_lz4_min bytes or more into
+ * le32(length) | lz4 block.  Returns the length of that, 0 when it would
+ * not be shorter than the value and the value is sealed as is.
+ */
+static ssize_t
+cryptredis_compress(const struct cryptredis *crp, const void *value,
+    size_t vlen, u_int8_t **bufp)
 {
-	char	 	 tmpv[3];
-	const char	*vp = value;
-	u_int8_t	*pkp = (u_int8_t *)pk;
-	unsigned int	 i;
-	int		 vlen;
+	u_int8_t	*buf;
+	ssize_t		 n;
 
-	vlen = strlen(value);
+	*bufp = NULL;
+	if (!cryptredis_compressible(crp, vlen))
+		return (0);
 
-	for (i = 0; i < pksize; i++) {
-		memset(tmpv, 0, sizeof(tmpv));
-		memcpy(tmpv, vp, 2);
-		pkp[i] = (u_int8_t)strtol(tmpv, (char **)NULL, 16);
+	if ((buf = malloc(vlen)) == NULL) {
+		(void)fprintf(stderr, "%s: malloc\n", __func__);
+		return (-1);
+	}
+	if ((n = cryptredis_compress_to(value, vlen, buf)) == 0) {
+		free(buf);
+		return (0);
+	}
+	*bufp = buf;
 
-		DPRINTF(stderr, "%s: i %d tmpv %s pkp[i] %02x\n", __func__, i,
-		    tmpv, pkp[i]);
+	return (n);
+}
 
-		if ((vlen -= 2) <= 0)
-			break;
+static int
+cryptredis_compressible(const struct cryptredis *crp, size_t vlen)
+{
+	return ((crp->cr_flags & CRYPTREDIS_F_LZ4) &&
+	    vlen >= crp->cr_lz4_min && vlen >= 5 &&
+	    vlen <= CRYPTREDIS_LZ4_MAXLEN);
+}
 
-		vp += 2;
-	}
+/* compress into vlen bytes at buf, 0 when that doesn't make it shorter */
+static ssize_t
+cryptredis_compress_to(const void *value, size_t vlen, u_int8_t *buf)
+{
+	ssize_t	n;
+
+	if ((n = lz4_compress(value, vlen, buf + 4, vlen - 5)) == -1)
+		return (0);
+	buf[0] = (u_int8_t)vlen;
+	buf[1] = (u_int8_t)(vlen >> 8);
+	buf[2] = (u_int8_t)(vlen >> 16);
+	buf[3] = (u_int8_t)(vlen >> 24);
+
+	return (n + 4);
 }
 
-int
-cryptredis_set_r(struct cryptredis *crp, const char *key, const char *value)
+/* length of what is stored for vlen bytes sealed as fmt */
+static size_t
+cryptredis_stored_len(const struct cryptredis *crp, int fmt, size_t vlen)
 {
-	char		*bufs;
-	u_int32_t	*buf;
-	const char	*data = value;
-	size_t		 buflen, bufslen;
-	struct cryptredis_context *cp = crp->cr_context;
-	int		 ret = -1;
+	size_t	slen = cryptredis_seal_size(fmt, vlen);
 
-	buflen = strlen(value);
-	if (crp->cr_crypt_enabled) {
-		buflen = cryptredis_align64(buflen);
-		bufslen = cryptredis_encsiz(buflen);
+	return (crp->cr_flags & CRYPTREDIS_F_RAW ? slen : (slen + 2) / 3 * 4);
+}
 
-		if ((buf = (u_int32_t *)calloc(1, buflen)) == NULL) {
-			(void)fprintf(stderr, "%s: calloc", __func__);
-			return (-1);
+/* room cryptredis_store_value() needs for a value of vlen bytes */
+static size_t
+cryptredis_store_room(const struct cryptredis *crp, size_t vlen)
+{
+	return ((cryptredis_compressible(crp, vlen) ? vlen : 0) +
+	    cryptredis_stored_len(crp, crp->cr_format, vlen) +
+	    CRYPTREDIS_STORE_SLACK);
+}
+
+/*
+ * Compress and store value in the cryptredis_store_room() bytes at p,
+ * without allocating; the stored value is left in *vp, its length
+ * returned.
+ */
+static ssize_t
+cryptredis_store_value(const struct cryptredis *crp, const void *value,
+    size_t vlen, char *p, char **vp)
+{
+	u_int8_t	*z;
+	size_t		 elen;
+	ssize_t		 zlen;
+	int		 fmt = crp->cr_format;
+
+	if (cryptredis_compressible(crp, vlen)) {
+		z = (u_int8_t *)p;
+		p += vlen;
+		if ((zlen = cryptredis_compress_to(value, vlen, z)) > 0) {
+			value = z;
+			vlen = zlen;
+			fmt |= CRYPTREDIS_FMT_LZ4;
 		}
+	}
+	elen = cryptredis_stored_len(crp, fmt, vlen);
+	if (cryptredis_store(crp, fmt, value, vlen, p, elen) == -1)
+		return (-1);
+	*vp = p;
+
+	return (elen);
+}
+
+/*
+ * Seal value into what is stored for it, the elen bytes from
+ * cryptredis_stored_len() at v, which has CRYPTREDIS_STORE_SLACK more
+ * bytes of room.  In base64 mode the value is sealed at the tail of its
+ * slot and encoded forward in place, the encoder never catches up with
+ * its input.  The legacy and CBC ciphers work on words, their slot is
+ * aligned.
+ */
+static int
+cryptredis_store(const struct cryptredis *crp, int fmt, const void *value,
+    size_t vlen, char *v, size_t elen)
+{
+	char		*q;
+	size_t		 slen, align;
+	int		 raw = crp->cr_flags & CRYPTREDIS_F_RAW;
+
+	align = (fmt & CRYPTREDIS_FMT_MASK) == CRYPTREDIS_FMT_LEGACY ||
+	    (fmt & CRYPTREDIS_FMT_MASK) == CRYPTREDIS_FMT_CBC ?
+	    sizeof(u_int32_t) : 1;
+	slen = cryptredis_seal_size(fmt, vlen);
+
+	q = raw ? v : v + elen - slen;
+	q += (align - (uintptr_t)q % align) % align;
+	if (cryptredis_seal(crp->cr_keyset->ks_keys[0], fmt, value, vlen, q,
+	    slen) != (ssize_t)slen)
+		return (-1);
 
-		if ((bufs = (char *)calloc(1, bufslen)) == NULL) {
-			(void)fprintf(stderr, "%s: calloc", __func__);
+	if (!raw) {
+		if (cryptredis_encode(v, elen + CRYPTREDIS_STORE_SLACK, q,
+		    slen) != (ssize_t)elen)
 			return (-1);
-		}
+	} else if (q != v)
+		memmove(v, q, slen);
+
+	return (0);
+}
+
+/*
+ * Append an encrypted SET to the hiredis output buffer, sealing the value
+ * straight into it instead of going through a seal buffer, an encode
+ * buffer and the formatted command.
+ */
+static int
+cryptredis_append_set(struct cryptredis *crp, int fmt, const char *key,
+    size_t klen, const void *value, size_t vlen)
+{
+	redisContext	*c = crp->cr_context->cc_hiredis_context;
+	char		*p;
+	size_t		 elen, room, n;
+
+	elen = cryptredis_stored_len(crp, fmt, vlen);
+	if (klen > INT_MAX / 4 || elen > INT_MAX / 4)	/* sds lengths are ints */
+		return (-1);
+
+	/* "*3\r\n$3\r\nSET\r\n$<klen>\r\n<key>\r\n$<elen>\r\n<value>\r\n" */
+	room = 64 + klen + elen + CRYPTREDIS_STORE_SLACK;
+	if ((p = sdsMakeRoomFor(c->obuf, room)) == NULL)
+		return (-1);
+	c->obuf = p;
+	p += sdslen(p);
+
+	n = snprintf(p, room, "*3\r\n$3\r\nSET\r\n$%zu\r\n", klen);
+	memcpy(p + n, key, klen);
+	n += klen;
+	n += snprintf(p + n, room - n, "\r\n$%zu\r\n", elen);
+
+	if (cryptredis_store(crp, fmt, value, vlen, p + n, elen) == -1)
+		return (-1);
+	n += elen;
+
+	p[n++] = '\r';
+	p[n++] = '\n';
+	sdsIncrLen(c->obuf, n);
+
+	return (0);
+}
+
+/*
+ * What cryptredis_set_rn() stores for value, in a new NUL terminated
+ * buffer left in *bufp: compressed, sealed and encoded the way crp is
+ * configured.  Returns its length, -1 on error or with encryption off.
+ * crp is only read, threads may share it while it isn't reconfigured.
+ */
+ssize_t
+cryptredis_value_seal(const struct cryptredis *crp, const void *value,
+    size_t vlen, char **bufp)
+{
+	u_int8_t	*zbuf = NULL;
+	char		*buf = NULL;
+	size_t		 elen;
+	ssize_t		 n;
+	int		 fmt = crp->cr_format;
+
+	*bufp = NULL;
+	if (!crp->cr_crypt_enabled)
+		return (-1);
 
-		cryptredis_encrypt(crp->cr_key, data, buf, buflen);
-		cryptredis_encode(bufs, bufslen, buf, buflen);
-		data = bufs;
+	if ((n = cryptredis_compress(crp, value, vlen, &zbuf)) == -1)
+		return (-1);
+	if (n > 0) {
+		value = zbuf;
+		vlen = n;
+		fmt |= CRYPTREDIS_FMT_LZ4;
 	}
 
-	if ((cp->cc_hiredis_reply = redisCommand(cp->cc_hiredis_context, "SET "
-	    "%s %s", key, data)) == NULL) {
-		(void)fprintf(stderr, "%s: redisCommand", __func__);
+	elen = cryptredis_stored_len(crp, fmt, vlen);
+	if ((buf = malloc(elen + CRYPTREDIS_STORE_SLACK + 1)) == NULL) {
+		(void)fprintf(stderr, "%s: malloc\n", __func__);
+		goto err;
+	}
+	if (cryptredis_store(crp, fmt, value, vlen, buf, elen) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_store\n", __func__);
 		goto err;
 	}
+	buf[elen] = '\0';
+	free(zbuf);
+	*bufp = buf;
 
-	ret = 0;
+	return (elen);
 
  err:
-	if (crp->cr_crypt_enabled) {
-		free(buf);
-		free(bufs);
-	}
+	free(buf);
+	free(zbuf);
 
-	return (ret);
+	return (-1);
 }
 
 int
 cryptredis_get_r(struct cryptredis *crp, const char *key)
 {
-	char		*bufs = NULL;
-	u_int32_t	*buf = NULL;
-	size_t		 bufslen;
+	return (cryptredis_get_rn(crp, key, strlen(key)));
+}
+
+/*
+ * Binary safe GET, the plaintext is left in the reply, its length in
+ * cryptredis_response_len().  Raw ciphertext is recognized by its header
+ * whatever the storage mode, so a handle reads values written either way;
+ * only legacy values, which have no header, need the matching mode, and
+ * they end at their first NUL.  The value is decoded and opened in place,
+ * the reply's buffer is the only one.
+ */
+int
+cryptredis_get_rn(struct cryptredis *crp, const char *key, size_t klen)
+{
 	redisReply	*rreply = NULL;
+	const char	*argv[2];
+	size_t		 argvlen[2];
+	ssize_t		 n;
 	int		 ret = -1;
 
-	if ((rreply = redisCommand(crp->cr_context->cc_hiredis_context, "GET "
-	    "%s", key)) == NULL) {
-		(void)fprintf(stderr, "%s: redisCommand\n", __func__);
+	argv[0] = "GET";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+	if ((rreply = redisCommandArgv(crp->cr_context->cc_hiredis_context,
+	    2, argv, argvlen)) == NULL) {
+		(void)fprintf(stderr, "%s: redisCommandArgv\n", __func__);
 		goto err;
 	}
-	
-	if (crp->cr_crypt_enabled) { 
-		if ((buf = (u_int32_t *)calloc(1, rreply->len)) == NULL) {
-			(void)fprintf(stderr, "%s: calloc\n", __func__);
-			goto err;
-		}
-
-		bufslen = cryptredis_decode(rreply->str, buf, rreply->len);
 
-		if ((bufs = calloc(1, bufslen)) == NULL) {
-			(void)fprintf(stderr, "%s: calloc\n", __func__);
+	if (crp->cr_crypt_enabled && rreply->type == REDIS_REPLY_STRING) {
+		cryptredis_sync_keys(crp);
+		if ((n = cryptredis_value_open(crp, &rreply->str,
+		    rreply->len)) == -1)
 			goto err;
-		}
-
-		cryptredis_decrypt(crp->cr_key, buf, bufs, bufslen);
-		memset(rreply->str, 0, rreply->len);
-		memcpy(rreply->str, bufs, bufslen);
-		rreply->len = bufslen;
+		rreply->str[n] = '\0';
+		rreply->len = n;
 	}
 
 	crp->cr_context->cc_hiredis_reply = rreply;
@@ -319,96 +740,853 @@ cryptredis_get_r(struct cryptredis *crp, const char *key)
 	if (ret == -1 && rreply)
 		freeReplyObject(rreply);
 
-	if (crp->cr_crypt_enabled) {
-		if (buf)
-			free(buf);
-		if (bufs)
-			free(bufs);
-	}
-
 	return (ret);
 }
 
-static int
-cryptredis_set_error(struct cryptredis *crp, const char *errmsg)
+/*
+ * MGET of nkeys keys, klens holds their lengths or is NULL for C strings.
+ * The array reply is the response, its values opened together; missing
+ * keys are nil elements, values that don't open error elements.
+ */
+int
+cryptredis_mget_r(struct cryptredis *crp, const char *const *keys,
+    const size_t *klens, size_t nkeys)
 {
-	struct cryptredis_context *ccp = crp->cr_context;
+	redisReply	*rreply;
+	const char	**argv;
+	size_t		*argvlen, i;
 
-	if (strlcpy(ccp->cc_errmsg, errmsg, sizeof(ccp->cc_errmsg)) == -1) {
-		(void)fprintf(stderr, "%s: strlcpy truncated", __func__);
+	if (nkeys == 0 || nkeys >= INT_MAX) {
+		(void)fprintf(stderr, "%s: %zu keys\n", __func__, nkeys);
+		return (-1);
+	}
+	argv = reallocarray(NULL, nkeys + 1, sizeof(*argv));
+	argvlen = reallocarray(NULL, nkeys + 1, sizeof(*argvlen));
+	if (argv == NULL || argvlen == NULL) {
+		(void)fprintf(stderr, "%s: reallocarray %s\n", __func__,
+		    strerror(errno));
+		free(argv);
+		free(argvlen);
 		return (-1);
 	}
-	ccp->cc_errnum = errno;
-	return (0);
-}
-
-int
-cryptredis_del_r(struct cryptredis *crp, const char *key)
-{
-	redisReply	*rreply = NULL;
 
-	if ((rreply = redisCommand(crp->cr_context->cc_hiredis_context,
-	    "DEL %s", key)) == NULL) {
-		(void)fprintf(stderr, "%s: redisCommand\n", __func__);
-		freeReplyObject(rreply);
+	argv[0] = "MGET";
+	argvlen[0] = 4;
+	for (i = 0; i < nkeys; i++) {
+		argv[i + 1] = keys[i];
+		argvlen[i + 1] = klens != NULL ? klens[i] : strlen(keys[i]);
+	}
+	rreply = redisCommandArgv(crp->cr_context->cc_hiredis_context,
+	    nkeys + 1, argv, argvlen);
+	free(argv);
+	free(argvlen);
+	if (rreply == NULL) {
+		(void)fprintf(stderr, "%s: redisCommandArgv\n", __func__);
 		return (-1);
 	}
+
+	if (crp->cr_crypt_enabled && rreply->type == REDIS_REPLY_ARRAY) {
+		cryptredis_sync_keys(crp);
+		cryptredis_open_replies(crp, rreply->element,
+		    rreply->elements);
+	}
 	crp->cr_context->cc_hiredis_reply = rreply;
 
 	return (0);
 }
 
+/*
+ * MSET of n pairs, klens and vlens hold the lengths of keys and values or
+ * are NULL for C strings.  All values are compressed, sealed and encoded
+ * in one pass into a scratch buffer the handle keeps for the next call,
+ * then go out as a single command.
+ */
 int
-cryptredis_ping_r(struct cryptredis *crp)
+cryptredis_mset_r(struct cryptredis *crp, const char *const *keys,
+    const size_t *klens, const void *const *vals, const size_t *vlens,
+    size_t n)
 {
-	struct cryptredis_context *cp = crp->cr_context;
-
-	if ((cp->cc_hiredis_reply = redisCommand(cp->cc_hiredis_context,
-	    "PING")) == NULL) {
-		(void)fprintf(stderr, "%s: redisCommand", __func__);
-		return (-1);
-	}
-
-	DPRINTF(stderr, "%s: reply %s\n", __func__,
-	    cp->cc_hiredis_reply->str);
-
-	return (0);
+	return (cryptredis_mset(crp, "MSET", keys, klens, vals, vlens, n));
 }
 
+/* MSETNX, the response is 1 if all keys were set, 0 if none was */
 int
-cryptredis_exists_r(struct cryptredis *crp, const char *key)
+cryptredis_msetnx_r(struct cryptredis *crp, const char *const *keys,
+    const size_t *klens, const void *const *vals, const size_t *vlens,
+    size_t n)
 {
-	struct cryptredis_context *cp = crp->cr_context;
+	return (cryptredis_mset(crp, "MSETNX", keys, klens, vals, vlens, n));
+}
 
-	if ((cp->cc_hiredis_reply = redisCommand(cp->cc_hiredis_context,
-	    "EXISTS %s", key)) == NULL) {
-		(void)fprintf(stderr, "%s: redisCommand", __func__);
+static int
+cryptredis_mset(struct cryptredis *crp, const char *cmd,
+    const char *const *keys, const size_t *klens, const void *const *vals,
+    const size_t *vlens, size_t n)
+{
+	const char	**argv;
+	char		 *p, *v;
+	size_t		 *argvlen, i, vlen, need;
+	ssize_t		  elen;
+
+	if (n == 0 || n > (INT_MAX - 1) / 2) {
+		(void)fprintf(stderr, "%s: %zu pairs\n", __func__, n);
 		return (-1);
 	}
 
-	DPRINTF(stderr, "%s: %s\n", __func__,
-	    crp->cr_context->cc_hiredis_reply->str);
+	/* argv, argvlen, then room to compress and store each value */
+	need = (2 * n + 1) * (sizeof(*argv) + sizeof(*argvlen));
+	if (crp->cr_crypt_enabled) {
+		cryptredis_sync_keys(crp);
+		for (i = 0; i < n; i++) {
+			vlen = vlens != NULL ? vlens[i] : strlen(vals[i]);
+			if (vlen > CRYPTREDIS_LZ4_MAXLEN) {
+				(void)fprintf(stderr, "%s: value of %zu "
+				    "bytes\n", __func__, vlen);
+				return (-1);
+			}
+			need += cryptredis_store_room(crp, vlen);
+		}
+	}
+	if ((argv = cryptredis_scratch(crp, need)) == NULL)
+		return (-1);
+	argvlen = (size_t *)(argv + 2 * n + 1);
+	p = (char *)(argvlen + 2 * n + 1);
+
+	argv[0] = cmd;
+	argvlen[0] = strlen(cmd);
+	for (i = 0; i < n; i++) {
+		argv[2 * i + 1] = keys[i];
+		argvlen[2 * i + 1] = klens != NULL ? klens[i] : strlen(keys[i]);
+		vlen = vlens != NULL ? vlens[i] : strlen(vals[i]);
+		if (!crp->cr_crypt_enabled) {
+			argv[2 * i + 2] = vals[i];
+			argvlen[2 * i + 2] = vlen;
+			continue;
+		}
+
+		if ((elen = cryptredis_store_value(crp, vals[i], vlen, p,
+		    &v)) == -1) {
+			(void)fprintf(stderr, "%s: cryptredis_store_value\n",
+			    __func__);
+			return (-1);
+		}
+		argv[2 * i + 2] = v;
+		argvlen[2 * i + 2] = elen;
+		p += cryptredis_store_room(crp, vlen);
+	}
+
+	if ((crp->cr_context->cc_hiredis_reply = redisCommandArgv(
+	    crp->cr_context->cc_hiredis_context, 2 * n + 1, argv,
+	    argvlen)) == NULL) {
+		(void)fprintf(stderr, "%s: redisCommandArgv\n", __func__);
+		return (-1);
+	}
 
 	return (0);
 }
 
-const char *
-cryptredis_response_string(const struct cryptredis *crp)
+/* the handle's scratch buffer, grown to len bytes, never shrunk */
+static void *
+cryptredis_scratch(struct cryptredis *crp, size_t len)
 {
-	if (crp->cr_context->cc_hiredis_reply != NULL)
-		return (crp->cr_context->cc_hiredis_reply->str);
+	struct cryptredis_context	*ccp = crp->cr_context;
+	void				*p;
+
+	if (len <= ccp->cc_scratch_size)
+		return (ccp->cc_scratch);
+	if ((p = realloc(ccp->cc_scratch, len)) == NULL) {
+		(void)fprintf(stderr, "%s: realloc %s\n", __func__,
+		    strerror(errno));
+		return (NULL);
+	}
+	ccp->cc_scratch = p;
+	ccp->cc_scratch_size = len;
+
+	return (p);
+}
+
+/*
+ * Turn a stored value back into plaintext in place, returns its length.
+ * base64 text is ascii, it never parses as a header.  Compressed values
+ * don't fit, *strp, a malloc(3)ed buffer, is then replaced by one of the
+ * right size with room for a NUL.  Like cryptredis_value_seal() this only
+ * reads crp.
+ */
+ssize_t
+cryptredis_value_open(const struct cryptredis *crp, char **strp, size_t len)
+{
+	ssize_t		 n;
+	int		 fmt, flags;
+
+	if (!crp->cr_crypt_enabled)
+		return (-1);
+
+	if ((n = cryptredis_value_decode(crp, *strp, len)) == -1)
+		return (-1);
+	flags = cryptredis_hdr_flags(*strp, n);
+	if ((n = cryptredis_unseal(crp->cr_keyset->ks_keys,
+	    crp->cr_keyset->ks_nkeys, *strp, n, *strp, n, &fmt)) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_unseal\n", __func__);
+		return (-1);
+	}
+	if (fmt == CRYPTREDIS_FMT_LEGACY)
+		flags = 0;
+
+	return (cryptredis_value_finish(strp, n, fmt, flags));
+}
+
+/*
+ * Base64 text holds legacy values, or any value without CRYPTREDIS_F_RAW.
+ * In raw mode a value with no header may still be base64 written by a
+ * handle in the other mode: it is decoded when its first characters
+ * decode to a header, and taken for a raw legacy value otherwise.
+ */
+static ssize_t
+cryptredis_value_decode(const struct cryptredis *crp, char *str, size_t len)
+{
+	u_int8_t	hdr[(CRYPTREDIS_HDRLEN + 2) / 3 * 3];
+	ssize_t		n = len;
+
+	if (cryptredis_hdr_parse(str, len) != CRYPTREDIS_FMT_LEGACY)
+		return (n);
+
+	if ((crp->cr_flags & CRYPTREDIS_F_RAW) &&
+	    (len < sizeof(hdr) / 3 * 4 || (n = cryptredis_decode(str,
+	    sizeof(hdr) / 3 * 4, hdr, sizeof(hdr))) == -1 ||
+	    cryptredis_hdr_parse(hdr, n) == CRYPTREDIS_FMT_LEGACY))
+		return (len);
+
+	if ((n = cryptredis_decode(str, len, str, len)) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_decode\n", __func__);
+		return (-1);
+	}
+
+	return (n);
+}
+
+/* plaintext of n bytes at *strp, opened from a value of format fmt */
+static ssize_t
+cryptredis_value_finish(char **strp, ssize_t n, int fmt, int flags)
+{
+	/* legacy values are zero padded C strings */
+	if (fmt == CRYPTREDIS_FMT_LEGACY)
+		n = strnlen(*strp, n);
+
+	if ((flags & CRYPTREDIS_HDR_LZ4) &&
+	    (n = cryptredis_decompress(strp, n)) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_decompress\n", __func__);
+		return (-1);
+	}
+
+	return (n);
+}
+
+/*
+ * Open the values of n string replies in place, all at once so block
+ * cipher values share the AES lanes, see cryptredis_unseal_batch().
+ * Other replies are left alone, values that don't open become errors.
+ */
+static void
+cryptredis_open_replies(const struct cryptredis *crp, redisReply **rv,
+    size_t n)
+{
+	redisReply	*r[CRYPTREDIS_OPEN_BATCH];
+	void		*vals[CRYPTREDIS_OPEN_BATCH];
+	size_t		 lens[CRYPTREDIS_OPEN_BATCH];
+	ssize_t		 out[CRYPTREDIS_OPEN_BATCH];
+	int		 fmt[CRYPTREDIS_OPEN_BATCH], flags[CRYPTREDIS_OPEN_BATCH];
+	size_t		 i, k, m;
+	ssize_t		 len;
+
+	for (i = 0; i < n; ) {
+		for (m = 0; m < CRYPTREDIS_OPEN_BATCH && i < n; i++) {
+			if (rv[i] == NULL || rv[i]->type != REDIS_REPLY_STRING)
+				continue;
+			if ((len = cryptredis_value_decode(crp, rv[i]->str,
+			    rv[i]->len)) == -1) {
+				cryptredis_reply_error(rv[i],
+				    "ERR cryptredis_value_decode");
+				continue;
+			}
+			r[m] = rv[i];
+			vals[m] = rv[i]->str;
+			lens[m] = len;
+			flags[m] = cryptredis_hdr_flags(rv[i]->str, len);
+			m++;
+		}
+
+		cryptredis_unseal_batch(crp->cr_keyset->ks_keys,
+		    crp->cr_keyset->ks_nkeys, vals, lens, out, fmt, m);
+
+		for (k = 0; k < m; k++) {
+			if (fmt[k] == CRYPTREDIS_FMT_LEGACY)
+				flags[k] = 0;
+			if (out[k] == -1 || (len = cryptredis_value_finish(
+			    &r[k]->str, out[k], fmt[k], flags[k])) == -1) {
+				cryptredis_reply_error(r[k],
+				    "ERR cryptredis_value_open");
+				continue;
+			}
+			r[k]->str[len] = '\0';
+			r[k]->len = len;
+		}
+	}
+}
+
+/* undo cryptredis_compress(), the new buffer has room for a NUL */
+static ssize_t
+cryptredis_decompress(char **strp, size_t len)
+{
+	const u_int8_t	*p = (const u_int8_t *)*strp;
+	char		*buf;
+	size_t		 olen;
+
+	if (len < 4)
+		return (-1);
+	olen = (size_t)p[0] | (size_t)p[1] << 8 | (size_t)p[2] << 16 |
+	    (size_t)p[3] << 24;
+	if (olen > CRYPTREDIS_LZ4_MAXLEN)
+		return (-1);
+
+	if ((buf = malloc(olen + 1)) == NULL)
+		return (-1);
+	if (lz4_decompress(p + 4, len - 4, buf, olen) != (ssize_t)olen) {
+		free(buf);
+		return (-1);
+	}
+	free(*strp);
+	*strp = buf;
+
+	return (olen);
+}
+
+static int
+cryptredis_set_error(struct cryptredis *crp, const char *errmsg)
+{
+	struct cryptredis_context *ccp = crp->cr_context;
+
+	if (strlcpy(ccp->cc_errmsg, errmsg, sizeof(ccp->cc_errmsg)) == -1) {
+		(void)fprintf(stderr, "%s: strlcpy truncated", __func__);
+		return (-1);
+	}
+	ccp->cc_errnum = errno;
+	return (0);
+}
+
+int
+cryptredis_del_r(struct cryptredis *crp, const char *key)
+{
+	redisReply	*rreply = NULL;
+
+	if ((rreply = redisCommand(crp->cr_context->cc_hiredis_context,
+	    "DEL %s", key)) == NULL) {
+		(void)fprintf(stderr, "%s: redisCommand\n", __func__);
+		freeReplyObject(rreply);
+		return (-1);
+	}
+	crp->cr_context->cc_hiredis_reply = rreply;
+
+	return (0);
+}
+
+int
+cryptredis_ping_r(struct cryptredis *crp)
+{
+	struct cryptredis_context *cp = crp->cr_context;
+
+	if ((cp->cc_hiredis_reply = redisCommand(cp->cc_hiredis_context,
+	    "PING")) == NULL) {
+		(void)fprintf(stderr, "%s: redisCommand", __func__);
+		return (-1);
+	}
+
+	DPRINTF(stderr, "%s: reply %s\n", __func__,
+	    cp->cc_hiredis_reply->str);
+
+	return (0);
+}
+
+int
+cryptredis_exists_r(struct cryptredis *crp, const char *key)
+{
+	struct cryptredis_context *cp = crp->cr_context;
+
+	if ((cp->cc_hiredis_reply = redisCommand(cp->cc_hiredis_context,
+	    "EXISTS %s", key)) == NULL) {
+		(void)fprintf(stderr, "%s: redisCommand", __func__);
+		return (-1);
+	}
+
+	DPRINTF(stderr, "%s: %s\n", __func__,
+	    crp->cr_context->cc_hiredis_reply->str);
+
+	return (0);
+}
+
+/*
+ * Pipelining: commands appended between cryptredis_pipeline_begin() and
+ * cryptredis_pipeline_exec() go out together, one write for all of them,
+ * and their replies come back in one round trip instead of one each.
+ * Values are sealed straight into the output buffer as they're appended,
+ * all with the keys current at begin; GET replies are opened together
+ * once every reply is in.  cryptredis_pipeline_next() then makes each
+ * reply the response in turn, to be freed with cryptredis_response_free()
+ * as usual.  A value that doesn't open comes back as an error reply, the
+ * others are unaffected.
+ */
+int
+cryptredis_pipeline_begin(struct cryptredis *crp)
+{
+	struct cryptredis_context *ccp = crp->cr_context;
+
+	if (ccp->cc_pipe_open) {
+		(void)fprintf(stderr, "%s: pipeline already begun\n",
+		    __func__);
+		return (-1);
+	}
+	cryptredis_pipeline_clear(crp);
+
+	if (crp->cr_crypt_enabled)
+		cryptredis_sync_keys(crp);
+	ccp->cc_pipe_open = 1;
+
+	return (0);
+}
+
+int
+cryptredis_pipeline_append_set(struct cryptredis *crp, const char *key,
+    size_t klen, const void *value, size_t vlen)
+{
+	if (cryptredis_pipeline_add(crp, 0) == -1)
+		return (-1);
+	if (cryptredis_append_value(crp, key, klen, value, vlen) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_append_value\n",
+		    __func__);
+		crp->cr_context->cc_pipe_len--;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+cryptredis_pipeline_append_get(struct cryptredis *crp, const char *key,
+    size_t klen)
+{
+	const char	*argv[2];
+	size_t		 argvlen[2];
+
+	if (cryptredis_pipeline_add(crp, 1) == -1)
+		return (-1);
+
+	argv[0] = "GET";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+	if (redisAppendCommandArgv(crp->cr_context->cc_hiredis_context, 2,
+	    argv, argvlen) != REDIS_OK) {
+		(void)fprintf(stderr, "%s: redisAppendCommandArgv\n",
+		    __func__);
+		crp->cr_context->cc_pipe_len--;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Send the pipeline and read every reply.  Returns -1 if the connection
+ * fails, the replies read so far are then dropped.
+ */
+int
+cryptredis_pipeline_exec(struct cryptredis *crp)
+{
+	struct cryptredis_context	*ccp = crp->cr_context;
+	redisReply			*rv[CRYPTREDIS_OPEN_BATCH];
+	void				*reply;
+	size_t				 i, m;
+
+	if (!ccp->cc_pipe_open) {
+		(void)fprintf(stderr, "%s: no pipeline\n", __func__);
+		return (-1);
+	}
+	ccp->cc_pipe_open = 0;
+
+	for (i = 0; i < ccp->cc_pipe_len; i++) {
+		if (redisGetReply(ccp->cc_hiredis_context, &reply) !=
+		    REDIS_OK) {
+			(void)fprintf(stderr, "%s: redisGetReply\n",
+			    __func__);
+			ccp->cc_pipe_len = i;
+			cryptredis_pipeline_clear(crp);
+			return (-1);
+		}
+		ccp->cc_pipe[i].cp_reply = reply;
+	}
+
+	for (i = 0, m = 0; i < ccp->cc_pipe_len && crp->cr_crypt_enabled;
+	    i++) {
+		if (ccp->cc_pipe[i].cp_get)
+			rv[m++] = ccp->cc_pipe[i].cp_reply;
+		if (m == CRYPTREDIS_OPEN_BATCH || i == ccp->cc_pipe_len - 1) {
+			cryptredis_open_replies(crp, rv, m);
+			m = 0;
+		}
+	}
+
+	return (0);
+}
+
+/* make the next reply of the pipeline the response, -1 past the last */
+int
+cryptredis_pipeline_next(struct cryptredis *crp)
+{
+	struct cryptredis_context *ccp = crp->cr_context;
+
+	if (ccp->cc_pipe_open || ccp->cc_pipe_next == ccp->cc_pipe_len)
+		return (-1);
+	ccp->cc_hiredis_reply = ccp->cc_pipe[ccp->cc_pipe_next].cp_reply;
+	ccp->cc_pipe[ccp->cc_pipe_next++].cp_reply = NULL;
+
+	return (0);
+}
+
+/* room for one more command, the array only ever grows */
+static int
+cryptredis_pipeline_add(struct cryptredis *crp, int get)
+{
+	struct cryptredis_context	*ccp = crp->cr_context;
+	struct cryptredis_pipe		*cp;
+	size_t				 nsize;
+
+	if (!ccp->cc_pipe_open) {
+		(void)fprintf(stderr, "%s: no pipeline\n", __func__);
+		return (-1);
+	}
+	if (ccp->cc_pipe_len == ccp->cc_pipe_size) {
+		nsize = ccp->cc_pipe_size ? ccp->cc_pipe_size * 2 : 16;
+		if ((cp = reallocarray(ccp->cc_pipe, nsize,
+		    sizeof(*cp))) == NULL) {
+			(void)fprintf(stderr, "%s: reallocarray %s\n",
+			    __func__, strerror(errno));
+			return (-1);
+		}
+		ccp->cc_pipe = cp;
+		ccp->cc_pipe_size = nsize;
+	}
+	cp = &ccp->cc_pipe[ccp->cc_pipe_len++];
+	cp->cp_reply = NULL;
+	cp->cp_get = get;
+
+	return (0);
+}
+
+/* drop the replies not handed out */
+static void
+cryptredis_pipeline_clear(struct cryptredis *crp)
+{
+	struct cryptredis_context	*ccp = crp->cr_context;
+	size_t				 i;
+
+	for (i = ccp->cc_pipe_next; i < ccp->cc_pipe_len; i++)
+		if (ccp->cc_pipe[i].cp_reply != NULL)
+			freeReplyObject(ccp->cc_pipe[i].cp_reply);
+	ccp->cc_pipe_len = ccp->cc_pipe_next = 0;
+}
+
+/*
+ * Asynchronous commands: values are sealed when the command is queued
+ * and replies opened before the callback runs, it gets the plaintext in
+ * place of the stored value or NULL if the connection went away first.
+ * hiredis frees the reply once the callback returns.
+ */
+struct cryptredis_async *
+cryptredis_async_open(const char *host, int port)
+{
+	struct cryptredis_async	*cra;
+
+	if ((cra = calloc(1, sizeof(*cra))) == NULL) {
+		(void)fprintf(stderr, "%s: calloc %s\n", __func__,
+		    strerror(errno));
+		return (NULL);
+	}
+
+	/* no connection, the context only holds the scratch buffer */
+	if ((cra->ca_crypt.cr_context = calloc(1,
+	    sizeof(*cra->ca_crypt.cr_context))) == NULL) {
+		(void)fprintf(stderr, "%s: calloc %s\n", __func__,
+		    strerror(errno));
+		goto err;
+	}
+	cra->ca_crypt.cr_lz4_min = CRYPTREDIS_LZ4_MIN;
+
+	if ((cra->ca_context = redisAsyncConnect(host, port)) == NULL) {
+		(void)fprintf(stderr, "%s: redisAsyncConnect\n", __func__);
+		goto err;
+	}
+	if (cra->ca_context->err != REDIS_OK) {
+		(void)fprintf(stderr, "%s: redisAsyncConnect %s\n", __func__,
+		    cra->ca_context->errstr);
+		redisAsyncFree(cra->ca_context);
+		goto err;
+	}
+	cra->ca_context->data = cra;
+	(void)redisAsyncSetDisconnectCallback(cra->ca_context,
+	    cryptredis_async_disconnected);
+	cra->ca_crypt.cr_connected = 1;
+
+	return (cra);
+
+ err:
+	free(cra->ca_crypt.cr_context);
+	free(cra);
 
 	return (NULL);
 }
 
+/*
+ * Callbacks still pending run with a NULL reply.  Not from a callback,
+ * disconnect with redisAsyncDisconnect() there and close once
+ * ca_ondisconnect has run.
+ */
 void
-cryptredis_response_free(struct cryptredis *crp)
+cryptredis_async_close(struct cryptredis_async *cra)
+{
+	if (cra->ca_context != NULL)
+		redisAsyncFree(cra->ca_context);
+	cryptredis_put_keys(&cra->ca_crypt);
+	free(cra->ca_crypt.cr_context->cc_scratch);
+	free(cra->ca_crypt.cr_context);
+	free(cra);
+}
+
+int
+cryptredis_async_set(struct cryptredis_async *cra, const char *key,
+    size_t klen, const void *value, size_t vlen, cryptredis_async_fn *fn,
+    void *arg)
+{
+	struct cryptredis	*crp = &cra->ca_crypt;
+	const char		*argv[3];
+	size_t			 argvlen[3];
+	char			*p, *v;
+	ssize_t			 elen;
+
+	argv[0] = "SET";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+	argv[2] = value;
+	argvlen[2] = vlen;
+
+	/* hiredis copies the command, the scratch buffer is free after */
+	if (crp->cr_crypt_enabled) {
+		cryptredis_sync_keys(crp);
+		if ((p = cryptredis_scratch(crp, cryptredis_store_room(crp,
+		    vlen))) == NULL)
+			return (-1);
+		if ((elen = cryptredis_store_value(crp, value, vlen, p,
+		    &v)) == -1) {
+			(void)fprintf(stderr, "%s: cryptredis_store_value\n",
+			    __func__);
+			return (-1);
+		}
+		argv[2] = v;
+		argvlen[2] = elen;
+	}
+
+	return (cryptredis_async_command(cra, 3, argv, argvlen, 0, fn, arg));
+}
+
+int
+cryptredis_async_get(struct cryptredis_async *cra, const char *key,
+    size_t klen, cryptredis_async_fn *fn, void *arg)
 {
-	switch (crp->cr_context->cc_hiredis_reply->type) {
-	case REDIS_REPLY_ARRAY:
-		/* TODO */
-		break;
+	const char	*argv[2];
+	size_t		 argvlen[2];
+
+	argv[0] = "GET";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+
+	return (cryptredis_async_command(cra, 2, argv, argvlen, 1, fn, arg));
+}
+
+static int
+cryptredis_async_command(struct cryptredis_async *cra, int argc,
+    const char **argv, const size_t *argvlen, int get,
+    cryptredis_async_fn *fn, void *arg)
+{
+	struct cryptredis_async_cmd	*cm;
+
+	if (cra->ca_context == NULL) {
+		(void)fprintf(stderr, "%s: not connected\n", __func__);
+		return (-1);
 	}
+	if ((cm = malloc(sizeof(*cm))) == NULL) {
+		(void)fprintf(stderr, "%s: malloc %s\n", __func__,
+		    strerror(errno));
+		return (-1);
+	}
+	cm->cm_fn = fn;
+	cm->cm_arg = arg;
+	cm->cm_get = get;
+
+	if (redisAsyncCommandArgv(cra->ca_context, cryptredis_async_reply, cm,
+	    argc, argv, argvlen) != REDIS_OK) {
+		(void)fprintf(stderr, "%s: redisAsyncCommandArgv\n",
+		    __func__);
+		free(cm);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* open the value of a GET reply, then hand it to the caller */
+static void
+cryptredis_async_reply(redisAsyncContext *ac, void *reply, void *arg)
+{
+	struct cryptredis_async		*cra = ac->data;
+	struct cryptredis_async_cmd	*cm = arg;
+	redisReply			*r = reply;
+
+	if (r != NULL && cm->cm_get && cra->ca_crypt.cr_crypt_enabled) {
+		cryptredis_sync_keys(&cra->ca_crypt);
+		cryptredis_open_replies(&cra->ca_crypt, &r, 1);
+	}
+	if (cm->cm_fn != NULL)
+		cm->cm_fn(cra, r, cm->cm_arg);
+	free(cm);
+}
+
+static void
+cryptredis_async_disconnected(const redisAsyncContext *ac, int status)
+{
+	struct cryptredis_async	*cra = ac->data;
+
+	cra->ca_context = NULL;
+	cra->ca_crypt.cr_connected = 0;
+	if (cra->ca_ondisconnect != NULL)
+		cra->ca_ondisconnect(cra, status);
+}
+
+/* turn the reply to a value that doesn't open into an error */
+static void
+cryptredis_reply_error(struct redisReply *r, const char *msg)
+{
+	free(r->str);
+	r->type = REDIS_REPLY_ERROR;
+	r->str = strdup(msg);
+	r->len = r->str != NULL ? strlen(msg) : 0;
+}
+
+const char *
+cryptredis_response_string(const struct cryptredis *crp)
+{
+	if (crp->cr_context->cc_hiredis_reply != NULL)
+		return (crp->cr_context->cc_hiredis_reply->str);
+
+	return (NULL);
+}
+
+/* length of cryptredis_response_string(), which may hold NULs */
+size_t
+cryptredis_response_len(const struct cryptredis *crp)
+{
+	if (crp->cr_context->cc_hiredis_reply != NULL)
+		return (crp->cr_context->cc_hiredis_reply->len);
+
+	return (0);
+}
+
+/* value of an integer response */
+long long
+cryptredis_response_integer(const struct cryptredis *crp)
+{
+	if (crp->cr_context->cc_hiredis_reply != NULL)
+		return (crp->cr_context->cc_hiredis_reply->integer);
+
+	return (0);
+}
+
+/* elements of an array response, 0 for any other */
+size_t
+cryptredis_response_elements(const struct cryptredis *crp)
+{
+	const redisReply *r = crp->cr_context->cc_hiredis_reply;
+
+	if (r != NULL && r->type == REDIS_REPLY_ARRAY)
+		return (r->elements);
+
+	return (0);
+}
+
+const char *
+cryptredis_response_element_string(const struct cryptredis *crp, size_t i)
+{
+	if (i >= cryptredis_response_elements(crp))
+		return (NULL);
+
+	return (crp->cr_context->cc_hiredis_reply->element[i]->str);
+}
+
+size_t
+cryptredis_response_element_len(const struct cryptredis *crp, size_t i)
+{
+	if (i >= cryptredis_response_elements(crp))
+		return (0);
+
+	return (crp->cr_context->cc_hiredis_reply->element[i]->len);
+}
+
+int
+cryptredis_response_element_type(const struct cryptredis *crp, size_t i)
+{
+	if (i >= cryptredis_response_elements(crp))
+		return (-1);
+
+	return (crp->cr_context->cc_hiredis_reply->element[i]->type);
+}
+
+/*
+ * The string of the response, NUL terminated, handed over to the caller
+ * to free(3) instead of being copied; the response keeps its type and
+ * length with no string.  NULL if it has none.
+ */
+char *
+cryptredis_response_take(struct cryptredis *crp)
+{
+	struct redisReply	*r = crp->cr_context->cc_hiredis_reply;
+	char			*str;
+
+	if (r == NULL)
+		return (NULL);
+	str = r->str;
+	r->str = NULL;
+
+	return (str);
+}
+
+/* the same for element i of an array response */
+char *
+cryptredis_response_element_take(struct cryptredis *crp, size_t i)
+{
+	struct redisReply	*r;
+	char			*str;
+
+	if (i >= cryptredis_response_elements(crp))
+		return (NULL);
+	r = crp->cr_context->cc_hiredis_reply->element[i];
+	str = r->str;
+	r->str = NULL;
+
+	return (str);
+}
+
+void
+cryptredis_response_free(struct cryptredis *crp)
+{
 	freeReplyObject(crp->cr_context->cc_hiredis_reply);
 	crp->cr_context->cc_hiredis_reply = NULL;
 }
@@ -418,3 +1596,381 @@ cryptredis_response_type(const struct cryptredis *crp)
 {
 	return (crp->cr_context->cc_hiredis_reply->type);
 }
+
+/*
+ * Reply handles.  While a command given one reads its reply, the hiredis
+ * reader builds it with the functions below instead of its own: the
+ * objects are nodes of the handle, taken off its free list along with
+ * the buffers they had the last time around, and never freed by hiredis.
+ * Releasing the handle puts them all back on the free list.
+ */
+struct cryptredis_reply *
+cryptredis_reply_new(void)
+{
+	struct cryptredis_reply	*rp;
+
+	if ((rp = calloc(1, sizeof(*rp))) == NULL)
+		(void)fprintf(stderr, "%s: calloc %s\n", __func__,
+		    strerror(errno));
+
+	return (rp);
+}
+
+void
+cryptredis_reply_release(struct cryptredis_reply *rp)
+{
+	struct cryptredis_node	*rn;
+	redisReply		*r;
+
+	while ((rn = rp->rp_used) != NULL) {
+		rp->rp_used = rn->rn_next;
+
+		/* opening may have traded the buffer for a new one */
+		r = &rn->rn_reply;
+		if ((r->type == REDIS_REPLY_STRING ||
+		    r->type == REDIS_REPLY_STATUS ||
+		    r->type == REDIS_REPLY_ERROR) && r->str != rn->rn_buf) {
+			rn->rn_buf = r->str;
+			rn->rn_size = r->str != NULL ? (size_t)r->len + 1 : 0;
+		}
+
+		rn->rn_next = rp->rp_free;
+		rp->rp_free = rn;
+	}
+	rp->rp_reply = NULL;
+}
+
+void
+cryptredis_reply_free(struct cryptredis_reply *rp)
+{
+	struct cryptredis_node	*rn;
+
+	if (rp == NULL)
+		return;
+
+	cryptredis_reply_release(rp);
+	while ((rn = rp->rp_free) != NULL) {
+		rp->rp_free = rn->rn_next;
+		free(rn->rn_buf);
+		free(rn->rn_elem);
+		free(rn);
+	}
+	free(rp);
+}
+
+/* the reply value of a GET, in rp */
+int
+cryptredis_get_rp(struct cryptredis *crp, const char *key, size_t klen,
+    struct cryptredis_reply *rp)
+{
+	const char	*argv[2];
+	size_t		 argvlen[2];
+
+	argv[0] = "GET";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+	if (cryptredis_command_rp(crp, 2, argv, argvlen, rp) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_command_rp\n", __func__);
+		return (-1);
+	}
+
+	if (crp->cr_crypt_enabled) {
+		cryptredis_sync_keys(crp);
+		cryptredis_open_replies(crp, &rp->rp_reply, 1);
+	}
+
+	return (0);
+}
+
+int
+cryptredis_set_rp(struct cryptredis *crp, const char *key, size_t klen,
+    const void *value, size_t vlen, struct cryptredis_reply *rp)
+{
+	if (crp->cr_crypt_enabled)
+		cryptredis_sync_keys(crp);
+	if (cryptredis_append_value(crp, key, klen, value, vlen) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_append_value\n",
+		    __func__);
+		return (-1);
+	}
+	if (cryptredis_read_rp(crp, rp) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_read_rp\n", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* like cryptredis_mget_r(), the arguments built in the scratch buffer */
+int
+cryptredis_mget_rp(struct cryptredis *crp, const char *const *keys,
+    const size_t *klens, size_t nkeys, struct cryptredis_reply *rp)
+{
+	const char	**argv;
+	size_t		 *argvlen, i;
+
+	if (nkeys == 0 || nkeys >= INT_MAX) {
+		(void)fprintf(stderr, "%s: %zu keys\n", __func__, nkeys);
+		return (-1);
+	}
+	if ((argv = cryptredis_scratch(crp, (nkeys + 1) * (sizeof(*argv) +
+	    sizeof(*argvlen)))) == NULL)
+		return (-1);
+	argvlen = (size_t *)(argv + nkeys + 1);
+
+	argv[0] = "MGET";
+	argvlen[0] = 4;
+	for (i = 0; i < nkeys; i++) {
+		argv[i + 1] = keys[i];
+		argvlen[i + 1] = klens != NULL ? klens[i] : strlen(keys[i]);
+	}
+	if (cryptredis_command_rp(crp, nkeys + 1, argv, argvlen, rp) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_command_rp\n", __func__);
+		return (-1);
+	}
+
+	if (crp->cr_crypt_enabled &&
+	    rp->rp_reply->type == REDIS_REPLY_ARRAY) {
+		cryptredis_sync_keys(crp);
+		cryptredis_open_replies(crp, rp->rp_reply->element,
+		    rp->rp_reply->elements);
+	}
+
+	return (0);
+}
+
+int
+cryptredis_del_rp(struct cryptredis *crp, const char *key, size_t klen,
+    struct cryptredis_reply *rp)
+{
+	const char	*argv[2];
+	size_t		 argvlen[2];
+
+	argv[0] = "DEL";
+	argvlen[0] = 3;
+	argv[1] = key;
+	argvlen[1] = klen;
+
+	return (cryptredis_command_rp(crp, 2, argv, argvlen, rp));
+}
+
+int
+cryptredis_exists_rp(struct cryptredis *crp, const char *key, size_t klen,
+    struct cryptredis_reply *rp)
+{
+	const char	*argv[2];
+	size_t		 argvlen[2];
+
+	argv[0] = "EXISTS";
+	argvlen[0] = 6;
+	argv[1] = key;
+	argvlen[1] = klen;
+
+	return (cryptredis_command_rp(crp, 2, argv, argvlen, rp));
+}
+
+int
+cryptredis_ping_rp(struct cryptredis *crp, struct cryptredis_reply *rp)
+{
+	const char	*argv[1];
+	size_t		 argvlen[1];
+
+	argv[0] = "PING";
+	argvlen[0] = 4;
+
+	return (cryptredis_command_rp(crp, 1, argv, argvlen, rp));
+}
+
+static int
+cryptredis_command_rp(struct cryptredis *crp, int argc, const char **argv,
+    const size_t *argvlen, struct cryptredis_reply *rp)
+{
+	if (redisAppendCommandArgv(crp->cr_context->cc_hiredis_context, argc,
+	    argv, argvlen) != REDIS_OK) {
+		(void)fprintf(stderr, "%s: redisAppendCommandArgv\n",
+		    __func__);
+		return (-1);
+	}
+
+	return (cryptredis_read_rp(crp, rp));
+}
+
+/* send what is appended and read its reply into rp */
+static int
+cryptredis_read_rp(struct cryptredis *crp, struct cryptredis_reply *rp)
+{
+	redisContext			*c = crp->cr_context->cc_hiredis_context;
+	redisReplyObjectFunctions	*fn = c->reader->fn;
+	void				*reply;
+	int				 ret;
+
+	cryptredis_reply_release(rp);
+	c->reader->fn = &cryptredis_node_fn;
+	c->reader->privdata = rp;
+	ret = redisGetReply(c, &reply);
+	c->reader->fn = fn;
+	c->reader->privdata = NULL;
+	if (ret != REDIS_OK) {
+		cryptredis_reply_release(rp);
+		return (-1);
+	}
+	rp->rp_reply = reply;
+
+	return (0);
+}
+
+/* a node of the handle reading, linked to its parent array */
+static struct cryptredis_node *
+cryptredis_node_get(const redisReadTask *task, int type)
+{
+	struct cryptredis_reply	*rp = task->privdata;
+	struct cryptredis_node	*rn;
+	redisReply		*parent;
+
+	if ((rn = rp->rp_free) != NULL)
+		rp->rp_free = rn->rn_next;
+	else if ((rn = calloc(1, sizeof(*rn))) == NULL)
+		return (NULL);
+	rn->rn_next = rp->rp_used;
+	rp->rp_used = rn;
+
+	memset(&rn->rn_reply, 0, sizeof(rn->rn_reply));
+	rn->rn_reply.type = type;
+	if (task->parent != NULL) {
+		parent = task->parent->obj;
+		parent->element[task->idx] = &rn->rn_reply;
+	}
+
+	return (rn);
+}
+
+static void *
+cryptredis_node_string(const redisReadTask *task, char *str, size_t len)
+{
+	struct cryptredis_node	*rn;
+	char			*p;
+	size_t			 size;
+
+	if ((rn = cryptredis_node_get(task, task->type)) == NULL)
+		return (NULL);
+	if (rn->rn_size < len + 1) {
+		size = len + 1 > 2 * rn->rn_size ? len + 1 : 2 * rn->rn_size;
+		if ((p = realloc(rn->rn_buf, size)) == NULL)
+			return (NULL);
+		rn->rn_buf = p;
+		rn->rn_size = size;
+	}
+	memcpy(rn->rn_buf, str, len);
+	rn->rn_buf[len] = '\0';
+	rn->rn_reply.str = rn->rn_buf;
+	rn->rn_reply.len = len;
+
+	return (rn);
+}
+
+static void *
+cryptredis_node_array(const redisReadTask *task, int elements)
+{
+	struct cryptredis_node	*rn;
+	redisReply		**e;
+
+	if ((rn = cryptredis_node_get(task, REDIS_REPLY_ARRAY)) == NULL)
+		return (NULL);
+	if ((size_t)elements > rn->rn_nelem) {
+		if ((e = reallocarray(rn->rn_elem, elements,
+		    sizeof(*e))) == NULL)
+			return (NULL);
+		rn->rn_elem = e;
+		rn->rn_nelem = elements;
+	}
+	memset(rn->rn_elem, 0, elements * sizeof(*rn->rn_elem));
+	rn->rn_reply.element = rn->rn_elem;
+	rn->rn_reply.elements = elements;
+
+	return (rn);
+}
+
+static void *
+cryptredis_node_integer(const redisReadTask *task, long long value)
+{
+	struct cryptredis_node	*rn;
+
+	if ((rn = cryptredis_node_get(task, REDIS_REPLY_INTEGER)) == NULL)
+		return (NULL);
+	rn->rn_reply.integer = value;
+
+	return (rn);
+}
+
+static void *
+cryptredis_node_nil(const redisReadTask *task)
+{
+	return (cryptredis_node_get(task, REDIS_REPLY_NIL));
+}
+
+/* nodes are the handle's, released with it */
+static void
+cryptredis_node_keep(void *obj)
+{
+}
+
+int
+cryptredis_reply_type(const struct cryptredis_reply *rp)
+{
+	return (rp->rp_reply != NULL ? rp->rp_reply->type : -1);
+}
+
+const char *
+cryptredis_reply_string(const struct cryptredis_reply *rp)
+{
+	return (rp->rp_reply != NULL ? rp->rp_reply->str : NULL);
+}
+
+size_t
+cryptredis_reply_len(const struct cryptredis_reply *rp)
+{
+	return (rp->rp_reply != NULL ? rp->rp_reply->len : 0);
+}
+
+long long
+cryptredis_reply_integer(const struct cryptredis_reply *rp)
+{
+	return (rp->rp_reply != NULL ? rp->rp_reply->integer : 0);
+}
+
+size_t
+cryptredis_reply_elements(const struct cryptredis_reply *rp)
+{
+	if (rp->rp_reply != NULL && rp->rp_reply->type == REDIS_REPLY_ARRAY)
+		return (rp->rp_reply->elements);
+
+	return (0);
+}
+
+const char *
+cryptredis_reply_element_string(const struct cryptredis_reply *rp, size_t i)
+{
+	if (i >= cryptredis_reply_elements(rp))
+		return (NULL);
+
+	return (rp->rp_reply->element[i]->str);
+}
+
+size_t
+cryptredis_reply_element_len(const struct cryptredis_reply *rp, size_t i)
+{
+	if (i >= cryptredis_reply_elements(rp))
+		return (0);
+
+	return (rp->rp_reply->element[i]->len);
+}
+
+int
+cryptredis_reply_element_type(const struct cryptredis_reply *rp, size_t i)
+{
+	if (i >= cryptredis_reply_elements(rp))
+		return (-1);
+
+	return (rp->rp_reply->element[i]->type);
+}
@@ -21,31 +21,173 @@
 extern "C" {
 #endif
 
+struct redisAsyncContext;
+struct redisReply;
+struct cryptredis_reply;
+
+/*
+ * Threading: a struct cryptredis handle owns its redis connection and its
+ * last reply, and must only be used by one thread at a time.  Distinct
+ * handles may be used concurrently without locking, encryption included;
+ * the only state they share are keys, derived once per key file by
+ * cryptredis_config_encrypt() and read-only after that.  It reads
+ * CRYPTREDIS_KEYFILE from the environment, do not change it while other
+ * threads enable encryption.  With CRYPTREDIS_F_KEYWATCH set first, a
+ * thread of the library reads the key files again when they change and
+ * handles pick the new keys up on their next request.
+ */
 struct cryptredis {
 	struct cryptredis_context	*cr_context;
-	struct cryptredis_key		*cr_key;
+	const struct cryptredis_keyset	*cr_keyset;	/* ks_keys[0] writes */
+	struct cryptredis_keywatch	*cr_keywatch;	/* or NULL */
+	unsigned int			 cr_keygen;	/* of cr_keyset */
 	int				 cr_connected;
 	int			 	 cr_crypt_enabled;
+	int				 cr_format;
 	uint32_t			 cr_flags;
+	size_t				 cr_lz4_min;	/* smallest value compressed */
 };
 
+/*
+ * An asynchronous connection driven by the caller's event loop: attach
+ * ca_context with one of the hiredis adapters, redisLibeventAttach() or
+ * redisLibevAttach().  ca_crypt holds the encryption settings, configure
+ * it with the cryptredis_config_*() calls; it has no connection of its
+ * own.  Same threading contract as struct cryptredis, one thread at a
+ * time, normally the loop's.
+ */
+struct cryptredis_async;
+typedef void	 (cryptredis_async_fn)(struct cryptredis_async *,
+		    struct redisReply *, void *);
+typedef void	 (cryptredis_async_disconnect_fn)(struct cryptredis_async *,
+		    int);
+
+struct cryptredis_async {
+	struct redisAsyncContext	*ca_context;	/* NULL once gone */
+	struct cryptredis		 ca_crypt;
+	cryptredis_async_disconnect_fn	*ca_ondisconnect;	/* or NULL */
+};
+
+/*
+ * Value formats, passed to cryptredis_config_encrypt(); reads accept any
+ * of them regardless of the configured one.
+ */
+#define CRYPTREDIS_FMT_NONE	0	/* encryption disabled */
+#define CRYPTREDIS_FMT_LEGACY	1	/* AES-256-CBC, fixed iv, padded */
+#define CRYPTREDIS_FMT_CTR	2	/* AES-256-CTR + HMAC-SHA256 */
+#define CRYPTREDIS_FMT_CBC	3	/* AES-256-CBC, fixed iv, pkcs#7 */
+#define CRYPTREDIS_FMT_CHACHA	4	/* ChaCha20-Poly1305 */
+#define CRYPTREDIS_FMT_MASK	0xff
+#define CRYPTREDIS_FMT_LZ4	0x100	/* or'ed in: compress values first */
+
+#define CRYPTREDIS_LZ4_MIN	128	/* default cr_lz4_min */
+
+/* cr_flags */
+#define CRYPTREDIS_F_RAW	0x00000001	/* raw ciphertext, no base64 */
+#define CRYPTREDIS_F_LZ4	0x00000002	/* compress before sealing */
+#define CRYPTREDIS_F_KEYWATCH	0x00000004	/* reload changed key files */
+
 struct cryptredis *
 	 cryptredis_open(const char *, int);
 int	 cryptredis_close(struct cryptredis *);
+int	 cryptredis_connected(const struct cryptredis *);
 int	 cryptredis_config_encrypt(struct cryptredis *, int);
+const char
+	*cryptredis_format_error(int);
+int	 cryptredis_config_raw(struct cryptredis *, int);
+int	 cryptredis_config_compress(struct cryptredis *, size_t);
+int	 cryptredis_config_keywatch(struct cryptredis *, int);
 
 int	 cryptredis_set(const char *, const char *);
 char	*cryptredis_get(const char *);
 
 int	 cryptredis_set_r(struct cryptredis *, const char *, const char *);
 int	 cryptredis_get_r(struct cryptredis *, const char *);
+int	 cryptredis_set_rn(struct cryptredis *, const char *, size_t,
+	    const void *, size_t);
+int	 cryptredis_get_rn(struct cryptredis *, const char *, size_t);
+int	 cryptredis_mget_r(struct cryptredis *, const char *const *,
+	    const size_t *, size_t);
+int	 cryptredis_mset_r(struct cryptredis *, const char *const *,
+	    const size_t *, const void *const *, const size_t *, size_t);
+int	 cryptredis_msetnx_r(struct cryptredis *, const char *const *,
+	    const size_t *, const void *const *, const size_t *, size_t);
 int	 cryptredis_ping_r(struct cryptredis *);
 int	 cryptredis_exists_r(struct cryptredis *, const char *);
 int	 cryptredis_del_r(struct cryptredis *, const char *);
 
+int	 cryptredis_pipeline_begin(struct cryptredis *);
+int	 cryptredis_pipeline_append_set(struct cryptredis *, const char *,
+	    size_t, const void *, size_t);
+int	 cryptredis_pipeline_append_get(struct cryptredis *, const char *,
+	    size_t);
+int	 cryptredis_pipeline_exec(struct cryptredis *);
+int	 cryptredis_pipeline_next(struct cryptredis *);
+
+/*
+ * Reply handles: a command given one leaves its reply there instead of in
+ * the handle's response, decrypted the same way, for the caller to keep
+ * as long as it likes.  The next command given the handle, or
+ * cryptredis_reply_release(), drops it; the memory is kept and the next
+ * replies are built in it, so a handle reused for replies of similar
+ * size allocates nothing.
+ */
+struct cryptredis_reply *
+	 cryptredis_reply_new(void);
+void	 cryptredis_reply_release(struct cryptredis_reply *);
+void	 cryptredis_reply_free(struct cryptredis_reply *);
+
+int	 cryptredis_get_rp(struct cryptredis *, const char *, size_t,
+	    struct cryptredis_reply *);
+int	 cryptredis_set_rp(struct cryptredis *, const char *, size_t,
+	    const void *, size_t, struct cryptredis_reply *);
+int	 cryptredis_mget_rp(struct cryptredis *, const char *const *,
+	    const size_t *, size_t, struct cryptredis_reply *);
+int	 cryptredis_del_rp(struct cryptredis *, const char *, size_t,
+	    struct cryptredis_reply *);
+int	 cryptredis_exists_rp(struct cryptredis *, const char *, size_t,
+	    struct cryptredis_reply *);
+int	 cryptredis_ping_rp(struct cryptredis *, struct cryptredis_reply *);
+
+int	 cryptredis_reply_type(const struct cryptredis_reply *);
+const char
+	*cryptredis_reply_string(const struct cryptredis_reply *);
+size_t	 cryptredis_reply_len(const struct cryptredis_reply *);
+long long
+	 cryptredis_reply_integer(const struct cryptredis_reply *);
+size_t	 cryptredis_reply_elements(const struct cryptredis_reply *);
+const char
+	*cryptredis_reply_element_string(const struct cryptredis_reply *,
+	    size_t);
+size_t	 cryptredis_reply_element_len(const struct cryptredis_reply *, size_t);
+int	 cryptredis_reply_element_type(const struct cryptredis_reply *,
+	    size_t);
+
+struct cryptredis_async *
+	 cryptredis_async_open(const char *, int);
+void	 cryptredis_async_close(struct cryptredis_async *);
+int	 cryptredis_async_set(struct cryptredis_async *, const char *, size_t,
+	    const void *, size_t, cryptredis_async_fn *, void *);
+int	 cryptredis_async_get(struct cryptredis_async *, const char *, size_t,
+	    cryptredis_async_fn *, void *);
+
+ssize_t	 cryptredis_value_seal(const struct cryptredis *, const void *, size_t,
+	    char **);
+ssize_t	 cryptredis_value_open(const struct cryptredis *, char **, size_t);
+
 const char
 	*cryptredis_response_string(const struct cryptredis *);
+size_t	 cryptredis_response_len(const struct cryptredis *);
+long long
+	 cryptredis_response_integer(const struct cryptredis *);
 int	 cryptredis_response_type(const struct cryptredis *);
+size_t	 cryptredis_response_elements(const struct cryptredis *);
+const char
+	*cryptredis_response_element_string(const struct cryptredis *, size_t);
+size_t	 cryptredis_response_element_len(const struct cryptredis *, size_t);
+int	 cryptredis_response_element_type(const struct cryptredis *, size_t);
+char	*cryptredis_response_take(struct cryptredis *);
+char	*cryptredis_response_element_take(struct cryptredis *, size_t);
 void	 cryptredis_response_free(struct cryptredis *);
 
 #ifdef __cplusplus
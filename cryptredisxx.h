@@ -17,10 +17,15 @@
 #ifndef CRYPTREDISXX_H
 #define CRYPTREDISXX_H
 
+#include <functional>
 #include <string>
+#include <string_view>
 #include <list>
+#include <utility>
 #include <vector>
 
+struct redisAsyncContext;
+
 #define CRPTRDS_NAMESPACE       CrptRds
 #define CRPTRDS_USE_NAMESPACE   using namespace ::CRPTRDS_NAMESPACE;
 #define CRPTRDS_BEGIN_NAMESPACE namespace CRPTRDS_NAMESPACE {
@@ -30,7 +35,12 @@ using namespace std;
 
 CRPTRDS_BEGIN_NAMESPACE
 
-class CryptRedisResultPrivate;
+/*
+ * A reply, moved rather than copied.  Strings up to InlineSize bytes are
+ * kept in the result itself, longer ones in the buffer the reply was read
+ * and decrypted into, taken over without a copy; view() looks at them in
+ * place.
+ */
 class CryptRedisResult
 {
 public:
@@ -47,25 +57,30 @@ public:
 	static const int String;
 	static const int Array;
 
-	explicit CryptRedisResult();
-	virtual ~CryptRedisResult();
+	static const size_t InlineSize = 32;
+
+	CryptRedisResult();
+	CryptRedisResult(CryptRedisResult &&) noexcept;
+	CryptRedisResult(const CryptRedisResult &) = delete;
+	~CryptRedisResult();
+
+	CryptRedisResult &operator=(CryptRedisResult &&) noexcept;
+	CryptRedisResult &operator=(const CryptRedisResult &) = delete;
 
 	void setStatus(int d);
-	int status();
-	string statusString();
-	static inline string statusString(int s) {
-		CryptRedisResult r;
-		r.setStatus(s);
-		return r.statusString();
-	};
+	int status() const;
+	string statusString() const;
+	static string statusString(int s);
 
 	int error();
-	string errorString();
+	string errorString() const;
 
-	void setData(const string &d);
+	void setData(string_view d);
 	void setData(long long d);
+	void adoptData(char *buf, size_t len);	// malloc(3)'d, or NULL
 
 	string toString() const;
+	string_view view() const;
 	int toInteger() const;
 
 	void setType(int t);
@@ -77,7 +92,16 @@ public:
 	void clear();
 
 private:
-	CryptRedisResultPrivate *d;
+	char		*heap;		/* or NULL, the string is in sbuf */
+	size_t		 len;
+	long long	 integer;
+	int		 rtype;
+	int		 rsize;
+	int		 rstatus;
+	char		 sbuf[InlineSize];
+
+	void release();
+	void moveFrom(CryptRedisResult &);
 };
 
 class CryptRedisResultSet : public list<CryptRedisResult>
@@ -86,10 +110,23 @@ public:
 	string statusString() { return string(); };
 };
 
+/*
+ * Same threading contract as the C API: a CryptRedisDb wraps one struct
+ * cryptredis handle, use it from one thread at a time; separate instances
+ * may run in parallel threads.
+ */
 class CryptRedisDbPrivate;
 class CryptRedisDb
 {
 public:
+	// value formats, CRYPTREDIS_FMT_* in cryptredis.h
+	enum {
+		LegacyFormat	= 1,
+		CtrHmacFormat	= 2,
+		CbcFormat	= 3,
+		ChachaPolyFormat = 4
+	};
+
 	explicit CryptRedisDb();
 	virtual ~CryptRedisDb();
 
@@ -104,15 +141,26 @@ public:
 
 	int setCryptEnabled(bool);
 	bool cryptEnabled();
+	int setCryptFormat(int f);
+	int cryptFormat();
+	void setRawStorage(bool);
+	bool rawStorage();
+	int setCompression(bool, size_t min = 128);	// CRYPTREDIS_LZ4_MIN
+	bool compression();
+	int setKeyWatch(bool);
+	bool keyWatch();
 	int resetKey();
 
 	// Redis commands
 	void get(const string &k, CryptRedisResult *rpl);
 	CryptRedisResult get(const string &k);
-	void mget(const vector<string> &keys,
-	    CryptRedisResultSet *rpl) { return; };
+	void mget(const vector<string> &keys, CryptRedisResultSet *rpl);
 	int set(const string &k, const string &v,
 	    CryptRedisResult *rpl = 0);
+	int mset(const vector<pair<string, string> > &kvs,
+	    CryptRedisResult *rpl = 0);
+	int msetnx(const vector<pair<string, string> > &kvs,
+	    CryptRedisResult *rpl = 0);
 	int del(const string &k, CryptRedisResult *rpl = 0);
 	int exists(const string &k, CryptRedisResult *rpl = 0);
 	int ping(CryptRedisResult *rpl = 0);
@@ -123,6 +171,85 @@ private:
 	CryptRedisDbPrivate *d;
 };
 
+/*
+ * A bounded set of CryptRedisDb connections threads share: acquire() one,
+ * use it from that thread alone, release() it.  Taking and returning a
+ * free connection is lock-free; only threads waiting for one when all
+ * are out block, for up to the timeout given.  Connections open on first
+ * use and again once they failed, those idle for the idle check time are
+ * PINGed before being handed out.  They all share the derived keys, see
+ * the keyring.  Configure the pool before the first acquire(), release
+ * every connection before deleting it.
+ */
+class CryptRedisPoolPrivate;
+class CryptRedisPool
+{
+public:
+	explicit CryptRedisPool(size_t n, const string &h = string(),
+	    int p = -1);
+	virtual ~CryptRedisPool();
+
+	size_t size() const;
+	size_t available() const;
+
+	// settings of every connection, see CryptRedisDb
+	void setCryptEnabled(bool);
+	int setCryptFormat(int f);
+	void setRawStorage(bool);
+	int setCompression(bool, size_t min = 128);	// CRYPTREDIS_LZ4_MIN
+	void setKeyWatch(bool);
+	void setIdleCheck(int ms);	// 0 never checks
+
+	// ms to wait, -1 forever, 0 not at all; NULL on timeout or failure
+	CryptRedisDb *acquire(int timeout = -1);
+	void release(CryptRedisDb *);
+
+private:
+	CryptRedisPoolPrivate *d;
+};
+
+/*
+ * Asynchronous commands on the caller's event loop, see struct
+ * cryptredis_async: after open(), attach context() with one of the
+ * hiredis adapters, redisLibeventAttach() or redisLibevAttach(), and run
+ * the loop.  A callback gets its result once the reply is in and opened,
+ * a Fail one if the connection went away first.  Use it from the loop's
+ * thread only.
+ */
+class CryptRedisAsyncDbPrivate;
+class CryptRedisAsyncDb
+{
+public:
+	typedef function<void (CryptRedisResult &)> Callback;
+
+	explicit CryptRedisAsyncDb();
+	virtual ~CryptRedisAsyncDb();
+
+	bool open(const string &h = string(), int p = -1);
+	void close();
+	bool connected();
+	struct redisAsyncContext *context();
+
+	int setCryptEnabled(bool);
+	bool cryptEnabled();
+	int setCryptFormat(int f);
+	int cryptFormat();
+	void setRawStorage(bool);
+	bool rawStorage();
+	int setCompression(bool, size_t min = 128);	// CRYPTREDIS_LZ4_MIN
+	bool compression();
+
+	// Redis commands, queued; -1 if they can't be
+	int get(const string &k, const Callback &cb);
+	int set(const string &k, const string &v,
+	    const Callback &cb = Callback());
+
+	string lastError();
+
+private:
+	CryptRedisAsyncDbPrivate *d;
+};
+
 CRPTRDS_END_NAMESPACE
 
 namespace CRPTRDS_NAMESPACE {}
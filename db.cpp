@@ -14,6 +14,8 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdlib.h>
+
 #include "hiredis/hiredis.h"
 #include "cryptredis.h"
 #include "cryptredisxx.h"
@@ -24,15 +26,47 @@ struct CryptRedisDbPrivate {
 	struct cryptredis	*cryptredis;
 	string			 host;
 	int			 port;
+	int			 format;
+	bool			 raw;
+	bool			 lz4;
+	size_t			 lz4min;
+	bool			 keywatch;
 	string			 errmsg;
 
 	void buildReply(CryptRedisResult *);
+	void buildReplySet(CryptRedisResultSet *);
+	int mset(bool, const vector<pair<string, string> > &,
+	    CryptRedisResult *);
+	int writeFormat() const;
+	string configError(int) const;
 };
 
+/* the configured format with the compression flag or'ed in */
+int
+CryptRedisDbPrivate::writeFormat() const
+{
+	return (format | (lz4 ? CRYPTREDIS_FMT_LZ4 : 0));
+}
+
+/* why cryptredis_config_encrypt() refused format */
+string
+CryptRedisDbPrivate::configError(int f) const
+{
+	const char	*errstr;
+
+	if ((errstr = cryptredis_format_error(f)) != NULL)
+		return (errstr);
+	if (getenv("CRYPTREDIS_KEYFILE") == NULL)
+		return ("CRYPTREDIS_KEYFILE environment variable not set");
+
+	return ("can't read the key files in CRYPTREDIS_KEYFILE");
+}
+
 void 
 CryptRedisDbPrivate::buildReply(CryptRedisResult *rpl)
 {
-	int type;
+	size_t	len;
+	int	type;
 
 	rpl->invalidate();
 
@@ -46,17 +80,47 @@ CryptRedisDbPrivate::buildReply(CryptRedisResult *rpl)
 		/* FALLTHROUGH */
 	case REDIS_REPLY_STATUS:
 	case REDIS_REPLY_STRING:
-		rpl->setData(cryptredis_response_string(cryptredis));
+		len = cryptredis_response_len(cryptredis);
+		rpl->adoptData(cryptredis_response_take(cryptredis), len);
 		break;
+	case REDIS_REPLY_INTEGER:
+		rpl->setData(cryptredis_response_integer(cryptredis));
 		break;
 	case REDIS_REPLY_ARRAY:
-		// TODO
+		rpl->setSize(cryptredis_response_elements(cryptredis));
 		break;
 	}
 
 	cryptredis_response_free(cryptredis);
 }
 
+/* one result per element of an array reply, nil elements stay Nil */
+void
+CryptRedisDbPrivate::buildReplySet(CryptRedisResultSet *rpl)
+{
+	size_t	i, n;
+	int	type;
+
+	rpl->clear();
+
+	n = cryptredis_response_elements(cryptredis);
+	for (i = 0; i < n; i++) {
+		rpl->emplace_back();
+		CryptRedisResult &res = rpl->back();
+
+		type = cryptredis_response_element_type(cryptredis, i);
+		res.setType(type);
+		res.setStatus(type == REDIS_REPLY_ERROR ?
+		    CryptRedisResult::Fail : CryptRedisResult::Ok);
+		if (type == REDIS_REPLY_STRING || type == REDIS_REPLY_ERROR)
+			res.adoptData(
+			    cryptredis_response_element_take(cryptredis, i),
+			    cryptredis_response_element_len(cryptredis, i));
+	}
+
+	cryptredis_response_free(cryptredis);
+}
+
 bool
 CryptRedisDb::open(const string &h, int p)
 {
@@ -71,6 +135,9 @@ CryptRedisDb::open(const string &h, int p)
 
 	if ((d->cryptredis = cryptredis_open(d->host.data(), d->port)) == NULL)
 		return (false);
+	cryptredis_config_raw(d->cryptredis, d->raw);
+	cryptredis_config_compress(d->cryptredis, d->lz4min);
+	cryptredis_config_keywatch(d->cryptredis, d->keywatch);
 
 	return (d->cryptredis->cr_connected);
 }
@@ -88,6 +155,11 @@ CryptRedisDb::CryptRedisDb() :
 	d(new CryptRedisDbPrivate)
 {
 	d->port = -1;
+	d->format = LegacyFormat;
+	d->raw = false;
+	d->lz4 = false;
+	d->lz4min = CRYPTREDIS_LZ4_MIN;
+	d->keywatch = false;
 	d->cryptredis = NULL;
 }
 
@@ -99,9 +171,10 @@ CryptRedisDb::~CryptRedisDb()
 	delete d;
 }
 
+/* false as well once the connection failed, open() again then */
 bool CryptRedisDb::connected()
 {
-	if (d->cryptredis && d->cryptredis->cr_connected)
+	if (d->cryptredis && cryptredis_connected(d->cryptredis))
 		return (true);
 
 	return (false);
@@ -112,7 +185,8 @@ CryptRedisDb::get(const string &key)
 {
 	CryptRedisResult	 res;
 
-	cryptredis_get_r(d->cryptredis, key.data());
+	if (cryptredis_get_rn(d->cryptredis, key.data(), key.size()) == -1)
+		return (res);
 
 	d->buildReply(&res);
 	return (res);
@@ -121,25 +195,114 @@ CryptRedisDb::get(const string &key)
 void 
 CryptRedisDb::get(const string &key, CryptRedisResult *reply)
 {
-	if (cryptredis_get_r(d->cryptredis, key.data()) == -1)
+	if (cryptredis_get_rn(d->cryptredis, key.data(), key.size()) == -1)
 		return;
 
 	d->buildReply(reply);
 }
 
+/*
+ * Values of keys in one round trip, in order; rpl holds a Nil result for
+ * each missing key.
+ */
+void
+CryptRedisDb::mget(const vector<string> &keys, CryptRedisResultSet *rpl)
+{
+	vector<const char *>	argv;
+	vector<size_t>		argvlen;
+
+	rpl->clear();
+	if (keys.empty())
+		return;
+
+	argv.reserve(keys.size());
+	argvlen.reserve(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		argv.push_back(keys[i].data());
+		argvlen.push_back(keys[i].size());
+	}
+	if (cryptredis_mget_r(d->cryptredis, argv.data(), argvlen.data(),
+	    keys.size()) == -1)
+		return;
+
+	d->buildReplySet(rpl);
+}
+
 int
 CryptRedisDb::set(const string &key, const string &value,
 	CryptRedisResult *reply)
 {
 	int res;
 
-	res = cryptredis_set_r(d->cryptredis, key.data(), value.data());
+	res = cryptredis_set_rn(d->cryptredis, key.data(), key.size(),
+	    value.data(), value.size());
+	if (res == -1) {
+		if (reply)
+			reply->clear();	/* Fail, nothing was read */
+		return (res);
+	}
 
 	if (reply) {
 		d->buildReply(reply);
 		reply->setData(res);
+	} else
+		cryptredis_response_free(d->cryptredis);
+
+	return (res);
+}
+
+/*
+ * Set every key of kvs in one command, the values encrypted together; see
+ * cryptredis_mset_r().
+ */
+int
+CryptRedisDb::mset(const vector<pair<string, string> > &kvs,
+	CryptRedisResult *reply)
+{
+	return (d->mset(false, kvs, reply));
+}
+
+/* like mset(), unless one of the keys exists; reply->toInteger() is 1 if set */
+int
+CryptRedisDb::msetnx(const vector<pair<string, string> > &kvs,
+	CryptRedisResult *reply)
+{
+	return (d->mset(true, kvs, reply));
+}
+
+int
+CryptRedisDbPrivate::mset(bool nx,
+    const vector<pair<string, string> > &kvs, CryptRedisResult *reply)
+{
+	vector<const char *>	keys;
+	vector<const void *>	vals;
+	vector<size_t>		klens, vlens;
+	int			res;
+
+	keys.reserve(kvs.size());
+	klens.reserve(kvs.size());
+	vals.reserve(kvs.size());
+	vlens.reserve(kvs.size());
+	for (size_t i = 0; i < kvs.size(); i++) {
+		keys.push_back(kvs[i].first.data());
+		klens.push_back(kvs[i].first.size());
+		vals.push_back(kvs[i].second.data());
+		vlens.push_back(kvs[i].second.size());
+	}
+
+	res = (nx ? cryptredis_msetnx_r : cryptredis_mset_r)(cryptredis,
+	    keys.data(), klens.data(), vals.data(), vlens.data(), kvs.size());
+	if (res == -1) {
+		if (reply)
+			reply->clear();
+		return (res);
 	}
 
+	if (reply)
+		buildReply(reply);
+	else
+		cryptredis_response_free(cryptredis);
+
 	return (res);
 }
 
@@ -149,12 +312,18 @@ CryptRedisDb::exists(const string &key, CryptRedisResult *reply)
 	int res;
 
 	res = cryptredis_exists_r(d->cryptredis, key.data());
+	if (res == -1) {
+		if (reply)
+			reply->clear();
+		return (res);
+	}
 
 	if (reply) {
 		d->buildReply(reply);
 		if (!res)
 			reply->setData(1);
-	}
+	} else
+		cryptredis_response_free(d->cryptredis);
 
 	return (res);
 }
@@ -165,11 +334,17 @@ CryptRedisDb::ping(CryptRedisResult *reply)
 	int res;
 
 	res = cryptredis_ping_r(d->cryptredis);
+	if (res == -1) {
+		if (reply)
+			reply->clear();
+		return (res);
+	}
 
 	if (reply) {
 		d->buildReply(reply);
 		reply->setData(res);
-	}
+	} else
+		cryptredis_response_free(d->cryptredis);
 
 	return (res);
 }
@@ -180,11 +355,17 @@ CryptRedisDb::del(const string &key, CryptRedisResult *reply)
 	int res;
 
 	res = cryptredis_del_r(d->cryptredis, key.data());
+	if (res == -1) {
+		if (reply)
+			reply->clear();
+		return (res);
+	}
 
 	if (reply) {
 		d->buildReply(reply);
 		reply->setData(res);
-	}
+	} else
+		cryptredis_response_free(d->cryptredis);
 
 	return (res);
 }
@@ -204,22 +385,134 @@ CryptRedisDb::setPort(int p)
 int
 CryptRedisDb::resetKey()
 {
-	return (cryptredis_config_encrypt(d->cryptredis, cryptEnabled() ? 1 :
-	    0));
+	return (setCryptEnabled(cryptEnabled()));
 }
 
+/* on error encryption stays as it was, see lastError() for why */
 int
 CryptRedisDb::setCryptEnabled(bool enable)
 {
-	int res;
+	int	f = enable ? d->writeFormat() : CRYPTREDIS_FMT_NONE;
+	int	res;
 
-	if ((res = cryptredis_config_encrypt(d->cryptredis, enable ? 1 : 0)) ==
-	    -1)
-		d->errmsg = "CRYPTREDIS_KEYFILE environment variable not set";
+	if ((res = cryptredis_config_encrypt(d->cryptredis, f)) == -1)
+		d->errmsg = d->configError(f);
 
 	return (res);
 }
 
+/*
+ * Format used for values written from now on, applied right away when
+ * encryption is already on.  -1 and nothing changed if it can't be, an
+ * unknown format or LegacyFormat with compression on.
+ */
+int
+CryptRedisDb::setCryptFormat(int f)
+{
+	int	old = d->format;
+	int	wf = f | (d->lz4 ? CRYPTREDIS_FMT_LZ4 : 0);
+
+	if (cryptredis_format_error(wf) != NULL) {
+		d->errmsg = d->configError(wf);
+		return (-1);
+	}
+
+	d->format = f;
+	if (d->cryptredis && cryptEnabled() && setCryptEnabled(true) == -1) {
+		d->format = old;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+CryptRedisDb::cryptFormat()
+{
+	return (d->format);
+}
+
+/*
+ * Store encrypted values as raw ciphertext instead of base64 text, see
+ * cryptredis_config_raw().
+ */
+void
+CryptRedisDb::setRawStorage(bool raw)
+{
+	d->raw = raw;
+
+	if (d->cryptredis)
+		cryptredis_config_raw(d->cryptredis, raw);
+}
+
+bool
+CryptRedisDb::rawStorage()
+{
+	return (d->raw);
+}
+
+/*
+ * Compress values of min bytes or more before encrypting them, see
+ * cryptredis_config_encrypt(); not with LegacyFormat, -1 and nothing
+ * changed then.
+ */
+int
+CryptRedisDb::setCompression(bool enable, size_t min)
+{
+	bool	oldlz4 = d->lz4;
+	size_t	oldmin = d->lz4min;
+
+	if (enable && cryptredis_format_error(d->format |
+	    CRYPTREDIS_FMT_LZ4) != NULL) {
+		d->errmsg = d->configError(d->format | CRYPTREDIS_FMT_LZ4);
+		return (-1);
+	}
+
+	d->lz4 = enable;
+	d->lz4min = min;
+	if (d->cryptredis) {
+		cryptredis_config_compress(d->cryptredis, min);
+		if (cryptEnabled() && setCryptEnabled(true) == -1) {
+			d->lz4 = oldlz4;
+			d->lz4min = oldmin;
+			cryptredis_config_compress(d->cryptredis, oldmin);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+bool
+CryptRedisDb::compression()
+{
+	return (d->lz4);
+}
+
+/*
+ * Pick up changes to the key files without opening again, see
+ * cryptredis_config_keywatch().
+ */
+int
+CryptRedisDb::setKeyWatch(bool watch)
+{
+	d->keywatch = watch;
+
+	if (d->cryptredis) {
+		cryptredis_config_keywatch(d->cryptredis, watch);
+		if (cryptEnabled())
+			return (setCryptEnabled(true));
+	}
+
+	return (0);
+}
+
+bool
+CryptRedisDb::keyWatch()
+{
+	return (d->keywatch);
+}
+
 bool
 CryptRedisDb::cryptEnabled()
 {
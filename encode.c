@@ -15,40 +15,573 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * Base64 (RFC 4648, padded), byte for byte what b64_ntop() writes.  The
+ * decoder is strict: no whitespace, padding only at the end and the bits
+ * it drops must be zero, so every value has a single encoding.
+ *
+ * The vector loops translate 12/24/48 bytes per pass and leave the tail,
+ * and anything they don't like, to the scalar code, which alone decides
+ * whether input is malformed.  They follow the pshufb and vqtbl schemes
+ * of Wojciech Mula and Daniel Lemire.
+ */
+
 #include <sys/types.h>
 
-#include <err.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <netinet/in.h>
-#include <resolv.h>
-#include <sys/param.h>
 
 #include "encode.h"
 
+static int	cryptredis_b64_probe(void);
+static size_t	b64_enc_scalar(char *, const u_int8_t *, size_t);
+static ssize_t	b64_dec_scalar(u_int8_t *, const char *, size_t);
+
+static int	cryptredis_b64 = -1;
+
+static const char b64_enc[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* 0xff: not in the alphabet */
+static const u_int8_t b64_dec[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+	0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+	0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+	0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+	0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
 size_t
 cryptredis_encsiz(int len)
 {
 	return (((len + 2) / 3) * 4 + 1);
 }
 
-void
+/* raw length of a padded encoding of slen chars, not validated */
+size_t
+cryptredis_decsiz(const char *src, size_t slen)
+{
+	size_t	len;
+
+	if (slen % 4 != 0)
+		return (0);
+	len = slen / 4 * 3;
+	if (slen > 0 && src[slen - 1] == '=')
+		len--;
+	if (slen > 1 && src[slen - 2] == '=')
+		len--;
+
+	return (len);
+}
+
+static size_t
+b64_enc_scalar(char *dst, const u_int8_t *src, size_t slen)
+{
+	char	*d = dst;
+	size_t	 i;
+
+	for (i = 0; i + 3 <= slen; i += 3, d += 4) {
+		d[0] = b64_enc[src[i] >> 2];
+		d[1] = b64_enc[(src[i] & 0x03) << 4 | src[i + 1] >> 4];
+		d[2] = b64_enc[(src[i + 1] & 0x0f) << 2 | src[i + 2] >> 6];
+		d[3] = b64_enc[src[i + 2] & 0x3f];
+	}
+	switch (slen - i) {
+	case 2:
+		d[0] = b64_enc[src[i] >> 2];
+		d[1] = b64_enc[(src[i] & 0x03) << 4 | src[i + 1] >> 4];
+		d[2] = b64_enc[(src[i + 1] & 0x0f) << 2];
+		d[3] = '=';
+		d += 4;
+		break;
+	case 1:
+		d[0] = b64_enc[src[i] >> 2];
+		d[1] = b64_enc[(src[i] & 0x03) << 4];
+		d[2] = d[3] = '=';
+		d += 4;
+		break;
+	}
+
+	return (d - dst);
+}
+
+/* slen is a multiple of 4, dst has room for the whole result */
+static ssize_t
+b64_dec_scalar(u_int8_t *dst, const char *src, size_t slen)
+{
+	const u_int8_t	*s = (const u_int8_t *)src;
+	u_int8_t	*d = dst;
+	u_int32_t	 a, b, c, e;
+	size_t		 i;
+
+	for (i = 0; i < slen; i += 4) {
+		a = b64_dec[s[i]];
+		b = b64_dec[s[i + 1]];
+		c = b64_dec[s[i + 2]];
+		e = b64_dec[s[i + 3]];
+
+		if (i + 4 == slen && s[i + 3] == '=') {
+			if ((a | b) & 0x80)
+				return (-1);
+			if (s[i + 2] == '=') {
+				/* xx==, the low 4 bits of b are dropped */
+				if (b & 0x0f)
+					return (-1);
+				*d++ = (u_int8_t)(a << 2 | b >> 4);
+				break;
+			}
+			/* xxx=, the low 2 bits of c are dropped */
+			if ((c & 0x80) || (c & 0x03))
+				return (-1);
+			*d++ = (u_int8_t)(a << 2 | b >> 4);
+			*d++ = (u_int8_t)(b << 4 | c >> 2);
+			break;
+		}
+
+		if ((a | b | c | e) & 0x80)
+			return (-1);
+		*d++ = (u_int8_t)(a << 2 | b >> 4);
+		*d++ = (u_int8_t)(b << 4 | c >> 2);
+		*d++ = (u_int8_t)(c << 6 | e);
+	}
+
+	return (d - dst);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define B64_SSE41_TARGET	__attribute__((target("ssse3,sse4.1")))
+#define B64_AVX2_TARGET		__attribute__((target("avx2")))
+
+static size_t	b64_enc_sse41(char *, const u_int8_t *, size_t);
+static size_t	b64_dec_sse41(u_int8_t *, const char *, size_t, size_t);
+static size_t	b64_enc_avx2(char *, const u_int8_t *, size_t);
+static size_t	b64_dec_avx2(u_int8_t *, const char *, size_t, size_t);
+
+static int
+cryptredis_b64_probe(void)
+{
+	unsigned int	eax, ebx, ecx, edx, xcr0;
+	int		sse41;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+		return (CRYPTREDIS_B64_SCALAR);
+	sse41 = (ecx & bit_SSSE3) != 0 && (ecx & bit_SSE4_1) != 0;
+
+	if ((ecx & bit_OSXSAVE) == 0)
+		return (sse41 ? CRYPTREDIS_B64_SSE41 : CRYPTREDIS_B64_SCALAR);
+	__asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+	if ((xcr0 & 0x6) == 0x6 &&
+	    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 &&
+	    (ebx & bit_AVX2) != 0)
+		return (CRYPTREDIS_B64_AVX2);
+
+	return (sse41 ? CRYPTREDIS_B64_SSE41 : CRYPTREDIS_B64_SCALAR);
+}
+
+/*
+ * Encode: spread 12 bytes to 16 lanes of 6 bits with a shuffle and two
+ * multiplies, then map each 6 bit index onto its character by adding an
+ * offset picked per range ('A', 'a', '0', '+', '/').
+ */
+static B64_SSE41_TARGET size_t
+b64_enc_sse41(char *dst, const u_int8_t *src, size_t slen)
+{
+	const __m128i	shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+			    4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i	offs = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63,
+			    'A', 0, 0);
+	__m128i		in, idx, r;
+	size_t		i;
+
+	/* reads 16 bytes for 12 */
+	for (i = 0; i + 16 <= slen; i += 12, dst += 16) {
+		in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+		    (src + i)), shuf);
+		idx = _mm_or_si128(
+		    _mm_mulhi_epu16(_mm_and_si128(in,
+		    _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+		    _mm_mullo_epi16(_mm_and_si128(in,
+		    _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
+
+		/* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12 */
+		r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(
+		    _mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+		r = _mm_add_epi8(_mm_shuffle_epi8(offs, r), idx);
+		_mm_storeu_si128((__m128i *)dst, r);
+	}
+
+	return (i);
+}
+
+/*
+ * Decode: two nibble lookups flag anything outside the alphabet, a third
+ * gives the offset back to the 6 bit value, then multiply-adds pack four
+ * sextets into three bytes.  Returns the chars consumed, stops early on
+ * a bad vector and never eats the last quantum, which may hold padding.
+ */
+static B64_SSE41_TARGET size_t
+b64_dec_sse41(u_int8_t *dst, const char *src, size_t slen, size_t dlen)
+{
+	const __m128i	lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11,
+			    0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b,
+			    0x1b, 0x1b, 0x1a);
+	const __m128i	lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04,
+			    0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10,
+			    0x10, 0x10, 0x10);
+	const __m128i	lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71,
+			    -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i	pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+			    13, 12, -1, -1, -1, -1);
+	const __m128i	m2f = _mm_set1_epi8(0x2f);
+	__m128i		in, hi, lo, roll;
+	size_t		i, o;
+
+	/* writes 16 bytes for 12 */
+	for (i = o = 0; i + 16 < slen && o + 16 <= dlen; i += 16, o += 12) {
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+		hi = _mm_and_si128(_mm_srli_epi32(in, 4), m2f);
+		lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, m2f));
+		if (!_mm_testz_si128(lo, _mm_shuffle_epi8(lut_hi, hi)))
+			break;
+		roll = _mm_shuffle_epi8(lut_roll,
+		    _mm_add_epi8(_mm_cmpeq_epi8(in, m2f), hi));
+		in = _mm_add_epi8(in, roll);
+
+		in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+		in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i *)(dst + o),
+		    _mm_shuffle_epi8(in, pack));
+	}
+
+	return (i);
+}
+
+/* the same per 128-bit lane, two vectors of 12 bytes at a time */
+static B64_AVX2_TARGET size_t
+b64_enc_avx2(char *dst, const u_int8_t *src, size_t slen)
+{
+	const __m256i	shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+			    4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8, 6, 7,
+			    4, 5, 3, 4, 1, 2, 0, 1);
+	const __m256i	offs = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63,
+			    'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			    '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	__m256i		in, idx, r;
+	size_t		i;
+
+	/* reads 28 bytes for 24 */
+	for (i = 0; i + 28 <= slen; i += 24, dst += 32) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+		    _mm_loadu_si128((const __m128i *)(src + i))),
+		    _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		idx = _mm256_or_si256(
+		    _mm256_mulhi_epu16(_mm256_and_si256(in,
+		    _mm256_set1_epi32(0x0fc0fc00)),
+		    _mm256_set1_epi32(0x04000040)),
+		    _mm256_mullo_epi16(_mm256_and_si256(in,
+		    _mm256_set1_epi32(0x003f03f0)),
+		    _mm256_set1_epi32(0x01000010)));
+
+		r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+		r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(
+		    _mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+		r = _mm256_add_epi8(_mm256_shuffle_epi8(offs, r), idx);
+		_mm256_storeu_si256((__m256i *)dst, r);
+	}
+
+	return (i);
+}
+
+static B64_AVX2_TARGET size_t
+b64_dec_avx2(u_int8_t *dst, const char *src, size_t slen, size_t dlen)
+{
+	const __m256i	lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11,
+			    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+			    0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11,
+			    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+			    0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i	lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02,
+			    0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+			    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02,
+			    0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+			    0x10, 0x10, 0x10, 0x10);
+	const __m256i	lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65,
+			    -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+			    -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i	pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+			    14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10,
+			    9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i	m2f = _mm256_set1_epi8(0x2f);
+	__m256i		in, hi, lo, roll;
+	size_t		i, o;
+
+	/* writes 32 bytes for 24 */
+	for (i = o = 0; i + 32 < slen && o + 32 <= dlen; i += 32, o += 24) {
+		in = _mm256_loadu_si256((const __m256i *)(src + i));
+		hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), m2f);
+		lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(in, m2f));
+		if (!_mm256_testz_si256(lo, _mm256_shuffle_epi8(lut_hi, hi)))
+			break;
+		roll = _mm256_shuffle_epi8(lut_roll,
+		    _mm256_add_epi8(_mm256_cmpeq_epi8(in, m2f), hi));
+		in = _mm256_add_epi8(in, roll);
+
+		in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+		in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+		in = _mm256_shuffle_epi8(in, pack);
+		/* 12 bytes at the bottom of each lane, close the gap */
+		in = _mm256_permutevar8x32_epi32(in,
+		    _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i *)(dst + o), in);
+	}
+
+	return (i);
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+static size_t	b64_enc_neon(char *, const u_int8_t *, size_t);
+static size_t	b64_dec_neon(u_int8_t *, const char *, size_t, size_t);
+
+static int
+cryptredis_b64_probe(void)
+{
+	/* Advanced SIMD is mandatory on aarch64 */
+	return (CRYPTREDIS_B64_NEON);
+}
+
+/* de-interleaving loads do the 3 <-> 4 regrouping, 64 entry tables */
+static size_t
+b64_enc_neon(char *dst, const u_int8_t *src, size_t slen)
+{
+	uint8x16x4_t	tab, out;
+	uint8x16x3_t	in;
+	uint8x16_t	m3f = vdupq_n_u8(0x3f);
+	size_t		i;
+
+	tab.val[0] = vld1q_u8((const u_int8_t *)b64_enc);
+	tab.val[1] = vld1q_u8((const u_int8_t *)b64_enc + 16);
+	tab.val[2] = vld1q_u8((const u_int8_t *)b64_enc + 32);
+	tab.val[3] = vld1q_u8((const u_int8_t *)b64_enc + 48);
+
+	for (i = 0; i + 48 <= slen; i += 48, dst += 64) {
+		in = vld3q_u8(src + i);
+		out.val[0] = vshrq_n_u8(in.val[0], 2);
+		out.val[1] = vandq_u8(vsliq_n_u8(vshrq_n_u8(in.val[1], 4),
+		    in.val[0], 4), m3f);
+		out.val[2] = vandq_u8(vsliq_n_u8(vshrq_n_u8(in.val[2], 6),
+		    in.val[1], 2), m3f);
+		out.val[3] = vandq_u8(in.val[2], m3f);
+
+		out.val[0] = vqtbl4q_u8(tab, out.val[0]);
+		out.val[1] = vqtbl4q_u8(tab, out.val[1]);
+		out.val[2] = vqtbl4q_u8(tab, out.val[2]);
+		out.val[3] = vqtbl4q_u8(tab, out.val[3]);
+		vst4q_u8((u_int8_t *)dst, out);
+	}
+
+	return (i);
+}
+
+static size_t
+b64_dec_neon(u_int8_t *dst, const char *src, size_t slen, size_t dlen)
+{
+	uint8x16x4_t	lo, hi, in;
+	uint8x16x3_t	out;
+	uint8x16_t	bad, c64 = vdupq_n_u8(64);
+	size_t		i, o;
+	int		j;
+
+	for (j = 0; j < 4; j++) {
+		lo.val[j] = vld1q_u8(b64_dec + 16 * j);
+		hi.val[j] = vld1q_u8(b64_dec + 64 + 16 * j);
+	}
+
+	for (i = o = 0; i + 64 < slen && o + 48 <= dlen; i += 64, o += 48) {
+		in = vld4q_u8((const u_int8_t *)src + i);
+		bad = vdupq_n_u8(0);
+		for (j = 0; j < 4; j++) {
+			/* chars >= 128 hit neither table, flag them apart */
+			bad = vorrq_u8(bad, vandq_u8(in.val[j],
+			    vdupq_n_u8(0x80)));
+			in.val[j] = vqtbx4q_u8(vqtbl4q_u8(lo, in.val[j]), hi,
+			    vsubq_u8(in.val[j], c64));
+			bad = vorrq_u8(bad, in.val[j]);
+		}
+		if (vmaxvq_u8(bad) > 0x3f)
+			break;
+
+		out.val[0] = vsliq_n_u8(vshrq_n_u8(in.val[1], 4),
+		    in.val[0], 2);
+		out.val[1] = vsliq_n_u8(vshrq_n_u8(in.val[2], 2),
+		    in.val[1], 4);
+		out.val[2] = vsliq_n_u8(in.val[3], in.val[2], 6);
+		vst3q_u8(dst + o, out);
+	}
+
+	return (i);
+}
+
+#else /* no vector code compiled in */
+
+static int
+cryptredis_b64_probe(void)
+{
+	return (CRYPTREDIS_B64_SCALAR);
+}
+
+#endif
+
+/*
+ * Encode slen bytes of src plus a NUL into dst, returns the length of the
+ * encoding or -1 if dst is shorter than cryptredis_encsiz(slen).  src may
+ * lie inside dst if it ends no sooner than the encoding: every pass reads
+ * its input before writing, and output grows by 4/3 of what was read.
+ */
+ssize_t
+cryptredis_encode_impl(int impl, char *dst, size_t dlen, const void *src,
+    size_t slen)
+{
+	const u_int8_t	*s = src;
+	size_t		 n = 0;
+
+	if (dlen < (slen + 2) / 3 * 4 + 1)
+		return (-1);
+
+	switch (impl) {
+#if defined(__x86_64__) || defined(__i386__)
+	case CRYPTREDIS_B64_AVX2:
+		n = b64_enc_avx2(dst, s, slen);
+		/* FALLTHROUGH */
+	case CRYPTREDIS_B64_SSE41:
+		n += b64_enc_sse41(dst + n / 3 * 4, s + n, slen - n);
+		break;
+#elif defined(__aarch64__)
+	case CRYPTREDIS_B64_NEON:
+		n = b64_enc_neon(dst, s, slen);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	n = n / 3 * 4 + b64_enc_scalar(dst + n / 3 * 4, s + n, slen - n);
+	dst[n] = '\0';
+
+	return (n);
+}
+
+/*
+ * Decode slen chars of src into dst, returns the decoded length or -1 if
+ * src is malformed or dst shorter than cryptredis_decsiz().  dst may be
+ * src itself, output never overtakes input.
+ */
+ssize_t
+cryptredis_decode_impl(int impl, const char *src, size_t slen, void *dst,
+    size_t dlen)
+{
+	u_int8_t	*d = dst;
+	size_t		 n = 0;
+	ssize_t		 len;
+
+	if (slen % 4 != 0 || cryptredis_decsiz(src, slen) > dlen)
+		return (-1);
+
+	switch (impl) {
+#if defined(__x86_64__) || defined(__i386__)
+	case CRYPTREDIS_B64_AVX2:
+		n = b64_dec_avx2(d, src, slen, dlen);
+		/* FALLTHROUGH */
+	case CRYPTREDIS_B64_SSE41:
+		n += b64_dec_sse41(d + n / 4 * 3, src + n, slen - n,
+		    dlen - n / 4 * 3);
+		break;
+#elif defined(__aarch64__)
+	case CRYPTREDIS_B64_NEON:
+		n = b64_dec_neon(d, src, slen, dlen);
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if ((len = b64_dec_scalar(d + n / 4 * 3, src + n, slen - n)) == -1)
+		return (-1);
+
+	return (n / 4 * 3 + len);
+}
+
+ssize_t
 cryptredis_encode(char *dst, size_t dlen, const void *src, size_t slen)
 {
-	unsigned char *p = (unsigned char *)src;
+	return (cryptredis_encode_impl(cryptredis_b64_impl(), dst, dlen, src,
+	    slen));
+}
 
-	if (b64_ntop(p, slen, dst, dlen) == -1)
-		errx(1, "b64_ntop: error encoding base64");
+ssize_t
+cryptredis_decode(const char *src, size_t slen, void *dst, size_t dlen)
+{
+	return (cryptredis_decode_impl(cryptredis_b64_impl(), src, slen, dst,
+	    dlen));
 }
 
-size_t
-cryptredis_decode(const char *src, void *dst, size_t dlen)
+/*
+ * The best codec for this CPU, probed once; racing threads store the same
+ * answer.  CRYPTREDIS_B64SCALAR forces the scalar code.
+ */
+int
+cryptredis_b64_impl(void)
 {
-	size_t		 s;
+	int	impl;
 
-	if ((s = b64_pton(src, dst, dlen)) == -1)
-		errx(1, "b64_pton: error decoding base64");
+	impl = __atomic_load_n(&cryptredis_b64, __ATOMIC_RELAXED);
+	if (impl == -1) {
+		if (getenv("CRYPTREDIS_B64SCALAR") != NULL)
+			impl = CRYPTREDIS_B64_SCALAR;
+		else
+			impl = cryptredis_b64_probe();
+		__atomic_store_n(&cryptredis_b64, impl, __ATOMIC_RELAXED);
+	}
 
-	return (s);
+	return (impl);
 }
@@ -18,13 +18,26 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 
+#include <sys/types.h>
+
 #include "tools.h"
 
 __BEGIN_DECLS
 
+/* codecs, cryptredis_b64_impl() returns the best one for this CPU */
+#define CRYPTREDIS_B64_SCALAR	0
+#define CRYPTREDIS_B64_SSE41	1	/* 12 bytes per pass */
+#define CRYPTREDIS_B64_AVX2	2	/* 24 bytes per pass */
+#define CRYPTREDIS_B64_NEON	3	/* 48 bytes per pass */
+
 size_t	cryptredis_encsiz(int);
-void	cryptredis_encode(char *, size_t, const void *, size_t);
-size_t	cryptredis_decode(const char *, void *, size_t);
+size_t	cryptredis_decsiz(const char *, size_t);
+ssize_t	cryptredis_encode(char *, size_t, const void *, size_t);
+ssize_t	cryptredis_decode(const char *, size_t, void *, size_t);
+
+int	cryptredis_b64_impl(void);
+ssize_t	cryptredis_encode_impl(int, char *, size_t, const void *, size_t);
+ssize_t	cryptredis_decode_impl(int, const char *, size_t, void *, size_t);
 
 __END_DECLS
 
@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Value formats, what cryptredis_set_r() hands to redis before base64:
+ *
+ * CRYPTREDIS_FMT_LEGACY	CBC, fixed whitened iv, zero padded to
+ *				cryptredis_align64(); no header.
+ * CRYPTREDIS_FMT_CTR		hdr | nonce[12] | AES-256-CTR(value) | tag[16]
+ *				tag is HMAC-SHA256 over everything before it,
+ *				the nonce is random per value, no padding.
+ * CRYPTREDIS_FMT_CBC		hdr | CBC(value | pkcs#7 padding)
+ *				same cipher and iv as the legacy format, padded
+ *				to the next 16 byte block only.
+ * CRYPTREDIS_FMT_CHACHA	hdr | nonce[12] | ChaCha20(value) | tag[16]
+ *				RFC 8439 AEAD with the header as associated
+ *				data, random nonce per value, no padding.
+ *
+ * hdr is struct cryptredis_hdr, then with CRYPTREDIS_HDR_KEYID the id of
+ * the key the value is sealed with, always written now; values without it
+ * predate key ids.  With CRYPTREDIS_HDR_LZ4 in the header flags the value
+ * sealed is le32(length) | lz4 block, see cryptredis_set_rn().
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptredis.h"
+#include "format.h"
+
+static ssize_t	cryptredis_unseal_key(const struct cryptredis_key *, int,
+		    size_t, const void *, size_t, void *, size_t);
+static const struct cryptredis_key *
+		cryptredis_kid_key(const struct cryptredis_key *const *, size_t,
+		    const struct cryptredis_hdr *);
+static ssize_t	cryptredis_cbc_unpad(const u_int8_t *, size_t);
+static ssize_t	cryptredis_unseal_legacy(const struct cryptredis_key *,
+		    const void *, size_t, void *, size_t);
+static int	cryptredis_legacy_padded(const u_int8_t *, size_t);
+
+/* values cryptredis_unseal_batch() gathers for one pass of the AES lanes */
+#define CRYPTREDIS_UNSEAL_BATCH	64
+
+size_t
+cryptredis_seal_size(int fmt, size_t len)
+{
+	switch (fmt & CRYPTREDIS_FMT_MASK) {
+	case CRYPTREDIS_FMT_CTR:
+		return (CRYPTREDIS_KIDHDRLEN + CRYPTREDIS_NONCELEN + len +
+		    CRYPTREDIS_TAGLEN);
+	case CRYPTREDIS_FMT_CBC:
+		return (CRYPTREDIS_KIDHDRLEN + (len & ~(size_t)15) + 16);
+	case CRYPTREDIS_FMT_CHACHA:
+		return (CRYPTREDIS_KIDHDRLEN + CRYPTREDIS_CC_NONCELEN + len +
+		    CRYPTREDIS_CC_TAGLEN);
+	default:
+		return (cryptredis_align64(len));
+	}
+}
+
+/*
+ * Seal slen bytes of src into dst, returns the sealed length or -1 when
+ * dst is too short.  The key id goes in the header, CRYPTREDIS_FMT_LZ4 in
+ * fmt only sets the header flag, src is already compressed.
+ */
+ssize_t
+cryptredis_seal(const struct cryptredis_key *key, int fmt, const void *src,
+    size_t slen, void *dst, size_t dlen)
+{
+	struct cryptredis_hdr	*hdr = dst;
+	u_int8_t		*nonce, *body;
+	u_int8_t		 mac[CRYPTREDIS_MACLEN];
+	size_t			 len, pad;
+
+	if ((len = cryptredis_seal_size(fmt, slen)) > dlen)
+		return (-1);
+
+	if ((fmt & CRYPTREDIS_FMT_MASK) != CRYPTREDIS_FMT_LEGACY) {
+		hdr->ch_magic[0] = CRYPTREDIS_HDR_MAGIC0;
+		hdr->ch_magic[1] = CRYPTREDIS_HDR_MAGIC1;
+		hdr->ch_format = fmt & CRYPTREDIS_FMT_MASK;
+		hdr->ch_flags = CRYPTREDIS_HDR_KEYID;
+		if (fmt & CRYPTREDIS_FMT_LZ4)
+			hdr->ch_flags |= CRYPTREDIS_HDR_LZ4;
+		memcpy(hdr + 1, key->kid, CRYPTREDIS_KIDLEN);
+	}
+	fmt &= CRYPTREDIS_FMT_MASK;
+
+	switch (fmt) {
+	case CRYPTREDIS_FMT_CTR:
+		nonce = (u_int8_t *)dst + CRYPTREDIS_KIDHDRLEN;
+		body = nonce + CRYPTREDIS_NONCELEN;
+
+		arc4random_buf(nonce, CRYPTREDIS_NONCELEN);
+		cryptredis_ctr_crypt(key, nonce, 0, src, body, slen);
+		cryptredis_mac(key, dst, body + slen - (u_int8_t *)dst, mac);
+		memcpy(body + slen, mac, CRYPTREDIS_TAGLEN);
+		break;
+	case CRYPTREDIS_FMT_CBC:
+		body = (u_int8_t *)dst + CRYPTREDIS_KIDHDRLEN;
+		len -= CRYPTREDIS_KIDHDRLEN;
+		pad = len - slen;
+		memcpy(body, src, slen);
+		memset(body + slen, (int)pad, pad);
+		cryptredis_encrypt(key, (char *)body, (u_int32_t *)body, len);
+		len += CRYPTREDIS_KIDHDRLEN;
+		break;
+	case CRYPTREDIS_FMT_CHACHA:
+		nonce = (u_int8_t *)dst + CRYPTREDIS_KIDHDRLEN;
+		body = nonce + CRYPTREDIS_CC_NONCELEN;
+
+		arc4random_buf(nonce, CRYPTREDIS_CC_NONCELEN);
+		cryptredis_chacha_seal(key, nonce, hdr, CRYPTREDIS_KIDHDRLEN,
+		    src, body, slen, body + slen);
+		break;
+	default:
+		/* the legacy cipher reads whole blocks, pad a copy */
+		memcpy(dst, src, slen);
+		memset((char *)dst + slen, 0, len - slen);
+		cryptredis_encrypt(key, dst, dst, len);
+		break;
+	}
+
+	return (len);
+}
+
+/*
+ * Open a value written by cryptredis_seal(), any format, with whichever of
+ * the nkeys keys it was sealed with; keys[0] is the one values are written
+ * with.  Returns the plaintext length, -1 when the value is malformed,
+ * fails authentication or its key isn't there.  Legacy values come back
+ * with their zero padding.  dst may equal src: the body is then opened
+ * where it lies and the plaintext moved down over the header.  *fmtp, if
+ * fmtp isn't NULL, is set to the format the value was opened as.
+ */
+ssize_t
+cryptredis_unseal(const struct cryptredis_key *const *keys, size_t nkeys,
+    const void *src, size_t slen, void *dst, size_t dlen, int *fmtp)
+{
+	const struct cryptredis_hdr	*hdr = src;
+	const struct cryptredis_key	*key;
+	ssize_t				 n = -1;
+	size_t				 i;
+	int				 fmt;
+
+	if (nkeys == 0)
+		return (-1);
+
+	fmt = cryptredis_hdr_parse(src, slen);
+	if (fmt == CRYPTREDIS_FMT_LEGACY)
+		n = cryptredis_unseal_key(keys[0], fmt, 0, src, slen, dst,
+		    dlen);
+	else if (hdr->ch_flags & CRYPTREDIS_HDR_KEYID) {
+		if (slen >= CRYPTREDIS_KIDHDRLEN &&
+		    (key = cryptredis_kid_key(keys, nkeys, hdr)) != NULL)
+			n = cryptredis_unseal_key(key, fmt,
+			    CRYPTREDIS_KIDHDRLEN, src, slen, dst, dlen);
+	} else {
+		/*
+		 * No key id: authenticated formats reject the wrong keys
+		 * before touching src, CBC can't tell and is opened with the
+		 * current key.
+		 */
+		if (fmt == CRYPTREDIS_FMT_CBC)
+			nkeys = 1;
+		for (i = 0; i < nkeys && n == -1; i++)
+			n = cryptredis_unseal_key(keys[i], fmt,
+			    CRYPTREDIS_HDRLEN, src, slen, dst, dlen);
+	}
+
+	/*
+	 * A legacy value starts like a header one time in 2^16 or so, try
+	 * it as one if it has a legacy length.  src is still whole: the
+	 * others reject it before opening anything, and a CBC one of this
+	 * length doesn't fill whole blocks.
+	 */
+	if (n == -1 && fmt != CRYPTREDIS_FMT_LEGACY &&
+	    cryptredis_align64(slen) == slen) {
+		fmt = CRYPTREDIS_FMT_LEGACY;
+		n = cryptredis_unseal_legacy(keys[0], src, slen, dst, dlen);
+	}
+	if (fmtp != NULL)
+		*fmtp = fmt;
+
+	return (n);
+}
+
+/*
+ * Open a value that parsed as a header as legacy after all.  Its padding
+ * is checked, there's nothing else to tell a wrong guess from.
+ */
+static ssize_t
+cryptredis_unseal_legacy(const struct cryptredis_key *key, const void *src,
+    size_t slen, void *dst, size_t dlen)
+{
+	ssize_t	n;
+
+	if ((n = cryptredis_unseal_key(key, CRYPTREDIS_FMT_LEGACY, 0, src,
+	    slen, dst, dlen)) == -1 || cryptredis_legacy_padded(dst, n) == -1)
+		return (-1);
+
+	return (n);
+}
+
+/*
+ * Legacy plaintext is a C string zero padded to cryptredis_align64() of
+ * its length, -1 if p isn't one.
+ */
+static int
+cryptredis_legacy_padded(const u_int8_t *p, size_t len)
+{
+	size_t		i, n = strnlen((const char *)p, len);
+	u_int8_t	bits = 0;
+
+	if (cryptredis_align64(n) != len)
+		return (-1);
+	for (i = n; i < len; i++)
+		bits |= p[i];
+
+	return (bits != 0 ? -1 : 0);
+}
+
+/* open a value of format fmt with key, its header is hlen bytes long */
+static ssize_t
+cryptredis_unseal_key(const struct cryptredis_key *key, int fmt, size_t hlen,
+    const void *src, size_t slen, void *dst, size_t dlen)
+{
+	const u_int8_t	*nonce, *body;
+	u_int8_t	*out;
+	u_int8_t	 mac[CRYPTREDIS_MACLEN];
+	size_t		 len;
+	ssize_t		 n;
+
+	switch (fmt) {
+	case CRYPTREDIS_FMT_CTR:
+		if (slen < hlen + CRYPTREDIS_NONCELEN + CRYPTREDIS_TAGLEN)
+			return (-1);
+		len = slen - hlen - CRYPTREDIS_NONCELEN - CRYPTREDIS_TAGLEN;
+		if (len > dlen)
+			return (-1);
+		nonce = (const u_int8_t *)src + hlen;
+		body = nonce + CRYPTREDIS_NONCELEN;
+		out = dst == src ? (u_int8_t *)body : dst;
+
+		cryptredis_mac(key, src, body + len - (const u_int8_t *)src,
+		    mac);
+		if (timingsafe_bcmp(mac, body + len, CRYPTREDIS_TAGLEN) != 0)
+			return (-1);
+		cryptredis_ctr_crypt(key, nonce, 0, body, out, len);
+		break;
+	case CRYPTREDIS_FMT_CBC:
+		body = (const u_int8_t *)src + hlen;
+		len = slen - hlen;
+		if (len == 0 || len % 16 != 0 || len > dlen)
+			return (-1);
+		out = dst == src ? (u_int8_t *)body : dst;
+		cryptredis_decrypt(key, (const u_int32_t *)body, (char *)out,
+		    len);
+		if ((n = cryptredis_cbc_unpad(out, len)) == -1)
+			return (-1);
+		len = n;
+		break;
+	case CRYPTREDIS_FMT_CHACHA:
+		if (slen < hlen + CRYPTREDIS_CC_NONCELEN +
+		    CRYPTREDIS_CC_TAGLEN)
+			return (-1);
+		len = slen - hlen - CRYPTREDIS_CC_NONCELEN -
+		    CRYPTREDIS_CC_TAGLEN;
+		if (len > dlen)
+			return (-1);
+		nonce = (const u_int8_t *)src + hlen;
+		body = nonce + CRYPTREDIS_CC_NONCELEN;
+		out = dst == src ? (u_int8_t *)body : dst;
+
+		if (cryptredis_chacha_open(key, nonce, src, hlen,
+		    body, out, len, body + len) == -1)
+			return (-1);
+		break;
+	default:
+		if (slen % 16 != 0 || slen > dlen)
+			return (-1);
+		cryptredis_decrypt(key, src, dst, slen);
+		return (slen);
+	}
+
+	if (out != dst)
+		memmove(dst, out, len);
+	return (len);
+}
+
+/*
+ * Open n values in place, vals[i] of lens[i] bytes, leaving in out[i]
+ * what cryptredis_unseal() would return for it and in fmts[i] the format
+ * it was opened as.  CBC and legacy values, whose cipher is the slow part,
+ * are gathered by key and decrypted together with
+ * cryptredis_decrypt_batch(), which interleaves their blocks over the AES
+ * lanes; the other formats are opened one by one.
+ */
+void
+cryptredis_unseal_batch(const struct cryptredis_key *const *keys,
+    size_t nkeys, void *const *vals, const size_t *lens, ssize_t *out,
+    int *fmts, size_t n)
+{
+	struct cryptredis_iov		 iov[CRYPTREDIS_UNSEAL_BATCH];
+	const struct cryptredis_key	*key[CRYPTREDIS_UNSEAL_BATCH];
+	const struct cryptredis_hdr	*hdr;
+	size_t				 hlen[CRYPTREDIS_UNSEAL_BATCH];
+	int				 guess[CRYPTREDIS_UNSEAL_BATCH];
+	size_t				 b, i, k, m, len, niov;
+	ssize_t				 plen;
+	u_int8_t			*body;
+
+	for (b = 0; b < n; b += CRYPTREDIS_UNSEAL_BATCH) {
+		m = n - b < CRYPTREDIS_UNSEAL_BATCH ? n - b :
+		    CRYPTREDIS_UNSEAL_BATCH;
+
+		for (i = 0; i < m; i++) {
+			hdr = vals[b + i];
+			len = lens[b + i];
+			out[b + i] = -1;
+			fmts[b + i] = cryptredis_hdr_parse(hdr, len);
+			key[i] = NULL;
+			hlen[i] = CRYPTREDIS_HDRLEN;
+			guess[i] = 0;
+			if (nkeys == 0)
+				continue;
+
+			switch (fmts[b + i]) {
+			case CRYPTREDIS_FMT_LEGACY:
+				if (len == 0) {
+					out[b + i] = 0;
+					continue;
+				}
+				key[i] = keys[0];
+				hlen[i] = 0;
+				break;
+			case CRYPTREDIS_FMT_CBC:
+				if (!(hdr->ch_flags & CRYPTREDIS_HDR_KEYID)) {
+					key[i] = keys[0];
+				} else if (len > CRYPTREDIS_KIDHDRLEN) {
+					key[i] = cryptredis_kid_key(keys,
+					    nkeys, hdr);
+					hlen[i] = CRYPTREDIS_KIDHDRLEN;
+				}
+				break;
+			default:
+				out[b + i] = cryptredis_unseal(keys, nkeys,
+				    vals[b + i], len, vals[b + i], len,
+				    &fmts[b + i]);
+				continue;
+			}
+			if (key[i] != NULL &&
+			    (len <= hlen[i] || (len - hlen[i]) % 16 != 0))
+				key[i] = NULL;
+
+			/* a legacy value starting like a header, see above */
+			if (key[i] == NULL && hlen[i] != 0 &&
+			    cryptredis_align64(len) == len) {
+				key[i] = keys[0];
+				hlen[i] = 0;
+				guess[i] = 1;
+			}
+		}
+
+		for (k = 0; k < nkeys; k++) {
+			for (niov = 0, i = 0; i < m; i++) {
+				if (key[i] != keys[k])
+					continue;
+				body = (u_int8_t *)vals[b + i] + hlen[i];
+				iov[niov].ci_src = iov[niov].ci_dst = body;
+				iov[niov].ci_len = lens[b + i] - hlen[i];
+				niov++;
+			}
+			if (niov > 0)
+				cryptredis_decrypt_batch(keys[k], iov, niov);
+		}
+
+		for (i = 0; i < m; i++) {
+			if (key[i] == NULL)
+				continue;
+			len = lens[b + i] - hlen[i];
+			if (hlen[i] == 0) {
+				/* legacy, zero padded */
+				if (guess[i] && cryptredis_legacy_padded(
+				    vals[b + i], len) == -1)
+					continue;
+				fmts[b + i] = CRYPTREDIS_FMT_LEGACY;
+				out[b + i] = len;
+				continue;
+			}
+			body = (u_int8_t *)vals[b + i] + hlen[i];
+			if ((plen = cryptredis_cbc_unpad(body, len)) == -1)
+				continue;
+			memmove(vals[b + i], body, plen);
+			out[b + i] = plen;
+		}
+	}
+}
+
+/* the key of the id following hdr, NULL if none of keys has it */
+static const struct cryptredis_key *
+cryptredis_kid_key(const struct cryptredis_key *const *keys, size_t nkeys,
+    const struct cryptredis_hdr *hdr)
+{
+	size_t	i;
+
+	for (i = 0; i < nkeys; i++)
+		if (memcmp(hdr + 1, keys[i]->kid, CRYPTREDIS_KIDLEN) == 0)
+			return (keys[i]);
+
+	return (NULL);
+}
+
+/* length of len bytes of pkcs#7 padded plaintext, -1 if badly padded */
+static ssize_t
+cryptredis_cbc_unpad(const u_int8_t *out, size_t len)
+{
+	u_int8_t	pad, bad;
+	size_t		i;
+
+	/* check the whole last block, don't branch on the padding */
+	pad = out[len - 1];
+	bad = (pad == 0) | (pad > 16);
+	for (i = 1; i <= 16; i++)
+		bad |= (i <= pad) & (out[len - i] != pad);
+	if (bad)
+		return (-1);
+
+	return (len - pad);
+}
+
+/* returns the value format, CRYPTREDIS_FMT_LEGACY when there's no header */
+int
+cryptredis_hdr_parse(const void *src, size_t slen)
+{
+	const struct cryptredis_hdr *hdr = src;
+
+	if (slen < CRYPTREDIS_HDRLEN ||
+	    hdr->ch_magic[0] != CRYPTREDIS_HDR_MAGIC0 ||
+	    hdr->ch_magic[1] != CRYPTREDIS_HDR_MAGIC1 ||
+	    (hdr->ch_flags & ~CRYPTREDIS_HDR_FLAGS) != 0)
+		return (CRYPTREDIS_FMT_LEGACY);
+
+	switch (hdr->ch_format) {
+	case CRYPTREDIS_FMT_CTR:
+	case CRYPTREDIS_FMT_CBC:
+	case CRYPTREDIS_FMT_CHACHA:
+		return (hdr->ch_format);
+	default:
+		return (CRYPTREDIS_FMT_LEGACY);
+	}
+}
+
+/* CRYPTREDIS_HDR_* flags of a value, 0 for legacy ones */
+int
+cryptredis_hdr_flags(const void *src, size_t slen)
+{
+	const struct cryptredis_hdr *hdr = src;
+
+	if (cryptredis_hdr_parse(src, slen) == CRYPTREDIS_FMT_LEGACY)
+		return (0);
+
+	return (hdr->ch_flags);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+#include "bsd-crypt.h"
+
+CEXT_BEGIN
+
+/*
+ * Every format but the legacy one starts with this header.  Legacy values
+ * are bare CBC ciphertext, they are recognized by the absence of it.
+ */
+struct cryptredis_hdr {
+	u_int8_t	ch_magic[2];
+	u_int8_t	ch_format;	/* CRYPTREDIS_FMT_* */
+	u_int8_t	ch_flags;	/* CRYPTREDIS_HDR_* */
+};
+
+#define CRYPTREDIS_HDR_LZ4	0x01	/* plaintext is lz4 compressed */
+#define CRYPTREDIS_HDR_KEYID	0x02	/* key id follows the header */
+#define CRYPTREDIS_HDR_FLAGS	(CRYPTREDIS_HDR_LZ4 | CRYPTREDIS_HDR_KEYID)
+
+#define CRYPTREDIS_HDR_MAGIC0	0xc7
+#define CRYPTREDIS_HDR_MAGIC1	0x52
+#define CRYPTREDIS_HDRLEN	sizeof(struct cryptredis_hdr)
+#define CRYPTREDIS_KIDHDRLEN	(CRYPTREDIS_HDRLEN + CRYPTREDIS_KIDLEN)
+#define CRYPTREDIS_TAGLEN	16	/* truncated hmac-sha256 */
+
+size_t	cryptredis_seal_size(int, size_t);
+ssize_t	cryptredis_seal(const struct cryptredis_key *, int, const void *,
+	    size_t, void *, size_t);
+ssize_t	cryptredis_unseal(const struct cryptredis_key *const *, size_t,
+	    const void *, size_t, void *, size_t, int *);
+void	cryptredis_unseal_batch(const struct cryptredis_key *const *, size_t,
+	    void *const *, const size_t *, ssize_t *, int *, size_t);
+int	cryptredis_hdr_parse(const void *, size_t);
+int	cryptredis_hdr_flags(const void *, size_t);
+
+CEXT_END
+
+#endif /* !FORMAT_H */
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Process wide cache of derived keys.  Reading a key file means running
+ * bcrypt_pbkdf, tens of milliseconds; handles enabling encryption with a
+ * key file already read get the same key back after a stat(2).  Entries
+ * are known by path and by the device, inode, mtime and size of the file,
+ * so replacing or rewriting it reads it again.  Keys are never written
+ * once derived, handles share them read-only; an outdated key stays
+ * around until the last handle holding it lets go.
+ *
+ * Handles hold the keys of their CRYPTREDIS_KEYFILE list as a keyset.
+ * A watched list has a thread of its own noticing changes to the files,
+ * inotify(7) on linux and a stat(2) a second elsewhere: it derives the
+ * new keyset off the request path, then publishes it with a bump of the
+ * list's generation.  Handles see the bump on their next request and
+ * trade their keyset for the new one, taking the lock only then; the
+ * keyset they held goes away with its last user, so a request running
+ * meanwhile finishes with the keys it started with.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <util.h>
+
+#include "keyring.h"
+
+struct cryptredis_keyent {
+	struct cryptredis_key	  ke_key;	/* first, see keyring_put */
+	struct cryptredis_keyent *ke_next;
+	char			 *ke_path;
+	dev_t			  ke_dev;
+	ino_t			  ke_ino;
+	struct timespec		  ke_mtim;
+	off_t			  ke_size;
+	u_int			  ke_refs;	/* handles holding ke_key */
+	int			  ke_stale;	/* unlinked, file changed */
+};
+
+struct cryptredis_keywatch {
+	struct cryptredis_keywatch	*kw_next;
+	char				*kw_spec;	/* CRYPTREDIS_KEYFILE */
+	struct cryptredis_keyset	*kw_set;	/* as of kw_gen */
+	u_int				 kw_gen;	/* atomic */
+};
+
+static struct cryptredis_keyent	*cryptredis_keyring;
+static struct cryptredis_keywatch *cryptredis_keywatches;
+static pthread_t		 cryptredis_keywatcher;
+static int			 cryptredis_keywatcher_fd = -1;
+static int			 cryptredis_keywatcher_on;
+static pthread_mutex_t		 cryptredis_keyring_mtx =
+				    PTHREAD_MUTEX_INITIALIZER;
+
+static int	cryptredis_keyent_match(const struct cryptredis_keyent *,
+		    const char *, const struct stat *);
+static void	cryptredis_keyent_free(struct cryptredis_keyent *);
+static int	cryptredis_keywatch_add(const char *);
+static void	cryptredis_keywatch_reload(struct cryptredis_keywatch *);
+#ifdef __linux__
+static int	cryptredis_keywatch_event(const struct cryptredis_keywatch *,
+		    const char *, ssize_t);
+#endif
+static void	*cryptredis_keywatcher_main(void *);
+static int	cryptredis_key_read(FILE *, struct cryptredis_key *);
+static void	cryptredis_load_hexbin(void *pk, const char *, size_t);
+
+/*
+ * Key of the file at path, derived once per version of the file.  Returns
+ * NULL if it can't be read; hand it back with cryptredis_keyring_put().
+ */
+const struct cryptredis_key *
+cryptredis_keyring_get(const char *path)
+{
+	struct cryptredis_keyent	*ke, *nke, **kep;
+	struct stat			 st;
+	FILE				*f;
+
+	if (stat(path, &st) == -1) {
+		(void)fprintf(stderr, "%s: stat %s %s\n", __func__, path,
+		    strerror(errno));
+		return (NULL);
+	}
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		return (NULL);
+	for (kep = &cryptredis_keyring; (ke = *kep) != NULL; ) {
+		if (strcmp(ke->ke_path, path) != 0) {
+			kep = &ke->ke_next;
+			continue;
+		}
+		if (cryptredis_keyent_match(ke, path, &st)) {
+			ke->ke_refs++;
+			(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+			return (&ke->ke_key);
+		}
+		/* the file changed, drop what was read from it before */
+		*kep = ke->ke_next;
+		if (ke->ke_refs == 0)
+			cryptredis_keyent_free(ke);
+		else
+			ke->ke_stale = 1;
+	}
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+	/* derive without the lock, other handles keep going meanwhile */
+	if ((nke = calloc(1, sizeof(*nke))) == NULL) {
+		(void)fprintf(stderr, "%s: calloc\n", __func__);
+		return (NULL);
+	}
+	if ((nke->ke_path = strdup(path)) == NULL) {
+		(void)fprintf(stderr, "%s: strdup\n", __func__);
+		goto err;
+	}
+	if ((f = fopen(path, "r")) == NULL) {
+		(void)fprintf(stderr, "%s: fopen %s\n", __func__, path);
+		goto err;
+	}
+	/* what was read, stat(2) above may have seen an older file */
+	if (fstat(fileno(f), &st) == -1 ||
+	    cryptredis_key_read(f, &nke->ke_key) == -1) {
+		(void)fprintf(stderr, "%s: cryptredis_key_read %s\n", __func__,
+		    path);
+		fclose(f);
+		goto err;
+	}
+	fclose(f);
+	nke->ke_dev = st.st_dev;
+	nke->ke_ino = st.st_ino;
+	nke->ke_mtim = st.st_mtim;
+	nke->ke_size = st.st_size;
+	nke->ke_refs = 1;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		goto err;
+	/* another thread may have read the same file meanwhile */
+	for (ke = cryptredis_keyring; ke != NULL; ke = ke->ke_next)
+		if (cryptredis_keyent_match(ke, path, &st))
+			break;
+	if (ke != NULL) {
+		ke->ke_refs++;
+		(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+		cryptredis_keyent_free(nke);
+		return (&ke->ke_key);
+	}
+	nke->ke_next = cryptredis_keyring;
+	cryptredis_keyring = nke;
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+	return (&nke->ke_key);
+
+ err:
+	cryptredis_keyent_free(nke);
+
+	return (NULL);
+}
+
+/* give back a key from cryptredis_keyring_get() */
+void
+cryptredis_keyring_put(const struct cryptredis_key *key)
+{
+	struct cryptredis_keyent	*ke = (struct cryptredis_keyent *)key;
+
+	if (key == NULL)
+		return;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		return;
+	if (--ke->ke_refs == 0 && ke->ke_stale)
+		cryptredis_keyent_free(ke);
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+}
+
+static int
+cryptredis_keyent_match(const struct cryptredis_keyent *ke, const char *path,
+    const struct stat *st)
+{
+	return (ke->ke_dev == st->st_dev && ke->ke_ino == st->st_ino &&
+	    ke->ke_mtim.tv_sec == st->st_mtim.tv_sec &&
+	    ke->ke_mtim.tv_nsec == st->st_mtim.tv_nsec &&
+	    ke->ke_size == st->st_size && strcmp(ke->ke_path, path) == 0);
+}
+
+static void
+cryptredis_keyent_free(struct cryptredis_keyent *ke)
+{
+	explicit_bzero(&ke->ke_key, sizeof(ke->ke_key));
+	free(ke->ke_path);
+	free(ke);
+}
+
+/*
+ * Keys of a colon separated list of key files, the first one seals.
+ * Returns NULL if one of them can't be read.
+ */
+const struct cryptredis_keyset *
+cryptredis_keyset_get(const char *spec)
+{
+	struct cryptredis_keyset	*ks;
+	char				*paths, *next, *path;
+
+	if ((ks = calloc(1, sizeof(*ks))) == NULL ||
+	    (paths = strdup(spec)) == NULL) {
+		(void)fprintf(stderr, "%s: calloc\n", __func__);
+		free(ks);
+		return (NULL);
+	}
+	ks->ks_refs = 1;
+
+	for (next = paths; (path = strsep(&next, ":")) != NULL; ) {
+		if (*path == '\0')
+			continue;
+		if (ks->ks_nkeys == CRYPTREDIS_MAXKEYS) {
+			(void)fprintf(stderr, "%s: more than %d key files\n",
+			    __func__, CRYPTREDIS_MAXKEYS);
+			goto err;
+		}
+		if ((ks->ks_keys[ks->ks_nkeys] =
+		    cryptredis_keyring_get(path)) == NULL)
+			goto err;
+		ks->ks_nkeys++;
+	}
+	if (ks->ks_nkeys == 0) {
+		(void)fprintf(stderr, "%s: no key file\n", __func__);
+		goto err;
+	}
+	free(paths);
+
+	return (ks);
+
+ err:
+	free(paths);
+	cryptredis_keyset_put(ks);
+
+	return (NULL);
+}
+
+void
+cryptredis_keyset_put(const struct cryptredis_keyset *cks)
+{
+	struct cryptredis_keyset	*ks = (struct cryptredis_keyset *)cks;
+	size_t				 i;
+	u_int				 refs;
+
+	if (ks == NULL)
+		return;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		return;
+	refs = --ks->ks_refs;
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+	if (refs > 0)
+		return;
+
+	for (i = 0; i < ks->ks_nkeys; i++)
+		cryptredis_keyring_put(ks->ks_keys[i]);
+	free(ks);
+}
+
+/*
+ * The watched list spec, its first keyset read right away; the watcher
+ * thread starts with the first list.  Lists are watched for the life of
+ * the process.
+ */
+struct cryptredis_keywatch *
+cryptredis_keywatch_get(const char *spec)
+{
+	struct cryptredis_keywatch	*kw, *nkw;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		return (NULL);
+	for (kw = cryptredis_keywatches; kw != NULL; kw = kw->kw_next)
+		if (strcmp(kw->kw_spec, spec) == 0)
+			break;
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+	if (kw != NULL)
+		return (kw);
+
+	if ((nkw = calloc(1, sizeof(*nkw))) == NULL ||
+	    (nkw->kw_spec = strdup(spec)) == NULL) {
+		(void)fprintf(stderr, "%s: calloc\n", __func__);
+		goto err;
+	}
+	if ((nkw->kw_set = (struct cryptredis_keyset *)
+	    cryptredis_keyset_get(spec)) == NULL)
+		goto err;
+	nkw->kw_gen = 1;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		goto err;
+	for (kw = cryptredis_keywatches; kw != NULL; kw = kw->kw_next)
+		if (strcmp(kw->kw_spec, spec) == 0)
+			break;
+	if (kw == NULL && !cryptredis_keywatcher_on) {
+#ifdef __linux__
+		cryptredis_keywatcher_fd = inotify_init1(IN_CLOEXEC);
+		if (cryptredis_keywatcher_fd == -1)
+			(void)fprintf(stderr, "%s: inotify_init1 %s\n",
+			    __func__, strerror(errno));
+#endif
+		if (pthread_create(&cryptredis_keywatcher, NULL,
+		    cryptredis_keywatcher_main, NULL) != 0 ||
+		    pthread_detach(cryptredis_keywatcher) != 0) {
+			(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+			(void)fprintf(stderr, "%s: pthread_create\n", __func__);
+			goto err;
+		}
+		cryptredis_keywatcher_on = 1;
+	}
+	if (kw == NULL && cryptredis_keywatch_add(spec) == -1) {
+		(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+		goto err;
+	}
+	if (kw == NULL) {
+		nkw->kw_next = cryptredis_keywatches;
+		cryptredis_keywatches = kw = nkw;
+		nkw = NULL;
+	}
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+ err:
+	if (nkw != NULL) {
+		cryptredis_keyset_put(nkw->kw_set);
+		free(nkw->kw_spec);
+		free(nkw);
+	}
+
+	return (kw);
+}
+
+/* generation of the keyset of kw, checked on every request */
+u_int
+cryptredis_keywatch_gen(const struct cryptredis_keywatch *kw)
+{
+	return (__atomic_load_n(&kw->kw_gen, __ATOMIC_ACQUIRE));
+}
+
+/* trade the keyset at *ksp for the current one of kw */
+void
+cryptredis_keywatch_sync(struct cryptredis_keywatch *kw,
+    const struct cryptredis_keyset **ksp, u_int *genp)
+{
+	const struct cryptredis_keyset	*old = *ksp;
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+		return;
+	kw->kw_set->ks_refs++;
+	*ksp = kw->kw_set;
+	*genp = kw->kw_gen;
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+	cryptredis_keyset_put(old);
+}
+
+/*
+ * Watch the directories of the files of spec, replacing a key file by
+ * rename(2) only shows there.  Called with the lock held.
+ */
+static int
+cryptredis_keywatch_add(const char *spec)
+{
+#ifdef __linux__
+	char	*paths, *next, *path, *dir;
+
+	if (cryptredis_keywatcher_fd == -1)
+		return (0);
+	if ((paths = strdup(spec)) == NULL)
+		return (-1);
+	for (next = paths; (path = strsep(&next, ":")) != NULL; ) {
+		if (*path == '\0')
+			continue;
+		dir = dirname(path);
+		if (inotify_add_watch(cryptredis_keywatcher_fd, dir,
+		    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE |
+		    IN_ATTRIB) == -1)
+			(void)fprintf(stderr, "%s: inotify_add_watch %s %s\n",
+			    __func__, dir, strerror(errno));
+	}
+	free(paths);
+#endif
+
+	return (0);
+}
+
+/* derive the keyset of kw again, publish it if its keys changed */
+static void
+cryptredis_keywatch_reload(struct cryptredis_keywatch *kw)
+{
+	const struct cryptredis_keyset	*ks, *old;
+
+	if ((ks = cryptredis_keyset_get(kw->kw_spec)) == NULL)
+		return;		/* keep the keys that worked */
+
+	if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0) {
+		cryptredis_keyset_put(ks);
+		return;
+	}
+	old = kw->kw_set;
+	if (ks->ks_nkeys == old->ks_nkeys && memcmp(ks->ks_keys,
+	    old->ks_keys, ks->ks_nkeys * sizeof(ks->ks_keys[0])) == 0) {
+		(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+		cryptredis_keyset_put(ks);
+		return;
+	}
+	kw->kw_set = (struct cryptredis_keyset *)ks;
+	__atomic_store_n(&kw->kw_gen, kw->kw_gen + 1, __ATOMIC_RELEASE);
+	(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+	cryptredis_keyset_put(old);
+}
+
+#ifdef __linux__
+/* one of the inotify events in buf names a file of kw */
+static int
+cryptredis_keywatch_event(const struct cryptredis_keywatch *kw,
+    const char *buf, ssize_t len)
+{
+	const struct inotify_event	*ev;
+	const char			*p, *name;
+	size_t				 nlen;
+	ssize_t				 off;
+
+	for (off = 0; off < len; off += sizeof(*ev) + ev->len) {
+		ev = (const struct inotify_event *)(buf + off);
+		if (ev->len == 0 || (ev->mask & IN_Q_OVERFLOW))
+			return (1);
+		for (p = kw->kw_spec; *p != '\0'; p += nlen) {
+			p += strspn(p, ":");
+			nlen = strcspn(p, ":");
+			for (name = p + nlen; name > p && name[-1] != '/'; )
+				name--;
+			if (strlen(ev->name) == (size_t)(p + nlen - name) &&
+			    strncmp(ev->name, name, p + nlen - name) == 0)
+				return (1);
+		}
+	}
+
+	return (0);
+}
+#endif
+
+static void *
+cryptredis_keywatcher_main(void *arg)
+{
+	struct cryptredis_keywatch	*kw;
+#ifdef __linux__
+	char				 buf[4096]
+					    __attribute__((aligned(8)));
+#endif
+	ssize_t				 n = -1;
+
+	for (;;) {
+#ifdef __linux__
+		if (cryptredis_keywatcher_fd == -1 || (n =
+		    read(cryptredis_keywatcher_fd, buf, sizeof(buf))) <= 0)
+			sleep(1);
+#else
+		sleep(1);
+#endif
+		if (pthread_mutex_lock(&cryptredis_keyring_mtx) != 0)
+			continue;
+		kw = cryptredis_keywatches;
+		(void)pthread_mutex_unlock(&cryptredis_keyring_mtx);
+
+		/* lists are never removed, kw_next never changes */
+		for (; kw != NULL; kw = kw->kw_next) {
+#ifdef __linux__
+			if (n > 0 && !cryptredis_keywatch_event(kw, buf, n))
+				continue;
+#endif
+			cryptredis_keywatch_reload(kw);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * salt, key and iv lines of a key file, then derive the key from them.
+ * All three must be there, the key line ended by a newline: the key has
+ * no set length, so a file read while being written may show it cut short.
+ */
+static int
+cryptredis_key_read(FILE *f, struct cryptredis_key *ckp)
+{
+	int	 	 i;
+	char	 	 line[LINE_MAX], *kp, *vp;
+	char		 tmpkey[LINE_MAX];
+	int		 seen = 0, ret = -1, nl;
+
+	memset(tmpkey, 0, sizeof(tmpkey));
+
+	/* no more than 3 lines */
+	for (i = 0; i < 3; i++) {
+		memset(line, 0, sizeof(line));
+		if (fgets(line, LINE_MAX, f) == NULL)
+			break;
+		if (strlen(line) == 0)
+			break;
+		nl = line[strlen(line) - 1] == '\n';
+		kp = line;
+		vp = strchr(kp, '=');
+
+		if (vp == NULL)
+			continue;
+
+		*vp++ = '\0';
+		vp += strspn(vp, " \t\r\n");
+
+		kp[strcspn(kp, "\r\n\t ")] = '\0';
+		vp[strcspn(vp, "\r\n\t ")] = '\0';
+
+		if (!strncmp(kp, "salt", 5) &&
+		    strlen(vp) >= 2 * sizeof(ckp->salt)) {
+			cryptredis_load_hexbin(ckp->salt, vp,
+			    sizeof(ckp->salt));
+			seen |= 1;
+		} else if (!strncmp(kp, "key", 3) && *vp != '\0' && nl) {
+			strlcpy(tmpkey, vp, sizeof(tmpkey));
+			seen |= 2;
+		} else if (!strncmp(kp, "iv", 2) &&
+		    strlen(vp) >= 2 * sizeof(ckp->iv)) {
+			cryptredis_load_hexbin(ckp->iv, vp,
+			    sizeof(ckp->iv));
+			seen |= 4;
+		}
+	}
+
+	/* a file being written shows up with lines missing or cut short */
+	if (seen != 7) {
+		(void)fprintf(stderr, "%s: incomplete key file\n", __func__);
+		goto err;
+	}
+
+	if (bcrypt_pbkdf(tmpkey, strlen(tmpkey), ckp->salt, sizeof(ckp->salt),
+	    ckp->key, sizeof(ckp->key), 16) == -1) {
+		(void)fprintf(stderr, "%s: bcrypt_pbkdf\n", __func__);
+		goto err;
+	}
+	cryptredis_key_setup(ckp);
+	ret = 0;
+
+ err:
+	explicit_bzero(line, sizeof(line));
+	explicit_bzero(tmpkey, sizeof(tmpkey));
+
+	return (ret);
+}
+
+static void
+cryptredis_load_hexbin(void *pk, const char *value, size_t pksize)
+{
+	char	 	 tmpv[3];
+	const char	*vp = value;
+	u_int8_t	*pkp = (u_int8_t *)pk;
+	unsigned int	 i;
+	int		 vlen;
+
+	vlen = strlen(value);
+
+	for (i = 0; i < pksize; i++) {
+		memset(tmpv, 0, sizeof(tmpv));
+		memcpy(tmpv, vp, 2);
+		pkp[i] = (u_int8_t)strtol(tmpv, (char **)NULL, 16);
+
+		if ((vlen -= 2) <= 0)
+			break;
+
+		vp += 2;
+	}
+}
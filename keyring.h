@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef KEYRING_H
+#define KEYRING_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+#include "bsd-crypt.h"
+
+CEXT_BEGIN
+
+#define CRYPTREDIS_MAXKEYS	8	/* key files in CRYPTREDIS_KEYFILE */
+
+/* the keys of a CRYPTREDIS_KEYFILE list, never changed once built */
+struct cryptredis_keyset {
+	const struct cryptredis_key	*ks_keys[CRYPTREDIS_MAXKEYS];
+	size_t				 ks_nkeys;	/* ks_keys[0] seals */
+	u_int				 ks_refs;
+};
+
+struct cryptredis_keywatch;
+
+const struct cryptredis_key *
+	cryptredis_keyring_get(const char *);
+void	cryptredis_keyring_put(const struct cryptredis_key *);
+
+const struct cryptredis_keyset *
+	cryptredis_keyset_get(const char *);
+void	cryptredis_keyset_put(const struct cryptredis_keyset *);
+
+struct cryptredis_keywatch *
+	cryptredis_keywatch_get(const char *);
+u_int	cryptredis_keywatch_gen(const struct cryptredis_keywatch *);
+void	cryptredis_keywatch_sync(struct cryptredis_keywatch *,
+	    const struct cryptredis_keyset **, u_int *);
+
+CEXT_END
+
+#endif /* !KEYRING_H */
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LZ4 block format, what LZ4_compress_default() and LZ4_decompress_safe()
+ * read and write.  A block is a run of sequences: a token holding the
+ * literal and match length nibbles, more literal length bytes, the
+ * literals, a little endian 16-bit offset and more match length bytes;
+ * the last sequence has literals only.  The compressor is the single
+ * pass, one probe hash table scheme, skipping faster through input that
+ * doesn't match.  The decompressor checks every length and offset against
+ * both buffers, malformed input is rejected, never read or written past.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "lz4.h"
+
+#define LZ4_MINMATCH	4
+#define LZ4_LASTLITERALS 5	/* the block ends with this many literals */
+#define LZ4_MFLIMIT	12	/* the last match starts this far from the end */
+#define LZ4_MAXOFF	65535
+#define LZ4_HASHLOG	12
+#define LZ4_SKIPSTRENGTH 6
+
+static u_int32_t
+lz4_read32(const u_int8_t *p)
+{
+	u_int32_t	v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+static u_int64_t
+lz4_read64(const u_int8_t *p)
+{
+	u_int64_t	v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+static u_int32_t
+lz4_hash(const u_int8_t *p)
+{
+	return ((lz4_read32(p) * 2654435761U) >> (32 - LZ4_HASHLOG));
+}
+
+/* 15 in the nibble, then bytes of 255 and the remainder */
+static u_int8_t *
+lz4_putlen(u_int8_t *op, size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (u_int8_t)len;
+	return (op);
+}
+
+/* worst case size of a block holding len bytes */
+size_t
+lz4_bound(size_t len)
+{
+	return (len + len / 255 + 16);
+}
+
+/*
+ * Compress slen bytes of src into dst, returns the block length or -1 if
+ * it doesn't fit in dlen bytes; ask for less than slen to only keep
+ * blocks that are smaller than their input.
+ */
+ssize_t
+lz4_compress(const void *src, size_t slen, void *dst, size_t dlen)
+{
+	u_int32_t	 table[1 << LZ4_HASHLOG];
+	const u_int8_t	*s = src, *ip = s, *anchor = s, *ref;
+	const u_int8_t	*end = s + slen, *mlimit;
+	u_int8_t	*op = dst, *oend = op + dlen;
+	size_t		 lit, ml, misses = 0;
+	u_int32_t	 h;
+
+	memset(table, 0, sizeof(table));
+
+	if (slen > LZ4_MFLIMIT) {
+		mlimit = end - LZ4_LASTLITERALS;
+		while (ip < end - LZ4_MFLIMIT) {
+			h = lz4_hash(ip);
+			ref = s + table[h];
+			table[h] = ip - s;
+			if (ref >= ip || ip - ref > LZ4_MAXOFF ||
+			    lz4_read32(ref) != lz4_read32(ip)) {
+				ip += 1 + (misses++ >> LZ4_SKIPSTRENGTH);
+				continue;
+			}
+			misses = 0;
+
+			/* grow the match both ways */
+			while (ip > anchor && ref > s && ip[-1] == ref[-1])
+				ip--, ref--;
+			ml = LZ4_MINMATCH;
+			while (ip + ml + 8 <= mlimit &&
+			    lz4_read64(ip + ml) == lz4_read64(ref + ml))
+				ml += 8;
+			while (ip + ml < mlimit && ip[ml] == ref[ml])
+				ml++;
+
+			lit = ip - anchor;
+			if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 +
+			    (ml - LZ4_MINMATCH) / 255 + 1)
+				return (-1);
+			*op = (lit < 15 ? lit : 15) << 4;
+			*op |= ml - LZ4_MINMATCH < 15 ? ml - LZ4_MINMATCH : 15;
+			op++;
+			if (lit >= 15)
+				op = lz4_putlen(op, lit);
+			memcpy(op, anchor, lit);
+			op += lit;
+			*op++ = (u_int8_t)(ip - ref);
+			*op++ = (u_int8_t)((ip - ref) >> 8);
+			if (ml - LZ4_MINMATCH >= 15)
+				op = lz4_putlen(op, ml - LZ4_MINMATCH);
+
+			ip += ml;
+			anchor = ip;
+			if (ip < end - LZ4_MFLIMIT)
+				table[lz4_hash(ip - 2)] = ip - 2 - s;
+		}
+	}
+
+	lit = end - anchor;
+	if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit)
+		return (-1);
+	*op++ = (lit < 15 ? lit : 15) << 4;
+	if (lit >= 15)
+		op = lz4_putlen(op, lit);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return (op - (u_int8_t *)dst);
+}
+
+/*
+ * Decompress the block of slen bytes at src into dst, returns the
+ * decompressed length or -1 if the block is malformed or needs more than
+ * dlen bytes.
+ */
+ssize_t
+lz4_decompress(const void *src, size_t slen, void *dst, size_t dlen)
+{
+	const u_int8_t	*ip = src, *iend = ip + slen, *ref;
+	u_int8_t	*op = dst, *oend = op + dlen;
+	size_t		 len, off;
+	u_int8_t	 token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip == iend || len > slen)
+					return (-1);
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return (-1);
+		/* short runs away from either end: one fixed size copy */
+		if (len <= 16 && iend - ip >= 16 && oend - op >= 16)
+			memcpy(op, ip, 16);
+		else
+			memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return (-1);
+		off = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (off == 0 || off > (size_t)(op - (u_int8_t *)dst))
+			return (-1);
+		ref = op - off;
+
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip == iend || len > dlen)
+					return (-1);
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ4_MINMATCH;
+		if (len > (size_t)(oend - op))
+			return (-1);
+
+		/*
+		 * A match may overlap its own output, repeating it.  8 byte
+		 * steps only ever read what is already written when off >= 8;
+		 * they may run up to 7 bytes past the match, not past dst.
+		 */
+		if (off >= 8 && (size_t)(oend - op) >= len + 8) {
+			for (; len > 0; len -= len < 8 ? len : 8) {
+				memcpy(op, ref, 8);
+				op += len < 8 ? len : 8;
+				ref += 8;
+			}
+		} else {
+			while (len-- > 0)
+				*op++ = *ref++;
+		}
+	}
+
+	return (op - (u_int8_t *)dst);
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Poly1305 (RFC 8439) with 26-bit limbs, after the public domain
+ * poly1305-donna 32-bit code by Andrew Moon.  Constant time, only 32x32
+ * multiplications.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "poly1305.h"
+
+static void	poly1305_blocks(struct poly1305_ctx *, const u_int8_t *,
+		    size_t);
+
+#define U8TO32(p)							\
+	((u_int32_t)(p)[0] | (u_int32_t)(p)[1] << 8 |			\
+	(u_int32_t)(p)[2] << 16 | (u_int32_t)(p)[3] << 24)
+#define U32TO8(p, v) do {						\
+	(p)[0] = (u_int8_t)(v); (p)[1] = (u_int8_t)((v) >> 8);		\
+	(p)[2] = (u_int8_t)((v) >> 16); (p)[3] = (u_int8_t)((v) >> 24);	\
+} while (0)
+
+void
+poly1305_init(struct poly1305_ctx *st, const u_int8_t *key)
+{
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = (U8TO32(&key[0])) & 0x3ffffff;
+	st->r[1] = (U8TO32(&key[3]) >> 2) & 0x3ffff03;
+	st->r[2] = (U8TO32(&key[6]) >> 4) & 0x3ffc0ff;
+	st->r[3] = (U8TO32(&key[9]) >> 6) & 0x3f03fff;
+	st->r[4] = (U8TO32(&key[12]) >> 8) & 0x00fffff;
+
+	memset(st->h, 0, sizeof(st->h));
+
+	st->pad[0] = U8TO32(&key[16]);
+	st->pad[1] = U8TO32(&key[20]);
+	st->pad[2] = U8TO32(&key[24]);
+	st->pad[3] = U8TO32(&key[28]);
+
+	st->leftover = 0;
+	st->final = 0;
+}
+
+static void
+poly1305_blocks(struct poly1305_ctx *st, const u_int8_t *m, size_t bytes)
+{
+	const u_int32_t	hibit = st->final ? 0 : (1UL << 24);
+	u_int32_t	r0, r1, r2, r3, r4;
+	u_int32_t	s1, s2, s3, s4;
+	u_int32_t	h0, h1, h2, h3, h4;
+	u_int64_t	d0, d1, d2, d3, d4;
+	u_int32_t	c;
+
+	r0 = st->r[0];
+	r1 = st->r[1];
+	r2 = st->r[2];
+	r3 = st->r[3];
+	r4 = st->r[4];
+
+	s1 = r1 * 5;
+	s2 = r2 * 5;
+	s3 = r3 * 5;
+	s4 = r4 * 5;
+
+	h0 = st->h[0];
+	h1 = st->h[1];
+	h2 = st->h[2];
+	h3 = st->h[3];
+	h4 = st->h[4];
+
+	while (bytes >= POLY1305_BLOCKLEN) {
+		/* h += m[i] */
+		h0 += (U8TO32(m + 0)) & 0x3ffffff;
+		h1 += (U8TO32(m + 3) >> 2) & 0x3ffffff;
+		h2 += (U8TO32(m + 6) >> 4) & 0x3ffffff;
+		h3 += (U8TO32(m + 9) >> 6) & 0x3ffffff;
+		h4 += (U8TO32(m + 12) >> 8) | hibit;
+
+		/* h *= r */
+		d0 = ((u_int64_t)h0 * r0) + ((u_int64_t)h1 * s4) +
+		    ((u_int64_t)h2 * s3) + ((u_int64_t)h3 * s2) +
+		    ((u_int64_t)h4 * s1);
+		d1 = ((u_int64_t)h0 * r1) + ((u_int64_t)h1 * r0) +
+		    ((u_int64_t)h2 * s4) + ((u_int64_t)h3 * s3) +
+		    ((u_int64_t)h4 * s2);
+		d2 = ((u_int64_t)h0 * r2) + ((u_int64_t)h1 * r1) +
+		    ((u_int64_t)h2 * r0) + ((u_int64_t)h3 * s4) +
+		    ((u_int64_t)h4 * s3);
+		d3 = ((u_int64_t)h0 * r3) + ((u_int64_t)h1 * r2) +
+		    ((u_int64_t)h2 * r1) + ((u_int64_t)h3 * r0) +
+		    ((u_int64_t)h4 * s4);
+		d4 = ((u_int64_t)h0 * r4) + ((u_int64_t)h1 * r3) +
+		    ((u_int64_t)h2 * r2) + ((u_int64_t)h3 * r1) +
+		    ((u_int64_t)h4 * r0);
+
+		/* (partial) h %= p */
+		c = (u_int32_t)(d0 >> 26);
+		h0 = (u_int32_t)d0 & 0x3ffffff;
+		d1 += c;
+		c = (u_int32_t)(d1 >> 26);
+		h1 = (u_int32_t)d1 & 0x3ffffff;
+		d2 += c;
+		c = (u_int32_t)(d2 >> 26);
+		h2 = (u_int32_t)d2 & 0x3ffffff;
+		d3 += c;
+		c = (u_int32_t)(d3 >> 26);
+		h3 = (u_int32_t)d3 & 0x3ffffff;
+		d4 += c;
+		c = (u_int32_t)(d4 >> 26);
+		h4 = (u_int32_t)d4 & 0x3ffffff;
+		h0 += c * 5;
+		c = (h0 >> 26);
+		h0 = h0 & 0x3ffffff;
+		h1 += c;
+
+		m += POLY1305_BLOCKLEN;
+		bytes -= POLY1305_BLOCKLEN;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+	st->h[3] = h3;
+	st->h[4] = h4;
+}
+
+void
+poly1305_update(struct poly1305_ctx *st, const u_int8_t *m, size_t bytes)
+{
+	size_t	want;
+
+	/* handle leftover */
+	if (st->leftover) {
+		want = POLY1305_BLOCKLEN - st->leftover;
+		if (want > bytes)
+			want = bytes;
+		memcpy(st->buffer + st->leftover, m, want);
+		bytes -= want;
+		m += want;
+		st->leftover += want;
+		if (st->leftover < POLY1305_BLOCKLEN)
+			return;
+		poly1305_blocks(st, st->buffer, POLY1305_BLOCKLEN);
+		st->leftover = 0;
+	}
+
+	/* process full blocks */
+	if (bytes >= POLY1305_BLOCKLEN) {
+		want = bytes & ~(POLY1305_BLOCKLEN - 1);
+		poly1305_blocks(st, m, want);
+		m += want;
+		bytes -= want;
+	}
+
+	/* store leftover */
+	if (bytes) {
+		memcpy(st->buffer + st->leftover, m, bytes);
+		st->leftover += bytes;
+	}
+}
+
+void
+poly1305_finish(struct poly1305_ctx *st, u_int8_t *mac)
+{
+	u_int32_t	h0, h1, h2, h3, h4, c;
+	u_int32_t	g0, g1, g2, g3, g4;
+	u_int64_t	f;
+	u_int32_t	mask;
+
+	/* process the remaining block */
+	if (st->leftover) {
+		st->buffer[st->leftover++] = 1;
+		memset(st->buffer + st->leftover, 0,
+		    POLY1305_BLOCKLEN - st->leftover);
+		st->final = 1;
+		poly1305_blocks(st, st->buffer, POLY1305_BLOCKLEN);
+	}
+
+	/* fully carry h */
+	h0 = st->h[0];
+	h1 = st->h[1];
+	h2 = st->h[2];
+	h3 = st->h[3];
+	h4 = st->h[4];
+
+	c = h1 >> 26;
+	h1 = h1 & 0x3ffffff;
+	h2 += c;
+	c = h2 >> 26;
+	h2 = h2 & 0x3ffffff;
+	h3 += c;
+	c = h3 >> 26;
+	h3 = h3 & 0x3ffffff;
+	h4 += c;
+	c = h4 >> 26;
+	h4 = h4 & 0x3ffffff;
+	h0 += c * 5;
+	c = h0 >> 26;
+	h0 = h0 & 0x3ffffff;
+	h1 += c;
+
+	/* compute h + -p */
+	g0 = h0 + 5;
+	c = g0 >> 26;
+	g0 &= 0x3ffffff;
+	g1 = h1 + c;
+	c = g1 >> 26;
+	g1 &= 0x3ffffff;
+	g2 = h2 + c;
+	c = g2 >> 26;
+	g2 &= 0x3ffffff;
+	g3 = h3 + c;
+	c = g3 >> 26;
+	g3 &= 0x3ffffff;
+	g4 = h4 + c - (1UL << 26);
+
+	/* select h if h < p, or h + -p if h >= p */
+	mask = (g4 >> ((sizeof(u_int32_t) * 8) - 1)) - 1;
+	g0 &= mask;
+	g1 &= mask;
+	g2 &= mask;
+	g3 &= mask;
+	g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	/* h = h % (2^128) */
+	h0 = ((h0) | (h1 << 26)) & 0xffffffff;
+	h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+	h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+	h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+
+	/* mac = (h + pad) % (2^128) */
+	f = (u_int64_t)h0 + st->pad[0];
+	h0 = (u_int32_t)f;
+	f = (u_int64_t)h1 + st->pad[1] + (f >> 32);
+	h1 = (u_int32_t)f;
+	f = (u_int64_t)h2 + st->pad[2] + (f >> 32);
+	h2 = (u_int32_t)f;
+	f = (u_int64_t)h3 + st->pad[3] + (f >> 32);
+	h3 = (u_int32_t)f;
+
+	U32TO8(mac + 0, h0);
+	U32TO8(mac + 4, h1);
+	U32TO8(mac + 8, h2);
+	U32TO8(mac + 12, h3);
+
+	/* zero out the state */
+	explicit_bzero(st, sizeof(*st));
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef POLY1305_H
+#define POLY1305_H
+
+#include <sys/types.h>
+
+#include "tools.h"
+
+CEXT_BEGIN
+
+#define POLY1305_KEYLEN		32
+#define POLY1305_TAGLEN		16
+#define POLY1305_BLOCKLEN	16
+
+/* one-time authenticator, the key must never be used for two messages */
+struct poly1305_ctx {
+	u_int32_t	r[5];
+	u_int32_t	h[5];
+	u_int32_t	pad[4];
+	size_t		leftover;
+	u_int8_t	buffer[POLY1305_BLOCKLEN];
+	int		final;
+};
+
+void	poly1305_init(struct poly1305_ctx *, const u_int8_t *);
+void	poly1305_update(struct poly1305_ctx *, const u_int8_t *, size_t);
+void	poly1305_finish(struct poly1305_ctx *, u_int8_t *);
+
+CEXT_END
+
+#endif /* !POLY1305_H */
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * avail counts the free connections; acquire() takes one off it with a
+ * compare and swap, then claims the first free slot, so low slots stay
+ * busy and connected and high ones only open under load.  Only when
+ * avail is 0 does a thread take the lock, to sleep until release() finds
+ * it waiting and wakes it.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "cryptredis.h"
+#include "cryptredisxx.h"
+
+#define CRYPTREDIS_POOL_IDLECHECK	30000	/* ms */
+
+CRPTRDS_BEGIN_NAMESPACE
+
+typedef chrono::steady_clock	poolclock;
+
+struct CryptRedisPoolPrivate {
+	CryptRedisDb		*dbs;
+	atomic<bool>		*busy;
+	poolclock::time_point	*used;		/* last released */
+	size_t			 size;
+	atomic<size_t>		 avail;
+	atomic<int>		 waiters;
+	mutex			 lock;
+	condition_variable	 cond;
+
+	string			 host;
+	int			 port;
+	bool			 crypt;
+	int			 idlecheck;
+
+	bool reserve();
+	bool prepare(size_t);
+};
+
+/* take one of the free connections off avail, false if there is none */
+bool
+CryptRedisPoolPrivate::reserve()
+{
+	size_t	n = avail.load();
+
+	while (n > 0)
+		if (avail.compare_exchange_weak(n, n - 1))
+			return (true);
+
+	return (false);
+}
+
+/* (re)open the connection of slot i if it isn't, or idled into failing */
+bool
+CryptRedisPoolPrivate::prepare(size_t i)
+{
+	CryptRedisDb		*db = &dbs[i];
+	CryptRedisResult	 res;
+
+	if (db->connected() && idlecheck > 0 && poolclock::now() - used[i] >=
+	    chrono::milliseconds(idlecheck)) {
+		if (db->ping(&res) != 0 || res.status() != CryptRedisResult::Ok)
+			db->close();
+	}
+	if (db->connected())
+		return (true);
+
+	db->close();
+	if (!db->open(host, port)) {
+		db->close();
+		return (false);
+	}
+	if (crypt && db->setCryptEnabled(true) == -1) {
+		db->close();
+		return (false);
+	}
+
+	return (true);
+}
+
+CryptRedisPool::CryptRedisPool(size_t n, const string &h, int p) :
+	d(new CryptRedisPoolPrivate)
+{
+	d->size = n;
+	d->dbs = new CryptRedisDb[n];
+	d->busy = new atomic<bool>[n];
+	d->used = new poolclock::time_point[n];
+	for (size_t i = 0; i < n; i++)
+		d->busy[i] = false;
+	d->avail = n;
+	d->waiters = 0;
+	d->host = h;
+	d->port = p;
+	d->crypt = false;
+	d->idlecheck = CRYPTREDIS_POOL_IDLECHECK;
+}
+
+CryptRedisPool::~CryptRedisPool()
+{
+	delete[] d->dbs;
+	delete[] d->busy;
+	delete[] d->used;
+	delete d;
+}
+
+size_t
+CryptRedisPool::size() const
+{
+	return (d->size);
+}
+
+size_t
+CryptRedisPool::available() const
+{
+	return (d->avail.load());
+}
+
+void
+CryptRedisPool::setCryptEnabled(bool enable)
+{
+	d->crypt = enable;
+}
+
+/* -1 if the connections refuse it, see CryptRedisDb::setCryptFormat() */
+int
+CryptRedisPool::setCryptFormat(int f)
+{
+	for (size_t i = 0; i < d->size; i++)
+		if (d->dbs[i].setCryptFormat(f) == -1)
+			return (-1);
+
+	return (0);
+}
+
+void
+CryptRedisPool::setRawStorage(bool raw)
+{
+	for (size_t i = 0; i < d->size; i++)
+		d->dbs[i].setRawStorage(raw);
+}
+
+int
+CryptRedisPool::setCompression(bool enable, size_t min)
+{
+	for (size_t i = 0; i < d->size; i++)
+		if (d->dbs[i].setCompression(enable, min) == -1)
+			return (-1);
+
+	return (0);
+}
+
+void
+CryptRedisPool::setKeyWatch(bool watch)
+{
+	for (size_t i = 0; i < d->size; i++)
+		d->dbs[i].setKeyWatch(watch);
+}
+
+/*
+ * Connections idle for ms or more are PINGed before being handed out,
+ * and opened again if that fails; CRYPTREDIS_POOL_IDLECHECK by default.
+ */
+void
+CryptRedisPool::setIdleCheck(int ms)
+{
+	d->idlecheck = ms;
+}
+
+CryptRedisDb *
+CryptRedisPool::acquire(int timeout)
+{
+	size_t	i;
+	bool	got, f;
+
+	if (!d->reserve()) {
+		if (timeout == 0)
+			return (NULL);
+
+		unique_lock<mutex> lk(d->lock);
+		d->waiters++;
+		if (timeout < 0) {
+			d->cond.wait(lk, [this] { return (d->reserve()); });
+			got = true;
+		} else
+			got = d->cond.wait_for(lk,
+			    chrono::milliseconds(timeout),
+			    [this] { return (d->reserve()); });
+		d->waiters--;
+		if (!got)
+			return (NULL);
+	}
+
+	/* avail kept one free for us, others may claim slots as we look */
+	for (i = 0;; i = (i + 1) % d->size) {
+		f = false;
+		if (!d->busy[i].load(memory_order_relaxed) &&
+		    d->busy[i].compare_exchange_strong(f, true,
+		    memory_order_acquire))
+			break;
+	}
+
+	if (!d->prepare(i)) {
+		release(&d->dbs[i]);
+		return (NULL);
+	}
+
+	return (&d->dbs[i]);
+}
+
+void
+CryptRedisPool::release(CryptRedisDb *db)
+{
+	size_t	i = db - d->dbs;
+
+	d->used[i] = poolclock::now();
+	d->busy[i].store(false, memory_order_release);
+	d->avail++;
+
+	/* a waiter counted itself under the lock before it last looked */
+	if (d->waiters.load() > 0) {
+		lock_guard<mutex> lk(d->lock);
+		d->cond.notify_one();
+	}
+}
+
+CRPTRDS_END_NAMESPACE
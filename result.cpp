@@ -14,6 +14,11 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
 #include "hiredis/hiredis.h"
 #include "cryptredisxx.h"
 
@@ -26,105 +31,179 @@ const int CryptRedisResult::Nil     = REDIS_REPLY_NIL;
 const int CryptRedisResult::String  = REDIS_REPLY_STRING;
 const int CryptRedisResult::Array   = REDIS_REPLY_ARRAY;
 
-struct CryptRedisResultPrivate {
-	string		data_s;
-	long long	data_i;
-	int		type;
-	int		size;
-	int		status;
-};
-
 CryptRedisResult::CryptRedisResult() :
-	d(new CryptRedisResultPrivate)
+	heap(NULL)
 {
 	clear();
 }
 
+CryptRedisResult::CryptRedisResult(CryptRedisResult &&r) noexcept :
+	heap(NULL)
+{
+	moveFrom(r);
+}
+
 CryptRedisResult::~CryptRedisResult()
 {
-	delete d;
+	release();
 }
 
+CryptRedisResult &
+CryptRedisResult::operator=(CryptRedisResult &&r) noexcept
+{
+	if (this != &r) {
+		release();
+		moveFrom(r);
+	}
+
+	return (*this);
+}
+
+void
+CryptRedisResult::release()
+{
+	free(heap);
+	heap = NULL;
+	len = 0;
+}
+
+/* r is left cleared; an inline string is copied, a taken over one moves */
 void
-CryptRedisResult::setData(const string &data)
+CryptRedisResult::moveFrom(CryptRedisResult &r)
 {
-	d->data_s = data;
+	heap = r.heap;
+	len = r.len;
+	if (heap == NULL)
+		memcpy(sbuf, r.sbuf, len);
+	integer = r.integer;
+	rtype = r.rtype;
+	rsize = r.rsize;
+	rstatus = r.rstatus;
+
+	r.heap = NULL;
+	r.clear();
+}
+
+void
+CryptRedisResult::setData(string_view data)
+{
+	char	*p;
+
+	if (data.size() <= InlineSize) {
+		release();
+		len = data.copy(sbuf, data.size());
+		return;
+	}
+
+	if ((p = (char *)malloc(data.size() + 1)) == NULL)
+		throw bad_alloc();
+	memcpy(p, data.data(), data.size());
+	p[data.size()] = '\0';
+	adoptData(p, data.size());
+}
+
+/* short strings are copied in and buf freed at once, as the reply would */
+void
+CryptRedisResult::adoptData(char *buf, size_t n)
+{
+	release();
+	if (buf == NULL)
+		return;
+
+	if (n <= InlineSize) {
+		memcpy(sbuf, buf, n);
+		free(buf);
+	} else
+		heap = buf;
+	len = n;
 }
 
 string
 CryptRedisResult::toString() const
 {
-	return (d->data_s);
+	return (string(view()));
+}
+
+string_view
+CryptRedisResult::view() const
+{
+	return (string_view(heap != NULL ? heap : sbuf, len));
 }
 
 void
 CryptRedisResult::setData(long long data)
 {
-	d->data_i = data;
+	integer = data;
 }
 
 int
 CryptRedisResult::toInteger() const
 {
-	return (d->data_i);
+	return (integer);
 }
 
 void
 CryptRedisResult::setType(int t)
 {
-	d->type = t;
+	rtype = t;
 }
 
 int
 CryptRedisResult::type() const
 {
-	return (d->type);
+	return (rtype);
 }
 
 void
 CryptRedisResult::setSize(int s)
 {
-	d->size = s;
+	rsize = s;
 }
 
 int
 CryptRedisResult::size() const
 {
-	return (d->size);
+	return (rsize);
 }
 
 void
 CryptRedisResult::clear()
 {
-	d->size = 0;
-	d->data_i = -1;
-	d->type = Nil;
-	d->data_s.clear();
-	d->status = CryptRedisResult::Fail;
+	release();
+	rsize = 0;
+	integer = -1;
+	rtype = Nil;
+	rstatus = CryptRedisResult::Fail;
 }
 
 void
 CryptRedisResult::setStatus(int s)
 {
-	d->status = s;
+	rstatus = s;
 }
 
 int
-CryptRedisResult::status()
+CryptRedisResult::status() const
+{
+	return (rstatus);
+}
+
+string
+CryptRedisResult::errorString() const
 {
-	return (d->status);
+	return (toString());
 }
 
 string
-CryptRedisResult::errorString()
+CryptRedisResult::statusString() const
 {
-	return (d->data_s);
+	return (statusString(rstatus));
 }
 
 string
-CryptRedisResult::statusString()
+CryptRedisResult::statusString(int s)
 {
-	switch (d->status) {
+	switch (s) {
 	case CryptRedisResult::Ok:
 		return ("CryptRedisResult::Ok");
 	case CryptRedisResult::Fail:
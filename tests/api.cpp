@@ -121,6 +121,41 @@ test_del()
     std::cerr << "==> end test redisdb.del()" << std::endl;
 }
 
+void
+test_mget()
+{
+    std::cerr << "==> begin test redisdb.mget()" << std::endl;
+    CryptRedisDb redisdb;
+    setup(&redisdb);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 3; i++) {
+        keys.push_back("mget_" + saltstr());
+        assert(CryptRedisResult::Ok == redisdb.set(keys.back(),
+            "bar" + keys.back()));
+    }
+    keys.insert(keys.begin() + 1, "mget_missing_" + saltstr());
+
+    CryptRedisResultSet resultset;
+    redisdb.mget(keys, &resultset);
+    assert(resultset.size() == keys.size());
+    size_t i = 0;
+    for (CryptRedisResultSet::iterator it = resultset.begin();
+        it != resultset.end(); it++, i++) {
+        std::cerr << "=> result " << it->toString() << std::endl;
+        assert(it->status() == CryptRedisResult::Ok);
+        if (i == 1) {
+            assert(it->type() == CryptRedisResult::Nil);
+            continue;
+        }
+        assert(it->type() == CryptRedisResult::String);
+        assert(it->toString() == "bar" + keys[i]);
+        assert(CryptRedisResult::Ok == redisdb.del(keys[i]));
+    }
+
+    teardown(&redisdb);
+    std::cerr << "==> end test redisdb.mget()" << std::endl;
+}
+
 int
 main(void)
 {
@@ -170,27 +205,7 @@ main(void)
     test_ping();
     test_exists();
     test_del();
+    test_mget();
 
     return 0;
-
-    // XXX
-#if 0
-    // use case (get command)
-    CryptRedisResultSet resultset;
-    std::vector<std::string> keys;
-    keys.push_back("keya");
-    keys.push_back("keyb");
-    keys.push_back("keyc");
-    redisdb.mget(keys, &resultset);
-
-    //std::cerr << "result status" << resultset.statusString();
-    for (auto entry : resultset) {
-        std::cerr << entry.toString() << std::endl;
-        std::cerr << entry.toInteger() << std::endl;
-    }
-
-    // use case (check crypto)
-    // - set step
-    // - get step
-#endif
 }
@@ -14,13 +14,15 @@
 # PERFORMANCE OF THIS SOFTWARE.
 
 .PATH:		${.CURDIR}/../..
-SRCS+=		encode.c tools.c bsd-crypt.c bsd-rijndael.c db.cpp result.cpp \
-		cryptredis.c
+SRCS+=		encode.c tools.c bsd-crypt.c bsd-rijndael.c aes-hw.c db.cpp \
+		result.cpp asyncdb.cpp pool.cpp cryptredis.c format.c aes-ct.c \
+		chacha.c poly1305.c lz4.c keyring.c
 
 .PATH:		${.CURDIR}/../../hiredis
 SRCS+=		async.c dict.c hiredis.c net.c sds.c
 
 CPPFLAGS+=	-ggdb3
-LDADD+=		-lstdc++ -lutil
+CXXFLAGS+=	-std=c++17
+LDADD+=		-lstdc++ -lutil -lpthread
 
 .include <bsd.prog.mk>
@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <pwd.h>
 
+#include <type_traits>
+
 #include "cryptredisxx.h"
 #include "encode.h"
 #include "apicrypt.h"
@@ -53,6 +55,19 @@ main(void)
 	assert(crres.toString() == entryval);
 	crres.clear();
 
+	/* settings refused leave encryption on as it was */
+	assert(crdb.setCompression(true) == -1);
+	APICRYPT_REPORT("setCompression %s", crdb.lastError().data());
+	assert(crdb.lastError().find("legacy") != string::npos);
+	assert(crdb.cryptEnabled() && !crdb.compression());
+	assert(crdb.setCryptFormat(99) == -1);
+	assert(crdb.cryptEnabled());
+	assert(crdb.cryptFormat() == CryptRedisDb::LegacyFormat);
+	assert(crdb.set(entrykey, entryval) == CryptRedisResult::Ok);
+	crdb.get(entrykey, &crres);
+	assert(crres.toString() == entryval);
+	crres.clear();
+
 	/*
 	 * retrieve the same key, disabling encrypt, shall get a ciphered
 	 * buffer
@@ -71,6 +86,158 @@ main(void)
 	APICRYPT_REPORT("crres.size() %lu encsiz %lu",
 	    crres.toString().size(), encsiz);
 	assert(crres.toString().size() == encsiz);
+	crres.clear();
+
+	/*
+	 * raw storage keeps binary values intact and stores the sealed bytes
+	 * themselves, no base64
+	 */
+	string	binval = entryval + string("\0 \r\n", 4);
+
+	crdb.setRawStorage(true);
+	assert(crdb.setCryptFormat(CryptRedisDb::CtrHmacFormat) == 0);
+	assert(crdb.setCryptEnabled(true) == 0);
+	assert(crdb.set(entrykey, binval) == CryptRedisResult::Ok);
+	crdb.get(entrykey, &crres);
+	assert(crres.status() == CryptRedisResult::Ok);
+	assert(crres.toString() == binval);
+	crres.clear();
+
+	assert(crdb.setCryptEnabled(false) == 0);
+	crdb.get(entrykey, &crres);
+	APICRYPT_REPORT("raw crres.size() %lu binval.size() %lu",
+	    crres.toString().size(), binval.size());
+	/* header, key id, nonce and tag */
+	assert(crres.toString().size() == binval.size() + 36);
+	crdb.setRawStorage(false);
+
+	/* compressed values are smaller on the wire, read back the same */
+	string	jsonval;
+
+	for (int i = 0; i < 64; i++)
+		jsonval += "{\"id\":42,\"name\":\"cryptredis\"},";
+	assert(crdb.setCompression(true) == 0);
+	assert(crdb.compression());
+	assert(crdb.setCryptEnabled(true) == 0);
+	assert(crdb.set(entrykey, jsonval) == CryptRedisResult::Ok);
+	crdb.get(entrykey, &crres);
+	assert(crres.toString() == jsonval);
+	crres.clear();
+
+	assert(crdb.setCryptEnabled(false) == 0);
+	crdb.get(entrykey, &crres);
+	APICRYPT_REPORT("lz4 crres.size() %lu jsonval.size() %lu",
+	    crres.toString().size(), jsonval.size());
+	assert(crres.toString().size() < jsonval.size() / 4);
+	crres.clear();
+	assert(crdb.setCompression(false) == 0);
+
+	/* a watched key file, reads and writes go on as before */
+	assert(crdb.setKeyWatch(true) == 0);
+	assert(crdb.keyWatch());
+	assert(crdb.setCryptEnabled(true) == 0);
+	assert(crdb.set(entrykey, jsonval) == CryptRedisResult::Ok);
+	crdb.get(entrykey, &crres);
+	assert(crres.toString() == jsonval);
+	crres.clear();
+	assert(crdb.setKeyWatch(false) == 0);
+	assert(crdb.setCryptEnabled(false) == 0);
+
+	/*
+	 * mget of values in every format, a missing key and a value stored
+	 * in clear, which doesn't open
+	 */
+	CryptRedisResultSet	crset;
+	vector<string>		mkeys;
+	const int		fmts[] = { CryptRedisDb::LegacyFormat,
+				    CryptRedisDb::CbcFormat,
+				    CryptRedisDb::CtrHmacFormat,
+				    CryptRedisDb::ChachaPolyFormat };
+
+	for (int i = 0; i < 40; i++) {
+		mkeys.push_back("mget_" + saltstr());
+		assert(crdb.setCryptFormat(fmts[i % 4]) == 0);
+		assert(crdb.setCryptEnabled(true) == 0);
+		assert(crdb.set(mkeys.back(), string(i * 7, 'v') +
+		    mkeys.back()) == CryptRedisResult::Ok);
+	}
+	mkeys.push_back("mget_missing_" + saltstr());
+	assert(crdb.setCryptEnabled(false) == 0);
+	mkeys.push_back("mget_clear_" + saltstr());
+	assert(crdb.set(mkeys.back(), "in clear") == CryptRedisResult::Ok);
+
+	assert(crdb.setCryptEnabled(true) == 0);
+	crdb.mget(mkeys, &crset);
+	assert(crset.size() == mkeys.size());
+	CryptRedisResultSet::iterator	it = crset.begin();
+	for (int i = 0; i < 40; i++, it++) {
+		assert(it->type() == CryptRedisResult::String);
+		assert(it->toString() == string(i * 7, 'v') + mkeys[i]);
+	}
+	assert(it->type() == CryptRedisResult::Nil);
+	assert((++it)->type() == CryptRedisResult::Error);
+	assert(it->status() == CryptRedisResult::Fail);
+	for (size_t i = 0; i < mkeys.size(); i++)
+		crdb.del(mkeys[i]);
+
+	/* the same keys written back with mset, then msetnx refusing */
+	vector<pair<string, string> >	kvs;
+
+	for (int i = 0; i < 40; i++)
+		kvs.push_back(make_pair(mkeys[i], string(i * 11, 'w') +
+		    mkeys[i]));
+	assert(crdb.mset(kvs, &crres) == 0);
+	assert(crres.toString() == "OK");
+	crres.clear();
+	mkeys.resize(40);
+	crdb.mget(mkeys, &crset);
+	it = crset.begin();
+	for (int i = 0; i < 40; i++, it++)
+		assert(it->toString() == kvs[i].second);
+	kvs.resize(2);
+	kvs[0].first = "msetnx_" + saltstr();
+	assert(crdb.msetnx(kvs, &crres) == 0);
+	assert(crres.type() == CryptRedisResult::Integer);
+	assert(crres.toInteger() == 0);
+	crres.clear();
+	crdb.mget(vector<string>(1, kvs[0].first), &crset);
+	assert(crset.front().type() == CryptRedisResult::Nil);
+	for (size_t i = 0; i < mkeys.size(); i++)
+		crdb.del(mkeys[i]);
+	assert(crdb.setCryptFormat(CryptRedisDb::LegacyFormat) == 0);
+	assert(crdb.setCryptEnabled(false) == 0);
+
+	/*
+	 * results move and aren't copied: a long value stays in the buffer it
+	 * was decrypted into, a short one is kept inline
+	 */
+	static_assert(!is_copy_constructible<CryptRedisResult>::value,
+	    "CryptRedisResult is move-only");
+	string		 longval(4000, 'l');
+	const char	*p;
+
+	assert(crdb.setCryptFormat(CryptRedisDb::ChachaPolyFormat) == 0);
+	assert(crdb.setCryptEnabled(true) == 0);
+	assert(crdb.set(entrykey, longval) == CryptRedisResult::Ok);
+	CryptRedisResult	lres = crdb.get(entrykey);
+	assert(lres.status() == CryptRedisResult::Ok);
+	assert(lres.view() == longval);
+	p = lres.view().data();
+	CryptRedisResult	mres(move(lres));
+	assert(mres.view().data() == p && mres.view() == longval);
+	assert(lres.view().empty() && lres.type() == CryptRedisResult::Nil);
+	lres = crdb.get("missing_" + saltstr());
+	assert(lres.type() == CryptRedisResult::Nil && lres.view().empty());
+
+	assert(crdb.set(entrykey, "short") == CryptRedisResult::Ok);
+	lres = crdb.get(entrykey);
+	assert(lres.view() == "short");
+	mres = move(lres);
+	assert(mres.view() == "short" && lres.view().empty());
+	assert(CryptRedisResult::statusString(CryptRedisResult::Fail) ==
+	    "CryptRedisResult::Fail");
+	assert(crdb.setCryptFormat(CryptRedisDb::LegacyFormat) == 0);
+	assert(crdb.setCryptEnabled(false) == 0);
 
 	/* cleanup */
 	assert(crdb.del(entrykey) == CryptRedisResult::Ok);
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * CryptRedisPool: more threads than connections set and read back
+ * encrypted values, each connection used by one thread at a time;
+ * acquire() times out while all are out and a blocked waiter wakes on
+ * release(); idle connections are PINGed.
+ */
+
+#include <sys/types.h>
+
+#include <unistd.h>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pwd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "cryptredisxx.h"
+#include "encode.h"
+#include "apicrypt.h"
+
+#define POOL_SIZE	4
+#define POOL_THREADS	16
+#define POOL_ROUNDS	200
+
+static atomic<int>	inuse[POOL_SIZE];
+
+static void
+worker(CryptRedisPool *pool, CryptRedisDb *first, int t)
+{
+	CryptRedisDb	*db;
+	string		 key, val;
+	int		 i;
+
+	for (i = 0; i < POOL_ROUNDS; i++) {
+		assert((db = pool->acquire()) != NULL);
+		assert(db >= first && db < first + POOL_SIZE);
+		assert(inuse[db - first]++ == 0);
+
+		key = "pool_" + to_string(getpid()) + "_" + to_string(t) +
+		    "_" + to_string(i % 8);
+		val = string(1 + (t * 37 + i) % 300, 'a' + t);
+		assert(db->set(key, val) == 0);
+		assert(db->get(key).toString() == val);
+		if (i % 8 == 7)
+			assert(db->del(key) == 0);
+
+		assert(inuse[db - first]-- == 1);
+		pool->release(db);
+	}
+}
+
+int
+main(void)
+{
+	APICRYPT_LABEL("CryptRedisPool");
+	CryptRedisPool		 pool(POOL_SIZE, "127.0.0.1", 6379);
+	CryptRedisDb		*dbs[POOL_SIZE], *first, *db;
+	CryptRedisResult	 res;
+	vector<thread>		 threads;
+	chrono::steady_clock::time_point t0;
+	char			 buf[LINE_MAX], keyfile[LINE_MAX];
+	atomic<bool>		 woke(false);
+	int			 i;
+
+	snprintf(keyfile, sizeof(keyfile),
+	    "CRYPTREDIS_KEYFILE=%s/../../obj/test.key", getcwd(buf,
+	    sizeof(buf)));
+	assert(!putenv(keyfile));
+
+	assert(pool.setCompression(true, 64) == -1);	/* legacy format */
+	assert(pool.setCryptFormat(CryptRedisDb::ChachaPolyFormat) == 0);
+	assert(pool.setCompression(true, 64) == 0);
+	pool.setCryptEnabled(true);
+	assert(pool.size() == POOL_SIZE);
+
+	/* the first connection opens lazily, the slots are contiguous */
+	assert((first = pool.acquire(0)) != NULL);
+	assert(first->connected() && first->cryptEnabled());
+	pool.release(first);
+
+	for (i = 0; i < POOL_THREADS; i++)
+		threads.push_back(thread(worker, &pool, first, i));
+	for (i = 0; i < POOL_THREADS; i++)
+		threads[i].join();
+	threads.clear();
+	assert(pool.available() == POOL_SIZE);
+
+	/* all out: no wait, then a bounded one */
+	for (i = 0; i < POOL_SIZE; i++)
+		assert((dbs[i] = pool.acquire(0)) != NULL);
+	assert(pool.available() == 0);
+	assert(pool.acquire(0) == NULL);
+	t0 = chrono::steady_clock::now();
+	assert(pool.acquire(50) == NULL);
+	assert(chrono::steady_clock::now() - t0 >= chrono::milliseconds(50));
+
+	/* a waiter without timeout gets the next one released */
+	threads.push_back(thread([&] {
+		CryptRedisDb *w;
+
+		assert((w = pool.acquire()) == dbs[0]);
+		woke = true;
+		pool.release(w);
+	}));
+	usleep(20000);
+	assert(!woke);
+	pool.release(dbs[0]);
+	threads[0].join();
+	assert(woke);
+	for (i = 1; i < POOL_SIZE; i++)
+		pool.release(dbs[i]);
+
+	/* idle connections are checked, and still work */
+	pool.setIdleCheck(1);
+	usleep(5000);
+	assert((db = pool.acquire(0)) != NULL);
+	assert(db->connected());
+	assert(db->ping(&res) == 0 && res.toString() == "PONG");
+	pool.release(db);
+	assert(pool.available() == POOL_SIZE);
+
+	return (0);
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Asynchronous API on a poll(2) loop standing in for libevent or libev,
+ * attached through the same hooks as the hiredis adapters.  Values set
+ * asynchronously read back through a blocking handle and the other way
+ * around, in every format; missing keys come back nil, commands pending
+ * at close get their callback with no reply.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cryptredis.h"
+#include "hiredis/async.h"
+
+#define NKEYS		64
+
+struct loop {
+	int	lp_fd;
+	short	lp_events;
+};
+
+struct expect {
+	const char	*ex_val;	/* NULL for nil */
+	size_t		 ex_len;
+	int		*ex_done;
+};
+
+static void
+loop_addread(void *arg)
+{
+	struct loop	*lp = arg;
+
+	lp->lp_events |= POLLIN;
+}
+
+static void
+loop_delread(void *arg)
+{
+	struct loop	*lp = arg;
+
+	lp->lp_events &= ~POLLIN;
+}
+
+static void
+loop_addwrite(void *arg)
+{
+	struct loop	*lp = arg;
+
+	lp->lp_events |= POLLOUT;
+}
+
+static void
+loop_delwrite(void *arg)
+{
+	struct loop	*lp = arg;
+
+	lp->lp_events &= ~POLLOUT;
+}
+
+static void
+loop_cleanup(void *arg)
+{
+	struct loop	*lp = arg;
+
+	lp->lp_events = 0;
+}
+
+static void
+loop_attach(struct loop *lp, redisAsyncContext *ac)
+{
+	lp->lp_fd = ac->c.fd;
+	lp->lp_events = 0;
+	ac->ev.addRead = loop_addread;
+	ac->ev.delRead = loop_delread;
+	ac->ev.addWrite = loop_addwrite;
+	ac->ev.delWrite = loop_delwrite;
+	ac->ev.cleanup = loop_cleanup;
+	ac->ev.data = lp;
+}
+
+/* run until *pending callbacks have run */
+static void
+loop_run(struct loop *lp, struct cryptredis_async *cra, const int *pending)
+{
+	struct pollfd	pfd;
+
+	while (*pending > 0) {
+		assert(cra->ca_context != NULL);
+		pfd.fd = lp->lp_fd;
+		pfd.events = lp->lp_events;
+		assert(poll(&pfd, 1, 5000) == 1);
+		if (pfd.revents & POLLOUT)
+			redisAsyncHandleWrite(cra->ca_context);
+		if (pfd.revents & (POLLIN | POLLHUP))
+			redisAsyncHandleRead(cra->ca_context);
+	}
+}
+
+static void
+cb_set(struct cryptredis_async *cra, struct redisReply *r, void *arg)
+{
+	assert(r != NULL && r->type == REDIS_REPLY_STATUS);
+	(*(int *)arg)--;
+}
+
+static void
+cb_get(struct cryptredis_async *cra, struct redisReply *r, void *arg)
+{
+	struct expect	*ex = arg;
+
+	assert(r != NULL);
+	if (ex->ex_val == NULL)
+		assert(r->type == REDIS_REPLY_NIL);
+	else {
+		assert(r->type == REDIS_REPLY_STRING);
+		assert((size_t)r->len == ex->ex_len);
+		assert(!memcmp(r->str, ex->ex_val, ex->ex_len));
+	}
+	(*ex->ex_done)--;
+}
+
+static void
+cb_gone(struct cryptredis_async *cra, struct redisReply *r, void *arg)
+{
+	assert(r == NULL);
+	(*(int *)arg)--;
+}
+
+static void
+test_format(struct cryptredis_async *cra, struct loop *lp,
+    struct cryptredis *crp, int fmt, int raw)
+{
+	struct expect	 ex[NKEYS + 1];
+	char		 keys[NKEYS][64], *vals[NKEYS];
+	size_t		 lens[NKEYS], i;
+	int		 pending;
+
+	assert(!cryptredis_config_encrypt(&cra->ca_crypt, fmt));
+	assert(!cryptredis_config_raw(&cra->ca_crypt, raw));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, raw));
+
+	for (i = 0; i < NKEYS; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "%d_async_%d_%d_%zu",
+		    getpid(), fmt, raw, i);
+		lens[i] = i % 4 == 0 ? 4096 + i : 1 + i;
+		assert((vals[i] = malloc(lens[i] + 1)) != NULL);
+		memset(vals[i], 'a' + i % 26, lens[i]);
+		vals[i][lens[i]] = '\0';
+		/* legacy values end at their first NUL */
+		if ((fmt & CRYPTREDIS_FMT_MASK) != CRYPTREDIS_FMT_LEGACY)
+			vals[i][lens[i] / 2] = '\0';
+	}
+
+	/* odd keys through the blocking handle, all read asynchronously */
+	pending = 0;
+	for (i = 0; i < NKEYS; i++) {
+		if (i % 2) {
+			assert(!cryptredis_set_rn(crp, keys[i],
+			    strlen(keys[i]), vals[i], lens[i]));
+			cryptredis_response_free(crp);
+			continue;
+		}
+		assert(!cryptredis_async_set(cra, keys[i], strlen(keys[i]),
+		    vals[i], lens[i], cb_set, &pending));
+		pending++;
+	}
+	for (i = 0; i < NKEYS; i++) {
+		ex[i].ex_val = vals[i];
+		ex[i].ex_len = lens[i];
+		ex[i].ex_done = &pending;
+		assert(!cryptredis_async_get(cra, keys[i], strlen(keys[i]),
+		    cb_get, &ex[i]));
+		pending++;
+	}
+	ex[NKEYS].ex_val = NULL;
+	ex[NKEYS].ex_done = &pending;
+	assert(!cryptredis_async_get(cra, "async_missing", 13, cb_get,
+	    &ex[NKEYS]));
+	pending++;
+	loop_run(lp, cra, &pending);
+
+	/* and the even ones read back blocking */
+	for (i = 0; i < NKEYS; i += 2) {
+		assert(!cryptredis_get_rn(crp, keys[i], strlen(keys[i])));
+		assert(cryptredis_response_len(crp) == lens[i]);
+		assert(!memcmp(cryptredis_response_string(crp), vals[i],
+		    lens[i]));
+		cryptredis_response_free(crp);
+	}
+
+	for (i = 0; i < NKEYS; i++) {
+		assert(!cryptredis_del_r(crp, keys[i]));
+		cryptredis_response_free(crp);
+		free(vals[i]);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct cryptredis_async	*cra;
+	struct cryptredis	*crp;
+	struct loop		 lp;
+	char			 buf[PATH_MAX], keyfile[PATH_MAX];
+	int			 pending;
+
+	fprintf(stderr, "==> begin test cryptasync\n");
+
+	snprintf(keyfile, sizeof(keyfile),
+	    "CRYPTREDIS_KEYFILE=%s/../../obj/test.key", getcwd(buf,
+	    sizeof(buf)));
+	assert(!putenv(keyfile));
+
+	assert((crp = cryptredis_open("localhost", 6379)) != NULL);
+	assert((cra = cryptredis_async_open("localhost", 6379)) != NULL);
+	assert(cra->ca_crypt.cr_connected);
+	loop_attach(&lp, cra->ca_context);
+
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_NONE, 0);
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_LEGACY, 0);
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_CTR, 0);
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_CBC, 1);
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_CTR | CRYPTREDIS_FMT_LZ4, 1);
+	test_format(cra, &lp, crp, CRYPTREDIS_FMT_CHACHA |
+	    CRYPTREDIS_FMT_LZ4, 0);
+
+	/* never sent, the callback still runs */
+	pending = 1;
+	assert(!cryptredis_async_get(cra, "async_missing", 13, cb_gone,
+	    &pending));
+	cryptredis_async_close(cra);
+	assert(pending == 0);
+
+	assert(!cryptredis_close(crp));
+
+	fprintf(stderr, "==> end test cryptasync\n");
+
+	return (0);
+}
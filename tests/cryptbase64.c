@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Base64 codecs: RFC 4648 vectors and malformed input through every
+ * implementation, then random values of all lengths compared against the
+ * scalar code, encoding and decoding both into a separate buffer and in
+ * place.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+
+#define MAXLEN		1024
+
+static const struct {
+	const char	*raw;
+	const char	*enc;
+} vectors[] = {
+	{ "", "" },
+	{ "f", "Zg==" },
+	{ "fo", "Zm8=" },
+	{ "foo", "Zm9v" },
+	{ "foob", "Zm9vYg==" },
+	{ "fooba", "Zm9vYmE=" },
+	{ "foobar", "Zm9vYmFy" }
+};
+
+/* each must be rejected, the long ones reach the vector loops */
+static const char *malformed[] = {
+	"Zg=",
+	"Zg",
+	"Zh==",				/* dropped bits not zero */
+	"Zm9=",
+	"Z===",
+	"=Zg=",
+	"Zm9v\nYmFy",
+	"Zm9vYmFy Zm9vYmE",
+	"Zm9vYm=yZm9vYmFy",
+	"Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy-m9vYmFyZm9vYmFy",
+	"Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy\x80m9vYmFyZm9vYmFyZm9vYmFy",
+	"Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmF_"
+};
+
+static int
+test_vectors(int impl)
+{
+	char	enc[32], dec[64];
+	size_t	i, len;
+	int	errors = 0;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		len = strlen(vectors[i].raw);
+		if (cryptredis_encode_impl(impl, enc, sizeof(enc),
+		    vectors[i].raw, len) != (ssize_t)strlen(vectors[i].enc) ||
+		    strcmp(enc, vectors[i].enc) != 0)
+			errors++;
+		if (cryptredis_decode_impl(impl, enc, strlen(enc), dec,
+		    sizeof(dec)) != (ssize_t)len ||
+		    memcmp(dec, vectors[i].raw, len) != 0)
+			errors++;
+	}
+
+	for (i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+		if (cryptredis_decode_impl(impl, malformed[i],
+		    strlen(malformed[i]), dec, sizeof(dec)) != -1)
+			errors++;
+
+	/* too short for the result */
+	if (cryptredis_encode_impl(impl, enc, 8, "foobar", 6) != -1 ||
+	    cryptredis_decode_impl(impl, "Zm9vYmFy", 8, dec, 5) != -1)
+		errors++;
+
+	return (errors);
+}
+
+static int
+test_random(int impl, size_t len)
+{
+	u_char	*raw, *dec;
+	char	*e0, *e1;
+	size_t	 elen = cryptredis_encsiz(len);
+	int	 errors = 0;
+
+	assert((raw = malloc(len + 1)) != NULL);
+	assert((dec = malloc(len + 1)) != NULL);
+	assert((e0 = malloc(elen)) != NULL);
+	assert((e1 = malloc(elen)) != NULL);
+	arc4random_buf(raw, len);
+
+	assert(cryptredis_encode_impl(CRYPTREDIS_B64_SCALAR, e0, elen, raw,
+	    len) == (ssize_t)elen - 1);
+	if (cryptredis_encode_impl(impl, e1, elen, raw, len) !=
+	    (ssize_t)elen - 1 || strcmp(e0, e1) != 0)
+		errors++;
+
+	/* the raw bytes at the tail of the output, as cryptredis_set_rn() */
+	memcpy(e1 + elen - 1 - len, raw, len);
+	if (cryptredis_encode_impl(impl, e1, elen, e1 + elen - 1 - len, len) !=
+	    (ssize_t)elen - 1 || strcmp(e0, e1) != 0)
+		errors++;
+
+	if (cryptredis_decode_impl(impl, e1, elen - 1, dec, len) !=
+	    (ssize_t)len || memcmp(dec, raw, len) != 0)
+		errors++;
+	if (cryptredis_decode_impl(impl, e1, elen - 1, e1, elen) !=
+	    (ssize_t)len || memcmp(e1, raw, len) != 0)
+		errors++;
+
+	free(raw);
+	free(dec);
+	free(e0);
+	free(e1);
+
+	return (errors);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t	len;
+	int	impl, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptbase64\n");
+
+	/* implementations this build or CPU lacks fall back, test all ids */
+	for (impl = CRYPTREDIS_B64_SCALAR; impl <= CRYPTREDIS_B64_NEON;
+	    impl++) {
+		errors += test_vectors(impl);
+		for (len = 0; len <= MAXLEN; len++)
+			errors += test_random(impl, len);
+	}
+	fprintf(stderr, "=> base64 impl %d errors %d\n",
+	    cryptredis_b64_impl(), errors);
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptbase64\n");
+
+	return (0);
+}
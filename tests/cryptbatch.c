@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Batch encrypt/decrypt: random mixes of value sizes, some in place, must
+ * give exactly what one cryptredis_encrypt/decrypt call per value gives.
+ * Also reports the throughput of a burst of small values both ways.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsd-crypt.h"
+#include "tools.h"
+
+#define NVALS		300
+#define NROUNDS		50
+#define MAXLEN		2048
+#define BURSTLEN	64
+#define BURSTVALS	1024
+#define BURSTROUNDS	200
+
+static struct cryptredis_key	key;
+
+static double
+elapsed(const struct timeval *t0)
+{
+	struct timeval	t1;
+
+	gettimeofday(&t1, NULL);
+
+	return ((t1.tv_sec - t0->tv_sec) + (t1.tv_usec - t0->tv_usec) / 1e6);
+}
+
+static int
+test_batch(size_t nvals)
+{
+	struct cryptredis_iov	*iov;
+	char			**plain, **cipher, **buf;
+	size_t			 i, len;
+	int			 errors = 0;
+
+	assert((iov = calloc(nvals, sizeof(*iov))) != NULL);
+	assert((plain = calloc(nvals, sizeof(*plain))) != NULL);
+	assert((cipher = calloc(nvals, sizeof(*cipher))) != NULL);
+	assert((buf = calloc(nvals, sizeof(*buf))) != NULL);
+
+	for (i = 0; i < nvals; i++) {
+		/* mostly small values, the odd large one */
+		len = 16 * (arc4random_uniform(8) ? 1 + arc4random_uniform(8) :
+		    1 + arc4random_uniform(MAXLEN / 16));
+		assert((plain[i] = malloc(len)) != NULL);
+		assert((cipher[i] = malloc(len)) != NULL);
+		assert((buf[i] = malloc(len)) != NULL);
+		arc4random_buf(plain[i], len);
+		cryptredis_encrypt(&key, plain[i], (u_int32_t *)cipher[i],
+		    len);
+
+		/* every third value is encrypted in place */
+		if (i % 3 == 0) {
+			memcpy(buf[i], plain[i], len);
+			iov[i].ci_src = buf[i];
+		} else
+			iov[i].ci_src = plain[i];
+		iov[i].ci_dst = buf[i];
+		iov[i].ci_len = len;
+	}
+
+	cryptredis_encrypt_batch(&key, iov, nvals);
+	for (i = 0; i < nvals; i++) {
+		if (memcmp(buf[i], cipher[i], iov[i].ci_len))
+			errors++;
+		iov[i].ci_src = (i % 3 == 0) ? buf[i] : cipher[i];
+	}
+
+	cryptredis_decrypt_batch(&key, iov, nvals);
+	for (i = 0; i < nvals; i++) {
+		if (memcmp(buf[i], plain[i], iov[i].ci_len))
+			errors++;
+		free(plain[i]);
+		free(cipher[i]);
+		free(buf[i]);
+	}
+
+	free(iov);
+	free(plain);
+	free(cipher);
+	free(buf);
+
+	return (errors);
+}
+
+static void
+bench_burst(void)
+{
+	struct cryptredis_iov	 iov[BURSTVALS];
+	struct timeval		 t0;
+	char			*src, *dst;
+	double			 single, batch;
+	int			 i, r;
+
+	assert((src = calloc(BURSTVALS, BURSTLEN)) != NULL);
+	assert((dst = calloc(BURSTVALS, BURSTLEN)) != NULL);
+	for (i = 0; i < BURSTVALS; i++) {
+		iov[i].ci_src = src + i * BURSTLEN;
+		iov[i].ci_dst = dst + i * BURSTLEN;
+		iov[i].ci_len = BURSTLEN;
+	}
+
+	gettimeofday(&t0, NULL);
+	for (r = 0; r < BURSTROUNDS; r++)
+		for (i = 0; i < BURSTVALS; i++)
+			cryptredis_encrypt(&key, iov[i].ci_src, iov[i].ci_dst,
+			    BURSTLEN);
+	single = elapsed(&t0);
+
+	gettimeofday(&t0, NULL);
+	for (r = 0; r < BURSTROUNDS; r++)
+		cryptredis_encrypt_batch(&key, iov, BURSTVALS);
+	batch = elapsed(&t0);
+
+	fprintf(stderr, "=> %d x %d bytes encrypt: single %.1f MB/s, "
+	    "batch %.1f MB/s\n", BURSTVALS, BURSTLEN,
+	    BURSTVALS * BURSTLEN * BURSTROUNDS / single / 1e6,
+	    BURSTVALS * BURSTLEN * BURSTROUNDS / batch / 1e6);
+
+	free(src);
+	free(dst);
+}
+
+int
+main(int argc, char **argv)
+{
+	int	i, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptbatch\n");
+
+	arc4random_buf(key.key, sizeof(key.key));
+	arc4random_buf(key.iv, sizeof(key.iv));
+	cryptredis_key_setup(&key);
+
+	for (i = 0; i < NROUNDS; i++) {
+		errors += test_batch(1 + arc4random_uniform(NVALS));
+		errors += test_batch(1 + arc4random_uniform(AESHW_LANES * 2));
+	}
+	fprintf(stderr, "=> errors %d\n", errors);
+	assert(errors == 0);
+
+	bench_burst();
+
+	fprintf(stderr, "==> end test cryptbatch\n");
+
+	return (0);
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * ChaCha20-Poly1305: the RFC 8439 test vectors through every ChaCha20
+ * implementation, then random lengths and counters compared against the
+ * scalar code, which covers the vector kernels and their scalar tails.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsd-crypt.h"
+#include "chacha.h"
+#include "poly1305.h"
+#include "tools.h"
+
+#define NRUNS		200
+#define MAXLEN		4096
+
+static const char sunscreen[] = "Ladies and Gentlemen of the class of '99: "
+    "If I could offer you only one tip for the future, sunscreen would be "
+    "it.";
+
+/* RFC 8439 2.4.2 */
+static const u_int8_t chacha_nonce[CHACHA_NONCELEN] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00
+};
+static const u_int8_t chacha_ct[] = {
+	0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80,
+	0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+	0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2,
+	0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+	0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab,
+	0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+	0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab,
+	0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+	0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61,
+	0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+	0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06,
+	0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+	0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6,
+	0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+	0x87, 0x4d
+};
+
+/* RFC 8439 2.5.2 */
+static const u_int8_t poly_key[POLY1305_KEYLEN] = {
+	0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33,
+	0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+	0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd,
+	0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+};
+static const u_int8_t poly_tag[POLY1305_TAGLEN] = {
+	0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6,
+	0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+};
+
+/* RFC 8439 2.8.2 */
+static const u_int8_t aead_nonce[CHACHA_NONCELEN] = {
+	0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47
+};
+static const u_int8_t aead_aad[] = {
+	0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7
+};
+static const u_int8_t aead_ct[] = {
+	0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb,
+	0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+	0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe,
+	0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+	0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12,
+	0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+	0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29,
+	0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+	0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c,
+	0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+	0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94,
+	0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+	0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d,
+	0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+	0x61, 0x16
+};
+static const u_int8_t aead_tag[POLY1305_TAGLEN] = {
+	0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a,
+	0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+};
+
+static int
+test_vectors(int impl)
+{
+	struct cryptredis_key	 key;
+	struct poly1305_ctx	 pctx;
+	u_int8_t		 k[CHACHA_KEYLEN], tag[POLY1305_TAGLEN];
+	u_char			 buf[sizeof(sunscreen)];
+	const char		*msg = "Cryptographic Forum Research Group";
+	size_t			 len = sizeof(sunscreen) - 1;
+	int			 i, errors = 0;
+
+	for (i = 0; i < CHACHA_KEYLEN; i++)
+		k[i] = i;
+	chacha20_xor(impl, k, chacha_nonce, 1, (const u_char *)sunscreen, buf,
+	    len);
+	if (memcmp(buf, chacha_ct, len))
+		errors++;
+
+	poly1305_init(&pctx, poly_key);
+	poly1305_update(&pctx, (const u_int8_t *)msg, 10);
+	poly1305_update(&pctx, (const u_int8_t *)msg + 10, strlen(msg) - 10);
+	poly1305_finish(&pctx, tag);
+	if (memcmp(tag, poly_tag, sizeof(tag)))
+		errors++;
+
+	memset(&key, 0, sizeof(key));
+	for (i = 0; i < CHACHA_KEYLEN; i++)
+		key.cc_key[i] = 0x80 + i;
+	key.chacha = impl;
+	cryptredis_chacha_seal(&key, aead_nonce, aead_aad, sizeof(aead_aad),
+	    sunscreen, buf, len, tag);
+	if (memcmp(buf, aead_ct, len) || memcmp(tag, aead_tag, sizeof(tag)))
+		errors++;
+	if (cryptredis_chacha_open(&key, aead_nonce, aead_aad,
+	    sizeof(aead_aad), buf, buf, len, tag) != 0 ||
+	    memcmp(buf, sunscreen, len))
+		errors++;
+
+	/* any flipped ciphertext bit must fail */
+	memcpy(buf, aead_ct, len);
+	buf[arc4random_uniform(len)] ^= 1 << arc4random_uniform(8);
+	if (cryptredis_chacha_open(&key, aead_nonce, aead_aad,
+	    sizeof(aead_aad), buf, buf, len, aead_tag) != -1)
+		errors++;
+
+	return (errors);
+}
+
+static int
+test_random(int impl)
+{
+	u_int8_t	 k[CHACHA_KEYLEN], nonce[CHACHA_NONCELEN];
+	u_char		*plain, *c0, *c1;
+	u_int32_t	 ctr;
+	size_t		 len;
+	int		 errors = 0;
+
+	len = arc4random_uniform(MAXLEN + 1);
+	ctr = arc4random_uniform(1024);
+	arc4random_buf(k, sizeof(k));
+	arc4random_buf(nonce, sizeof(nonce));
+	assert((plain = malloc(len + 1)) != NULL);
+	assert((c0 = malloc(len + 1)) != NULL);
+	assert((c1 = malloc(len + 1)) != NULL);
+	arc4random_buf(plain, len);
+
+	chacha20_xor(CHACHA_SCALAR, k, nonce, ctr, plain, c0, len);
+	chacha20_xor(impl, k, nonce, ctr, plain, c1, len);
+	if (memcmp(c0, c1, len))
+		errors++;
+
+	/* in place */
+	memcpy(c1, plain, len);
+	chacha20_xor(impl, k, nonce, ctr, c1, c1, len);
+	if (memcmp(c0, c1, len))
+		errors++;
+
+	free(plain);
+	free(c0);
+	free(c1);
+
+	return (errors);
+}
+
+int
+main(int argc, char **argv)
+{
+	int	impl, i, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptchacha\n");
+
+	/* implementations this build or CPU lacks fall back, test all ids */
+	for (impl = CHACHA_SCALAR; impl <= CHACHA_NEON; impl++) {
+		errors += test_vectors(impl);
+		for (i = 0; i < NRUNS; i++)
+			errors += test_random(impl);
+	}
+	fprintf(stderr, "=> chacha impl %d errors %d\n", chacha_probe(),
+	    errors);
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptchacha\n");
+
+	return (0);
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Every AES engine must produce the same bytes: the same keys are set up
+ * once per engine, forced through the engine field, and CBC, CTR and
+ * batch results compared against the table driven code.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsd-crypt.h"
+#include "tools.h"
+
+#define NKEYS		50
+#define MAXLEN		1024
+
+static int
+test_engine(const struct cryptredis_key *ref, struct cryptredis_key *key,
+    int engine)
+{
+	struct cryptredis_iov	 iov[3];
+	u_int8_t		 nonce[CRYPTREDIS_NONCELEN];
+	char			*plain, *c0, *c1;
+	size_t			 len;
+	int			 errors = 0;
+
+	key->engine = engine;
+	if (engine == CRYPTREDIS_AES_CT) {
+		aesct_set_key(&key->ctctx, &key->ctx);
+		aesct_set_key(&key->ctr_ctctx, &key->ctr_ctx);
+	}
+
+	len = 16 * (1 + arc4random_uniform(MAXLEN / 16));
+	assert((plain = malloc(3 * len)) != NULL);
+	assert((c0 = malloc(3 * len)) != NULL);
+	assert((c1 = malloc(3 * len)) != NULL);
+	arc4random_buf(plain, 3 * len);
+	arc4random_buf(nonce, sizeof(nonce));
+
+	cryptredis_encrypt(ref, plain, (u_int32_t *)c0, len);
+	cryptredis_encrypt(key, plain, (u_int32_t *)c1, len);
+	if (memcmp(c0, c1, len))
+		errors++;
+	cryptredis_decrypt(key, (u_int32_t *)c1, c1, len);
+	if (memcmp(plain, c1, len))
+		errors++;
+
+	cryptredis_ctr_crypt(ref, nonce, 7, plain, c0, len - 5);
+	cryptredis_ctr_crypt(key, nonce, 7, plain, c1, len - 5);
+	if (memcmp(c0, c1, len - 5))
+		errors++;
+
+	/* a batch of three values, the last one encrypted in place */
+	memcpy(c1 + 2 * len, plain + 2 * len, len);
+	iov[0].ci_src = plain;
+	iov[0].ci_dst = c1;
+	iov[0].ci_len = len;
+	iov[1].ci_src = plain + len;
+	iov[1].ci_dst = c1 + len;
+	iov[1].ci_len = 16;
+	iov[2].ci_src = c1 + 2 * len;
+	iov[2].ci_dst = c1 + 2 * len;
+	iov[2].ci_len = len;
+	cryptredis_encrypt_batch(key, iov, 3);
+	cryptredis_encrypt(ref, plain, (u_int32_t *)c0, len);
+	cryptredis_encrypt(ref, plain + len, (u_int32_t *)(c0 + len), 16);
+	cryptredis_encrypt(ref, plain + 2 * len, (u_int32_t *)(c0 + 2 * len),
+	    len);
+	if (memcmp(c0, c1, len) || memcmp(c0 + len, c1 + len, 16) ||
+	    memcmp(c0 + 2 * len, c1 + 2 * len, len))
+		errors++;
+
+	free(plain);
+	free(c0);
+	free(c1);
+
+	return (errors);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct cryptredis_key	ref, key;
+	int			i, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptengines\n");
+
+	for (i = 0; i < NKEYS; i++) {
+		memset(&ref, 0, sizeof(ref));
+		arc4random_buf(ref.key, sizeof(ref.key));
+		arc4random_buf(ref.iv, sizeof(ref.iv));
+		cryptredis_key_setup(&ref);
+		memcpy(&key, &ref, sizeof(key));
+		ref.engine = CRYPTREDIS_AES_TABLE;
+
+		errors += test_engine(&ref, &key, CRYPTREDIS_AES_CT);
+		if (aeshw_probe()) {
+			aeshw_set_key(&key.hwctx, &key.ctx);
+			aeshw_set_key(&key.ctr_hwctx, &key.ctr_ctx);
+			errors += test_engine(&ref, &key, CRYPTREDIS_AES_HW);
+		}
+	}
+	fprintf(stderr, "=> aeshw %s errors %d\n",
+	    aeshw_probe() ? "yes" : "no", errors);
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptengines\n");
+
+	return (0);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Heap allocations per GET.  The library is linked with malloc, calloc,
+ * realloc and free wrapped (see the Makefile); every value is fetched
+ * once with encryption off, which is what hiredis alone costs for the
+ * same bytes on the wire, and once decrypted.  Decrypting used to add two
+ * callocs and two extra passes over the value, it must now add nothing.
+ * A reply handle reused across GETs must allocate less than either.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cryptredis.h"
+
+#define NGETS		2000
+
+void	*__real_malloc(size_t);
+void	*__real_calloc(size_t, size_t);
+void	*__real_realloc(void *, size_t);
+void	 __real_free(void *);
+
+void	*__wrap_malloc(size_t);
+void	*__wrap_calloc(size_t, size_t);
+void	*__wrap_realloc(void *, size_t);
+void	 __wrap_free(void *);
+
+static size_t	nallocs, nbytes;
+
+void *
+__wrap_malloc(size_t size)
+{
+	nallocs++;
+	nbytes += size;
+	return (__real_malloc(size));
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	nallocs++;
+	nbytes += nmemb * size;
+	return (__real_calloc(nmemb, size));
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	nallocs++;
+	nbytes += size;
+	return (__real_realloc(ptr, size));
+}
+
+void
+__wrap_free(void *ptr)
+{
+	__real_free(ptr);
+}
+
+struct getstat {
+	double	gs_allocs;	/* per GET */
+	double	gs_bytes;
+	double	gs_usec;
+};
+
+static void
+bench_get(struct cryptredis *crp, const char *key, const char *val,
+    size_t vlen, struct getstat *gs)
+{
+	struct timespec	t0, t1;
+	int		i;
+
+	/* warm up, the hiredis reader keeps its buffer */
+	assert(!cryptredis_get_r(crp, key));
+	cryptredis_response_free(crp);
+
+	nallocs = nbytes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < NGETS; i++) {
+		assert(!cryptredis_get_r(crp, key));
+		if (val != NULL) {
+			assert(cryptredis_response_len(crp) == vlen);
+			assert(!memcmp(cryptredis_response_string(crp), val,
+			    vlen));
+		}
+		cryptredis_response_free(crp);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	gs->gs_allocs = (double)nallocs / NGETS;
+	gs->gs_bytes = (double)nbytes / NGETS;
+	gs->gs_usec = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+	    (t1.tv_nsec - t0.tv_nsec)) / 1e3 / NGETS;
+}
+
+/* the same through a reply handle, which keeps its memory between GETs */
+static void
+bench_get_rp(struct cryptredis *crp, const char *key, const char *val,
+    size_t vlen, struct getstat *gs)
+{
+	struct cryptredis_reply	*rp;
+	struct timespec		 t0, t1;
+	int			 i;
+
+	assert((rp = cryptredis_reply_new()) != NULL);
+	assert(!cryptredis_get_rp(crp, key, strlen(key), rp));
+
+	nallocs = nbytes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < NGETS; i++) {
+		assert(!cryptredis_get_rp(crp, key, strlen(key), rp));
+		assert(cryptredis_reply_len(rp) == vlen);
+		assert(!memcmp(cryptredis_reply_string(rp), val, vlen));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	cryptredis_reply_free(rp);
+
+	gs->gs_allocs = (double)nallocs / NGETS;
+	gs->gs_bytes = (double)nbytes / NGETS;
+	gs->gs_usec = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+	    (t1.tv_nsec - t0.tv_nsec)) / 1e3 / NGETS;
+}
+
+static int
+bench_format(struct cryptredis *crp, int fmt, int raw, size_t vlen)
+{
+	struct getstat	 plain, crypt, handle;
+	char		 key[LINE_MAX];
+	char		*val;
+
+	assert((val = malloc(vlen + 1)) != NULL);
+	memset(val, 'v', vlen);
+	val[vlen] = '\0';
+	snprintf(key, sizeof(key), "%d_getalloc_%d_%d_%zu", getpid(), fmt,
+	    raw, vlen);
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, raw));
+	assert(!cryptredis_set_r(crp, key, val));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	bench_get(crp, key, NULL, 0, &plain);
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	bench_get(crp, key, val, vlen, &crypt);
+	bench_get_rp(crp, key, val, vlen, &handle);
+
+	printf("fmt %d %-6s %6zu bytes: %5.2f allocs %8.0f bytes %6.1fus, "
+	    "plain %5.2f allocs %8.0f bytes %6.1fus, "
+	    "handle %5.2f allocs %8.0f bytes %6.1fus\n", fmt,
+	    raw ? "raw" : "base64", vlen, crypt.gs_allocs, crypt.gs_bytes,
+	    crypt.gs_usec, plain.gs_allocs, plain.gs_bytes, plain.gs_usec,
+	    handle.gs_allocs, handle.gs_bytes, handle.gs_usec);
+
+	assert(!cryptredis_del_r(crp, key));
+	cryptredis_response_free(crp);
+	free(val);
+
+	return (crypt.gs_allocs > plain.gs_allocs ||
+	    handle.gs_allocs >= plain.gs_allocs);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const size_t	 sizes[] = { 16, 1000, 64 * 1024 };
+	static const int	 fmts[] = { CRYPTREDIS_FMT_LEGACY,
+				    CRYPTREDIS_FMT_CTR, CRYPTREDIS_FMT_CBC,
+				    CRYPTREDIS_FMT_CHACHA };
+	struct cryptredis	*c;
+	char			 buf[PATH_MAX], keyfile[PATH_MAX];
+	size_t			 f, s;
+	int			 raw, errors = 0;
+
+	snprintf(keyfile, sizeof(keyfile),
+	    "CRYPTREDIS_KEYFILE=%s/../../obj/test.key", getcwd(buf,
+	    sizeof(buf)));
+	assert(!putenv(keyfile));
+
+	assert((c = cryptredis_open("localhost", 6379)) != NULL);
+	assert(c->cr_connected);
+
+	for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++)
+		for (raw = 0; raw <= 1; raw++)
+			for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+				/* legacy values have no header to tell raw */
+				if (raw && fmts[f] == CRYPTREDIS_FMT_LEGACY)
+					continue;
+				errors += bench_format(c, fmts[f], raw,
+				    sizes[s]);
+			}
+
+	assert(!cryptredis_close(c));
+
+	return (errors != 0);
+}
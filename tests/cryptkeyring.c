@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Key cache: a key file is derived once, later lookups get the same key
+ * back in a fraction of the time, rewriting the file derives a new one
+ * while handles holding the old key keep it intact, and threads looking
+ * up and releasing the same file all agree on one key.  A watched key
+ * file replaced by rename(2) is picked up by the watcher thread, one cut
+ * short is not, and a keyset held across the change stays intact.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "keyring.h"
+
+#define NTHREADS	8
+#define NLOOKUPS	2000
+#define WATCHWAIT	5000	/* ms for the watcher to notice */
+
+struct testthread {
+	pthread_t			 tt_thread;
+	const char			*tt_path;
+	const struct cryptredis_key	*tt_key;
+	int				 tt_errors;
+};
+
+static void
+write_keyfile(const char *path, const char *key, time_t mtime)
+{
+	struct timeval	 tv[2];
+	FILE		*f;
+
+	assert((f = fopen(path, "w")) != NULL);
+	fprintf(f, "salt=0102030405060708\n");
+	fprintf(f, "key=%s\n", key);
+	fprintf(f, "iv =000102030405060708090A0B0C0D0E0F\n");
+	assert(fclose(f) == 0);
+
+	/* mtime granularity may be coarse, make versions differ anyway */
+	tv[0].tv_sec = tv[1].tv_sec = mtime;
+	tv[0].tv_usec = tv[1].tv_usec = 0;
+	assert(utimes(path, tv) == 0);
+}
+
+static double
+usec_since(const struct timespec *t0)
+{
+	struct timespec	t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return ((t1.tv_sec - t0->tv_sec) * 1e6 +
+	    (t1.tv_nsec - t0->tv_nsec) / 1e3);
+}
+
+static void *
+lookup_thread(void *arg)
+{
+	struct testthread		*tt = arg;
+	const struct cryptredis_key	*k;
+	int				 i;
+
+	for (i = 0; i < NLOOKUPS; i++) {
+		if ((k = cryptredis_keyring_get(tt->tt_path)) != tt->tt_key)
+			tt->tt_errors++;
+		cryptredis_keyring_put(k);
+	}
+
+	return (NULL);
+}
+
+static u_int
+wait_gen(const struct cryptredis_keywatch *kw, u_int gen, int ms)
+{
+	while (cryptredis_keywatch_gen(kw) == gen && ms-- > 0)
+		usleep(1000);
+
+	return (cryptredis_keywatch_gen(kw));
+}
+
+static int
+test_keywatch(void)
+{
+	struct cryptredis_key		 saved;
+	struct cryptredis_keywatch	*kw;
+	const struct cryptredis_keyset	*ks = NULL, *held = NULL;
+	char				 path[] = "/tmp/cryptkeywatch.XXXXXXXXXX";
+	char				 npath[sizeof(path) + 4];
+	FILE				*f;
+	u_int				 gen, hgen;
+	int				 fd, errors = 0;
+
+	assert((fd = mkstemp(path)) != -1);
+	close(fd);
+	write_keyfile(path, "F00DFACE", 1000000003);
+	snprintf(npath, sizeof(npath), "%s.new", path);
+
+	assert((kw = cryptredis_keywatch_get(path)) != NULL);
+	if (cryptredis_keywatch_get(path) != kw)
+		errors++;
+	cryptredis_keywatch_sync(kw, &ks, &gen);
+	cryptredis_keywatch_sync(kw, &held, &hgen);
+	assert(ks != NULL && ks == held && ks->ks_nkeys == 1);
+	memcpy(&saved, ks->ks_keys[0], sizeof(saved));
+
+	/* a file cut short keeps the keys that worked */
+	assert((f = fopen(npath, "w")) != NULL);
+	fprintf(f, "salt=0102030405060708\nkey=DEADBEEF\n");
+	assert(fclose(f) == 0);
+	assert(rename(npath, path) == 0);
+	if (wait_gen(kw, gen, 2000) != gen)
+		errors++;
+
+	/* and so does one cut in the middle of its key line */
+	assert((f = fopen(npath, "w")) != NULL);
+	fprintf(f, "salt=0102030405060708\n");
+	fprintf(f, "iv =000102030405060708090A0B0C0D0E0F\nkey=DEAD");
+	assert(fclose(f) == 0);
+	assert(rename(npath, path) == 0);
+	if (wait_gen(kw, gen, 2000) != gen)
+		errors++;
+
+	write_keyfile(npath, "DEADBEEF", 1000000004);
+	assert(rename(npath, path) == 0);
+	if (wait_gen(kw, gen, WATCHWAIT) == gen) {
+		fprintf(stderr, "%s: no reload\n", __func__);
+		errors++;
+	}
+
+	/* trade one handle's keys, the other one keeps the old ones */
+	cryptredis_keywatch_sync(kw, &ks, &gen);
+	if (ks == held || memcmp(ks->ks_keys[0]->key, saved.key,
+	    sizeof(saved.key)) == 0)
+		errors++;
+	if (memcmp(held->ks_keys[0], &saved, sizeof(saved)) != 0)
+		errors++;
+	cryptredis_keyset_put(held);
+	cryptredis_keyset_put(ks);
+
+	assert(unlink(path) == 0);
+
+	return (errors);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct testthread		 tt[NTHREADS];
+	struct timespec			 t0;
+	struct cryptredis_key		 saved;
+	const struct cryptredis_key	*k1, *k2, *k3;
+	char				 path[] = "/tmp/cryptkeyring.XXXXXXXXXX";
+	double				 derive, lookup;
+	int				 fd, i, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptkeyring\n");
+
+	assert((fd = mkstemp(path)) != -1);
+	close(fd);
+	write_keyfile(path, "F00DFACE", 1000000000);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	assert((k1 = cryptredis_keyring_get(path)) != NULL);
+	derive = usec_since(&t0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	assert((k2 = cryptredis_keyring_get(path)) != NULL);
+	lookup = usec_since(&t0);
+	fprintf(stderr, "derive %.0fus, cached lookup %.1fus\n", derive,
+	    lookup);
+	if (k1 != k2 || lookup * 10 > derive)
+		errors++;
+
+	/* still cached once nobody holds it */
+	cryptredis_keyring_put(k1);
+	cryptredis_keyring_put(k2);
+	assert((k1 = cryptredis_keyring_get(path)) != NULL);
+	if (k1 != k2)
+		errors++;
+	memcpy(&saved, k1, sizeof(saved));
+
+	/* a new version of the file, the old key lives on while held */
+	write_keyfile(path, "DEADBEEF", 1000000001);
+	assert((k2 = cryptredis_keyring_get(path)) != NULL);
+	if (k2 == k1 || memcmp(k2->key, saved.key, sizeof(saved.key)) == 0)
+		errors++;
+	if (memcmp(k1, &saved, sizeof(saved)) != 0)
+		errors++;
+	cryptredis_keyring_put(k1);
+
+	/* same contents as the first version derive the same key */
+	write_keyfile(path, "F00DFACE", 1000000002);
+	assert((k3 = cryptredis_keyring_get(path)) != NULL);
+	if (k3 == k2 || memcmp(k3->key, saved.key, sizeof(saved.key)) != 0)
+		errors++;
+	cryptredis_keyring_put(k2);
+
+	for (i = 0; i < NTHREADS; i++) {
+		tt[i].tt_path = path;
+		tt[i].tt_key = k3;
+		tt[i].tt_errors = 0;
+		assert(pthread_create(&tt[i].tt_thread, NULL, lookup_thread,
+		    &tt[i]) == 0);
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		assert(pthread_join(tt[i].tt_thread, NULL) == 0);
+		errors += tt[i].tt_errors;
+	}
+	cryptredis_keyring_put(k3);
+
+	assert(unlink(path) == 0);
+	if (cryptredis_keyring_get(path) != NULL)
+		errors++;
+
+	errors += test_keywatch();
+
+	fprintf(stderr, "=> errors %d\n", errors);
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptkeyring\n");
+
+	return (0);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LZ4 block codec: a block written by the reference LZ4_compress_default(),
+ * round trips of random, repetitive and json-like values of all lengths,
+ * then every truncation and many bit flips of compressed values, which
+ * must fail or decode within bounds, never crash.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define MAXLEN		4096
+
+static const char refplain[] =
+    "{\"id\":1,\"name\":\"alice\",\"tags\":[\"a\",\"b\"]},"
+    "{\"id\":2,\"name\":\"alice\",\"tags\":[\"a\",\"b\"]},"
+    "{\"id\":3,\"name\":\"alice\",\"tags\":[\"a\",\"b\"]}";
+
+static const u_int8_t refblock[] = {
+	0xf2, 0x1a, 0x7b, 0x22, 0x69, 0x64, 0x22, 0x3a,
+	0x31, 0x2c, 0x22, 0x6e, 0x61, 0x6d, 0x65, 0x22,
+	0x3a, 0x22, 0x61, 0x6c, 0x69, 0x63, 0x65, 0x22,
+	0x2c, 0x22, 0x74, 0x61, 0x67, 0x73, 0x22, 0x3a,
+	0x5b, 0x22, 0x61, 0x22, 0x2c, 0x22, 0x62, 0x22,
+	0x5d, 0x7d, 0x2c, 0x29, 0x00, 0x1f, 0x32, 0x29,
+	0x00, 0x15, 0x1f, 0x33, 0x29, 0x00, 0x09, 0x50,
+	0x22, 0x62, 0x22, 0x5d, 0x7d
+};
+
+static void
+fill(u_char *buf, size_t len, int kind)
+{
+	static const char	*words[] = { "{\"id\":", "\"name\":\"", "bob",
+				    "alice", "\"tags\":[", "true", "null", "},",
+				    "1234" };
+	const char		*w;
+	size_t			 i, n;
+
+	switch (kind) {
+	case 0:
+		arc4random_buf(buf, len);
+		break;
+	case 1:
+		memset(buf, 'a', len);
+		break;
+	default:
+		for (i = 0; i < len; i += n) {
+			w = words[arc4random_uniform(9)];
+			n = strlen(w) < len - i ? strlen(w) : len - i;
+			memcpy(buf + i, w, n);
+		}
+		break;
+	}
+}
+
+static int
+test_reference(void)
+{
+	char	out[sizeof(refplain)];
+	int	errors = 0;
+
+	if (lz4_decompress(refblock, sizeof(refblock), out,
+	    sizeof(refplain) - 1) != sizeof(refplain) - 1 ||
+	    memcmp(out, refplain, sizeof(refplain) - 1) != 0)
+		errors++;
+
+	/* one byte short of room */
+	if (lz4_decompress(refblock, sizeof(refblock), out,
+	    sizeof(refplain) - 2) != -1)
+		errors++;
+
+	return (errors);
+}
+
+static int
+test_roundtrip(size_t len, int kind)
+{
+	u_char	*raw, *blk, *dec;
+	size_t	 blen = lz4_bound(len), i;
+	ssize_t	 n;
+	int	 errors = 0;
+
+	assert((raw = malloc(len + 1)) != NULL);
+	assert((blk = malloc(blen)) != NULL);
+	assert((dec = malloc(len + 1)) != NULL);
+	fill(raw, len, kind);
+
+	assert((n = lz4_compress(raw, len, blk, blen)) != -1);
+	if (lz4_decompress(blk, n, dec, len) != (ssize_t)len ||
+	    memcmp(dec, raw, len) != 0)
+		errors++;
+	/* repetitive input must shrink, random input must fit the bound */
+	if (kind == 1 && len >= 64 && (size_t)n > len / 4)
+		errors++;
+	if (kind == 0 && len > 16 && lz4_compress(raw, len, blk, len - 1) !=
+	    -1)
+		errors++;
+
+	for (i = 0; i < (size_t)n; i++)
+		(void)lz4_decompress(blk, i, dec, len);
+	for (i = 0; i < 64 && n > 0; i++) {
+		blk[arc4random_uniform(n)] ^= 1 << arc4random_uniform(8);
+		(void)lz4_decompress(blk, n, dec, len);
+	}
+
+	free(raw);
+	free(blk);
+	free(dec);
+
+	return (errors);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t	len;
+	int	kind, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptlz4\n");
+
+	errors += test_reference();
+	for (kind = 0; kind < 3; kind++)
+		for (len = 0; len <= MAXLEN; len += len < 128 ? 1 : 61)
+			errors += test_roundtrip(len, kind);
+	fprintf(stderr, "=> errors %d\n", errors);
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptlz4\n");
+
+	return (0);
+}
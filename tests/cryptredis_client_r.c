@@ -22,7 +22,10 @@
 #include <string.h>
 
 #include "cryptredis.h"
+#include "format.h"
+#include "keyring.h"
 #include "cryptredis_test.h"
+#include "hiredis/hiredis.h"
 
 void
 genrandstr(char *b, size_t bs, const char *p)
@@ -147,6 +150,710 @@ test_cryptredis_del_r(struct cryptredis *crp)
 	assert(cryptredis_response_string(crp) == NULL);
 }
 
+/*
+ * values written in one format are readable by a handle configured with
+ * any other one
+ */
+void
+test_cryptredis_format_r(struct cryptredis *crp, int wfmt, int rfmt)
+{
+	char	entrykey[LINE_MAX];
+	char	entryval[LINE_MAX];
+
+	genrandstr(entrykey, sizeof(entrykey), __func__);
+	genrandstr(entryval, sizeof(entryval), "foobar");
+
+	assert(!cryptredis_config_encrypt(crp, wfmt));
+	assert(crp->cr_format == wfmt);
+	assert(!cryptredis_set_r(crp, entrykey, entryval));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_config_encrypt(crp, rfmt));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(cryptredis_response_string(crp) != NULL);
+	assert(!strcmp(entryval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_del_r(crp, entrykey));
+}
+
+/*
+ * binary keys and values through the length taking calls, stored as raw
+ * ciphertext and read back by a handle in base64 mode too, and the other
+ * way around; legacy values are C strings, they end at the first NUL
+ */
+void
+test_cryptredis_raw_r(struct cryptredis *crp, int fmt)
+{
+	char	entrykey[LINE_MAX];
+	char	entryval[LINE_MAX];
+	size_t	vlen, rlen;
+
+	genrandstr(entrykey, sizeof(entrykey), "foo bar");
+	genrandstr(entryval, sizeof(entryval), "foo bar");
+	vlen = strlen(entryval) + 4;
+	memcpy(entryval + vlen - 4, "\0\r\n\xff", 4);
+	rlen = fmt == CRYPTREDIS_FMT_LEGACY ? vlen - 4 : vlen;
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, 1));
+	assert(!cryptredis_set_rn(crp, entrykey, strlen(entrykey), entryval,
+	    vlen));
+	assert(!strcmp("OK", cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_get_rn(crp, entrykey, strlen(entrykey)));
+	assert(cryptredis_response_len(crp) == rlen);
+	assert(!memcmp(entryval, cryptredis_response_string(crp), rlen));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_config_raw(crp, 0));
+	if (fmt != CRYPTREDIS_FMT_NONE && fmt != CRYPTREDIS_FMT_LEGACY) {
+		assert(!cryptredis_get_r(crp, entrykey));
+		assert(cryptredis_response_len(crp) == vlen);
+		assert(!memcmp(entryval, cryptredis_response_string(crp),
+		    vlen));
+		cryptredis_response_free(crp);
+	}
+
+	/* and the same through base64 */
+	assert(!cryptredis_set_rn(crp, entrykey, strlen(entrykey), entryval,
+	    vlen));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_get_rn(crp, entrykey, strlen(entrykey)));
+	assert(cryptredis_response_len(crp) == rlen);
+	assert(!memcmp(entryval, cryptredis_response_string(crp), rlen));
+	cryptredis_response_free(crp);
+
+	/* read back by a handle in raw mode */
+	assert(!cryptredis_config_raw(crp, 1));
+	if (fmt != CRYPTREDIS_FMT_NONE && fmt != CRYPTREDIS_FMT_LEGACY) {
+		assert(!cryptredis_get_rn(crp, entrykey, strlen(entrykey)));
+		assert(cryptredis_response_len(crp) == vlen);
+		assert(!memcmp(entryval, cryptredis_response_string(crp),
+		    vlen));
+		cryptredis_response_free(crp);
+	}
+	assert(!cryptredis_config_raw(crp, 0));
+
+	assert(!cryptredis_del_r(crp, entrykey));
+}
+
+void
+test_cryptredis_lz4_r(struct cryptredis *crp, int fmt, int raw)
+{
+	static const char rec[] = "{\"id\":1234,\"name\":\"foo bar\","
+	    "\"tags\":[\"a\",\"b\"],\"active\":true},";
+	char	entrykey[LINE_MAX];
+	char	entryval[4096 + 1];
+	size_t	vlen, i;
+
+	genrandstr(entrykey, sizeof(entrykey), __func__);
+	for (i = 0; i + sizeof(rec) - 1 < sizeof(entryval); i += sizeof(rec) - 1)
+		memcpy(entryval + i, rec, sizeof(rec) - 1);
+	entryval[i] = '\0';
+	vlen = i;
+
+	assert(cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_LEGACY |
+	    CRYPTREDIS_FMT_LZ4) == -1);
+	assert(!cryptredis_config_encrypt(crp, fmt | CRYPTREDIS_FMT_LZ4));
+	assert(!cryptredis_config_raw(crp, raw));
+	assert(!cryptredis_set_rn(crp, entrykey, strlen(entrykey), entryval,
+	    vlen));
+	assert(!strcmp("OK", cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_get_rn(crp, entrykey, strlen(entrykey)));
+	assert(cryptredis_response_len(crp) == vlen);
+	assert(!memcmp(entryval, cryptredis_response_string(crp), vlen));
+	cryptredis_response_free(crp);
+
+	/* stored compressed, still read back with compression off */
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(cryptredis_response_len(crp) < vlen / 4);
+	cryptredis_response_free(crp);
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(!strcmp(entryval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	/* below the threshold values are sealed as they are */
+	assert(!cryptredis_config_encrypt(crp, fmt | CRYPTREDIS_FMT_LZ4));
+	assert(!cryptredis_config_compress(crp, vlen + 1));
+	assert(!cryptredis_set_r(crp, entrykey, entryval));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(cryptredis_response_len(crp) > vlen);
+	cryptredis_response_free(crp);
+	assert(!cryptredis_config_encrypt(crp, fmt | CRYPTREDIS_FMT_LZ4));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(!strcmp(entryval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_config_compress(crp, CRYPTREDIS_LZ4_MIN));
+
+	assert(!cryptredis_config_raw(crp, 0));
+	assert(!cryptredis_del_r(crp, entrykey));
+}
+
+/*
+ * cryptredis_value_seal() makes what cryptredis_set_rn() would store,
+ * written as is it reads back through cryptredis_get_rn(), and
+ * cryptredis_value_open() opens it without redis.
+ */
+void
+test_cryptredis_value_r(struct cryptredis *crp, int fmt, int raw)
+{
+	char	 entrykey[LINE_MAX];
+	char	 entryval[LINE_MAX];
+	char	*buf;
+	ssize_t	 n;
+
+	genrandstr(entrykey, sizeof(entrykey), __func__);
+	genrandstr(entryval, sizeof(entryval), "foo bar");
+
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(cryptredis_value_seal(crp, entryval, strlen(entryval),
+	    &buf) == -1);
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, raw));
+	assert((n = cryptredis_value_seal(crp, entryval, strlen(entryval),
+	    &buf)) > 0);
+	assert(buf[n] == '\0');
+
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(!cryptredis_set_rn(crp, entrykey, strlen(entrykey), buf, n));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_get_r(crp, entrykey));
+	assert(!strcmp(entryval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert((n = cryptredis_value_open(crp, &buf, n)) ==
+	    (ssize_t)strlen(entryval));
+	assert(!memcmp(entryval, buf, n));
+	free(buf);
+
+	assert(!cryptredis_config_raw(crp, 0));
+	assert(!cryptredis_del_r(crp, entrykey));
+}
+
+/*
+ * Legacy values are bare ciphertext, the first bytes of some look like a
+ * header.  Such a one is made by choosing its first ciphertext block and
+ * decrypting it to the start of the plaintext; it must still read back,
+ * alone and through MGET.
+ */
+void
+test_cryptredis_legacy_magic_r(struct cryptredis *crp, int hfmt, int hflags,
+    int raw)
+{
+	const struct cryptredis_key	*key;
+	const char			*keys[2];
+	size_t				 klens[2];
+	u_int32_t			 blk[4];
+	u_int8_t			*b = (u_int8_t *)blk;
+	char				 entrykey[2][LINE_MAX];
+	char				 entryval[33], *buf;
+	ssize_t				 n;
+	int				 i;
+
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_LEGACY));
+	assert(!cryptredis_config_raw(crp, raw));
+	key = crp->cr_keyset->ks_keys[0];
+
+	/* a first block decrypting to no NUL, the value is a C string */
+	do {
+		arc4random_buf(blk, sizeof(blk));
+		b[0] = CRYPTREDIS_HDR_MAGIC0;
+		b[1] = CRYPTREDIS_HDR_MAGIC1;
+		b[2] = hfmt;
+		b[3] = hflags;
+		cryptredis_decrypt(key, blk, entryval, sizeof(blk));
+	} while (memchr(entryval, '\0', sizeof(blk)) != NULL);
+	strlcpy(entryval + sizeof(blk), "legacy magic", sizeof(entryval) -
+	    sizeof(blk));
+
+	assert((n = cryptredis_value_seal(crp, entryval, strlen(entryval),
+	    &buf)) > 0);
+	if (raw) {
+		assert(!memcmp(buf, blk, sizeof(blk)));
+		assert(cryptredis_hdr_parse(buf, n) == hfmt);
+	}
+
+	for (i = 0; i < 2; i++) {
+		genrandstr(entrykey[i], sizeof(entrykey[i]), __func__);
+		keys[i] = entrykey[i];
+		klens[i] = strlen(entrykey[i]);
+		assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+		assert(!cryptredis_set_rn(crp, keys[i], klens[i], buf, n));
+		cryptredis_response_free(crp);
+	}
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_LEGACY));
+
+	assert(!cryptredis_get_rn(crp, keys[0], klens[0]));
+	assert(!strcmp(entryval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_mget_r(crp, keys, klens, 2));
+	for (i = 0; i < 2; i++) {
+		assert(cryptredis_response_element_type(crp, i) ==
+		    REDIS_REPLY_STRING);
+		assert(!strcmp(entryval,
+		    cryptredis_response_element_string(crp, i)));
+	}
+	cryptredis_response_free(crp);
+
+	assert((n = cryptredis_value_open(crp, &buf, n)) ==
+	    (ssize_t)strlen(entryval));
+	assert(!memcmp(entryval, buf, n));
+	free(buf);
+
+	for (i = 0; i < 2; i++)
+		assert(!cryptredis_del_r(crp, keys[i]));
+	assert(!cryptredis_config_raw(crp, 0));
+}
+
+/*
+ * Key rotation: values carry the id of their key, a second key file is
+ * added to CRYPTREDIS_KEYFILE and made the one writing; values of either
+ * key read back while both are listed, and fail instead of decrypting to
+ * garbage once their key is gone.
+ */
+void
+test_cryptredis_rotate_r(struct cryptredis *crp, int fmt)
+{
+	char	 oldkey[LINE_MAX], newkey[LINE_MAX];
+	char	 oldpath[PATH_MAX], newpath[] = "/tmp/cryptrotate.XXXXXXXX";
+	char	 oldval[LINE_MAX], newval[LINE_MAX], keys[2 * PATH_MAX + 2];
+	FILE	*f;
+	int	 fd;
+
+	genrandstr(oldkey, sizeof(oldkey), __func__);
+	genrandstr(newkey, sizeof(newkey), __func__);
+	genrandstr(oldval, sizeof(oldval), "old");
+	genrandstr(newval, sizeof(newval), "new");
+	assert(strlcpy(oldpath, getenv("CRYPTREDIS_KEYFILE"),
+	    sizeof(oldpath)) < sizeof(oldpath));
+
+	assert((fd = mkstemp(newpath)) != -1);
+	assert((f = fdopen(fd, "w")) != NULL);
+	fprintf(f, "salt=%08X%08X\nkey=%08X%08X\niv =%08X%08X%08X%08X\n",
+	    arc4random(), arc4random(), arc4random(), arc4random(),
+	    arc4random(), arc4random(), arc4random(), arc4random());
+	assert(fclose(f) == 0);
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_set_r(crp, oldkey, oldval));
+	cryptredis_response_free(crp);
+
+	/* the new key writes, the old one still reads */
+	snprintf(keys, sizeof(keys), "%s:%s", newpath, oldpath);
+	assert(!setenv("CRYPTREDIS_KEYFILE", keys, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(crp->cr_keyset->ks_nkeys == 2);
+	assert(!cryptredis_set_r(crp, newkey, newval));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_get_r(crp, oldkey));
+	assert(!strcmp(oldval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+	assert(!cryptredis_get_r(crp, newkey));
+	assert(!strcmp(newval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	/* the order of the others doesn't matter to reads */
+	snprintf(keys, sizeof(keys), "%s:%s", oldpath, newpath);
+	assert(!setenv("CRYPTREDIS_KEYFILE", keys, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_get_r(crp, newkey));
+	assert(!strcmp(newval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	/* the old key retired */
+	assert(!setenv("CRYPTREDIS_KEYFILE", newpath, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(cryptredis_get_r(crp, oldkey) == -1);
+	assert(!cryptredis_get_r(crp, newkey));
+	assert(!strcmp(newval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	assert(!setenv("CRYPTREDIS_KEYFILE", oldpath, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_del_r(crp, oldkey));
+	assert(!cryptredis_del_r(crp, newkey));
+	assert(!unlink(newpath));
+}
+
+/*
+ * A watched key file rewritten under a handle: the handle seals with the
+ * new key from its next request on, without configuring it again.
+ */
+void
+test_cryptredis_keywatch_r(struct cryptredis *crp, int fmt)
+{
+	char	 oldkey[LINE_MAX], newkey[LINE_MAX];
+	char	 oldpath[PATH_MAX], path[] = "/tmp/cryptwatch.XXXXXXXX";
+	char	 npath[sizeof(path) + 4];
+	char	 oldval[LINE_MAX], newval[LINE_MAX];
+	FILE	*f;
+	u_int	 gen;
+	int	 fd, i;
+
+	genrandstr(oldkey, sizeof(oldkey), __func__);
+	genrandstr(newkey, sizeof(newkey), __func__);
+	genrandstr(oldval, sizeof(oldval), "old");
+	genrandstr(newval, sizeof(newval), "new");
+	assert(strlcpy(oldpath, getenv("CRYPTREDIS_KEYFILE"),
+	    sizeof(oldpath)) < sizeof(oldpath));
+	snprintf(npath, sizeof(npath), "%s.new", path);
+
+	/* a key file of its own, rewritten below */
+	assert((fd = mkstemp(path)) != -1);
+	assert((f = fdopen(fd, "w")) != NULL);
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(!setenv("CRYPTREDIS_KEYFILE", path, 1));
+	fprintf(f, "salt=%08X%08X\nkey=%08X%08X\niv =%08X%08X%08X%08X\n",
+	    arc4random(), arc4random(), arc4random(), arc4random(),
+	    arc4random(), arc4random(), arc4random(), arc4random());
+	assert(fclose(f) == 0);
+
+	assert(!cryptredis_config_keywatch(crp, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(crp->cr_keywatch != NULL);
+	gen = crp->cr_keygen;
+	assert(!cryptredis_set_r(crp, oldkey, oldval));
+	cryptredis_response_free(crp);
+
+	assert((f = fopen(npath, "w")) != NULL);
+	fprintf(f, "salt=%08X%08X\nkey=%08X%08X\niv =%08X%08X%08X%08X\n",
+	    arc4random(), arc4random(), arc4random(), arc4random(),
+	    arc4random(), arc4random(), arc4random(), arc4random());
+	assert(fclose(f) == 0);
+	assert(!rename(npath, path));
+	for (i = 0; i < 5000 &&
+	    cryptredis_keywatch_gen(crp->cr_keywatch) == gen; i++)
+		usleep(1000);
+	assert(cryptredis_keywatch_gen(crp->cr_keywatch) != gen);
+
+	/* the next request trades the keys, the old one is gone */
+	assert(!cryptredis_set_r(crp, newkey, newval));
+	cryptredis_response_free(crp);
+	assert(crp->cr_keygen != gen);
+	assert(!cryptredis_get_r(crp, newkey));
+	assert(!strcmp(newval, cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+	assert(cryptredis_get_r(crp, oldkey) == -1);
+
+	assert(!cryptredis_config_keywatch(crp, 0));
+	assert(!setenv("CRYPTREDIS_KEYFILE", oldpath, 1));
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(crp->cr_keywatch == NULL);
+	assert(!cryptredis_del_r(crp, oldkey));
+	assert(!cryptredis_del_r(crp, newkey));
+	assert(!unlink(path));
+}
+
+/*
+ * Pipeline: sets then gets of values of many lengths in one round trip,
+ * a missing key reads nil and, with encryption, a value written in clear
+ * reads as an error without failing the others.
+ */
+#define PIPELINE_N	64
+
+void
+test_cryptredis_pipeline_r(struct cryptredis *crp, int fmt)
+{
+	char	 entrykey[PIPELINE_N][LINE_MAX], entryval[PIPELINE_N][LINE_MAX];
+	char	 clearkey[LINE_MAX];
+	size_t	 n;
+	int	 i;
+
+	for (i = 0; i < PIPELINE_N; i++) {
+		genrandstr(entrykey[i], sizeof(entrykey[i]), __func__);
+		genrandstr(entryval[i], sizeof(entryval[i]), "foo bar");
+		n = strlen(entryval[i]);
+		memset(entryval[i] + n, 'x', i * 8);
+		entryval[i][n + i * 8] = '\0';
+	}
+	genrandstr(clearkey, sizeof(clearkey), __func__);
+
+	assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+	assert(!cryptredis_set_r(crp, clearkey, "in clear"));
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(cryptredis_pipeline_exec(crp) == -1);
+	assert(!cryptredis_pipeline_begin(crp));
+	assert(cryptredis_pipeline_begin(crp) == -1);
+	for (i = 0; i < PIPELINE_N; i++)
+		assert(!cryptredis_pipeline_append_set(crp, entrykey[i],
+		    strlen(entrykey[i]), entryval[i], strlen(entryval[i])));
+	for (i = 0; i < PIPELINE_N; i++)
+		assert(!cryptredis_pipeline_append_get(crp, entrykey[i],
+		    strlen(entrykey[i])));
+	assert(!cryptredis_pipeline_append_get(crp, "nosuchkey", 9));
+	assert(!cryptredis_pipeline_append_get(crp, clearkey,
+	    strlen(clearkey)));
+	assert(cryptredis_pipeline_next(crp) == -1);
+	assert(!cryptredis_pipeline_exec(crp));
+
+	for (i = 0; i < PIPELINE_N; i++) {
+		assert(!cryptredis_pipeline_next(crp));
+		assert(!strcmp("OK", cryptredis_response_string(crp)));
+		cryptredis_response_free(crp);
+	}
+	for (i = 0; i < PIPELINE_N; i++) {
+		assert(!cryptredis_pipeline_next(crp));
+		assert(cryptredis_response_type(crp) == REDIS_REPLY_STRING);
+		assert(cryptredis_response_len(crp) == strlen(entryval[i]));
+		assert(!strcmp(entryval[i], cryptredis_response_string(crp)));
+		cryptredis_response_free(crp);
+	}
+	assert(!cryptredis_pipeline_next(crp));
+	assert(cryptredis_response_type(crp) == REDIS_REPLY_NIL);
+	cryptredis_response_free(crp);
+	assert(!cryptredis_pipeline_next(crp));
+	assert(cryptredis_response_type(crp) == (fmt == CRYPTREDIS_FMT_NONE ?
+	    REDIS_REPLY_STRING : REDIS_REPLY_ERROR));
+	cryptredis_response_free(crp);
+	assert(cryptredis_pipeline_next(crp) == -1);
+
+	/* replies left unread go with the next pipeline */
+	assert(!cryptredis_pipeline_begin(crp));
+	for (i = 0; i < PIPELINE_N; i++)
+		assert(!cryptredis_pipeline_append_get(crp, entrykey[i],
+		    strlen(entrykey[i])));
+	assert(!cryptredis_pipeline_exec(crp));
+	assert(!cryptredis_pipeline_begin(crp));
+	assert(!cryptredis_pipeline_exec(crp));
+	assert(cryptredis_pipeline_next(crp) == -1);
+
+	for (i = 0; i < PIPELINE_N; i++)
+		assert(!cryptredis_del_r(crp, entrykey[i]));
+	assert(!cryptredis_del_r(crp, clearkey));
+}
+
+/*
+ * MGET of more values than one batch opens, written in two formats, with
+ * a missing key between them.
+ */
+void
+test_cryptredis_mget_r(struct cryptredis *crp, int fmt, int raw)
+{
+	char		 entrykey[PIPELINE_N * 2][LINE_MAX];
+	char		 entryval[PIPELINE_N * 2][LINE_MAX];
+	const char	*keys[PIPELINE_N * 2 + 1];
+	size_t		 n;
+	int		 i;
+
+	assert(!cryptredis_config_raw(crp, raw));
+	for (i = 0; i < PIPELINE_N * 2; i++) {
+		genrandstr(entrykey[i], sizeof(entrykey[i]), __func__);
+		genrandstr(entryval[i], sizeof(entryval[i]), "foo bar");
+		n = strlen(entryval[i]);
+		memset(entryval[i] + n, 'x', i * 3);
+		entryval[i][n + i * 3] = '\0';
+		keys[i < PIPELINE_N ? i : i + 1] = entrykey[i];
+		assert(!cryptredis_config_encrypt(crp, i % 2 ? fmt :
+		    CRYPTREDIS_FMT_CHACHA));
+		assert(!cryptredis_set_r(crp, entrykey[i], entryval[i]));
+		cryptredis_response_free(crp);
+	}
+	keys[PIPELINE_N] = "nosuchkey";
+
+	assert(!cryptredis_mget_r(crp, keys, NULL, PIPELINE_N * 2 + 1));
+	assert(cryptredis_response_type(crp) == REDIS_REPLY_ARRAY);
+	assert(cryptredis_response_elements(crp) == PIPELINE_N * 2 + 1);
+	for (i = 0; i < PIPELINE_N * 2; i++) {
+		size_t	e = i < PIPELINE_N ? i : i + 1;
+
+		assert(cryptredis_response_element_type(crp, e) ==
+		    REDIS_REPLY_STRING);
+		assert(cryptredis_response_element_len(crp, e) ==
+		    strlen(entryval[i]));
+		assert(!strcmp(entryval[i],
+		    cryptredis_response_element_string(crp, e)));
+	}
+	assert(cryptredis_response_element_type(crp, PIPELINE_N) ==
+	    REDIS_REPLY_NIL);
+	assert(cryptredis_response_element_string(crp,
+	    PIPELINE_N * 2 + 1) == NULL);
+	cryptredis_response_free(crp);
+
+	for (i = 0; i < PIPELINE_N * 2; i++)
+		assert(!cryptredis_del_r(crp, entrykey[i]));
+	assert(!cryptredis_config_raw(crp, 0));
+}
+
+/*
+ * MSET of values of many lengths read back with MGET, twice so the
+ * scratch buffer is reused, then MSETNX setting all of its keys or, with
+ * one of them taken, none.
+ */
+void
+test_cryptredis_mset_r(struct cryptredis *crp, int fmt, int raw)
+{
+	char		 entrykey[PIPELINE_N][LINE_MAX];
+	char		 entryval[PIPELINE_N][LINE_MAX];
+	char		 nxkey[2][LINE_MAX];
+	const char	*keys[PIPELINE_N];
+	const void	*vals[PIPELINE_N];
+	size_t		 vlens[PIPELINE_N], n;
+	int		 i, pass;
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, raw));
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < PIPELINE_N; i++) {
+			genrandstr(entrykey[i], sizeof(entrykey[i]), __func__);
+			genrandstr(entryval[i], sizeof(entryval[i]), "foo");
+			n = strlen(entryval[i]);
+			memset(entryval[i] + n, 'x', i * 20);
+			entryval[i][n + i * 20] = '\0';
+			keys[i] = entrykey[i];
+			vals[i] = entryval[i];
+			vlens[i] = strlen(entryval[i]);
+		}
+		/* a NUL inside a binary value, legacy ones end at it */
+		if (fmt != CRYPTREDIS_FMT_LEGACY)
+			entryval[1][2] = '\0';
+
+		assert(!cryptredis_mset_r(crp, keys, NULL, vals, vlens,
+		    PIPELINE_N));
+		assert(!strcmp("OK", cryptredis_response_string(crp)));
+		cryptredis_response_free(crp);
+
+		assert(!cryptredis_mget_r(crp, keys, NULL, PIPELINE_N));
+		for (i = 0; i < PIPELINE_N; i++) {
+			assert(cryptredis_response_element_len(crp, i) ==
+			    vlens[i]);
+			assert(!memcmp(entryval[i],
+			    cryptredis_response_element_string(crp, i),
+			    vlens[i]));
+		}
+		cryptredis_response_free(crp);
+	}
+
+	genrandstr(nxkey[0], sizeof(nxkey[0]), __func__);
+	genrandstr(nxkey[1], sizeof(nxkey[1]), __func__);
+	keys[0] = nxkey[0];
+	keys[1] = nxkey[1];
+	assert(!cryptredis_msetnx_r(crp, keys, NULL, vals, NULL, 3));
+	assert(cryptredis_response_integer(crp) == 0);
+	cryptredis_response_free(crp);
+	assert(!cryptredis_exists_r(crp, nxkey[0]));
+	assert(cryptredis_response_integer(crp) == 0);
+	cryptredis_response_free(crp);
+
+	assert(!cryptredis_msetnx_r(crp, keys, NULL, vals, NULL, 2));
+	assert(cryptredis_response_integer(crp) == 1);
+	cryptredis_response_free(crp);
+	assert(!cryptredis_get_r(crp, nxkey[1]));
+	assert(!strcmp(entryval[1], cryptredis_response_string(crp)));
+	cryptredis_response_free(crp);
+
+	for (i = 0; i < PIPELINE_N; i++)
+		assert(!cryptredis_del_r(crp, entrykey[i]));
+	assert(!cryptredis_del_r(crp, nxkey[0]));
+	assert(!cryptredis_del_r(crp, nxkey[1]));
+	assert(!cryptredis_config_raw(crp, 0));
+}
+
+/*
+ * Reply handles: replies of several commands held at once, each handle
+ * reused for values of growing and shrinking length, compressed ones
+ * included, an MGET array with a missing key, integer and status replies;
+ * a value stored in clear reads as an error.
+ */
+void
+test_cryptredis_reply_r(struct cryptredis *crp, int fmt, int raw)
+{
+	struct cryptredis_reply	*rp[2];
+	char			 entrykey[PIPELINE_N][LINE_MAX];
+	char			*entryval[PIPELINE_N];
+	const char		*keys[PIPELINE_N + 1];
+	size_t			 vlens[PIPELINE_N];
+	int			 i, k;
+
+	assert(!cryptredis_config_encrypt(crp, fmt));
+	assert(!cryptredis_config_raw(crp, raw));
+	assert((rp[0] = cryptredis_reply_new()) != NULL);
+	assert((rp[1] = cryptredis_reply_new()) != NULL);
+
+	for (i = 0; i < PIPELINE_N; i++) {
+		genrandstr(entrykey[i], sizeof(entrykey[i]), __func__);
+		keys[i] = entrykey[i];
+		vlens[i] = i % 3 == 0 ? 4000 - i * 50 : 1 + i * 7;
+		assert((entryval[i] = malloc(vlens[i] + 1)) != NULL);
+		memset(entryval[i], 'a' + i % 26, vlens[i]);
+		entryval[i][vlens[i]] = '\0';
+		/* legacy values end at their first NUL */
+		if (fmt != CRYPTREDIS_FMT_LEGACY)
+			entryval[i][vlens[i] / 2] = '\0';
+		assert(!cryptredis_set_rp(crp, entrykey[i],
+		    strlen(entrykey[i]), entryval[i], vlens[i], rp[i % 2]));
+		assert(cryptredis_reply_type(rp[i % 2]) == REDIS_REPLY_STATUS);
+		assert(!strcmp("OK", cryptredis_reply_string(rp[i % 2])));
+	}
+	keys[PIPELINE_N] = "nosuchkey";
+
+	for (i = 0; i + 1 < PIPELINE_N; i++) {
+		for (k = 0; k < 2; k++)
+			assert(!cryptredis_get_rp(crp, entrykey[i + k],
+			    strlen(entrykey[i + k]), rp[k]));
+		for (k = 0; k < 2; k++) {
+			assert(cryptredis_reply_type(rp[k]) ==
+			    REDIS_REPLY_STRING);
+			assert(cryptredis_reply_len(rp[k]) == vlens[i + k]);
+			assert(!memcmp(cryptredis_reply_string(rp[k]),
+			    entryval[i + k], vlens[i + k]));
+		}
+	}
+
+	assert(!cryptredis_mget_rp(crp, keys, NULL, PIPELINE_N + 1, rp[0]));
+	assert(cryptredis_reply_type(rp[0]) == REDIS_REPLY_ARRAY);
+	assert(cryptredis_reply_elements(rp[0]) == PIPELINE_N + 1);
+	for (i = 0; i < PIPELINE_N; i++) {
+		assert(cryptredis_reply_element_type(rp[0], i) ==
+		    REDIS_REPLY_STRING);
+		assert(cryptredis_reply_element_len(rp[0], i) == vlens[i]);
+		assert(!memcmp(cryptredis_reply_element_string(rp[0], i),
+		    entryval[i], vlens[i]));
+	}
+	assert(cryptredis_reply_element_type(rp[0], PIPELINE_N) ==
+	    REDIS_REPLY_NIL);
+	assert(cryptredis_reply_element_string(rp[0], PIPELINE_N + 1) ==
+	    NULL);
+
+	assert(!cryptredis_ping_rp(crp, rp[1]));
+	assert(!strcmp("PONG", cryptredis_reply_string(rp[1])));
+	assert(!cryptredis_exists_rp(crp, keys[0], strlen(keys[0]), rp[1]));
+	assert(cryptredis_reply_integer(rp[1]) == 1);
+
+	if (fmt != CRYPTREDIS_FMT_NONE) {
+		assert(!cryptredis_config_encrypt(crp, CRYPTREDIS_FMT_NONE));
+		assert(!cryptredis_set_rp(crp, keys[0], strlen(keys[0]),
+		    "in clear", 8, rp[0]));
+		assert(!cryptredis_config_encrypt(crp, fmt));
+		assert(!cryptredis_get_rp(crp, keys[0], strlen(keys[0]),
+		    rp[0]));
+		assert(cryptredis_reply_type(rp[0]) == REDIS_REPLY_ERROR);
+	}
+
+	for (i = 0; i < PIPELINE_N; i++) {
+		assert(!cryptredis_del_rp(crp, keys[i], strlen(keys[i]),
+		    rp[1]));
+		assert(cryptredis_reply_integer(rp[1]) == 1);
+		free(entryval[i]);
+	}
+	cryptredis_reply_release(rp[0]);
+	assert(cryptredis_reply_type(rp[0]) == -1);
+	cryptredis_reply_free(rp[0]);
+	cryptredis_reply_free(rp[1]);
+	assert(!cryptredis_config_raw(crp, 0));
+}
+
 #define TESTOPEN(crp)	do {						\
 	assert((crp = cryptredis_open("localhost", 6379)) != NULL);	\
 	assert(crp->cr_connected);					\
@@ -189,5 +896,70 @@ main(int argc, char **argv)
 	test_cryptredis_del_r(c);
 	TESTCLOSE(c);
 
+	TESTOPEN(c);
+	assert(!cryptredis_config_encrypt(c, CRYPTREDIS_FMT_CTR));
+	assert(c->cr_crypt_enabled);
+	/* a format refused leaves the handle as it was, keys and all */
+	assert(cryptredis_config_encrypt(c, -1) == -1);
+	assert(c->cr_crypt_enabled && c->cr_format == CRYPTREDIS_FMT_CTR);
+	assert(cryptredis_config_encrypt(c, CRYPTREDIS_FMT_LEGACY |
+	    CRYPTREDIS_FMT_LZ4) == -1);
+	assert(c->cr_crypt_enabled && c->cr_format == CRYPTREDIS_FMT_CTR);
+	assert(c->cr_keyset != NULL);
+	assert(cryptredis_format_error(CRYPTREDIS_FMT_CHACHA |
+	    CRYPTREDIS_FMT_LZ4) == NULL);
+	assert(!cryptredis_config_encrypt(c, CRYPTREDIS_FMT_CTR));
+
+	test_cryptredis_set_r(c);
+	test_cryptredis_get_r(c);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_CTR, CRYPTREDIS_FMT_LEGACY);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_LEGACY, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_CBC, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_LEGACY, CRYPTREDIS_FMT_CBC);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_CHACHA, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_format_r(c, CRYPTREDIS_FMT_CBC, CRYPTREDIS_FMT_CHACHA);
+	test_cryptredis_raw_r(c, CRYPTREDIS_FMT_NONE);
+	test_cryptredis_raw_r(c, CRYPTREDIS_FMT_LEGACY);
+	test_cryptredis_raw_r(c, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_raw_r(c, CRYPTREDIS_FMT_CBC);
+	test_cryptredis_raw_r(c, CRYPTREDIS_FMT_CHACHA);
+	test_cryptredis_lz4_r(c, CRYPTREDIS_FMT_CTR, 0);
+	test_cryptredis_lz4_r(c, CRYPTREDIS_FMT_CBC, 1);
+	test_cryptredis_lz4_r(c, CRYPTREDIS_FMT_CHACHA, 0);
+	test_cryptredis_lz4_r(c, CRYPTREDIS_FMT_CHACHA, 1);
+	test_cryptredis_value_r(c, CRYPTREDIS_FMT_LEGACY, 0);
+	test_cryptredis_legacy_magic_r(c, CRYPTREDIS_FMT_CTR,
+	    CRYPTREDIS_HDR_KEYID, 1);
+	test_cryptredis_legacy_magic_r(c, CRYPTREDIS_FMT_CBC, 0, 1);
+	test_cryptredis_legacy_magic_r(c, CRYPTREDIS_FMT_CHACHA, 0, 0);
+	test_cryptredis_legacy_magic_r(c, CRYPTREDIS_FMT_CBC,
+	    CRYPTREDIS_HDR_KEYID | CRYPTREDIS_HDR_LZ4, 0);
+	test_cryptredis_value_r(c, CRYPTREDIS_FMT_CBC, 0);
+	test_cryptredis_value_r(c, CRYPTREDIS_FMT_CBC, 1);
+	test_cryptredis_value_r(c, CRYPTREDIS_FMT_CHACHA | CRYPTREDIS_FMT_LZ4,
+	    1);
+	test_cryptredis_rotate_r(c, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_rotate_r(c, CRYPTREDIS_FMT_CBC);
+	test_cryptredis_rotate_r(c, CRYPTREDIS_FMT_CHACHA);
+	test_cryptredis_keywatch_r(c, CRYPTREDIS_FMT_CHACHA);
+	test_cryptredis_pipeline_r(c, CRYPTREDIS_FMT_NONE);
+	test_cryptredis_pipeline_r(c, CRYPTREDIS_FMT_CTR);
+	test_cryptredis_pipeline_r(c, CRYPTREDIS_FMT_CHACHA | CRYPTREDIS_FMT_LZ4);
+	test_cryptredis_mget_r(c, CRYPTREDIS_FMT_CBC, 0);
+	test_cryptredis_mget_r(c, CRYPTREDIS_FMT_CBC, 1);
+	test_cryptredis_mget_r(c, CRYPTREDIS_FMT_LEGACY, 0);
+	test_cryptredis_mget_r(c, CRYPTREDIS_FMT_CTR | CRYPTREDIS_FMT_LZ4, 1);
+	test_cryptredis_mset_r(c, CRYPTREDIS_FMT_NONE, 0);
+	test_cryptredis_mset_r(c, CRYPTREDIS_FMT_LEGACY, 0);
+	test_cryptredis_mset_r(c, CRYPTREDIS_FMT_CBC, 1);
+	test_cryptredis_mset_r(c, CRYPTREDIS_FMT_CTR | CRYPTREDIS_FMT_LZ4, 0);
+	test_cryptredis_mset_r(c, CRYPTREDIS_FMT_CHACHA | CRYPTREDIS_FMT_LZ4, 1);
+	test_cryptredis_reply_r(c, CRYPTREDIS_FMT_NONE, 0);
+	test_cryptredis_reply_r(c, CRYPTREDIS_FMT_LEGACY, 0);
+	test_cryptredis_reply_r(c, CRYPTREDIS_FMT_CBC, 1);
+	test_cryptredis_reply_r(c, CRYPTREDIS_FMT_CTR | CRYPTREDIS_FMT_LZ4, 0);
+	test_cryptredis_reply_r(c, CRYPTREDIS_FMT_CHACHA | CRYPTREDIS_FMT_LZ4, 1);
+	TESTCLOSE(c);
+
 	return (0);
 }
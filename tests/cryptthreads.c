@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Crypto stress: several threads hammer encrypt/decrypt with different
+ * keys, some of them shared between threads, and compare every result
+ * against ciphertext computed up front by a single thread.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsd-crypt.h"
+#include "tools.h"
+
+#define NTHREADS	8
+#define NKEYS		3
+#define NMSGS		16
+#define NROUNDS		4000
+#define MAXLEN		4096
+
+struct testmsg {
+	char		*tm_plain;
+	size_t		 tm_len;
+	u_int32_t	*tm_cipher[NKEYS];
+};
+
+struct testthread {
+	pthread_t		 tt_thread;
+	int			 tt_id;
+	struct cryptredis_key	*tt_key;
+	int			 tt_keyidx;
+	int			 tt_errors;
+};
+
+static struct cryptredis_key	keys[NKEYS];
+static struct testmsg		msgs[NMSGS];
+
+static void
+setup_keys(void)
+{
+	int	i;
+
+	for (i = 0; i < NKEYS; i++) {
+		memset(&keys[i], 0, sizeof(keys[i]));
+		arc4random_buf(keys[i].key, sizeof(keys[i].key));
+		arc4random_buf(keys[i].iv, sizeof(keys[i].iv));
+		cryptredis_key_setup(&keys[i]);
+	}
+}
+
+static void
+setup_msgs(void)
+{
+	int	i, k;
+
+	for (i = 0; i < NMSGS; i++) {
+		msgs[i].tm_len = cryptredis_align64(1 + arc4random_uniform(MAXLEN));
+		assert((msgs[i].tm_plain = calloc(1, msgs[i].tm_len)) != NULL);
+		arc4random_buf(msgs[i].tm_plain, msgs[i].tm_len);
+
+		for (k = 0; k < NKEYS; k++) {
+			assert((msgs[i].tm_cipher[k] = calloc(1,
+			    msgs[i].tm_len)) != NULL);
+			cryptredis_encrypt(&keys[k], msgs[i].tm_plain,
+			    msgs[i].tm_cipher[k], msgs[i].tm_len);
+		}
+	}
+}
+
+static void *
+test_worker(void *arg)
+{
+	struct testthread	*tt = arg;
+	struct cryptredis_key	 own;
+	u_int32_t		*cbuf;
+	char			*pbuf;
+	struct testmsg		*tm;
+	int			 i;
+
+	assert((cbuf = calloc(1, MAXLEN * 2)) != NULL);
+	assert((pbuf = calloc(1, MAXLEN * 2)) != NULL);
+
+	/* odd threads work on a private copy, set up concurrently */
+	if (tt->tt_id % 2) {
+		memcpy(&own, tt->tt_key, sizeof(own));
+		cryptredis_key_setup(&own);
+		tt->tt_key = &own;
+	}
+
+	for (i = 0; i < NROUNDS; i++) {
+		tm = &msgs[(i + tt->tt_id) % NMSGS];
+
+		cryptredis_encrypt(tt->tt_key, tm->tm_plain, cbuf, tm->tm_len);
+		if (memcmp(cbuf, tm->tm_cipher[tt->tt_keyidx], tm->tm_len))
+			tt->tt_errors++;
+
+		cryptredis_decrypt(tt->tt_key, cbuf, pbuf, tm->tm_len);
+		if (memcmp(pbuf, tm->tm_plain, tm->tm_len))
+			tt->tt_errors++;
+	}
+
+	free(cbuf);
+	free(pbuf);
+
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct testthread	threads[NTHREADS];
+	int			i, errors = 0;
+
+	fprintf(stderr, "==> begin test cryptthreads\n");
+
+	setup_keys();
+	setup_msgs();
+
+	for (i = 0; i < NTHREADS; i++) {
+		threads[i].tt_id = i;
+		threads[i].tt_keyidx = i % NKEYS;
+		threads[i].tt_key = &keys[i % NKEYS];
+		threads[i].tt_errors = 0;
+		assert(pthread_create(&threads[i].tt_thread, NULL, test_worker,
+		    &threads[i]) == 0);
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		assert(pthread_join(threads[i].tt_thread, NULL) == 0);
+		fprintf(stderr, "=> thread %d key %d errors %d\n", i,
+		    threads[i].tt_keyidx, threads[i].tt_errors);
+		errors += threads[i].tt_errors;
+	}
+	assert(errors == 0);
+
+	fprintf(stderr, "==> end test cryptthreads\n");
+
+	return (0);
+}
@@ -41,7 +41,9 @@ test_disk_retrieve(struct cryptredis_key *key)
     disk_retrieve("/tmp/temp_store", &senc, &senclen);
     fprintf(stderr, "=> read from store: %s\n", senc);
 
-    size_t len = cryptredis_decode(senc, ciphbuf, SIZBUF);
+    ssize_t len = cryptredis_decode(senc, strlen(senc), ciphbuf, SIZBUF);
+    if (len == -1)
+        errx(1, "malformed base64 in store");
     decrypt_wrap(key, ciphbuf, deciphbuf, len);
     free(senc);
 }
@@ -69,7 +71,10 @@ main(int argc, char **argv)
 
     fprintf(stderr, "=> read from store: %s\n", src);
     bzero(ciphbuf, SIZBUF);
-    size_t declen = cryptredis_decode(src, ciphbuf, SIZBUF);
+    src[strcspn(src, "\n")] = '\0';
+    ssize_t declen = cryptredis_decode(src, strlen(src), ciphbuf, SIZBUF);
+    if (declen == -1)
+        errx(1, "malformed base64 input");
 
     /* dump ciphbuf */
     int i = 0;
@@ -133,7 +133,8 @@ test_decode()
 	u_int32_t	 cryptbuf_src[] = { 0x2d582960, 0xde09730e, 0xab6b33fc,
 			    0x7391780d };
 	u_int32_t	 cryptbuf_dst[SIZBUF];
-	size_t		 buflen, len;
+	size_t		 buflen;
+	ssize_t		 len;
 
 	fprintf(stderr, "==> begin test decode\n");
 	fprintf(stderr, "=> cryptbuf_src: x%08x x%08x x%08x x%08x\n",
@@ -144,12 +145,13 @@ test_decode()
 	    cryptbuf_dst[3]);
 
 	buflen = sizeof(cryptbuf_src);
-	len = cryptredis_decode(encodeds, cryptbuf_dst, SIZBUF);
+	len = cryptredis_decode(encodeds, strlen(encodeds), cryptbuf_dst,
+	    sizeof(cryptbuf_dst));
 
 	fprintf(stderr, "=> len: %ld\n", len);
 	fprintf(stderr, "=> buflen: %ld\n", buflen);
 
-	assert(buflen == len);
+	assert(len != -1 && buflen == (size_t)len);
 	assert(memcmp(cryptbuf_dst, cryptbuf_src, buflen) == 0);
 
 	fprintf(stderr, "==> end test decode\n");
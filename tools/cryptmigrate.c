@@ -0,0 +1,547 @@
+/*
+ * Copyright (c) 2016 Andre de Oliveira <deoliveirambx@googlemail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * cryptmigrate: rewrite the values of a redis instance in the format, key
+ * and storage mode given on the command line, reading them in whatever
+ * they were written with.  The keyspace is walked with SCAN, each batch
+ * of keys fetched with one MGET, opened and sealed again by a pool of
+ * worker threads, and written back with one EVAL that only replaces the
+ * values still holding what was read, keeping their ttl.  Each worker
+ * has its own connection and pipelines the write of a batch with the
+ * read of the next, one round trip per batch.  Values already in the
+ * target format under the target key are left alone, so a migration can
+ * be stopped and run again.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cryptredis.h"
+#include "bsd-crypt.h"
+#include "encode.h"
+#include "format.h"
+#include "keyring.h"
+#include "hiredis/hiredis.h"
+
+#define MIGRATE_BATCH	512	/* keys per SCAN COUNT and MGET */
+
+/* replace KEYS[i] by ARGV[2i] if it still holds ARGV[2i-1] */
+static const char migrate_cas[] =
+    "local n = 0\n"
+    "for i = 1, #KEYS do\n"
+    "  if redis.call('GET', KEYS[i]) == ARGV[2 * i - 1] then\n"
+    "    local ttl = redis.call('PTTL', KEYS[i])\n"
+    "    redis.call('SET', KEYS[i], ARGV[2 * i])\n"
+    "    if ttl > 0 then redis.call('PEXPIRE', KEYS[i], ttl) end\n"
+    "    n = n + 1\n"
+    "  end\n"
+    "end\n"
+    "return n\n";
+
+/* keys of one SCAN reply */
+struct batch {
+	redisReply	*b_reply;
+	redisReply	**b_keys;
+	size_t		 b_nkeys;
+	struct batch	*b_next;
+};
+
+struct queue {
+	pthread_mutex_t	 q_mtx;
+	pthread_cond_t	 q_notempty;
+	pthread_cond_t	 q_notfull;
+	struct batch	*q_head;
+	struct batch	**q_tail;
+	size_t		 q_len;
+	size_t		 q_max;
+	int		 q_done;	/* no more batches coming */
+};
+
+struct stats {
+	u_int64_t	 s_scanned;
+	u_int64_t	 s_missing;	/* gone or not a string */
+	u_int64_t	 s_current;	/* already in the target format */
+	u_int64_t	 s_migrated;
+	u_int64_t	 s_changed;	/* written meanwhile, left alone */
+	u_int64_t	 s_failed;	/* can't be opened */
+};
+
+struct worker {
+	pthread_t	 w_thread;
+	redisContext	*w_ctx;
+	struct stats	 w_stats;
+	size_t		 w_pending;	/* values in the EVAL in flight */
+};
+
+static struct cryptredis	*rd;	/* opens values, any format */
+static struct cryptredis	*wr;	/* seals them in the target one */
+static struct queue		 queue;
+static int			 dryrun;
+static int			 rewriteall;
+
+static __dead void usage(void);
+static int	parse_format(const char *);
+static void	queue_put(struct batch *);
+static struct batch *
+		queue_get(void);
+static void	batch_free(struct batch *);
+static int	value_current(const char *, size_t);
+static int	migrate_batch(struct worker *, struct batch *, redisReply *);
+static int	migrate_written(struct worker *);
+static void	*migrate_worker(void *);
+
+static __dead void
+usage(void)
+{
+	extern char	*__progname;
+
+	(void)fprintf(stderr, "usage: %s [-anRrz] [-b count] [-f format] "
+	    "[-h host] [-j jobs]\n\t[-m pattern] [-p port]\n", __progname);
+	exit(1);
+}
+
+static int
+parse_format(const char *s)
+{
+	if (strcmp(s, "legacy") == 0)
+		return (CRYPTREDIS_FMT_LEGACY);
+	if (strcmp(s, "ctr") == 0)
+		return (CRYPTREDIS_FMT_CTR);
+	if (strcmp(s, "cbc") == 0)
+		return (CRYPTREDIS_FMT_CBC);
+	if (strcmp(s, "chacha") == 0)
+		return (CRYPTREDIS_FMT_CHACHA);
+
+	return (-1);
+}
+
+static void
+queue_put(struct batch *b)
+{
+	pthread_mutex_lock(&queue.q_mtx);
+	while (queue.q_len == queue.q_max)
+		pthread_cond_wait(&queue.q_notfull, &queue.q_mtx);
+	*queue.q_tail = b;
+	queue.q_tail = &b->b_next;
+	queue.q_len++;
+	pthread_cond_signal(&queue.q_notempty);
+	pthread_mutex_unlock(&queue.q_mtx);
+}
+
+/* next batch, NULL once the scan is over and the queue drained */
+static struct batch *
+queue_get(void)
+{
+	struct batch	*b;
+
+	pthread_mutex_lock(&queue.q_mtx);
+	while (queue.q_head == NULL && !queue.q_done)
+		pthread_cond_wait(&queue.q_notempty, &queue.q_mtx);
+	if ((b = queue.q_head) != NULL) {
+		if ((queue.q_head = b->b_next) == NULL)
+			queue.q_tail = &queue.q_head;
+		queue.q_len--;
+		pthread_cond_signal(&queue.q_notfull);
+	}
+	pthread_mutex_unlock(&queue.q_mtx);
+
+	return (b);
+}
+
+static void
+batch_free(struct batch *b)
+{
+	freeReplyObject(b->b_reply);
+	free(b);
+}
+
+/*
+ * Whether a stored value is already sealed in the target format with the
+ * target key, from its first bytes; legacy values can't tell.
+ */
+static int
+value_current(const char *v, size_t len)
+{
+	u_int8_t	 hdr[12];
+	const void	*p = v;
+
+	if (rewriteall || wr->cr_format == CRYPTREDIS_FMT_LEGACY)
+		return (0);
+
+	if (!(wr->cr_flags & CRYPTREDIS_F_RAW)) {
+		/* 12 chars of base64 are 9 bytes, the header and key id */
+		if (len < 12 || cryptredis_decode(v, 12, hdr, sizeof(hdr)) !=
+		    9)
+			return (0);
+		p = hdr;
+	} else if (len < CRYPTREDIS_KIDHDRLEN)
+		return (0);
+
+	return (cryptredis_hdr_parse(p, CRYPTREDIS_KIDHDRLEN) ==
+	    wr->cr_format &&
+	    (cryptredis_hdr_flags(p, CRYPTREDIS_KIDHDRLEN) &
+	    CRYPTREDIS_HDR_KEYID) &&
+	    memcmp((const u_int8_t *)p + CRYPTREDIS_HDRLEN,
+	    wr->cr_keyset->ks_keys[0]->kid, CRYPTREDIS_KIDLEN) == 0);
+}
+
+/*
+ * Convert the values of a batch read by MGET and append the EVAL writing
+ * them back, it goes out with the next command.  Returns -1 on error.
+ */
+static int
+migrate_batch(struct worker *w, struct batch *b, redisReply *r)
+{
+	struct stats	 *st = &w->w_stats;
+	redisReply	 *e;
+	const char	**argv = NULL;
+	size_t		 *argvlen = NULL;
+	char		**sealed = NULL;
+	char		 *plain, nkeys[32];
+	size_t		  i, n = 0, argc;
+	ssize_t		  len;
+	int		  ret = -1;
+
+	if (r->type != REDIS_REPLY_ARRAY || r->elements != b->b_nkeys) {
+		warnx("MGET: unexpected reply");
+		return (-1);
+	}
+
+	argc = 3 + 3 * b->b_nkeys;
+	if ((argv = calloc(argc, sizeof(*argv))) == NULL ||
+	    (argvlen = calloc(argc, sizeof(*argvlen))) == NULL ||
+	    (sealed = calloc(b->b_nkeys, sizeof(*sealed))) == NULL) {
+		warn("calloc");
+		goto err;
+	}
+
+	for (i = 0; i < b->b_nkeys; i++) {
+		e = r->element[i];
+		st->s_scanned++;
+		if (e->type != REDIS_REPLY_STRING) {
+			st->s_missing++;
+			continue;
+		}
+		if (value_current(e->str, e->len)) {
+			st->s_current++;
+			continue;
+		}
+
+		/* opened in place, the value read is sent back as is */
+		if ((plain = malloc(e->len + 1)) == NULL) {
+			warn("malloc");
+			goto err;
+		}
+		memcpy(plain, e->str, e->len);
+		if ((len = cryptredis_value_open(rd, &plain, e->len)) == -1 ||
+		    (len = cryptredis_value_seal(wr, plain, len,
+		    &sealed[n])) == -1) {
+			warnx("%.*s: can't be converted", (int)b->b_keys[i]->len,
+			    b->b_keys[i]->str);
+			free(plain);
+			st->s_failed++;
+			continue;
+		}
+		free(plain);
+
+		argv[3 + n] = b->b_keys[i]->str;
+		argvlen[3 + n] = b->b_keys[i]->len;
+		argv[3 + b->b_nkeys + 2 * n] = e->str;
+		argvlen[3 + b->b_nkeys + 2 * n] = e->len;
+		argv[3 + b->b_nkeys + 2 * n + 1] = sealed[n];
+		argvlen[3 + b->b_nkeys + 2 * n + 1] = len;
+		n++;
+	}
+
+	if (n > 0 && dryrun)
+		st->s_migrated += n;
+	else if (n > 0) {
+		/* the values follow the keys actually sent */
+		memmove(&argv[3 + n], &argv[3 + b->b_nkeys],
+		    2 * n * sizeof(*argv));
+		memmove(&argvlen[3 + n], &argvlen[3 + b->b_nkeys],
+		    2 * n * sizeof(*argvlen));
+		argv[0] = "EVAL";
+		argvlen[0] = 4;
+		argv[1] = migrate_cas;
+		argvlen[1] = sizeof(migrate_cas) - 1;
+		argvlen[2] = snprintf(nkeys, sizeof(nkeys), "%zu", n);
+		argv[2] = nkeys;
+		if (redisAppendCommandArgv(w->w_ctx, 3 + 3 * n, argv,
+		    argvlen) != REDIS_OK) {
+			warnx("EVAL: %s", w->w_ctx->errstr);
+			goto err;
+		}
+		w->w_pending = n;
+	}
+	ret = 0;
+
+ err:
+	if (sealed != NULL)
+		for (i = 0; i < n; i++)
+			free(sealed[i]);
+	free(sealed);
+	free(argvlen);
+	free(argv);
+
+	return (ret);
+}
+
+/* reply of the EVAL in flight */
+static int
+migrate_written(struct worker *w)
+{
+	redisReply	*r;
+
+	if (w->w_pending == 0)
+		return (0);
+
+	if (redisGetReply(w->w_ctx, (void **)&r) != REDIS_OK) {
+		warnx("EVAL: %s", w->w_ctx->errstr);
+		return (-1);
+	}
+	if (r->type != REDIS_REPLY_INTEGER ||
+	    (u_int64_t)r->integer > w->w_pending) {
+		warnx("EVAL: %s", r->type == REDIS_REPLY_ERROR ? r->str :
+		    "unexpected reply");
+		freeReplyObject(r);
+		return (-1);
+	}
+	w->w_stats.s_migrated += r->integer;
+	w->w_stats.s_changed += w->w_pending - r->integer;
+	w->w_pending = 0;
+	freeReplyObject(r);
+
+	return (0);
+}
+
+static void *
+migrate_worker(void *arg)
+{
+	struct worker	 *w = arg;
+	struct batch	 *b;
+	redisReply	 *r;
+	const char	**argv;
+	size_t		 *argvlen, i;
+
+	while ((b = queue_get()) != NULL) {
+		if ((argv = calloc(b->b_nkeys + 1, sizeof(*argv))) == NULL ||
+		    (argvlen = calloc(b->b_nkeys + 1,
+		    sizeof(*argvlen))) == NULL)
+			err(1, "calloc");
+		argv[0] = "MGET";
+		argvlen[0] = 4;
+		for (i = 0; i < b->b_nkeys; i++) {
+			argv[i + 1] = b->b_keys[i]->str;
+			argvlen[i + 1] = b->b_keys[i]->len;
+		}
+		if (redisAppendCommandArgv(w->w_ctx, b->b_nkeys + 1, argv,
+		    argvlen) != REDIS_OK)
+			errx(1, "MGET: %s", w->w_ctx->errstr);
+		free(argv);
+		free(argvlen);
+
+		/* the previous batch's EVAL went out just before the MGET */
+		if (migrate_written(w) == -1)
+			exit(1);
+		if (redisGetReply(w->w_ctx, (void **)&r) != REDIS_OK)
+			errx(1, "MGET: %s", w->w_ctx->errstr);
+		if (migrate_batch(w, b, r) == -1)
+			exit(1);
+		freeReplyObject(r);
+		batch_free(b);
+	}
+	if (migrate_written(w) == -1)
+		exit(1);
+
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct worker	*workers;
+	struct stats	 total;
+	struct batch	*b;
+	struct timespec	 t0, t1;
+	redisContext	*c;
+	redisReply	*r;
+	const char	*host = "127.0.0.1", *pattern = "*", *errstr;
+	char		 cursor[32] = "0";
+	double		 secs;
+	long long	 count = MIGRATE_BATCH;
+	int		 ch, fmt = CRYPTREDIS_FMT_CHACHA, port = 6379;
+	int		 rawin = 0, rawout = 0, lz4 = 0, njobs, i;
+
+	if ((njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		njobs = 1;
+
+	while ((ch = getopt(argc, argv, "ab:f:h:j:m:np:Rrz")) != -1) {
+		switch (ch) {
+		case 'a':
+			rewriteall = 1;
+			break;
+		case 'b':
+			count = strtonum(optarg, 1, 65536, &errstr);
+			if (errstr != NULL)
+				errx(1, "batch size is %s: %s", errstr, optarg);
+			break;
+		case 'f':
+			if ((fmt = parse_format(optarg)) == -1)
+				errx(1, "unknown format: %s", optarg);
+			break;
+		case 'h':
+			host = optarg;
+			break;
+		case 'j':
+			njobs = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr != NULL)
+				errx(1, "jobs is %s: %s", errstr, optarg);
+			break;
+		case 'm':
+			pattern = optarg;
+			break;
+		case 'n':
+			dryrun = 1;
+			break;
+		case 'p':
+			port = strtonum(optarg, 1, 65535, &errstr);
+			if (errstr != NULL)
+				errx(1, "port is %s: %s", errstr, optarg);
+			break;
+		case 'R':
+			rawin = 1;
+			break;
+		case 'r':
+			rawout = 1;
+			break;
+		case 'z':
+			lz4 = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	/* every key of CRYPTREDIS_KEYFILE opens, the first one seals */
+	if ((rd = cryptredis_open(host, port)) == NULL ||
+	    (wr = cryptredis_open(host, port)) == NULL)
+		errx(1, "can't connect to %s:%d", host, port);
+	if (cryptredis_config_encrypt(rd, fmt) == -1 ||
+	    cryptredis_config_raw(rd, rawin) == -1 ||
+	    cryptredis_config_encrypt(wr, fmt | (lz4 ?
+	    CRYPTREDIS_FMT_LZ4 : 0)) == -1 ||
+	    cryptredis_config_raw(wr, rawout) == -1)
+		errx(1, "can't configure encryption, check CRYPTREDIS_KEYFILE");
+
+	if ((c = redisConnect(host, port)) == NULL || c->err)
+		errx(1, "redisConnect: %s", c ? c->errstr : "out of memory");
+
+	if (pthread_mutex_init(&queue.q_mtx, NULL) != 0 ||
+	    pthread_cond_init(&queue.q_notempty, NULL) != 0 ||
+	    pthread_cond_init(&queue.q_notfull, NULL) != 0)
+		errx(1, "pthread init");
+	queue.q_tail = &queue.q_head;
+	queue.q_max = 2 * njobs;
+
+	if ((workers = calloc(njobs, sizeof(*workers))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < njobs; i++) {
+		if ((workers[i].w_ctx = redisConnect(host, port)) == NULL ||
+		    workers[i].w_ctx->err)
+			errx(1, "redisConnect: %s", workers[i].w_ctx ?
+			    workers[i].w_ctx->errstr : "out of memory");
+		if (pthread_create(&workers[i].w_thread, NULL, migrate_worker,
+		    &workers[i]) != 0)
+			errx(1, "pthread_create");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		if ((r = redisCommand(c, "SCAN %s MATCH %s COUNT %lld", cursor,
+		    pattern, count)) == NULL)
+			errx(1, "SCAN: %s", c->errstr);
+		if (r->type != REDIS_REPLY_ARRAY || r->elements != 2 ||
+		    r->element[0]->type != REDIS_REPLY_STRING ||
+		    r->element[1]->type != REDIS_REPLY_ARRAY)
+			errx(1, "SCAN: %s", r->type == REDIS_REPLY_ERROR ?
+			    r->str : "unexpected reply");
+		if (strlcpy(cursor, r->element[0]->str, sizeof(cursor)) >=
+		    sizeof(cursor))
+			errx(1, "SCAN: cursor too long");
+
+		if (r->element[1]->elements == 0) {
+			freeReplyObject(r);
+			continue;
+		}
+		if ((b = calloc(1, sizeof(*b))) == NULL)
+			err(1, "calloc");
+		b->b_reply = r;
+		b->b_keys = r->element[1]->element;
+		b->b_nkeys = r->element[1]->elements;
+		queue_put(b);
+	} while (strcmp(cursor, "0") != 0);
+
+	pthread_mutex_lock(&queue.q_mtx);
+	queue.q_done = 1;
+	pthread_cond_broadcast(&queue.q_notempty);
+	pthread_mutex_unlock(&queue.q_mtx);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < njobs; i++) {
+		if (pthread_join(workers[i].w_thread, NULL) != 0)
+			errx(1, "pthread_join");
+		total.s_scanned += workers[i].w_stats.s_scanned;
+		total.s_missing += workers[i].w_stats.s_missing;
+		total.s_current += workers[i].w_stats.s_current;
+		total.s_migrated += workers[i].w_stats.s_migrated;
+		total.s_changed += workers[i].w_stats.s_changed;
+		total.s_failed += workers[i].w_stats.s_failed;
+		redisFree(workers[i].w_ctx);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("%llu keys in %.2fs, %.0f keys/s: %llu %s, %llu current, "
+	    "%llu changed meanwhile, %llu gone, %llu failed\n",
+	    (unsigned long long)total.s_scanned, secs,
+	    secs > 0 ? total.s_scanned / secs : 0,
+	    (unsigned long long)total.s_migrated,
+	    dryrun ? "to migrate" : "migrated",
+	    (unsigned long long)total.s_current,
+	    (unsigned long long)total.s_changed,
+	    (unsigned long long)total.s_missing,
+	    (unsigned long long)total.s_failed);
+
+	free(workers);
+	redisFree(c);
+	cryptredis_close(wr);
+	cryptredis_close(rd);
+
+	return (total.s_failed != 0);
+}